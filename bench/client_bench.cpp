@@ -0,0 +1,335 @@
+/**
+ * @file client_bench.cpp
+ * @brief tsdb_cpp网络客户端的基准测试。在回环地址上启动MockServer和MockUdpSink，
+ * 以给定的并发数和批大小驱动insert_points、post_http和query，报告吞吐、每点系统调用数和单次调用的延迟分位数。
+ *
+ * 系统调用由链接选项--wrap拦截计数，只统计发起请求的线程，模拟服务端的调用不计入。
+ *
+ * 用法：tsdb_client_bench [--mode udp|http|query|all] [--threads N] [--batch N] [--calls N]
+ *                         [--columns] [--no-pool] [--encoding gzip|zstd] [--packet-bytes N]
+ */
+#include "../src/tsdb.hpp"
+#include "../src/tsdb_query.hpp"
+#include "../test/MockServer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
+
+namespace {
+thread_local bool countSyscalls = false;
+thread_local size_t syscalls = 0;
+
+inline void countSyscall()
+{
+    if (countSyscalls)
+        syscalls++;
+}
+}
+
+// 客户端用到的系统调用，由-Wl,--wrap=<name>转到这里
+extern "C" {
+int __real_socket(int, int, int);
+int __real_connect(int, const sockaddr*, socklen_t);
+int __real_setsockopt(int, int, int, const void*, socklen_t);
+int __real_poll(pollfd*, nfds_t, int);
+int __real_close(int);
+ssize_t __real_sendmsg(int, const msghdr*, int);
+int __real_sendmmsg(int, mmsghdr*, unsigned int, int);
+ssize_t __real_sendto(int, const void*, size_t, int, const sockaddr*, socklen_t);
+ssize_t __real_writev(int, const iovec*, int);
+ssize_t __real_recv(int, void*, size_t, int);
+
+int __wrap_socket(int domain, int type, int protocol)
+{
+    countSyscall();
+    return __real_socket(domain, type, protocol);
+}
+int __wrap_connect(int fd, const sockaddr* addr, socklen_t len)
+{
+    countSyscall();
+    return __real_connect(fd, addr, len);
+}
+int __wrap_setsockopt(int fd, int level, int name, const void* value, socklen_t len)
+{
+    countSyscall();
+    return __real_setsockopt(fd, level, name, value, len);
+}
+int __wrap_poll(pollfd* fds, nfds_t n, int timeout)
+{
+    countSyscall();
+    return __real_poll(fds, n, timeout);
+}
+int __wrap_close(int fd)
+{
+    countSyscall();
+    return __real_close(fd);
+}
+ssize_t __wrap_sendmsg(int fd, const msghdr* msg, int flags)
+{
+    countSyscall();
+    return __real_sendmsg(fd, msg, flags);
+}
+int __wrap_sendmmsg(int fd, mmsghdr* msgs, unsigned int n, int flags)
+{
+    countSyscall();
+    return __real_sendmmsg(fd, msgs, n, flags);
+}
+ssize_t __wrap_sendto(int fd, const void* buf, size_t len, int flags, const sockaddr* addr, socklen_t addrLen)
+{
+    countSyscall();
+    return __real_sendto(fd, buf, len, flags, addr, addrLen);
+}
+ssize_t __wrap_writev(int fd, const iovec* iov, int n)
+{
+    countSyscall();
+    return __real_writev(fd, iov, n);
+}
+ssize_t __wrap_recv(int fd, void* buf, size_t len, int flags)
+{
+    countSyscall();
+    return __real_recv(fd, buf, len, flags);
+}
+}
+
+struct BenchOptions {
+    std::string mode = "all";
+    size_t threads = 4;
+    size_t batch = 1000;
+    size_t calls = 200; // 每个线程的调用次数
+    bool columns = false; // 写入用insert_columns/columns()，查询用query_columns
+    bool pool = true;
+    tsdb_cpp::content_encoding encoding = tsdb_cpp::ENCODING_IDENTITY;
+    size_t packetBytes = tsdb_cpp::UDP_PAYLOAD_BYTES;
+};
+
+// 一个线程的结果
+struct ThreadResult {
+    std::vector<long long> latencyNs;
+    size_t points = 0;
+    size_t bytes = 0;
+    size_t syscalls = 0;
+    size_t errors = 0;
+};
+
+// 每个线程调用op(thread, call, result)共calls次，op返回本次的点数，失败返回负数
+template <typename Op>
+void runBench(const char* name, const BenchOptions& options, Op op)
+{
+    std::vector<ThreadResult> results(options.threads);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < options.threads; t++) {
+        threads.emplace_back([&, t]() {
+            ThreadResult& r = results[t];
+            r.latencyNs.reserve(options.calls);
+            syscalls = 0;
+            countSyscalls = true;
+            for (size_t c = 0; c < options.calls; c++) {
+                auto beg = std::chrono::steady_clock::now();
+                long long points = op(t, c, r);
+                r.latencyNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - beg).count());
+                if (points < 0)
+                    r.errors++;
+                else
+                    r.points += points;
+            }
+            countSyscalls = false;
+            r.syscalls = syscalls;
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ThreadResult total;
+    for (auto& r : results) {
+        total.latencyNs.insert(total.latencyNs.end(), r.latencyNs.begin(), r.latencyNs.end());
+        total.points += r.points;
+        total.bytes += r.bytes;
+        total.syscalls += r.syscalls;
+        total.errors += r.errors;
+    }
+    std::sort(total.latencyNs.begin(), total.latencyNs.end());
+    auto percentileUs = [&](double q) {
+        if (total.latencyNs.empty())
+            return 0.0;
+        size_t i = std::min(total.latencyNs.size() - 1, static_cast<size_t>(std::ceil(q * total.latencyNs.size())) - (q > 0));
+        return total.latencyNs[i] / 1e3;
+    };
+    printf("%-6s threads=%zu batch=%zu calls=%zu%s%s\n", name, options.threads, options.batch, total.latencyNs.size(),
+        options.columns ? " columns" : "", options.pool ? "" : " no-pool");
+    printf("       %.0f points/s, %.1f MB/s, %.3f syscalls/point, %zu errors\n", total.points / seconds, total.bytes / seconds / 1e6,
+        total.points ? static_cast<double>(total.syscalls) / total.points : 0.0, total.errors);
+    printf("       latency us: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n", percentileUs(0.5), percentileUs(0.9), percentileUs(0.99), percentileUs(1));
+}
+
+// 每个线程一个序列，时间戳按调用序号连续
+void fillBatch(size_t thread, size_t call, size_t batch, std::vector<long long>& timestamps, std::vector<double>& values)
+{
+    timestamps.resize(batch);
+    values.resize(batch);
+    long long base = 1700000000000000000LL + static_cast<long long>(call * batch) * 1000;
+    for (size_t i = 0; i < batch; i++) {
+        timestamps[i] = base + static_cast<long long>(i) * 1000;
+        values[i] = std::sin((call * batch + i) * 1e-3) * 100 + thread;
+    }
+}
+
+void benchUdp(const BenchOptions& options)
+{
+    MockUdpSink sink;
+    int port = sink.start();
+    if (port < 0) {
+        fprintf(stderr, "cannot start udp sink\n");
+        return;
+    }
+    std::vector<std::unique_ptr<tsdb_cpp::tsdb_entry>> entries;
+    std::vector<std::string> names;
+    for (size_t t = 0; t < options.threads; t++) {
+        entries.push_back(std::make_unique<tsdb_cpp::tsdb_entry>("127.0.0.1", port, options.packetBytes));
+        names.push_back("sensor" + std::to_string(t));
+    }
+    runBench("udp", options, [&](size_t t, size_t c, ThreadResult& r) -> long long {
+        thread_local std::vector<long long> timestamps;
+        thread_local std::vector<double> values;
+        thread_local std::vector<tsdb_cpp::point> points;
+        fillBatch(t, c, options.batch, timestamps, values);
+        int ret;
+        if (options.columns) {
+            ret = entries[t]->insert_columns("datas", { { "pointName", names[t] } }, "value", timestamps.data(), values.data(), options.batch);
+        } else {
+            points.clear();
+            for (size_t i = 0; i < options.batch; i++)
+                points.emplace_back(names[t], values[i], timestamps[i]);
+            ret = entries[t]->insert_points(points);
+        }
+        r.bytes += entries[t]->last_batch().bytes_;
+        return ret == 0 ? static_cast<long long>(options.batch) : -1;
+    });
+    size_t sent = options.threads * options.calls * options.batch;
+    sink.waitForLines(sent, 500);
+    printf("       sink received %zu of %zu lines in %zu datagrams\n", sink.lines(), sent, sink.packets());
+}
+
+tsdb_cpp::server_info serverInfo(int port, const BenchOptions& options)
+{
+    tsdb_cpp::server_info si("127.0.0.1", port, "bench");
+    if (!options.pool)
+        si.pool_.reset();
+    else
+        si.pool_ = std::make_shared<tsdb_cpp::connection_pool>(options.threads);
+    si.encoding_ = options.encoding;
+    return si;
+}
+
+void benchHttp(const BenchOptions& options)
+{
+    MockServer server;
+    int port = server.start();
+    if (port < 0) {
+        fprintf(stderr, "cannot start mock server\n");
+        return;
+    }
+    tsdb_cpp::server_info si = serverInfo(port, options);
+    runBench("http", options, [&](size_t t, size_t c, ThreadResult& r) -> long long {
+        thread_local std::vector<long long> timestamps;
+        thread_local std::vector<double> values;
+        thread_local tsdb_cpp::tsdb_data_builder builder;
+        fillBatch(t, c, options.batch, timestamps, values);
+        std::string name = "sensor" + std::to_string(t);
+        builder.clear();
+        if (options.columns) {
+            builder.columns("datas", { { "pointName", name } }, "value", timestamps.data(), values.data(), options.batch);
+        } else {
+            for (size_t i = 0; i < options.batch; i++)
+                builder.meas("datas").tag("pointName", name).field("value", values[i]).timestamp(timestamps[i]);
+        }
+        r.bytes += builder.view().length();
+        return builder.post_http(si) == 0 ? static_cast<long long>(options.batch) : -1;
+    });
+    printf("       server accepted %zu connections, %zu requests, %zu body bytes on the wire\n", server.connections(), server.requests(), server.bodyBytes());
+}
+
+void benchQuery(const BenchOptions& options)
+{
+    MockServer server;
+    int port = server.start();
+    if (port < 0) {
+        fprintf(stderr, "cannot start mock server\n");
+        return;
+    }
+    // 响应一个batch行的序列
+    std::string response = "{\"results\":[{\"statement_id\":0,\"series\":[{\"name\":\"datas\",\"columns\":[\"time\",\"value\"],\"values\":[";
+    for (size_t i = 0; i < options.batch; i++) {
+        response += i ? ",[" : "[";
+        response += std::to_string(1700000000000000000LL + static_cast<long long>(i) * 1000) + "," + std::to_string(i * 0.5) + "]";
+    }
+    response += "]}]}]}\n";
+    server.setHandler([&](const MockServer::Request& req, std::string& body) {
+        if (req.path != "/query")
+            return MockServer::defaultHandler(req, body);
+        body = response;
+        return 200;
+    });
+    tsdb_cpp::server_info si = serverInfo(port, options);
+    runBench("query", options, [&](size_t, size_t, ThreadResult& r) -> long long {
+        thread_local std::string resp;
+        if (options.columns) {
+            size_t rows = 0;
+            int ret = tsdb_cpp::query_columns("select value from datas", si, [&](const tsdb_cpp::series_batch& b) {
+                rows += b.rows();
+                return true;
+            });
+            r.bytes += response.length();
+            return ret == 0 ? static_cast<long long>(rows) : -1;
+        }
+        int ret = tsdb_cpp::query(resp, "select value from datas", si);
+        r.bytes += resp.length();
+        return ret == 0 ? static_cast<long long>(options.batch) : -1;
+    });
+}
+
+int main(int argc, char const* argv[])
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        auto next = [&]() { return i + 1 < argc ? argv[++i] : ""; };
+        if (strcmp(argv[i], "--mode") == 0)
+            options.mode = next();
+        else if (strcmp(argv[i], "--threads") == 0)
+            options.threads = std::max(1L, atol(next()));
+        else if (strcmp(argv[i], "--batch") == 0)
+            options.batch = std::max(1L, atol(next()));
+        else if (strcmp(argv[i], "--calls") == 0)
+            options.calls = std::max(1L, atol(next()));
+        else if (strcmp(argv[i], "--packet-bytes") == 0)
+            options.packetBytes = std::max(1L, atol(next()));
+        else if (strcmp(argv[i], "--columns") == 0)
+            options.columns = true;
+        else if (strcmp(argv[i], "--no-pool") == 0)
+            options.pool = false;
+        else if (strcmp(argv[i], "--encoding") == 0) {
+            std::string name = next();
+            options.encoding = name == "gzip" ? tsdb_cpp::ENCODING_GZIP : name == "zstd" ? tsdb_cpp::ENCODING_ZSTD : tsdb_cpp::ENCODING_IDENTITY;
+        } else {
+            fprintf(stderr, "usage: %s [--mode udp|http|query|all] [--threads N] [--batch N] [--calls N] [--columns] [--no-pool] [--encoding gzip|zstd] [--packet-bytes N]\n", argv[0]);
+            return 1;
+        }
+    }
+    bool all = options.mode == "all";
+    if (all || options.mode == "udp")
+        benchUdp(options);
+    if (all || options.mode == "http")
+        benchHttp(options);
+    if (all || options.mode == "query")
+        benchQuery(options);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "src/tsdb_hf.hpp"
+#include "test/ClientUnitTest.hpp"
 #include "test/HFUnitTest.hpp"
 #include "utils/Utils.hpp"
 #include <cstddef>
@@ -13,7 +14,7 @@ vector<point> uniformDistributionPoints(int cnt, double a = 0, double b = 1)
     std::default_random_engine engine(static_cast<unsigned int>(time(0)));
     std::uniform_real_distribution<double> distrib(a, b);
     for (int i = 0; i < cnt; i++) {
-        point p("uniformDistributionPoints", distrib(engine), Utils::getCurNanoseconds());
+        point p("uniformDistributionPoints", distrib(engine), Utils::getFastNanoseconds());
         points.push_back(p);
     }
     return points;
@@ -24,7 +25,17 @@ vector<point> normalDistributionPoints(int cnt, double mean = 0, double stddev =
     std::default_random_engine engine(static_cast<unsigned int>(time(0)));
     std::normal_distribution<double> distrib(0, 1.0);
     for (int i = 0; i < cnt; i++) {
-        point p("normalDistributionPoints", distrib(engine), Utils::getCurNanoseconds());
+        point p("normalDistributionPoints", distrib(engine), Utils::getFastNanoseconds());
+        points.push_back(p);
+    }
+    return points;
+}
+
+vector<basic_point<int64_t>> counterPoints(int cnt, int64_t begin = 0)
+{
+    vector<basic_point<int64_t>> points;
+    for (int i = 0; i < cnt; i++) {
+        basic_point<int64_t> p("counterPoints", begin + i, Utils::getFastNanoseconds());
         points.push_back(p);
     }
     return points;
@@ -34,7 +45,7 @@ vector<point> sequentialPoints(int cnt, double begin = 0)
 {
     vector<point> points;
     for (int i = 0; i < cnt; i++) {
-        point p("sequentialPoints", begin + i, Utils::getCurNanoseconds());
+        point p("sequentialPoints", begin + i, Utils::getFastNanoseconds());
         points.push_back(p);
     }
     return points;
@@ -48,6 +59,32 @@ void test()
     test.compressBytesToFilesUnitTest();
     test.mergeRangeUnitTest();
     test.streamEmitUnitTest();
+    test.codecUnitTest();
+    test.cadenceUnitTest();
+    test.typedStreamUnitTest();
+    test.outOfOrderUnitTest();
+    test.lossyUnitTest();
+    test.ingestUnitTest();
+    test.metricsUnitTest();
+    test.fastClockUnitTest();
+    test.arrowUnitTest();
+    test.manifestUnitTest();
+    test.multiFieldUnitTest();
+    test.nullUnitTest();
+    test.sketchUnitTest();
+    test.filterUnitTest();
+    test.liveUnitTest();
+    test.bulkUnitTest();
+    ClientUnitTest clientTest;
+    clientTest.builderUnitTest();
+    clientTest.keepAliveUnitTest();
+    clientTest.udpBatchingUnitTest();
+    clientTest.asyncUnitTest();
+    clientTest.compressionUnitTest();
+    clientTest.streamingQueryUnitTest();
+    clientTest.responseFramingUnitTest();
+    clientTest.spoolUnitTest();
+    clientTest.exportUnitTest();
     std::cout << "——————————— Unit Tests Done ———————————" << std::endl;
 }
 
@@ -78,4 +115,8 @@ int main(int argc, char const* argv[])
     tsdb_entry.initialize();
     tsdb_entry.insert_points(uniformDistributionPoints(pointsCnt));
     tsdb_entry.close();
+
+    tsdb_entry.initialize();
+    tsdb_entry.insert_points(counterPoints(pointsCnt));
+    tsdb_entry.close();
 }
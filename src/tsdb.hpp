@@ -2,11 +2,27 @@
 #define TSDB_CPP_HPP
 
 #include <cstddef>
-#include <sstream>
+#include <charconv>
+#include <string_view>
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <climits>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+#include <zlib.h>
+#include <zstd.h>
 
 #ifdef _WIN32
     #define NOMINMAX
@@ -18,18 +34,118 @@
         __int64 r = send(sock, (const char*)iov->iov_base, iov->iov_len, 0);
         return (r < 0 || cnt == 1) ? r : r + writev(sock, iov + 1, cnt - 1);
     }
+    #define poll WSAPoll
 #else
     #include <unistd.h>
+    #include <poll.h>
     #include <sys/types.h>
     #include <sys/socket.h>
     #include <sys/uio.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
     #define closesocket close
+    #ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+    #endif
 #endif
 using namespace std;
 
 namespace tsdb_cpp {
+    struct server_info;
+
+    namespace detail {
+        // 响应的状态行和分帧相关的头部
+        struct response_head {
+            int code_ = 0;
+            long long content_length_ = -1;
+            bool chunked_ = false;
+            bool keep_alive_ = true;
+
+            int parse_status(const std::string& line) {
+                size_t sp = line.find(' ');
+                if(line.compare(0, 5, "HTTP/") != 0 || sp == std::string::npos || (code_ = atoi(line.c_str() + sp + 1)) < 100) return -10;
+                keep_alive_ = line.compare(0, sp, "HTTP/1.0") != 0;
+                content_length_ = -1;
+                chunked_ = false;
+                return 0;
+            }
+            int parse_header(const std::string& line) {
+                size_t colon = line.find(':');
+                if(colon == std::string::npos) return -11;
+                size_t vbeg = line.find_first_not_of(' ', colon + 1);
+                std::string name(line, 0, colon), value(line, vbeg == std::string::npos ? line.length() : vbeg, std::string::npos);
+                for(auto& c : name) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+                for(auto& c : value) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+                if(name == "content-length")
+                    content_length_ = strtoll(value.c_str(), NULL, 10);
+                else if(name == "transfer-encoding")
+                    chunked_ = value.find("chunked") != std::string::npos;
+                else if(name == "connection")
+                    keep_alive_ = value.find("close") == std::string::npos && (keep_alive_ || value.find("keep-alive") != std::string::npos);
+                return 0;
+            }
+        };
+        inline int parse_chunk_size(const std::string& line, unsigned long long& n) {
+            char* end;
+            n = strtoull(line.c_str(), &end, 16);
+            return (end == line.c_str() || (*end && *end != ';' && *end != ' ')) ? -8 : 0;
+        }
+
+        // 响应体按到达的片段交给调用方，返回false时中止读取
+        typedef std::function<bool(const char*, size_t)> body_sink;
+
+        // 一条HTTP/1.1连接及其读缓冲，响应按Content-Length或chunked分帧读完后连接可复用
+        struct http_connection {
+            int sock_ = -1;
+            unsigned timeout_sec_ = 0;
+            std::string buf_;
+            size_t pos_ = 0, end_ = 0;
+            size_t received_ = 0;
+            std::chrono::steady_clock::time_point idle_since_;
+
+            http_connection() : buf_(0x4000, '\0') {}
+            ~http_connection() { if(sock_ >= 0) closesocket(sock_); }
+            http_connection(const http_connection&) = delete;
+            http_connection& operator=(const http_connection&) = delete;
+
+            int open(const server_info& si, unsigned timeout_sec);
+            int set_timeout(unsigned timeout_sec);
+            bool healthy() const;
+            int send(const char* header, size_t header_len, std::string_view body);
+            int read_response(const char* method, const body_sink& sink, bool& keep_alive);
+        private:
+            int fill();
+            int read_line(std::string& line);
+            int read_body(size_t n, const body_sink& sink);
+            int read_until_close(const body_sink& sink);
+        };
+    }
+
+    // server_info及其拷贝共享一个连接池；空闲连接复用前检查是否空闲过久或已被对端关闭。
+    // 连接不区分目标地址，修改host_/port_后应换用新的连接池
+    struct connection_pool {
+        connection_pool(size_t max_idle = 8, unsigned idle_timeout_sec = 30)
+            : max_idle_(max_idle), idle_timeout_sec_(idle_timeout_sec) {}
+
+        std::unique_ptr<detail::http_connection> acquire(const server_info& si, unsigned timeout_sec, int& err, bool& reused);
+        void release(std::unique_ptr<detail::http_connection> conn);
+        void clear()            { std::lock_guard<std::mutex> lock(mtx_); idle_.clear(); }
+
+        size_t idle() const     { std::lock_guard<std::mutex> lock(mtx_); return idle_.size(); }
+        size_t connects() const { std::lock_guard<std::mutex> lock(mtx_); return connects_; }
+        size_t reuses() const   { std::lock_guard<std::mutex> lock(mtx_); return reuses_; }
+    private:
+        mutable std::mutex mtx_;
+        std::vector<std::unique_ptr<detail::http_connection>> idle_;
+        size_t max_idle_;
+        unsigned idle_timeout_sec_;
+        size_t connects_ = 0, reuses_ = 0;
+    };
+
+    // 写入请求体的Content-Encoding
+    enum content_encoding { ENCODING_IDENTITY, ENCODING_GZIP, ENCODING_ZSTD };
+
     struct server_info {
         std::string host_;
         int port_;
@@ -38,15 +154,18 @@ namespace tsdb_cpp {
         std::string pwd_;
         std::string precision_;
         std::string token_;
+        std::shared_ptr<connection_pool> pool_;     // 置空则每个请求使用一条短连接
+        content_encoding encoding_ = ENCODING_IDENTITY;
+        int compression_level_ = 0;                 // 0为各算法的默认级别
         server_info(const std::string& host, int port, const std::string& db = "", const std::string& usr = "", const std::string& pwd = "", const std::string& precision = "ms", const std::string& token = "")
-            : host_(host), port_(port), db_(db), usr_(usr), pwd_(pwd), precision_(precision), token_(token) {}
+            : host_(host), port_(port), db_(db), usr_(usr), pwd_(pwd), precision_(precision), token_(token), pool_(std::make_shared<connection_pool>()) {}
     };
     struct point {
-        const std::string& name_;
+        std::string name_;
         double value_;
         long long nanoseconds_;
-        point(const std::string& name, double value, long long nanoseconds)
-            : name_(name), value_(value), nanoseconds_(nanoseconds) {}
+        point(std::string name, double value, long long nanoseconds)
+            : name_(std::move(name)), value_(value), nanoseconds_(nanoseconds) {}
     };
 
     namespace detail {
@@ -54,13 +173,29 @@ namespace tsdb_cpp {
         struct tag_caller;
         struct field_caller;
         struct ts_caller;
+        // 各字节在度量名（", "）、标签和字段键（",= "）、字符串字段值（"）中是否需要转义
+        struct escape_table {
+            unsigned char flags_[256] = {};
+            escape_table() {
+                flags_[static_cast<unsigned char>(',')] = 1 | 2;
+                flags_[static_cast<unsigned char>(' ')] = 1 | 2;
+                flags_[static_cast<unsigned char>('=')] = 2;
+                flags_[static_cast<unsigned char>('"')] = 4;
+            }
+        };
         struct inner {
             static int http_request(const char*, const char*, const std::string&, const std::string&, const server_info&, std::string*, unsigned timeout_sec = 0);
+            static int http_request(const char*, const char*, const std::string&, std::string_view, const server_info&, const body_sink& sink, unsigned timeout_sec, const char* extra_headers = NULL);
+            static size_t format_header(std::string& out, const char* method, const char* uri, const std::string& querystring, size_t body_length, const server_info& si, bool keep_alive, const char* extra_headers = NULL);
+            static int compress_body(std::string_view src, content_encoding encoding, int level, std::string& out);
+            static const char* encoding_name(content_encoding encoding) { return encoding == ENCODING_GZIP ? "gzip" : encoding == ENCODING_ZSTD ? "zstd" : "identity"; }
             static inline unsigned char to_hex(unsigned char x) { return  x > 9 ? x + 55 : x + 48; }
         };
     }
     static void url_encode(std::string& out, const std::string& src);
 
+    typedef std::vector<std::pair<std::string_view, std::string_view>> tag_list;
+
     inline int query(std::string& resp, const std::string& query, const server_info& si, unsigned timeout_sec = 0) {
         std::string qs("&q=");
         url_encode(qs, query);
@@ -71,76 +206,217 @@ namespace tsdb_cpp {
         url_encode(qs, db_name);
         return detail::inner::http_request("POST", "query", qs, "", si, &resp, timeout_sec);
     }
+    inline int ping(const server_info& si, unsigned timeout_sec = 0) {
+        return detail::inner::http_request("GET", "ping", "", "", si, NULL, timeout_sec);
+    }
 
+    // 行协议构建器，直接格式化到可复用的连续缓冲区，clear()保留容量，整个批次不再分配内存
     struct tsdb_data_builder {
     public:
-        tsdb_data_builder() {
-            lines_.imbue(std::locale("C"));
-            lines_.clear();
+        tsdb_data_builder(size_t capacity = 0x1000) {
+            lines_.reserve(capacity);
         }
         void clear() {
             lines_.clear();
-            lines_.str(""); 
         }
-        detail::tag_caller& meas(const std::string& m) {
-            lines_ << '\n'; 
+        void reserve(size_t capacity) {
+            lines_.reserve(capacity);
+        }
+        void erase_front(size_t n) {
+            lines_.erase(0, n);
+        }
+        std::string_view view() const {
+            return lines_;
+        }
+        detail::tag_caller& meas(std::string_view m) {
+            lines_ += '\n'; 
             return _m(m);
         }
         int send_udp(const std::string& host, int port) {
              return _send_udp(host, port); 
         }
         int send_udp(int sock, sockaddr_in& addr) {
-            int ret = sendto(sock, &lines_.str()[0], lines_.str().length(), 0, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+            int ret = sendto(sock, lines_.data(), lines_.length(), 0, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
             return ret;
         }
+        int post_http(const server_info& si, std::string* resp = NULL, unsigned timeout_sec = 0) {
+            return _post_http(si, resp, timeout_sec);
+        }
+
+        /**
+         * 一个序列的多个点一次格式化：度量名、标签集和字段键只转义一次，之后每行复制这段前缀
+         * @param prec 浮点数的小数位数，负数取能精确还原的最短表示
+         * @param valid 可为空；非空时valid[i]为0的点是空值，跳过
+         * @return 追加的行数，NaN和Inf无法用行协议表示，跳过
+         */
+        template <typename T>
+        size_t columns(std::string_view m, const tag_list& tags, std::string_view field_key,
+                       const long long* timestamps, const T* values, size_t n, int prec = -1, const uint8_t* valid = nullptr) {
+            size_t start = lines_.length();
+            lines_ += '\n';
+            _escape(m, ESCAPE_MEAS);
+            for(const auto& t : tags) _t(t.first, t.second);
+            lines_ += ' ';
+            _escape(field_key, ESCAPE_KEY);
+            lines_ += '=';
+            prefix_.assign(lines_, start, std::string::npos);
+            lines_.resize(start);
+            lines_.reserve(start + n * (prefix_.length() + 48));
+
+            size_t written = 0;
+            for(size_t i = 0; i < n; i++) {
+                if(valid && !valid[i]) continue;
+                T v = values[i];
+                if constexpr (std::is_floating_point_v<T>) {
+                    if(!std::isfinite(v)) continue;
+                }
+                size_t pos = lines_.length();
+                if constexpr (std::is_floating_point_v<T>) {
+                    if(prec >= 0) {
+                        lines_ += prefix_;
+                        _append_fixed(v, prec);
+                        _ts(timestamps[i]);
+                        written++;
+                        continue;
+                    }
+                }
+                // 最短浮点表示、整数和时间戳都不超过24字节，按上界一次扩容
+                lines_.resize(pos + prefix_.length() + 64);
+                char* p = &lines_[pos];
+                char* end = &lines_[0] + lines_.length();
+                memcpy(p, prefix_.data(), prefix_.length());
+                p += prefix_.length();
+                if constexpr (std::is_same_v<T, bool>) {
+                    *p++ = v ? 't' : 'f';
+                } else {
+                    p = std::to_chars(p, end, v).ptr;
+                    if constexpr (std::is_integral_v<T>) *p++ = 'i';
+                }
+                *p++ = ' ';
+                p = std::to_chars(p, end, timestamps[i]).ptr;
+                lines_.resize(p - &lines_[0]);
+                written++;
+            }
+            return written;
+        }
+
+        /**
+         * 多字段版本：第i行依次写出各字段的values[k][i]，字段键为field_keys[k]
+         * @param valid 可为空；非空时valid[k][i]为0表示该字段是空值，不写出
+         * @return 追加的行数，空值、NaN和Inf不写出该字段，一行的字段全部不能写出时跳过该行
+         */
+        template <typename T>
+        size_t columns(std::string_view m, const tag_list& tags, const std::vector<std::string_view>& field_keys,
+                       const long long* timestamps, const T* const* values, size_t n, int prec = -1, const uint8_t* const* valid = nullptr) {
+            size_t start = lines_.length();
+            lines_ += '\n';
+            _escape(m, ESCAPE_MEAS);
+            for(const auto& t : tags) _t(t.first, t.second);
+            lines_ += ' ';
+            prefix_.assign(lines_, start, std::string::npos);
+            lines_.resize(start);
+            keys_.resize(field_keys.size());
+            for(size_t k = 0; k < field_keys.size(); k++) {
+                size_t pos = lines_.length();
+                _escape(field_keys[k], ESCAPE_KEY);
+                lines_ += '=';
+                keys_[k].assign(lines_, pos, std::string::npos);
+                lines_.resize(pos);
+            }
+
+            size_t written = 0;
+            for(size_t i = 0; i < n; i++) {
+                size_t pos = lines_.length();
+                lines_ += prefix_;
+                bool first = true;
+                for(size_t k = 0; k < field_keys.size(); k++) {
+                    if(valid && !valid[k][i]) continue;
+                    T v = values[k][i];
+                    if constexpr (std::is_floating_point_v<T>) {
+                        if(!std::isfinite(v)) continue;
+                    }
+                    if(!first) lines_ += ',';
+                    first = false;
+                    lines_ += keys_[k];
+                    _append_value(v, prec);
+                }
+                if(first) {
+                    lines_.resize(pos);
+                    continue;
+                }
+                _ts(timestamps[i]);
+                written++;
+            }
+            return written;
+        }
 
     protected:
-        detail::tag_caller& _m(const std::string& m) {
-            _escape(m, ", ");
+        enum escape_set : unsigned char { ESCAPE_MEAS = 1, ESCAPE_KEY = 2, ESCAPE_STR = 4 };
+
+        template <typename T>
+        void _append_value(T v, int prec) {
+            if constexpr (std::is_same_v<T, bool>) {
+                lines_ += v ? 't' : 'f';
+            } else if constexpr (std::is_integral_v<T>) {
+                _append_int(v);
+                lines_ += 'i';
+            } else if(prec >= 0) {
+                _append_fixed(v, prec);
+            } else {
+                size_t n = lines_.length();
+                lines_.resize(n + 32);
+                lines_.resize(std::to_chars(&lines_[n], &lines_[0] + lines_.length(), v).ptr - &lines_[0]);
+            }
+        }
+
+        detail::tag_caller& _m(std::string_view m) {
+            _escape(m, ESCAPE_MEAS);
             return reinterpret_cast<detail::tag_caller&>(*this);
         }
-        detail::tag_caller& _t(const std::string& k, const std::string& v) {
-            lines_ << ',';
-            _escape(k, ",= ");
-            lines_ << '=';
-            _escape(v, ",= ");
+        detail::tag_caller& _t(std::string_view k, std::string_view v) {
+            lines_ += ',';
+            _escape(k, ESCAPE_KEY);
+            lines_ += '=';
+            _escape(v, ESCAPE_KEY);
             return reinterpret_cast<detail::tag_caller&>(*this);
         }
-        detail::field_caller& _f_s(char delim, const std::string& k, const std::string& v) {
-            lines_ << delim;
-            _escape(k, ",= ");
-            lines_ << "=\"";
-            _escape(v, "\"");
-            lines_ << '\"';
+        detail::field_caller& _f_s(char delim, std::string_view k, std::string_view v) {
+            lines_ += delim;
+            _escape(k, ESCAPE_KEY);
+            lines_ += "=\"";
+            _escape(v, ESCAPE_STR);
+            lines_ += '\"';
             return reinterpret_cast<detail::field_caller&>(*this);
         }
-        detail::field_caller& _f_i(char delim, const std::string& k, long long v) {
-            lines_ << delim;
-            _escape(k, ",= ");
-            lines_ << '=';
-            lines_ << v << 'i';
+        detail::field_caller& _f_i(char delim, std::string_view k, long long v) {
+            lines_ += delim;
+            _escape(k, ESCAPE_KEY);
+            lines_ += '=';
+            _append_int(v);
+            lines_ += 'i';
             return reinterpret_cast<detail::field_caller&>(*this);
         }
-        detail::field_caller& _f_f(char delim, const std::string& k, double v, int prec) {
-            lines_ << delim;
-            _escape(k, ",= ");
-            lines_.precision(prec);
-            lines_.setf(std::ios::fixed);
-            lines_ << '=' << v;
+        detail::field_caller& _f_f(char delim, std::string_view k, double v, int prec) {
+            lines_ += delim;
+            _escape(k, ESCAPE_KEY);
+            lines_ += '=';
+            _append_fixed(v, prec);
             return reinterpret_cast<detail::field_caller&>(*this);
         }
-        detail::field_caller& _f_b(char delim, const std::string& k, bool v) {
-            lines_ << delim;
-            _escape(k, ",= ");
-            lines_ << '=' << (v ? 't' : 'f');
+        detail::field_caller& _f_b(char delim, std::string_view k, bool v) {
+            lines_ += delim;
+            _escape(k, ESCAPE_KEY);
+            lines_ += '=';
+            lines_ += v ? 't' : 'f';
             return reinterpret_cast<detail::field_caller&>(*this);
         }
         detail::ts_caller& _ts(long long ts) {
-            lines_ << ' ' << ts;
+            lines_ += ' ';
+            _append_int(ts);
             return reinterpret_cast<detail::ts_caller&>(*this);
         }
         int _post_http(const server_info& si, std::string* resp, unsigned timeout_sec = 0) {
-            return detail::inner::http_request("POST", "write", "", lines_.str(), si, resp, timeout_sec);
+            return detail::inner::http_request("POST", "write", "", lines_, si, resp, timeout_sec);
         }
         int _send_udp(const std::string& host, int port) {
             int sock, ret = 0;
@@ -152,23 +428,47 @@ namespace tsdb_cpp {
 
             if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) return -2;
 
-            lines_ << '\n';
-            ret = sendto(sock, &lines_.str()[0], lines_.str().length(), 0, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+            lines_ += '\n';
+            ret = sendto(sock, lines_.data(), lines_.length(), 0, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
 
             closesocket(sock);
             return ret;
         }
-        void _escape(const std::string& src, const char* escape_seq) {
-            size_t pos = 0, start = 0;
-            while((pos = src.find_first_of(escape_seq, start)) != std::string::npos) {
-                lines_.write(src.c_str() + start, pos - start);
-                lines_ << '\\' << src[pos];
-                start = ++pos;
+        void _append_int(long long v) {
+            size_t n = lines_.length();
+            lines_.resize(n + 20);
+            lines_.resize(std::to_chars(&lines_[n], &lines_[0] + lines_.length(), v).ptr - &lines_[0]);
+        }
+        void _append_fixed(double v, int prec) {
+            // 定点格式的位数取决于数量级，先按常见长度格式化，放不下时按double的最大长度重试
+            size_t n = lines_.length();
+            for(size_t width : { static_cast<size_t>(32 + prec), static_cast<size_t>(328 + prec) }) {
+                lines_.resize(n + width);
+                auto res = std::to_chars(&lines_[n], &lines_[0] + lines_.length(), v, std::chars_format::fixed, prec);
+                if(res.ec == std::errc()) {
+                    lines_.resize(res.ptr - &lines_[0]);
+                    return;
+                }
+            }
+            lines_.resize(n);
+        }
+        // 按查表结果整段追加不需转义的字节
+        void _escape(std::string_view src, unsigned char set) {
+            static const detail::escape_table table;
+            size_t start = 0;
+            for(size_t pos = 0; pos < src.length(); pos++) {
+                if(table.flags_[static_cast<unsigned char>(src[pos])] & set) {
+                    lines_.append(src.data() + start, pos - start);
+                    lines_ += '\\';
+                    start = pos;
+                }
             }
-            lines_.write(src.c_str() + start, src.length() - start);
+            lines_.append(src.data() + start, src.length() - start);
         }
 
-        std::stringstream lines_;
+        std::string lines_;
+        std::string prefix_;
+        std::vector<std::string> keys_;
     };
     
     inline void url_encode(std::string& out, const std::string& src) {
@@ -189,208 +489,524 @@ namespace tsdb_cpp {
 
     namespace detail {
         struct tag_caller : public tsdb_data_builder {
-            detail::tag_caller& tag(const std::string& k, const std::string& v)       { return _t(k, v); }
-            detail::field_caller& field(const std::string& k, const std::string& v)   { return _f_s(' ', k, v); }
-            detail::field_caller& field(const std::string& k, bool v)                 { return _f_b(' ', k, v); }
-            detail::field_caller& field(const std::string& k, short v)                { return _f_i(' ', k, v); }
-            detail::field_caller& field(const std::string& k, int v)                  { return _f_i(' ', k, v); }
-            detail::field_caller& field(const std::string& k, long v)                 { return _f_i(' ', k, v); }
-            detail::field_caller& field(const std::string& k, long long v)            { return _f_i(' ', k, v); }
-            detail::field_caller& field(const std::string& k, double v, int prec = 2) { return _f_f(' ', k, v, prec); }
+            detail::tag_caller& tag(std::string_view k, std::string_view v)         { return _t(k, v); }
+            detail::field_caller& field(std::string_view k, std::string_view v)     { return _f_s(' ', k, v); }
+            detail::field_caller& field(std::string_view k, const char* v)          { return _f_s(' ', k, v); }
+            detail::field_caller& field(std::string_view k, bool v)                 { return _f_b(' ', k, v); }
+            detail::field_caller& field(std::string_view k, short v)                { return _f_i(' ', k, v); }
+            detail::field_caller& field(std::string_view k, int v)                  { return _f_i(' ', k, v); }
+            detail::field_caller& field(std::string_view k, long v)                 { return _f_i(' ', k, v); }
+            detail::field_caller& field(std::string_view k, long long v)            { return _f_i(' ', k, v); }
+            detail::field_caller& field(std::string_view k, double v, int prec = 2) { return _f_f(' ', k, v, prec); }
         private:
-            detail::tag_caller& meas(const std::string& m);
+            detail::tag_caller& meas(std::string_view m);
         };
         struct ts_caller : public tsdb_data_builder {
-            detail::tag_caller& meas(const std::string& m)                            { lines_ << '\n'; return _m(m); }
+            detail::tag_caller& meas(std::string_view m)                            { lines_ += '\n'; return _m(m); }
             int post_http(const server_info& si, std::string* resp = NULL,
                                           unsigned timeout_sec = 0)            { return _post_http(si, resp, timeout_sec); }
             int send_udp(const std::string& host, int port)                           { return _send_udp(host, port); }
         };
         struct field_caller : public ts_caller {
-            detail::field_caller& field(const std::string& k, const std::string& v)   { return _f_s(',', k, v); }
-            detail::field_caller& field(const std::string& k, bool v)                 { return _f_b(',', k, v); }
-            detail::field_caller& field(const std::string& k, short v)                { return _f_i(',', k, v); }
-            detail::field_caller& field(const std::string& k, int v)                  { return _f_i(',', k, v); }
-            detail::field_caller& field(const std::string& k, long v)                 { return _f_i(',', k, v); }
-            detail::field_caller& field(const std::string& k, long long v)            { return _f_i(',', k, v); }
-            detail::field_caller& field(const std::string& k, double v, int prec = 2) { return _f_f(',', k, v, prec); }
-            detail::ts_caller& timestamp(unsigned long long ts)                       { return _ts(ts); }
+            detail::field_caller& field(std::string_view k, std::string_view v)     { return _f_s(',', k, v); }
+            detail::field_caller& field(std::string_view k, const char* v)          { return _f_s(',', k, v); }
+            detail::field_caller& field(std::string_view k, bool v)                 { return _f_b(',', k, v); }
+            detail::field_caller& field(std::string_view k, short v)                { return _f_i(',', k, v); }
+            detail::field_caller& field(std::string_view k, int v)                  { return _f_i(',', k, v); }
+            detail::field_caller& field(std::string_view k, long v)                 { return _f_i(',', k, v); }
+            detail::field_caller& field(std::string_view k, long long v)            { return _f_i(',', k, v); }
+            detail::field_caller& field(std::string_view k, double v, int prec = 2) { return _f_f(',', k, v, prec); }
+            detail::ts_caller& timestamp(unsigned long long ts)                     { return _ts(ts); }
         };
-        inline int inner::http_request(const char* method, const char* uri,
-            const std::string& querystring, const std::string& body, const server_info& si, std::string* resp, unsigned timeout_sec) {
-            std::string header;
-            struct iovec iv[2];
+        inline int http_connection::open(const server_info& si, unsigned timeout_sec) {
             struct sockaddr_in addr;
-            int sock, ret_code = 0, content_length = 0, len = 0;
-            char ch;
-            unsigned char chunked = 0;
+            int one = 1;
 
             addr.sin_family = AF_INET;
             addr.sin_port = htons(si.port_);
             if((addr.sin_addr.s_addr = inet_addr(si.host_.c_str())) == INADDR_NONE) return -1;
 
-            if((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -2;
+            if((sock_ = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -2;
+            timeout_sec_ = ~0u;
+            if(set_timeout(timeout_sec) < 0) return -2;
+            // 请求头和请求体一次写出，关闭Nagle避免与延迟确认叠加出40ms的停顿
+            setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&one), sizeof(one));
 
+            if(connect(sock_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) return -3;
+            return 0;
+        }
+        inline int http_connection::set_timeout(unsigned timeout_sec) {
+            if(timeout_sec == timeout_sec_) return 0;
             struct timeval timeout;
             timeout.tv_sec = static_cast<long>(timeout_sec);
             timeout.tv_usec = 0;
-            if(setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<char*> (&timeout), sizeof(timeout)) < 0) return -2;
+            if(setsockopt(sock_, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<char*>(&timeout), sizeof(timeout)) < 0 ||
+               setsockopt(sock_, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<char*>(&timeout), sizeof(timeout)) < 0) return -2;
+            timeout_sec_ = timeout_sec;
+            return 0;
+        }
+        inline bool http_connection::healthy() const {
+            struct pollfd pfd;
+            pfd.fd = sock_;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            // 空闲连接上不应有可读数据，可读说明对端已关闭（EOF）或发来了多余的字节
+            return sock_ >= 0 && pos_ == end_ && poll(&pfd, 1, 0) == 0;
+        }
+        inline int http_connection::send(const char* header, size_t header_len, std::string_view body) {
+            struct iovec iv[2];
+            struct iovec* cur = iv;
+            int cnt = body.empty() ? 1 : 2;
+
+            iv[0].iov_base = const_cast<char*>(header);
+            iv[0].iov_len = header_len;
+            iv[1].iov_base = const_cast<char*>(body.data());
+            iv[1].iov_len = body.length();
+            while(cnt > 0) {
+#ifdef _WIN32
+                long long n = writev(sock_, cur, cnt);
+#else
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = cur;
+                msg.msg_iovlen = cnt;
+                // 向已被对端关闭的连接写入时不能触发SIGPIPE
+                ssize_t n = sendmsg(sock_, &msg, MSG_NOSIGNAL);
+#endif
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) return -6;
+                while(cnt > 0 && static_cast<size_t>(n) >= cur->iov_len) {
+                    n -= cur->iov_len;
+                    ++cur;
+                    --cnt;
+                }
+                if(cnt > 0) {
+                    cur->iov_base = static_cast<char*>(cur->iov_base) + n;
+                    cur->iov_len -= n;
+                }
+            }
+            return 0;
+        }
+        inline int http_connection::fill() {
+            long long n;
+            do {
+                n = recv(sock_, &buf_[0], buf_.length(), 0);
+            } while(n < 0 && errno == EINTR);
+            if(n <= 0) return -7;
+            pos_ = 0;
+            end_ = static_cast<size_t>(n);
+            received_ += end_;
+            return 0;
+        }
+        inline int http_connection::read_line(std::string& line) {
+            line.clear();
+            for(;;) {
+                if(pos_ == end_ && fill() < 0) return -7;
+                const char* beg = &buf_[pos_];
+                const char* nl = static_cast<const char*>(memchr(beg, '\n', end_ - pos_));
+                size_t n = nl ? nl - beg : end_ - pos_;
+                line.append(beg, n);
+                pos_ += nl ? n + 1 : n;
+                if(nl) break;
+                if(line.length() > 0x10000) return -11;
+            }
+            if(!line.empty() && line.back() == '\r') line.pop_back();
+            return 0;
+        }
+        inline int http_connection::read_body(size_t n, const body_sink& sink) {
+            while(n > 0) {
+                if(pos_ == end_ && fill() < 0) return -7;
+                size_t len = std::min(n, end_ - pos_);
+                if(sink && !sink(&buf_[pos_], len)) return -13;
+                pos_ += len;
+                n -= len;
+            }
+            return 0;
+        }
+        inline int http_connection::read_until_close(const body_sink& sink) {
+            while(pos_ < end_ || fill() == 0) {
+                if(sink && !sink(&buf_[pos_], end_ - pos_)) return -13;
+                pos_ = end_;
+            }
+            return 0;
+        }
+        inline int http_connection::read_response(const char* method, const body_sink& sink, bool& keep_alive) {
+            std::string line;
+            response_head head;
+            int ret;
+
+            // 跳过100 Continue等临时响应
+            while(head.code_ / 100 <= 1) {
+                if((ret = read_line(line)) < 0 || (ret = head.parse_status(line)) < 0) return ret;
+                for(;;) {
+                    if((ret = read_line(line)) < 0) return ret;
+                    if(line.empty()) break;
+                    if((ret = head.parse_header(line)) < 0) return ret;
+                }
+            }
 
-            if(connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
-                closesocket(sock);
-                return -3;
+            keep_alive = head.keep_alive_;
+            if(!strcmp(method, "HEAD") || head.code_ == 204 || head.code_ == 304) return head.code_;
+            if(head.chunked_) {
+                for(;;) {
+                    unsigned long long n;
+                    if((ret = read_line(line)) < 0 || (ret = parse_chunk_size(line, n)) < 0) return ret;
+                    if(!n) break;
+                    if((ret = read_body(n, sink)) < 0 || (ret = read_line(line)) < 0) return ret;
+                    if(!line.empty()) return -9;
+                }
+                do {
+                    if((ret = read_line(line)) < 0) return ret;
+                } while(!line.empty());
+            } else if(head.content_length_ >= 0) {
+                if((ret = read_body(static_cast<size_t>(head.content_length_), sink)) < 0) return ret;
+            } else {
+                // 既无Content-Length也非chunked，响应体以连接关闭为界，连接不能复用
+                keep_alive = false;
+                if((ret = read_until_close(sink)) < 0) return ret;
             }
+            return head.code_;
+        }
 
-            header.resize(len = 0x100);
+        // 把请求头追加到out末尾，返回请求头长度
+        // extra_headers为若干以"\r\n"开头的头部行
+        inline size_t inner::format_header(std::string& out, const char* method, const char* uri, const std::string& querystring, size_t body_length, const server_info& si, bool keep_alive, const char* extra_headers) {
+            size_t base = out.length();
+            int len = 0x100, n;
 
             for(;;) {
-                iv[0].iov_len = snprintf(&header[0], len, 
-                    "%s /%s?db=%s%s%s%s%s%s%s%s HTTP/1.1\r\nHost: %s%s%s\r\nContent-Length: %d\r\n\r\n", 
+                out.resize(base + len);
+                n = snprintf(&out[base], len, 
+                    "%s /%s?db=%s%s%s%s%s%s%s%s HTTP/1.1\r\nHost: %s%s%s\r\nContent-Length: %zu%s%s\r\n\r\n", 
                     method, uri, si.db_.c_str(), !si.token_.empty() ? "" : "&u=", !si.token_.empty() ? "" : si.usr_.c_str(), !si.token_.empty() ? "" : "&p=", !si.token_.empty() ? "" : si.pwd_.c_str(),
-                    strcmp(uri, "write") ? "&epoch=" : "&precision=", si.precision_.c_str(), querystring.c_str(), si.host_.c_str(), si.token_.empty() ? "" : "\r\nAuthorization: Token ", si.token_.c_str(), (int)body.length());
-                if(static_cast<int>(iv[0].iov_len) >= len)
-                    header.resize(len *= 2);
+                    strcmp(uri, "write") ? "&epoch=" : "&precision=", si.precision_.c_str(), querystring.c_str(), si.host_.c_str(), si.token_.empty() ? "" : "\r\nAuthorization: Token ", si.token_.c_str(), body_length,
+                    keep_alive ? "" : "\r\nConnection: close", extra_headers ? extra_headers : "");
+                if(n >= len)
+                    len *= 2;
                 else
                     break;
             }
-            iv[0].iov_base = &header[0];
-            iv[1].iov_base = const_cast<char*>(&body[0]);
-            iv[1].iov_len = body.length();
+            out.resize(base + n);
+            return n;
+        }
 
-            if(writev(sock, iv, 2) < static_cast<int>(iv[0].iov_len + iv[1].iov_len)) {
-                ret_code = -6;
-                goto END;
+        // 压缩上下文按线程复用；返回0，失败返回-5
+        inline int inner::compress_body(std::string_view src, content_encoding encoding, int level, std::string& out) {
+            if(encoding == ENCODING_ZSTD) {
+                thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+                if(!cctx || ZSTD_isError(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, level))) return -5;
+                out.resize(ZSTD_compressBound(src.length()));
+                size_t n = ZSTD_compress2(cctx.get(), &out[0], out.length(), src.data(), src.length());
+                if(ZSTD_isError(n)) return -5;
+                out.resize(n);
+                return 0;
             }
+            if(encoding == ENCODING_GZIP) {
+                struct gzip_stream {
+                    z_stream zs;
+                    int level = INT_MIN;
+                    gzip_stream() { memset(&zs, 0, sizeof(zs)); }
+                    ~gzip_stream() { if(level != INT_MIN) deflateEnd(&zs); }
+                };
+                thread_local gzip_stream gz;
+                int zlevel = level ? level : Z_DEFAULT_COMPRESSION;
+                if(gz.level != zlevel) {
+                    if(gz.level != INT_MIN) deflateEnd(&gz.zs);
+                    gz.level = INT_MIN;
+                    // windowBits加16输出gzip头和尾
+                    if(deflateInit2(&gz.zs, zlevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -5;
+                    gz.level = zlevel;
+                } else if(deflateReset(&gz.zs) != Z_OK) {
+                    return -5;
+                }
+                out.resize(deflateBound(&gz.zs, src.length()));
+                gz.zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src.data()));
+                gz.zs.avail_in = static_cast<uInt>(src.length());
+                gz.zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+                gz.zs.avail_out = static_cast<uInt>(out.length());
+                if(deflate(&gz.zs, Z_FINISH) != Z_STREAM_END) return -5;
+                out.resize(gz.zs.total_out);
+                return 0;
+            }
+            out.assign(src.data(), src.length());
+            return 0;
+        }
 
-            iv[0].iov_len = len;
-
-#define _NO_MORE() (len >= static_cast<int>(iv[0].iov_len) && \
-    (iv[0].iov_len = recv(sock, &header[0], header.length(), len = 0)) == static_cast<size_t>(-1))
-#define _GET_NEXT_CHAR() (ch = _NO_MORE() ? 0 : header[len++])
-#define _LOOP_NEXT(statement) for(;;) { if(!(_GET_NEXT_CHAR())) { ret_code = -7; goto END; } statement }
-#define _UNTIL(c) _LOOP_NEXT( if(ch == c) break; )
-#define _GET_NUMBER(n) _LOOP_NEXT( if(ch >= '0' && ch <= '9') n = n * 10 + (ch - '0'); else break; )
-#define _GET_CHUNKED_LEN(n, c) _LOOP_NEXT( if(ch >= '0' && ch <= '9') n = n * 16 + (ch - '0'); \
-            else if(ch >= 'A' && ch <= 'F') n = n * 16 + (ch - 'A') + 10; \
-            else if(ch >= 'a' && ch <= 'f') n = n * 16 + (ch - 'a') + 10; else {if(ch != c) { ret_code = -8; goto END; } break;} )
-#define _(c) if((_GET_NEXT_CHAR()) != c) break;
-#define __(c) if((_GET_NEXT_CHAR()) != c) { ret_code = -9; goto END; }
-
+        inline int inner::http_request(const char* method, const char* uri,
+            const std::string& querystring, const std::string& body, const server_info& si, std::string* resp, unsigned timeout_sec) {
             if(resp) resp->clear();
+            return http_request(method, uri, querystring, body, si, resp ? body_sink([resp](const char* p, size_t n) { resp->append(p, n); return true; }) : body_sink(), timeout_sec);
+        }
 
-            _UNTIL(' ')_GET_NUMBER(ret_code)
-            for(;;) {
-                _UNTIL('\n')
-                switch(_GET_NEXT_CHAR()) {
-                    case 'C':_('o')_('n')_('t')_('e')_('n')_('t')_('-')
-                        _('L')_('e')_('n')_('g')_('t')_('h')_(':')_(' ')
-                        _GET_NUMBER(content_length)
-                        break;
-                    case 'T':_('r')_('a')_('n')_('s')_('f')_('e')_('r')_('-')
-                        _('E')_('n')_('c')_('o')_('d')_('i')_('n')_('g')_(':')
-                        _(' ')_('c')_('h')_('u')_('n')_('k')_('e')_('d')
-                        chunked = 1;
-                        break;
-                    case '\r':__('\n')
-                        switch(chunked) {
-                            do {__('\r')__('\n')
-                            case 1:
-                                _GET_CHUNKED_LEN(content_length, '\r')__('\n')
-                                if(!content_length) {
-                                    __('\r')__('\n')
-                                    goto END;
-                                }
-                            case 0:
-                                while(content_length > 0 && !_NO_MORE()) {
-                                    content_length -= (iv[1].iov_len = std::min(content_length, static_cast<int>(iv[0].iov_len) - len));
-                                    if(resp) resp->append(&header[len], iv[1].iov_len);
-                                    len += iv[1].iov_len;
-                                }
-                            } while(chunked);
-                        }
-                        goto END;
+        inline int inner::http_request(const char* method, const char* uri,
+            const std::string& querystring, std::string_view body, const server_info& si, const body_sink& sink, unsigned timeout_sec, const char* extra_headers) {
+            thread_local std::string compressed;
+            std::string_view payload = body;
+            std::string header, extra(extra_headers ? extra_headers : "");
+            int ret_code = 0;
+            bool keep_alive = true, reused = false;
+
+            // 直接从调用方的缓冲区压缩到线程内复用的缓冲区
+            if(si.encoding_ != ENCODING_IDENTITY && !body.empty()) {
+                if(compress_body(body, si.encoding_, si.compression_level_, compressed) < 0) return -5;
+                payload = compressed;
+                extra = extra + "\r\nContent-Encoding: " + encoding_name(si.encoding_);
+            }
+            size_t header_len = format_header(header, method, uri, querystring, payload.length(), si, static_cast<bool>(si.pool_), extra.c_str());
+
+            // 复用的空闲连接可能刚被服务端关闭，没有收到任何响应字节（响应体也尚未交给sink）时丢弃空闲连接，用新连接重试一次
+            for(int attempt = 0; attempt < 2; attempt++) {
+                std::unique_ptr<http_connection> conn;
+                if(si.pool_) {
+                    conn = si.pool_->acquire(si, timeout_sec, ret_code, reused);
+                } else {
+                    conn.reset(new http_connection());
+                    if((ret_code = conn->open(si, timeout_sec)) < 0) conn.reset();
                 }
-                if(!ch) {
-                    ret_code = -10;
-                    goto END;
+                if(!conn) break;
+
+                conn->received_ = 0;
+                if((ret_code = conn->send(&header[0], header_len, payload)) == 0)
+                    ret_code = conn->read_response(method, sink, keep_alive);
+                if(ret_code >= 0) {
+                    if(si.pool_ && keep_alive) si.pool_->release(std::move(conn));
+                    break;
                 }
+                if(!reused || conn->received_ > 0) break;
+                si.pool_->clear();
             }
-            ret_code = -11;
-        END:
-            closesocket(sock);
             return ret_code / 100 == 2 ? 0 : ret_code;
-#undef _NO_MORE
-#undef _GET_NEXT_CHAR
-#undef _LOOP_NEXT
-#undef _UNTIL
-#undef _GET_NUMBER
-#undef _GET_CHUNKED_LEN
-#undef _
-#undef __
         }
     }
 
+    inline std::unique_ptr<detail::http_connection> connection_pool::acquire(const server_info& si, unsigned timeout_sec, int& err, bool& reused) {
+        std::unique_ptr<detail::http_connection> conn;
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            // 后进先出，最近用过的连接最可能仍然存活
+            while(!idle_.empty()) {
+                conn = std::move(idle_.back());
+                idle_.pop_back();
+                if(now - conn->idle_since_ < std::chrono::seconds(idle_timeout_sec_) && conn->healthy())
+                    break;
+                conn.reset();
+            }
+            ++(conn ? reuses_ : connects_);
+        }
+        err = 0;
+        reused = static_cast<bool>(conn);
+        if(conn) {
+            if((err = conn->set_timeout(timeout_sec)) < 0) conn.reset();
+            return conn;
+        }
+        conn.reset(new detail::http_connection());
+        if((err = conn->open(si, timeout_sec)) < 0) conn.reset();
+        return conn;
+    }
+    inline void connection_pool::release(std::unique_ptr<detail::http_connection> conn) {
+        conn->idle_since_ = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mtx_);
+        if(idle_.size() < max_idle_) idle_.push_back(std::move(conn));
+    }
+
+    // 数据报负载上限：以太网MTU 1500扣除IP/UDP头后取1400，巨帧（MTU 9000）可取8900
+    static constexpr size_t UDP_PAYLOAD_BYTES = 1400;
+    static constexpr size_t UDP_MAX_PAYLOAD_BYTES = 65507;
+
+    struct udp_stats {
+        size_t packets_ = 0;        // 成功发送的数据报
+        size_t bytes_ = 0;          // 成功发送的负载字节
+        size_t send_errors_ = 0;    // 发送失败的数据报
+        size_t zero_sends_ = 0;     // sendmmsg返回0、一条也没发出的次数，跳过的数据报计入send_errors_，不设置errno
+        int last_errno_ = 0;
+        void add(const udp_stats& o) {
+            packets_ += o.packets_;
+            bytes_ += o.bytes_;
+            send_errors_ += o.send_errors_;
+            zero_sends_ += o.zero_sends_;
+            if(o.last_errno_) last_errno_ = o.last_errno_;
+        }
+    };
+
+    // 按字节预算把行打包成数据报，每攒满一批由一次sendmmsg交给内核
     struct tsdb_entry {
-        tsdb_entry(const std::string& host, int port) : host_(host), port_(port) {
+        static constexpr size_t MAX_BATCH_PACKETS = 64;
+
+        tsdb_entry(const std::string& host, int port, size_t packet_bytes = UDP_PAYLOAD_BYTES) : host_(host), port_(port), builder_(MAX_BATCH_PACKETS * 0x800) {
+            set_packet_bytes(packet_bytes);
             addr.sin_family = AF_INET;
             addr.sin_port = htons(port);
             if((addr.sin_addr.s_addr = inet_addr(host.c_str())) == INADDR_NONE) {
-                cout << "socket:" << -1 << endl;
-            }
-
-            if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-                cout << "socket:" << -2 << endl;
+                error_ = -1;
+                return;
             }
+            if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) error_ = -2;
         }
+        ~tsdb_entry() { close(); }
+        tsdb_entry(const tsdb_entry&) = delete;
+        tsdb_entry& operator=(const tsdb_entry&) = delete;
 
         inline void close() {
-            ::close(sock);
+            if(sock >= 0) ::closesocket(sock);
+            sock = -1;
         }
 
+        inline void set_packet_bytes(size_t packet_bytes) { packet_bytes_ = std::min(std::max<size_t>(packet_bytes, 1), UDP_MAX_PAYLOAD_BYTES); }
+        inline size_t packet_bytes() const                { return packet_bytes_; }
+        inline int error() const                          { return error_; }
+        inline const udp_stats& last_batch() const        { return last_batch_; }
+        inline const udp_stats& totals() const            { return totals_; }
+
+        // 返回0；构造时地址或套接字无效返回-1/-2；有数据报发送失败返回-4，计数见last_batch()
         inline int insert_points(const std::vector<point>& points) {
-            std::string mea = "datas";
-            tsdb_data_builder tsdb_data_builder;
-            size_t i;
-            for(i=0;i<points.size();i++) {
-                if(i%points_count_per_package==0) {
-                    if(i>0) {
-                        int size = tsdb_data_builder.send_udp(sock, addr); 
-                        if(size<=0)cout << "send size:" << size << std::endl;
+            if(error_) return error_;
+            last_batch_ = udp_stats();
+            for(const auto& p : points) append(p);
+            return flush();
+        }
+
+        inline int insert_point(const point& point) {
+            if(error_) return error_;
+            last_batch_ = udp_stats();
+            append(point);
+            return flush();
+        }
+
+        // 已格式化的行协议文本，按行切分打包，不经过内部缓冲
+        inline int insert_lines(std::string_view lines) {
+            if(error_) return error_;
+            last_batch_ = udp_stats();
+            pack(lines);
+            totals_.add(last_batch_);
+            return last_batch_.send_errors_ ? -4 : 0;
+        }
+
+        // 一个序列的时间戳和值数组，每次格式化COLUMN_CHUNK个点到复用的缓冲后打包发送
+        template <typename T>
+        int insert_columns(std::string_view m, const tag_list& tags, std::string_view field_key,
+                           const long long* timestamps, const T* values, size_t n) {
+            if(error_) return error_;
+            last_batch_ = udp_stats();
+            for(size_t beg = 0; beg < n; beg += COLUMN_CHUNK) {
+                builder_.clear();
+                builder_.columns(m, tags, field_key, timestamps + beg, values + beg, std::min(COLUMN_CHUNK, n - beg));
+                pack(builder_.view());
+            }
+            builder_.clear();
+            totals_.add(last_batch_);
+            return last_batch_.send_errors_ ? -4 : 0;
+        }
+    protected:
+        static constexpr size_t COLUMN_CHUNK = 4096;
+
+        void pack(std::string_view lines) {
+            size_t packet_start = 0, first = 0;
+            for(size_t line_start = 0; line_start < lines.length();) {
+                size_t next = lines.find('\n', line_start + 1);
+                if(next == std::string_view::npos) next = lines.length();
+                if(next - packet_start > packet_bytes_ && line_start > packet_start) {
+                    packet_ends_.push_back(line_start);
+                    packet_start = line_start;
+                    if(packet_ends_.size() == MAX_BATCH_PACKETS) {
+                        send_packets(lines.data(), first);
+                        first = packet_start;
                     }
-                    tsdb_data_builder.clear();
                 }
-                tsdb_data_builder.meas(mea)
-                .tag("pointName", points[i].name_)
-                .field("value", points[i].value_)
-                .timestamp( points[i].nanoseconds_);
+                line_start = next;
             }
-            if(i%points_count_per_package!=0) {
-                int size = tsdb_data_builder.send_udp(sock, addr); 
-                if(size<=0)cout << "send size:" << size << std::endl;
+            if(lines.length() > packet_start) packet_ends_.push_back(lines.length());
+            send_packets(lines.data(), first);
+        }
+        void append(const point& p) {
+            size_t line_start = builder_.view().length();
+            builder_.meas("datas")
+            .tag("pointName", p.name_)
+            .field("value", p.value_)
+            .timestamp(p.nanoseconds_);
+            // 加入新行超出预算时在新行之前切分；单行超出预算时独占一个数据报
+            if(builder_.view().length() - packet_start_ > packet_bytes_ && line_start > packet_start_) {
+                packet_ends_.push_back(line_start);
+                packet_start_ = line_start;
+                if(packet_ends_.size() == MAX_BATCH_PACKETS) {
+                    send_packets(builder_.view().data(), 0);
+                    builder_.erase_front(packet_start_);
+                    packet_start_ = 0;
+                }
             }
-            return 0;
         }
-
-        inline int insert_point(const point& point) {
-            std::string mea = "datas";
-            tsdb_data_builder tsdb_data_builder;
-
-            tsdb_data_builder.meas(mea)
-            .tag("pointName", point.name_)
-            .field("value", point.value_)
-            .timestamp(point.nanoseconds_);
-            int size = tsdb_data_builder.send_udp(sock, addr); 
-            if(size<=0)cout << "send size:" << size << std::endl;
-            return 0;
+        int flush() {
+            if(builder_.view().length() > packet_start_) packet_ends_.push_back(builder_.view().length());
+            send_packets(builder_.view().data(), 0);
+            builder_.clear();
+            packet_start_ = 0;
+            totals_.add(last_batch_);
+            return last_batch_.send_errors_ ? -4 : 0;
         }
-    protected:
-        int sock;
+        // packet_ends_为相对base的各数据报末尾，第一个数据报从beg开始
+        void send_packets(const char* base, size_t beg) {
+            size_t n = packet_ends_.size();
+            iovs_.resize(n);
+            for(size_t i = 0; i < n; i++) {
+                iovs_[i].iov_base = const_cast<char*>(base + beg);
+                iovs_[i].iov_len = packet_ends_[i] - beg;
+                beg = packet_ends_[i];
+            }
+#ifdef __linux__
+            msgs_.resize(n);
+            for(size_t i = 0; i < n; i++) {
+                memset(&msgs_[i], 0, sizeof(msgs_[i]));
+                msgs_[i].msg_hdr.msg_name = &addr;
+                msgs_[i].msg_hdr.msg_namelen = sizeof(addr);
+                msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+                msgs_[i].msg_hdr.msg_iovlen = 1;
+            }
+            for(size_t sent = 0; sent < n;) {
+                int r = sendmmsg(sock, &msgs_[sent], static_cast<unsigned>(n - sent), 0);
+                if(r < 0 && errno == EINTR) continue;
+                // 只有第一条数据报失败时sendmmsg才返回错误，记录后跳过这一条；
+                // 返回0时errno没有被设置，只计数，同样跳过这一条以免原地重试
+                if(r <= 0) {
+                    last_batch_.send_errors_++;
+                    if(r < 0) last_batch_.last_errno_ = errno;
+                    else last_batch_.zero_sends_++;
+                    sent++;
+                    continue;
+                }
+                for(size_t i = sent; i < sent + r; i++) last_batch_.bytes_ += msgs_[i].msg_len;
+                last_batch_.packets_ += r;
+                sent += r;
+            }
+#else
+            for(size_t i = 0; i < n; i++) {
+                long long r = sendto(sock, static_cast<const char*>(iovs_[i].iov_base), iovs_[i].iov_len, 0, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+                if(r < 0) {
+                    last_batch_.send_errors_++;
+                    last_batch_.last_errno_ = errno;
+                } else {
+                    last_batch_.packets_++;
+                    last_batch_.bytes_ += r;
+                }
+            }
+#endif
+            packet_ends_.clear();
+        }
+
+        int sock = -1;
         struct sockaddr_in addr;
-        const std::string& host_;
+        std::string host_;
         int port_;
-        int points_count_per_package = 30;
+        int error_ = 0;
+        size_t packet_bytes_ = UDP_PAYLOAD_BYTES;
+        tsdb_data_builder builder_;
+        size_t packet_start_ = 0;
+        std::vector<size_t> packet_ends_;
+        std::vector<struct iovec> iovs_;
+#ifdef __linux__
+        std::vector<struct mmsghdr> msgs_;
+#endif
+        udp_stats last_batch_, totals_;
     };
-
 }
 
 #endif // TSDB_CPP_HPP
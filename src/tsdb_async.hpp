@@ -0,0 +1,424 @@
+// asynchronous pipelined write client of tsdb_cpp (linux only)
+#ifndef TSDB_ASYNC_HPP
+#define TSDB_ASYNC_HPP
+
+#include "tsdb.hpp"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace tsdb_cpp {
+    namespace detail {
+        // 增量解析HTTP/1.1响应，字节可按任意边界到达，每解析完一个响应调用一次on_response(code, keep_alive)
+        struct http_response_parser {
+            enum state_t { STATUS, HEADER, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER, UNTIL_CLOSE };
+
+            // 返回0，格式错误返回负数
+            template <typename F>
+            int feed(const char* p, size_t n, F&& on_response) {
+                const char* end = p + n;
+                while(p < end) {
+                    if(state_ == BODY || state_ == CHUNK_DATA) {
+                        size_t len = static_cast<size_t>(std::min<unsigned long long>(remaining_, end - p));
+                        p += len;
+                        if(!(remaining_ -= len)) {
+                            if(state_ == BODY) complete(on_response);
+                            else state_ = CHUNK_END;
+                        }
+                        continue;
+                    }
+                    if(state_ == UNTIL_CLOSE) break;
+                    const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+                    size_t len = nl ? nl - p : end - p;
+                    if(line_.length() + len > 0x10000) return -11;
+                    line_.append(p, len);
+                    p += nl ? len + 1 : len;
+                    if(!nl) break;
+                    if(!line_.empty() && line_.back() == '\r') line_.pop_back();
+                    int ret = on_line(on_response);
+                    line_.clear();
+                    if(ret < 0) return ret;
+                }
+                return 0;
+            }
+
+            // 连接关闭时调用，以关闭为界的响应在此完成
+            template <typename F>
+            bool finish(F&& on_response) {
+                if(state_ != UNTIL_CLOSE) return false;
+                head_.keep_alive_ = false;
+                complete(on_response);
+                return true;
+            }
+
+            void reset() {
+                state_ = STATUS;
+                line_.clear();
+            }
+        private:
+            template <typename F>
+            int on_line(F& on_response) {
+                int ret = 0;
+                switch(state_) {
+                    case STATUS:
+                        if((ret = head_.parse_status(line_)) == 0) state_ = HEADER;
+                        break;
+                    case HEADER:
+                        if(!line_.empty())
+                            ret = head_.parse_header(line_);
+                        else if(head_.code_ / 100 == 1)
+                            state_ = STATUS;
+                        else if(head_.code_ == 204 || head_.code_ == 304 || (!head_.chunked_ && head_.content_length_ == 0))
+                            complete(on_response);
+                        else if(head_.chunked_)
+                            state_ = CHUNK_SIZE;
+                        else if(head_.content_length_ > 0) {
+                            remaining_ = head_.content_length_;
+                            state_ = BODY;
+                        } else
+                            state_ = UNTIL_CLOSE;
+                        break;
+                    case CHUNK_SIZE:
+                        if((ret = parse_chunk_size(line_, remaining_)) == 0) state_ = remaining_ ? CHUNK_DATA : TRAILER;
+                        break;
+                    case CHUNK_END:
+                        if(!line_.empty()) ret = -9;
+                        state_ = CHUNK_SIZE;
+                        break;
+                    case TRAILER:
+                        if(line_.empty()) complete(on_response);
+                        break;
+                    default:
+                        break;
+                }
+                return ret;
+            }
+            template <typename F>
+            void complete(F& on_response) {
+                state_ = STATUS;
+                on_response(head_.code_, head_.keep_alive_);
+            }
+
+            state_t state_ = STATUS;
+            std::string line_;
+            response_head head_;
+            unsigned long long remaining_ = 0;
+        };
+    }
+
+    // 单个epoll事件循环驱动的异步写入客户端。写入请求进入队列，在若干条keep-alive连接上流水线发送，
+    // 收到应答后完成future或回调；回调在事件循环线程中执行，不应阻塞。
+    // 完成值与post_http的返回值相同，另外-12表示客户端已停止或事件循环创建失败
+    struct async_client {
+        typedef std::function<void(int)> callback;
+
+        /**
+         * @param connections 最多使用的连接数
+         * @param pipeline_depth 每条连接上已发送未应答的请求数上限
+         * @param timeout_sec 最早的未应答请求超过该时长时断开连接，0表示不超时
+         */
+        async_client(const server_info& si, size_t connections = 4, size_t pipeline_depth = 16, unsigned timeout_sec = 0)
+            : si_(si), pipeline_depth_(std::max<size_t>(pipeline_depth, 1)), timeout_sec_(timeout_sec), conns_(std::max<size_t>(connections, 1)),
+              encoding_header_(std::string("\r\nContent-Encoding: ") + detail::inner::encoding_name(si.encoding_)) {
+            if((epfd_ = epoll_create1(EPOLL_CLOEXEC)) < 0 || (wakefd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) return;
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = WAKE;
+            if(epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev) < 0) return;
+            running_ = true;
+            loop_ = std::thread([this]() { run(); });
+        }
+        ~async_client() {
+            stop();
+            if(wakefd_ >= 0) ::close(wakefd_);
+            if(epfd_ >= 0) ::close(epfd_);
+        }
+        async_client(const async_client&) = delete;
+        async_client& operator=(const async_client&) = delete;
+
+        // 配置了Content-Encoding时在调用线程压缩，压缩开销分摊到各提交线程
+        void post(std::string body, callback cb) {
+            if(si_.encoding_ != ENCODING_IDENTITY && !body.empty()) {
+                thread_local std::string compressed;
+                if(detail::inner::compress_body(body, si_.encoding_, si_.compression_level_, compressed) < 0) {
+                    if(cb) cb(-5);
+                    return;
+                }
+                body.swap(compressed);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if(running_ && !stopping_) {
+                    submitted_.push_back(request { std::move(body), std::move(cb) });
+                    pending_++;
+                    cb = nullptr;
+                }
+            }
+            if(cb) {
+                cb(-12);
+                return;
+            }
+            wake();
+        }
+        std::future<int> post(std::string body) {
+            auto promise = std::make_shared<std::promise<int>>();
+            std::future<int> result = promise->get_future();
+            post(std::move(body), [promise](int ret) { promise->set_value(ret); });
+            return result;
+        }
+        std::future<int> post(const tsdb_data_builder& builder) {
+            return post(std::string(builder.view()));
+        }
+
+        // 等待已提交的请求全部完成后停止事件循环
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if(!running_ || stopping_) return;
+                stopping_ = true;
+            }
+            wake();
+            loop_.join();
+        }
+
+        // 已提交但尚未完成的请求数
+        size_t pending() const { return pending_.load(); }
+    private:
+        static constexpr uint64_t WAKE = ~0ull;
+
+        struct request {
+            std::string body;
+            callback cb;
+        };
+        struct connection {
+            int fd = -1;
+            bool connecting = false;
+            bool failed = false;
+            bool want_write = false;
+            std::string out;
+            size_t out_pos = 0;
+            // 已写入out、等待应答的请求，与应答一一按序对应
+            std::deque<std::pair<callback, std::chrono::steady_clock::time_point>> inflight;
+            detail::http_response_parser parser;
+        };
+
+        void wake() {
+            uint64_t one = 1;
+            ssize_t r = ::write(wakefd_, &one, sizeof(one));
+            (void)r;
+        }
+
+        void complete(callback& cb, int code) {
+            pending_--;
+            if(cb) cb(code / 100 == 2 ? 0 : code);
+        }
+
+        void run() {
+            struct epoll_event events[64];
+            for(;;) {
+                int n = epoll_wait(epfd_, events, 64, 100);
+                for(int i = 0; i < n; i++) {
+                    if(events[i].data.u64 == WAKE) {
+                        uint64_t v;
+                        ssize_t r = ::read(wakefd_, &v, sizeof(v));
+                        (void)r;
+                        continue;
+                    }
+                    connection& c = conns_[events[i].data.u64];
+                    if(c.fd < 0) continue;
+                    if(c.connecting && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && !finish_connect(c)) continue;
+                    if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) on_readable(c);
+                    if(c.fd >= 0 && (events[i].events & EPOLLOUT)) flush(c);
+                }
+
+                bool stopping;
+                {
+                    std::lock_guard<std::mutex> lock(mtx_);
+                    for(auto& r : submitted_) queue_.push_back(std::move(r));
+                    submitted_.clear();
+                    stopping = stopping_;
+                }
+                check_timeouts();
+                dispatch();
+
+                if(stopping && queue_.empty() && std::all_of(conns_.begin(), conns_.end(), [](const connection& c) { return c.inflight.empty(); }))
+                    break;
+            }
+            for(auto& c : conns_) close(c, -12);
+            std::lock_guard<std::mutex> lock(mtx_);
+            running_ = false;
+        }
+
+        // 把队列中的请求轮流分配给还有流水线余量的连接
+        void dispatch() {
+            bool assigned = true;
+            while(!queue_.empty() && assigned) {
+                assigned = false;
+                for(auto& c : conns_) {
+                    if(queue_.empty()) break;
+                    if(c.inflight.size() >= pipeline_depth_) continue;
+                    if(c.fd < 0 && !open(c)) {
+                        // 无法创建套接字时队列中的请求全部失败，避免future永远等待
+                        while(!queue_.empty()) {
+                            complete(queue_.front().cb, -2);
+                            queue_.pop_front();
+                        }
+                        return;
+                    }
+                    request& r = queue_.front();
+                    detail::inner::format_header(c.out, "POST", "write", "", r.body.length(), si_, true,
+                        si_.encoding_ != ENCODING_IDENTITY && !r.body.empty() ? encoding_header_.c_str() : NULL);
+                    c.out += r.body;
+                    c.inflight.emplace_back(std::move(r.cb), std::chrono::steady_clock::now());
+                    queue_.pop_front();
+                    assigned = true;
+                }
+            }
+            for(auto& c : conns_) {
+                if(c.fd >= 0 && c.failed)
+                    close(c, -3);
+                else if(c.fd >= 0 && !c.connecting && c.out_pos < c.out.length())
+                    flush(c);
+            }
+        }
+
+        bool open(connection& c) {
+            struct sockaddr_in addr;
+            int one = 1;
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(si_.port_);
+            if((addr.sin_addr.s_addr = inet_addr(si_.host_.c_str())) == INADDR_NONE) return false;
+            if((c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) return false;
+            setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            c.connecting = true;
+            c.want_write = true;
+            c.parser.reset();
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT;
+            ev.data.u64 = &c - &conns_[0];
+            epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+            // 立即失败的连接在分配完请求后以-3关闭
+            c.failed = connect(c.fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS;
+            return true;
+        }
+
+        bool finish_connect(connection& c) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if(getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+                close(c, -3);
+                return false;
+            }
+            c.connecting = false;
+            return true;
+        }
+
+        void flush(connection& c) {
+            if(c.connecting) return;
+            while(c.out_pos < c.out.length()) {
+                ssize_t n = ::send(c.fd, c.out.data() + c.out_pos, c.out.length() - c.out_pos, MSG_NOSIGNAL);
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                if(n <= 0) {
+                    close(c, -6);
+                    return;
+                }
+                c.out_pos += n;
+            }
+            if(c.out_pos == c.out.length()) {
+                c.out.clear();
+                c.out_pos = 0;
+            }
+            set_want_write(c, !c.out.empty());
+        }
+
+        void set_want_write(connection& c, bool want) {
+            if(c.want_write == want) return;
+            struct epoll_event ev;
+            ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+            ev.data.u64 = &c - &conns_[0];
+            epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+            c.want_write = want;
+        }
+
+        void on_readable(connection& c) {
+            char buf[0x4000];
+            bool closing = false;
+            auto on_response = [&](int code, bool keep_alive) {
+                if(c.inflight.empty()) {
+                    closing = true;
+                    return;
+                }
+                complete(c.inflight.front().first, code);
+                c.inflight.pop_front();
+                closing = closing || !keep_alive;
+            };
+            for(;;) {
+                ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                if(n <= 0) {
+                    c.parser.finish(on_response);
+                    close(c, -7);
+                    return;
+                }
+                int ret = c.parser.feed(buf, n, on_response);
+                if(ret < 0) {
+                    close(c, ret);
+                    return;
+                }
+                // 服务端声明关闭连接后，之后流水线上的请求不会再得到应答
+                if(closing) {
+                    close(c, -7);
+                    return;
+                }
+            }
+        }
+
+        void check_timeouts() {
+            if(!timeout_sec_) return;
+            auto now = std::chrono::steady_clock::now();
+            for(auto& c : conns_) {
+                if(c.fd >= 0 && !c.inflight.empty() && now - c.inflight.front().second > std::chrono::seconds(timeout_sec_))
+                    close(c, -7);
+            }
+        }
+
+        // 关闭连接，已发送未应答的请求以code完成
+        void close(connection& c, int code) {
+            if(c.fd >= 0) ::close(c.fd);
+            c.fd = -1;
+            c.connecting = false;
+            c.failed = false;
+            c.want_write = false;
+            c.out.clear();
+            c.out_pos = 0;
+            c.parser.reset();
+            for(auto& r : c.inflight) complete(r.first, code);
+            c.inflight.clear();
+        }
+
+        server_info si_;
+        size_t pipeline_depth_;
+        unsigned timeout_sec_;
+        std::vector<connection> conns_;
+        std::deque<request> queue_;     // 只由事件循环访问
+        std::string encoding_header_;
+
+        int epfd_ = -1;
+        int wakefd_ = -1;
+        std::thread loop_;
+        mutable std::mutex mtx_;
+        std::vector<request> submitted_;
+        bool running_ = false;
+        bool stopping_ = false;
+        std::atomic<size_t> pending_ { 0 };
+    };
+}
+
+#endif // TSDB_ASYNC_HPP
@@ -3,31 +3,55 @@
 #define TSDB_HF_CPP_HPP
 
 #include "../utils/ArgParser.hpp"
+#include "../utils/Metrics.hpp"
 #include "../utils/Utils.hpp"
+#include "tsdb_hf_codec.hpp"
+#include "tsdb_hf_kernels.hpp"
+#include "tsdb_hf_sketch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
+#include <numeric>
 #include <ostream>
+#include <queue>
 #include <sched.h>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
 #include <unistd.h>
 #include <utility>
 #include <vector>
+#include <zlib.h>
 #include <zstd.h>
 
 namespace tsdb_hf_cpp {
 
-struct point {
+template <typename T>
+struct basic_point {
     const std::string name_;
-    double value_;
+    T value_;
     long long nanoseconds_;
-    point(const std::string& name, double value, long long nanoseconds)
+    basic_point(const std::string& name, T value, long long nanoseconds)
         : name_(name)
         , value_(value)
         , nanoseconds_(nanoseconds)
@@ -35,239 +59,2331 @@ struct point {
     }
 };
 
+using point = basic_point<double>;
+
+// 多字段流中第2个及之后字段的值列
+struct FieldColumn {
+    size_t valuesSize;
+    Encoding valueEncoding;
+    size_t nullCount = 0;
+    size_t sketchSize = 0;
+    double minValue = -std::numeric_limits<double>::infinity();
+    double maxValue = std::numeric_limits<double>::infinity();
+};
+
+// 一个块是一次压缩的最小单位，时间戳列和值列分别压缩为同一序号的两个文件；多字段流的每个字段各有一个值列文件，共用时间戳列
+struct Block {
+    size_t index;
+    size_t count;
+    long long minTimestamp;
+    long long maxTimestamp;
+    size_t timestampsSize;
+    size_t valuesSize;
+    Encoding timestampEncoding;
+    Encoding valueEncoding;
+    // 溢出块保存早于已封存数据的迟到点，时间范围可能与普通块重叠
+    bool overflow;
+    // 有空值的值列文件以有效性位图开头，其后只编码非空值
+    size_t nullCount = 0;
+    // 分位数草图文件压缩后的大小，为0表示该块没有草图
+    size_t sketchSize = 0;
+    // 非空值的下界和上界，扫描时据此跳过整块；未知时为±inf
+    double minValue = -std::numeric_limits<double>::infinity();
+    double maxValue = std::numeric_limits<double>::infinity();
+    // 第1个字段沿用valuesSize、valueEncoding、nullCount、sketchSize和值域
+    std::vector<FieldColumn> extraFields;
+
+    nlohmann::json to_json() const
+    {
+        nlohmann::json j = { { "index", index }, { "count", count }, { "minTimestamp", minTimestamp }, { "maxTimestamp", maxTimestamp },
+            { "timestampsSize", timestampsSize }, { "valuesSize", valuesSize }, { "timestampEncoding", encodingName(timestampEncoding) },
+            { "valueEncoding", encodingName(valueEncoding) }, { "overflow", overflow } };
+        if (nullCount)
+            j["nullCount"] = nullCount;
+        if (sketchSize)
+            j["sketchSize"] = sketchSize;
+        putValueRange(j, minValue, maxValue);
+        for (const auto& field : extraFields) {
+            nlohmann::json f = { { "valuesSize", field.valuesSize }, { "valueEncoding", encodingName(field.valueEncoding) } };
+            if (field.nullCount)
+                f["nullCount"] = field.nullCount;
+            if (field.sketchSize)
+                f["sketchSize"] = field.sketchSize;
+            putValueRange(f, field.minValue, field.maxValue);
+            j["fields"].push_back(f);
+        }
+        return j;
+    }
+
+    size_t fieldValuesSize(size_t field) const
+    {
+        return field == 0 ? valuesSize : extraFields[field - 1].valuesSize;
+    }
+
+    Encoding fieldValueEncoding(size_t field) const
+    {
+        return field == 0 ? valueEncoding : extraFields[field - 1].valueEncoding;
+    }
+
+    size_t fieldNullCount(size_t field) const
+    {
+        return field == 0 ? nullCount : extraFields[field - 1].nullCount;
+    }
+
+    size_t fieldSketchSize(size_t field) const
+    {
+        return field == 0 ? sketchSize : extraFields[field - 1].sketchSize;
+    }
+
+    double fieldMinValue(size_t field) const
+    {
+        return field == 0 ? minValue : extraFields[field - 1].minValue;
+    }
+
+    double fieldMaxValue(size_t field) const
+    {
+        return field == 0 ? maxValue : extraFields[field - 1].maxValue;
+    }
+
+    // json不能表示inf，只写出有限的界
+    static void putValueRange(nlohmann::json& j, double min, double max)
+    {
+        if (std::isfinite(min))
+            j["minValue"] = min;
+        if (std::isfinite(max))
+            j["maxValue"] = max;
+    }
+
+    static Block from_json(const nlohmann::json& j, Encoding defaultValueEncoding)
+    {
+        Block block;
+        block.index = j.at("index").get<size_t>();
+        block.count = j.at("count").get<size_t>();
+        block.minTimestamp = j.at("minTimestamp").get<long long>();
+        block.maxTimestamp = j.at("maxTimestamp").get<long long>();
+        block.timestampsSize = j.at("timestampsSize").get<size_t>();
+        block.valuesSize = j.at("valuesSize").get<size_t>();
+        block.overflow = j.value("overflow", false);
+        block.nullCount = j.value<size_t>("nullCount", 0);
+        block.sketchSize = j.value<size_t>("sketchSize", 0);
+        block.minValue = j.value("minValue", -std::numeric_limits<double>::infinity());
+        block.maxValue = j.value("maxValue", std::numeric_limits<double>::infinity());
+        if (!parseEncoding(j.value("timestampEncoding", "plain"), block.timestampEncoding))
+            throw std::invalid_argument("unknown timestamp encoding");
+        block.valueEncoding = defaultValueEncoding;
+        if (j.contains("valueEncoding") && !parseEncoding(j.at("valueEncoding").get<std::string>(), block.valueEncoding))
+            throw std::invalid_argument("unknown value encoding");
+        if (j.contains("fields")) {
+            for (const auto& field : j.at("fields")) {
+                FieldColumn column { field.at("valuesSize").get<size_t>(), defaultValueEncoding, field.value<size_t>("nullCount", 0), field.value<size_t>("sketchSize", 0) };
+                if (!parseEncoding(field.value("valueEncoding", encodingName(defaultValueEncoding)), column.valueEncoding))
+                    throw std::invalid_argument("unknown value encoding");
+                column.minValue = field.value("minValue", -std::numeric_limits<double>::infinity());
+                column.maxValue = field.value("maxValue", std::numeric_limits<double>::infinity());
+                block.extraFields.push_back(column);
+            }
+        }
+        return block;
+    }
+};
+
 struct Stream {
 public:
     size_t streamInputSize;
     size_t streamOutputSize;
-    double compressTimeMs;
+    long long compressTimeNs;
+
+private:
+    static inline std::atomic<size_t> streamNumber { 0 };
+    long long timestampOffset;
+    std::string streamName;
+    std::string timeUnit;
+    std::string datetimeStr;
+    std::string dataPath;
+    bool valueTypeBound;
+    ValueType valueType;
+    ErrorBound errorBound;
+    std::vector<std::string> fieldNames;
+    std::vector<Block> blocks;
+    std::map<std::string, std::vector<std::pair<size_t, size_t>>> idxRangesMap;
+
+public:
+    Stream()
+    {
+        streamNumber++;
+        timestampOffset = 0;
+        timeUnit = "ns";
+        streamInputSize = 0;
+        streamOutputSize = 0;
+        compressTimeNs = 0;
+        streamName = "";
+        valueTypeBound = false;
+        valueType = VALUE_DOUBLE;
+    }
+
+    /**
+     * @brief 流的值类型在第一次写入时确定，之后写入的类型必须一致
+     */
+    bool bindValueType(ValueType type)
+    {
+        if (!valueTypeBound) {
+            valueType = type;
+            valueTypeBound = true;
+        }
+        return valueType == type;
+    }
+
+    ValueType getValueType() const
+    {
+        return valueType;
+    }
+
+    void setErrorBound(const ErrorBound& bound)
+    {
+        errorBound = bound;
+    }
+
+    const ErrorBound& getErrorBound() const
+    {
+        return errorBound;
+    }
+
+    /**
+     * @brief 设置多字段流的字段名，每个时间戳对应每个字段各一个值。未设置时为单字段流，字段名为value
+     */
+    void setFields(const std::vector<std::string>& names)
+    {
+        fieldNames = names;
+    }
+
+    const std::vector<std::string>& getFields() const
+    {
+        return fieldNames;
+    }
+
+    size_t fieldCount() const
+    {
+        return std::max<size_t>(fieldNames.size(), 1);
+    }
+
+    // 第k个字段的名字，单字段流为value
+    std::string fieldName(size_t k) const
+    {
+        return fieldNames.empty() ? "value" : fieldNames[k];
+    }
+
+    /**
+     * @return 字段序号，不存在时为-1
+     */
+    int fieldIndex(const std::string& name) const
+    {
+        if (fieldNames.empty())
+            return name == "value" ? 0 : -1;
+        auto it = std::find(fieldNames.begin(), fieldNames.end(), name);
+        return it == fieldNames.end() ? -1 : static_cast<int>(it - fieldNames.begin());
+    }
+
+    void addBlock(const Block& block)
+    {
+        blocks.push_back(block);
+    }
+
+    const std::vector<Block>& getBlocks() const
+    {
+        return blocks;
+    }
+
+    size_t nextBlockIndex() const
+    {
+        return blocks.empty() ? 0 : blocks.back().index + 1;
+    }
+
+    void setDataPath(const std::string& path)
+    {
+        dataPath = path;
+    }
+
+    std::string getDataPath() const
+    {
+        return dataPath;
+    }
+
+    void addFile(const std::string& file)
+    {
+        idxRangesMap[file] = std::vector<std::pair<size_t, size_t>>({ { 0, 0 } });
+    }
+
+    void addIdxRangeOfFile(const std::string& file, std::pair<size_t, size_t>& range)
+    {
+        if (range.first == range.second)
+            return;
+        if (idxRangesMap.count(file) == 0)
+            addFile(file);
+        std::vector<std::pair<size_t, size_t>>& idxRangesOfFile = idxRangesMap.at(file);
+        auto res = Utils::mergeRange(idxRangesOfFile[idxRangesOfFile.size() - 1], range);
+        if (!res)
+            idxRangesOfFile.push_back(range);
+    }
+
+    void setTimestampOffset(long long offset)
+    {
+        timestampOffset = offset;
+    }
+
+    void setTimeUnit(std::string unit)
+    {
+        timeUnit = unit;
+    }
+
+    long long getTimestampOffset() const
+    {
+        return timestampOffset;
+    }
+
+    std::string getTimeUnit() const
+    {
+        return timeUnit;
+    }
+
+    nlohmann::json to_json() const
+    {
+        nlohmann::json j;
+        j["streamNumber"] = streamNumber.load();
+        j["timestampOffset"] = timestampOffset;
+        j["timeUnit"] = timeUnit;
+        j["streamName"] = streamName;
+        j["datetime"] = datetimeStr;
+        j["dataPath"] = dataPath;
+        j["valueType"] = valueTypeName(valueType);
+        if (errorBound.mode != ERROR_NONE)
+            j["errorBound"] = { { "mode", errorBound.mode == ERROR_ABSOLUTE ? "absolute" : "relative" }, { "value", errorBound.value } };
+        if (!fieldNames.empty())
+            j["fields"] = fieldNames;
+        j["blocks"] = nlohmann::json::array();
+        for (const auto& block : blocks)
+            j["blocks"].push_back(block.to_json());
+        for (const auto& pair : idxRangesMap) {
+            nlohmann::json ranges;
+            for (const auto& range : pair.second) {
+                ranges.push_back({ { "start", range.first }, { "end", range.second } });
+            }
+            j["idxRangesMap"][pair.first] = ranges;
+        }
+        return j;
+    }
+
+    /**
+     * @brief 从emit()生成的json文件恢复流的元数据
+     */
+    static bool load(const std::string& path, Stream& stream)
+    {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Cannot open file " << path << std::endl;
+            return false;
+        }
+        try {
+            nlohmann::json j = nlohmann::json::parse(file);
+            stream.timestampOffset = j.at("timestampOffset").get<long long>();
+            stream.timeUnit = j.at("timeUnit").get<std::string>();
+            stream.streamName = j.at("streamName").get<std::string>();
+            stream.datetimeStr = j.at("datetime").get<std::string>();
+            stream.dataPath = j.at("dataPath").get<std::string>();
+            if (!parseValueType(j.at("valueType").get<std::string>(), stream.valueType)) {
+                std::cerr << "Unknown value type in " << path << std::endl;
+                return false;
+            }
+            stream.valueTypeBound = true;
+            stream.errorBound = ErrorBound();
+            if (j.contains("errorBound")) {
+                stream.errorBound.mode = j["errorBound"].at("mode") == "absolute" ? ERROR_ABSOLUTE : ERROR_RELATIVE;
+                stream.errorBound.value = j["errorBound"].at("value").get<double>();
+            }
+            stream.fieldNames = j.value("fields", std::vector<std::string>());
+            Encoding defaultValueEncoding = ENCODING_BYTE_SHUFFLE;
+            if (stream.valueType == VALUE_INT64)
+                defaultValueEncoding = ENCODING_ZIGZAG_VARINT;
+            else if (stream.valueType == VALUE_BOOL)
+                defaultValueEncoding = ENCODING_BITMAP;
+            stream.blocks.clear();
+            for (const auto& block : j.at("blocks")) {
+                stream.blocks.push_back(Block::from_json(block, defaultValueEncoding));
+                if (stream.blocks.back().extraFields.size() + 1 != stream.fieldCount())
+                    throw std::invalid_argument("block field count mismatch");
+            }
+        } catch (std::exception& e) {
+            std::cerr << "Invalid stream file " << path << ": " << e.what() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::string emit(const std::string& targetDir)
+    {
+        std::filesystem::create_directory(targetDir);
+        std::string path = targetDir + '/' + streamName + datetimeStr + ".json";
+        std::fstream file(path, std::ios::out);
+        if (!file) {
+            std::cerr << "Cannot open file " << path << std::endl;
+            return "";
+        }
+        auto jsonStr = this->to_json().dump(4);
+        file << jsonStr;
+        return path;
+    }
+
+    void resetNumber()
+    {
+        streamNumber = 0;
+    }
+
+    void setName(std::string name)
+    {
+        streamName = name;
+    }
+
+    size_t getNumber() const
+    {
+        return streamNumber;
+    }
+
+    std::string getName() const
+    {
+        return streamName;
+    }
+
+    void setDatetimeStr(std::string datetime)
+    {
+        datetimeStr = datetime;
+    }
+
+    std::string getDatetimeStr() const
+    {
+        return datetimeStr;
+    }
+
+    void showPerformance()
+    {
+        std::cout << "stream " << streamName << "\'s performance: " << std::endl;
+        std::cout << "stream input size:  \t" << streamInputSize / 1024.0 << " KB" << std::endl;
+        std::cout << "stream output size: \t" << streamOutputSize / 1024.0 << " KB" << std::endl;
+        std::cout << "compress time cost: \t" << compressTimeNs / 1e6 << " ms." << std::endl;
+        if (streamOutputSize > 0)
+            std::cout << "compress ratio:     \t" << 100.0 * streamInputSize / streamOutputSize << " %." << std::endl;
+        if (compressTimeNs > 0)
+            std::cout << "throughput:         \t" << (streamInputSize / (compressTimeNs / 1e9)) / 1024 / 1024 << " MB/s." << std::endl;
+        std::cout << std::endl;
+    }
+};
+
+/**
+ * @brief 全部已封存流段的持久化清单，打开存储时只需mmap一个文件，不必遍历dataDir和jsonDir、逐个解析json。
+ * 文件由头部和事务记录[u32 长度][u32 crc32][操作...]组成，一条记录内的操作
+ * （登记流段、移除流段）同时生效。记录用pwrite追加，由flock串行化，多个进程可共享同一清单；
+ * 打开时截掉crc不符的残缺尾部。流段的块元数据也在记录中，打开时只读取每段的摘要，load()时才解析块
+ */
+class Manifest {
+public:
+    struct Segment {
+        uint64_t id;
+        std::string name;
+        std::string jsonPath;
+        std::string dataPath;
+        ValueType valueType;
+        long long minTimestamp; // 已加上timestampOffset
+        long long maxTimestamp;
+        size_t points;
+        size_t blocks;
+    };
+
+    /**
+     * @brief 打开或创建清单。同一进程内相同路径共享一个实例
+     *
+     * @param sync 每次提交后fdatasync
+     * @param importDir 非空时，清单由本次open()新建则立即登记该目录中已有的json；之后共享实例的open()不再重复登记
+     * @return 文件无法打开或映射时为空
+     */
+    static std::shared_ptr<Manifest> open(const std::string& path, bool sync = false, const std::string& importDir = "")
+    {
+        static std::mutex openedMutex;
+        static std::map<std::string, std::weak_ptr<Manifest>> opened;
+        std::error_code ec;
+        std::string key = std::filesystem::absolute(path, ec).lexically_normal().string();
+        std::lock_guard<std::mutex> lock(openedMutex);
+        if (auto manifest = opened[key].lock())
+            return manifest;
+        std::shared_ptr<Manifest> manifest(new Manifest(path, sync));
+        if (manifest->fd < 0)
+            return nullptr;
+        if (manifest->fileCreated && !importDir.empty())
+            manifest->importDirectory(importDir);
+        opened[key] = manifest;
+        return manifest;
+    }
+
+    ~Manifest()
+    {
+        closeFile();
+    }
+
+    Manifest(const Manifest&) = delete;
+    Manifest& operator=(const Manifest&) = delete;
+
+    /**
+     * @brief 清单文件是否由本次open()新建，新建时可用importDirectory()登记已有的json
+     */
+    bool created() const
+    {
+        return fileCreated;
+    }
+
+    /**
+     * @brief 登记一个已写出的流段
+     *
+     * @return 流段id，失败时为0
+     */
+    uint64_t add(const Stream& stream, const std::string& jsonPath)
+    {
+        return replace({}, &stream, jsonPath);
+    }
+
+    /**
+     * @brief 在一个事务中移除removed中的流段并登记added（可为空），用于合并或清理过期数据
+     *
+     * @return added的id；added为空时成功返回UINT64_MAX；失败时为0
+     */
+    uint64_t replace(const std::vector<uint64_t>& removed, const Stream* added, const std::string& jsonPath = "")
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!lock())
+            return 0;
+        std::string payload;
+        for (uint64_t id : removed) {
+            if (entries.count(id)) {
+                put<uint8_t>(payload, OP_REMOVE);
+                put<uint64_t>(payload, id);
+            }
+        }
+        uint64_t id = added ? nextId : UINT64_MAX;
+        if (added)
+            putSegment(payload, id, *added, jsonPath);
+        bool ok = payload.empty() || append(payload);
+        unlock();
+        if (ok && deadBytes > liveBytes && fileSize > CHECKPOINT_BYTES)
+            rewrite();
+        return ok ? id : 0;
+    }
+
+    /**
+     * @brief 所有序列名
+     */
+    std::vector<std::string> series()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        refresh();
+        std::vector<std::string> names;
+        for (const auto& pair : byName)
+            names.push_back(pair.first);
+        return names;
+    }
+
+    /**
+     * @brief 序列name中与[from, to]相交的流段，按起始时间排序
+     */
+    std::vector<Segment> segments(const std::string& name, long long from = LLONG_MIN, long long to = LLONG_MAX)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        refresh();
+        std::vector<Segment> result;
+        auto it = byName.find(name);
+        if (it == byName.end())
+            return result;
+        for (uint64_t id : it->second) {
+            const Segment& segment = entries.at(id).segment;
+            if (segment.maxTimestamp >= from && segment.minTimestamp <= to)
+                result.push_back(segment);
+        }
+        std::sort(result.begin(), result.end(), [](const Segment& a, const Segment& b) { return a.minTimestamp < b.minTimestamp; });
+        return result;
+    }
+
+    /**
+     * @brief 从清单恢复流段的元数据，与Stream::load(jsonPath)等价，不读取json
+     *
+     * @param stream 新构造的Stream
+     */
+    bool load(uint64_t id, Stream& stream)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        refresh();
+        auto it = entries.find(id);
+        if (it == entries.end())
+            return false;
+        Reader reader { map + it->second.offset, map + it->second.offset + it->second.bytes };
+        reader.get<uint8_t>();
+        reader.get<uint64_t>();
+        reader.getString();
+        stream.setName(reader.getString());
+        stream.setDatetimeStr(reader.getString());
+        stream.setDataPath(reader.getString());
+        stream.setTimeUnit(reader.getString());
+        stream.setTimestampOffset(reader.get<long long>());
+        stream.bindValueType(static_cast<ValueType>(reader.get<uint8_t>()));
+        ErrorBound bound;
+        bound.mode = static_cast<ErrorMode>(reader.get<uint8_t>());
+        bound.value = reader.get<double>();
+        stream.setErrorBound(bound);
+        std::vector<std::string> fields(reader.get<uint32_t>());
+        for (auto& field : fields)
+            field = reader.getString();
+        stream.setFields(fields);
+        reader.get<long long>();
+        reader.get<long long>();
+        reader.get<uint64_t>();
+        uint32_t blocks = reader.get<uint32_t>();
+        for (uint32_t i = 0; i < blocks && reader.ok; i++) {
+            Block block;
+            block.index = reader.get<uint64_t>();
+            block.count = reader.get<uint64_t>();
+            block.minTimestamp = reader.get<long long>();
+            block.maxTimestamp = reader.get<long long>();
+            block.timestampsSize = reader.get<uint64_t>();
+            block.valuesSize = reader.get<uint64_t>();
+            block.timestampEncoding = static_cast<Encoding>(reader.get<uint8_t>());
+            block.valueEncoding = static_cast<Encoding>(reader.get<uint8_t>());
+            block.overflow = reader.get<uint8_t>();
+            block.nullCount = reader.get<uint64_t>();
+            block.sketchSize = reader.get<uint64_t>();
+            block.minValue = reader.get<double>();
+            block.maxValue = reader.get<double>();
+            for (size_t k = 1; k < stream.fieldCount(); k++) {
+                FieldColumn field;
+                field.valuesSize = reader.get<uint64_t>();
+                field.valueEncoding = static_cast<Encoding>(reader.get<uint8_t>());
+                field.nullCount = reader.get<uint64_t>();
+                field.sketchSize = reader.get<uint64_t>();
+                field.minValue = reader.get<double>();
+                field.maxValue = reader.get<double>();
+                block.extraFields.push_back(field);
+            }
+            stream.addBlock(block);
+        }
+        return reader.ok;
+    }
+
+    /**
+     * @brief 把dir中尚未登记的流json一次性登记，用于从旧版本的目录布局迁移
+     *
+     * @return 新登记的流段数
+     */
+    size_t importDirectory(const std::string& dir)
+    {
+        std::vector<std::string> paths;
+        std::error_code ec;
+        for (const auto& file : std::filesystem::directory_iterator(dir, ec)) {
+            if (file.is_regular_file() && file.path().extension() == ".json")
+                paths.push_back(file.path().string());
+        }
+        std::sort(paths.begin(), paths.end());
+
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!lock())
+            return 0;
+        std::set<std::string> known;
+        for (const auto& pair : entries)
+            known.insert(pair.second.segment.jsonPath);
+        std::string payload;
+        size_t imported = 0;
+        for (const auto& path : paths) {
+            Stream stream;
+            if (known.count(path) || !Stream::load(path, stream))
+                continue;
+            putSegment(payload, nextId + imported, stream, path);
+            imported++;
+        }
+        bool ok = payload.empty() || append(payload);
+        unlock();
+        return ok ? imported : 0;
+    }
+
+    /**
+     * @brief 只保留仍有效的流段重写清单，经rename原子替换
+     */
+    bool checkpoint()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        return rewrite();
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        refresh();
+        return entries.size();
+    }
+
+    size_t fileBytes() const
+    {
+        return fileSize;
+    }
+
+private:
+    static constexpr char MAGIC[8] = { 'T', 'S', 'D', 'B', 'M', 'A', 'N', '2' };
+    // 记录格式的版本，OP_ADD的布局（块、字段元数据）每次变化都要加1。
+    // 版本不符或magic为没有版本号的TSDBMAN1时，清单视为新建，由调用方从json重新导入
+    static constexpr uint64_t FORMAT_VERSION = 5;
+    // 头部：magic、已校验的末尾偏移、id的下限（重写后不复用已移除的id）、格式版本
+    static constexpr size_t HEADER_BYTES = 32;
+    static constexpr size_t RECORD_HEADER = 8;
+    static constexpr size_t BLOCK_BYTES = 10 * 8 + 3;
+    static constexpr size_t FIELD_BYTES = 5 * 8 + 1;
+    // 失效记录多于有效记录且文件超过该大小时自动重写
+    static constexpr size_t CHECKPOINT_BYTES = 1 << 20;
+
+    enum Op : uint8_t {
+        OP_ADD = 1,
+        OP_REMOVE = 2
+    };
+
+    struct Entry {
+        Segment segment;
+        size_t offset; // OP_ADD操作在文件中的位置
+        size_t bytes;
+    };
+
+    struct Reader {
+        const char* p;
+        const char* end;
+        bool ok = true;
+
+        template <typename T>
+        T get()
+        {
+            T value {};
+            if (static_cast<size_t>(end - p) < sizeof(T)) {
+                ok = false;
+                return value;
+            }
+            memcpy(&value, p, sizeof(T));
+            p += sizeof(T);
+            return value;
+        }
+
+        std::string getString()
+        {
+            uint32_t n = get<uint32_t>();
+            if (!ok || static_cast<size_t>(end - p) < n) {
+                ok = false;
+                return "";
+            }
+            std::string s(p, n);
+            p += n;
+            return s;
+        }
+
+        void skip(size_t n)
+        {
+            if (static_cast<size_t>(end - p) < n)
+                ok = false;
+            else
+                p += n;
+        }
+    };
+
+    template <typename T>
+    static void put(std::string& out, T value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static void putString(std::string& out, const std::string& s)
+    {
+        put<uint32_t>(out, s.size());
+        out += s;
+    }
+
+    // 流段的摘要在前，块元数据在后，扫描时可整体跳过
+    static void putSegment(std::string& out, uint64_t id, const Stream& stream, const std::string& jsonPath)
+    {
+        long long minTimestamp = LLONG_MAX, maxTimestamp = LLONG_MIN;
+        uint64_t points = 0;
+        for (const auto& block : stream.getBlocks()) {
+            minTimestamp = std::min(minTimestamp, block.minTimestamp);
+            maxTimestamp = std::max(maxTimestamp, block.maxTimestamp);
+            points += block.count;
+        }
+        put<uint8_t>(out, OP_ADD);
+        put<uint64_t>(out, id);
+        putString(out, jsonPath);
+        putString(out, stream.getName());
+        putString(out, stream.getDatetimeStr());
+        putString(out, stream.getDataPath());
+        putString(out, stream.getTimeUnit());
+        put<long long>(out, stream.getTimestampOffset());
+        put<uint8_t>(out, stream.getValueType());
+        put<uint8_t>(out, stream.getErrorBound().mode);
+        put<double>(out, stream.getErrorBound().value);
+        put<uint32_t>(out, stream.getFields().size());
+        for (const auto& field : stream.getFields())
+            putString(out, field);
+        put<long long>(out, minTimestamp);
+        put<long long>(out, maxTimestamp);
+        put<uint64_t>(out, points);
+        put<uint32_t>(out, stream.getBlocks().size());
+        for (const auto& block : stream.getBlocks()) {
+            put<uint64_t>(out, block.index);
+            put<uint64_t>(out, block.count);
+            put<long long>(out, block.minTimestamp);
+            put<long long>(out, block.maxTimestamp);
+            put<uint64_t>(out, block.timestampsSize);
+            put<uint64_t>(out, block.valuesSize);
+            put<uint8_t>(out, block.timestampEncoding);
+            put<uint8_t>(out, block.valueEncoding);
+            put<uint8_t>(out, block.overflow);
+            put<uint64_t>(out, block.nullCount);
+            put<uint64_t>(out, block.sketchSize);
+            put<double>(out, block.minValue);
+            put<double>(out, block.maxValue);
+            for (const auto& field : block.extraFields) {
+                put<uint64_t>(out, field.valuesSize);
+                put<uint8_t>(out, field.valueEncoding);
+                put<uint64_t>(out, field.nullCount);
+                put<uint64_t>(out, field.sketchSize);
+                put<double>(out, field.minValue);
+                put<double>(out, field.maxValue);
+            }
+        }
+    }
+
+    static uint32_t checksum(const char* data, size_t n)
+    {
+        return static_cast<uint32_t>(crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data), static_cast<uInt>(n)));
+    }
+
+    Manifest(const std::string& path, bool sync)
+        : path(path)
+        , sync(sync)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (lock())
+            unlock();
+        else
+            closeFile();
+    }
+
+    bool openFile()
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            std::cerr << "Cannot open manifest " << path << std::endl;
+        return fd >= 0;
+    }
+
+    void closeFile()
+    {
+        if (map)
+            munmap(const_cast<char*>(map), mapped);
+        if (fd >= 0)
+            ::close(fd);
+        map = nullptr;
+        mapped = 0;
+        fd = -1;
+        fileSize = scanned = checkedEnd = 0;
+        liveBytes = deadBytes = 0;
+        nextId = 1;
+        entries.clear();
+        byName.clear();
+    }
+
+    // 文件已被其他进程的checkpoint替换
+    bool replacedOnDisk() const
+    {
+        struct stat onDisk, opened;
+        return ::stat(path.c_str(), &onDisk) != 0 || ::fstat(fd, &opened) != 0 || onDisk.st_ino != opened.st_ino || onDisk.st_dev != opened.st_dev;
+    }
+
+    // 加文件锁并扫描到文件末尾，截掉残缺的尾部记录
+    bool lock()
+    {
+        for (int attempt = 0; attempt < 8; attempt++) {
+            if (fd < 0 && !openFile())
+                return false;
+            if (flock(fd, LOCK_EX) != 0)
+                return false;
+            if (!replacedOnDisk()) {
+                if (scan(true))
+                    return true;
+                unlock();
+                return false;
+            }
+            flock(fd, LOCK_UN);
+            closeFile();
+        }
+        return false;
+    }
+
+    void unlock()
+    {
+        flock(fd, LOCK_UN);
+    }
+
+    // 读取其他进程追加的记录，不加文件锁；正在写入的记录校验不过，留到下次
+    void refresh()
+    {
+        if (fd < 0 || replacedOnDisk()) {
+            closeFile();
+            if (lock())
+                unlock();
+            return;
+        }
+        scan(false);
+    }
+
+    bool remap(size_t size)
+    {
+        if (size == mapped)
+            return true;
+        if (map)
+            munmap(const_cast<char*>(map), mapped);
+        map = nullptr;
+        mapped = 0;
+        if (size == 0)
+            return true;
+        void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            std::cerr << "Cannot map manifest " << path << std::endl;
+            return false;
+        }
+        map = static_cast<const char*>(p);
+        mapped = size;
+        return true;
+    }
+
+    bool scan(bool recover)
+    {
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+            return false;
+        size_t size = st.st_size;
+        if (scanned == 0) {
+            char header[HEADER_BYTES] = {};
+            size_t headerBytes = std::min(size, HEADER_BYTES);
+            uint64_t version = 0;
+            bool complete = ::pread(fd, header, headerBytes, 0) == static_cast<ssize_t>(headerBytes);
+            memcpy(&version, header + 3 * sizeof(uint64_t), sizeof(version));
+            if (!complete || size < HEADER_BYTES || memcmp(header, MAGIC, sizeof(MAGIC)) != 0 || version != FORMAT_VERSION) {
+                if (!recover)
+                    return true;
+                // 旧格式的记录无法按当前布局解析，丢弃后重建
+                bool outdated = complete && size >= sizeof(MAGIC) && memcmp(header, MAGIC, sizeof(MAGIC) - 1) == 0;
+                if (size > HEADER_BYTES && !outdated) {
+                    std::cerr << "Invalid manifest " << path << std::endl;
+                    return false;
+                }
+                if (outdated && size > HEADER_BYTES)
+                    std::cerr << "Manifest " << path << " has an older format, rebuilding it" << std::endl;
+                // 新建的清单
+                memcpy(header, MAGIC, sizeof(MAGIC));
+                uint64_t fields[3] = { HEADER_BYTES, 1, FORMAT_VERSION };
+                memcpy(header + sizeof(MAGIC), fields, sizeof(fields));
+                if (::ftruncate(fd, 0) != 0 || ::pwrite(fd, header, HEADER_BYTES, 0) != static_cast<ssize_t>(HEADER_BYTES))
+                    return false;
+                fileCreated = true;
+                size = HEADER_BYTES;
+            }
+            uint64_t baseId;
+            memcpy(&checkedEnd, header + sizeof(MAGIC), sizeof(checkedEnd));
+            memcpy(&baseId, header + sizeof(MAGIC) + sizeof(checkedEnd), sizeof(baseId));
+            nextId = std::max(nextId, baseId);
+            scanned = HEADER_BYTES;
+        }
+        if (!remap(size))
+            return false;
+        while (scanned + RECORD_HEADER <= size) {
+            uint32_t head[2];
+            memcpy(head, map + scanned, RECORD_HEADER);
+            size_t end = scanned + RECORD_HEADER + head[0];
+            // checkedEnd之前的记录上次打开时已校验，不再计算crc
+            if (head[0] == 0 || end > size || (end > checkedEnd && checksum(map + scanned + RECORD_HEADER, head[0]) != head[1]))
+                break;
+            applyRecord(scanned + RECORD_HEADER, end);
+            scanned = end;
+        }
+        fileSize = size;
+        if (!recover)
+            return true;
+        if (scanned < size) {
+            std::cerr << "Truncated " << size - scanned << " bytes of incomplete records in manifest " << path << std::endl;
+            if (::ftruncate(fd, scanned) != 0 || !remap(scanned))
+                return false;
+            fileSize = scanned;
+        }
+        if (checkedEnd < scanned && ::fdatasync(fd) == 0) {
+            uint64_t end = scanned;
+            if (::pwrite(fd, &end, sizeof(end), sizeof(MAGIC)) == sizeof(end))
+                checkedEnd = end;
+        }
+        return true;
+    }
+
+    void applyRecord(size_t beg, size_t end)
+    {
+        Reader reader { map + beg, map + end };
+        while (reader.ok && reader.p < reader.end) {
+            const char* op = reader.p;
+            uint8_t type = reader.get<uint8_t>();
+            uint64_t id = reader.get<uint64_t>();
+            nextId = std::max(nextId, id + 1);
+            if (type == OP_REMOVE) {
+                auto it = entries.find(id);
+                if (it == entries.end())
+                    continue;
+                liveBytes -= it->second.bytes;
+                deadBytes += it->second.bytes + (reader.p - op);
+                auto& ids = byName[it->second.segment.name];
+                ids.erase(id);
+                if (ids.empty())
+                    byName.erase(it->second.segment.name);
+                entries.erase(it);
+                continue;
+            }
+            if (type != OP_ADD)
+                break;
+            Segment segment;
+            segment.id = id;
+            segment.jsonPath = reader.getString();
+            segment.name = reader.getString();
+            reader.getString();
+            segment.dataPath = reader.getString();
+            reader.getString();
+            long long offset = reader.get<long long>();
+            segment.valueType = static_cast<ValueType>(reader.get<uint8_t>());
+            reader.skip(1 + sizeof(double));
+            uint32_t fields = reader.get<uint32_t>();
+            for (uint32_t i = 0; i < fields && reader.ok; i++)
+                reader.getString();
+            segment.minTimestamp = reader.get<long long>() + offset;
+            segment.maxTimestamp = reader.get<long long>() + offset;
+            segment.points = reader.get<uint64_t>();
+            segment.blocks = reader.get<uint32_t>();
+            reader.skip(segment.blocks * (BLOCK_BYTES + (std::max<uint32_t>(fields, 1) - 1) * FIELD_BYTES));
+            if (!reader.ok)
+                break;
+            size_t bytes = reader.p - op;
+            byName[segment.name].insert(id);
+            entries[id] = { std::move(segment), static_cast<size_t>(op - map), bytes };
+            liveBytes += bytes;
+        }
+    }
+
+    // 持有文件锁时调用
+    bool append(const std::string& payload)
+    {
+        uint32_t head[2] = { static_cast<uint32_t>(payload.size()), checksum(payload.data(), payload.size()) };
+        std::string record(reinterpret_cast<const char*>(head), RECORD_HEADER);
+        record += payload;
+        if (::pwrite(fd, record.data(), record.size(), fileSize) != static_cast<ssize_t>(record.size())) {
+            std::cerr << "Cannot write manifest " << path << std::endl;
+            return false;
+        }
+        if (sync)
+            ::fdatasync(fd);
+        return scan(false) && scanned == fileSize;
+    }
+
+    // 持有mutex时调用
+    bool rewrite()
+    {
+        if (!lock())
+            return false;
+        std::string tmpPath = path + ".tmp";
+        int tmp = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (tmp < 0) {
+            unlock();
+            return false;
+        }
+        std::string out(MAGIC, sizeof(MAGIC));
+        put<uint64_t>(out, 0);
+        put<uint64_t>(out, nextId);
+        put<uint64_t>(out, FORMAT_VERSION);
+        for (const auto& pair : entries) {
+            put<uint32_t>(out, pair.second.bytes);
+            put<uint32_t>(out, checksum(map + pair.second.offset, pair.second.bytes));
+            out.append(map + pair.second.offset, pair.second.bytes);
+        }
+        uint64_t end = out.size();
+        memcpy(&out[sizeof(MAGIC)], &end, sizeof(end));
+        bool ok = ::write(tmp, out.data(), out.size()) == static_cast<ssize_t>(out.size()) && ::fdatasync(tmp) == 0;
+        ::close(tmp);
+        ok = ok && ::rename(tmpPath.c_str(), path.c_str()) == 0;
+        if (ok) {
+            std::string dir = std::filesystem::path(path).parent_path().string();
+            int dirFd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_CLOEXEC);
+            if (dirFd >= 0) {
+                ::fsync(dirFd);
+                ::close(dirFd);
+            }
+        }
+        // 等待旧文件锁的进程在拿到锁后发现文件已被替换，转而打开新文件
+        unlock();
+        closeFile();
+        if (lock())
+            unlock();
+        return ok;
+    }
+
+    std::string path;
+    bool sync;
+    bool fileCreated = false;
+    int fd = -1;
+    const char* map = nullptr;
+    size_t mapped = 0;
+    size_t fileSize = 0;
+    size_t scanned = 0;
+    uint64_t checkedEnd = 0;
+    size_t liveBytes = 0;
+    size_t deadBytes = 0;
+    uint64_t nextId = 1;
+    std::map<uint64_t, Entry> entries;
+    std::map<std::string, std::set<uint64_t>> byName;
+    std::mutex mutex;
+};
+
+/**
+ * @brief 尚未封存为块的行，列式存放。多字段流的值按行存放，每个时间戳对应字段数个值；valid为空表示没有空值
+ */
+template <typename T>
+struct Memtable {
+    std::vector<long long> timestamps;
+    std::vector<T> values;
+    std::vector<uint8_t> valid;
+};
+
+/**
+ * @brief 写入中的流在某一时刻的一致视图：已封存的块（getStream()）加上尚未封存的行，每个点恰好出现在两者之一。
+ * 由tsdb_entry::snapshot()生成，之后的写入和封块不影响已生成的快照
+ */
+template <typename T>
+class LiveSnapshot {
+public:
+    const Stream& getStream() const
+    {
+        return stream;
+    }
+
+    // 尚未封存的行数
+    size_t memtableRows() const
+    {
+        return (frozen ? frozen->timestamps.size() - frozenBegin : 0) + staged.timestamps.size();
+    }
+
+private:
+    friend struct tsdb_entry;
+    Stream stream;
+    // 正在封块的冻结行与写入方共享，[frozenBegin, size)尚未登记为块
+    std::shared_ptr<const Memtable<T>> frozen;
+    size_t frozenBegin = 0;
+    // 暂存区和溢出区的副本
+    Memtable<T> staged;
+};
+
+struct tsdb_entry {
+    enum CompressOp {
+        COMPRESS_ERROR,
+        COMPRESS_CONTINUE,
+        COMPRESS_END
+    };
+
+private:
+    struct Arguments {
+        int compress_compressionLevel;
+        size_t compress_outBufferSize;
+        size_t blockPoints;
+        double sketchAccuracy;
+        size_t sketchMaxBuckets;
+        long long reorderWindow;
+        size_t zstFileMaxSize;
+        size_t indexWidth;
+        std::string dataDir;
+        std::string jsonDir;
+        std::string manifestFile;
+        std::string fileNameFormat;
+        std::string timestampsFileNamePrefix;
+        std::string valuesFileNamePrefix;
+        bool fsync;
+        std::string metricsDumpFile;
+        int metricsListenPort;
+    } arguments;
+
+    // 每个流的写入暂存区：按时间有序，吸收乱序窗口内的迟到点；早于已封存数据的点进入溢出区
+    struct Staging {
+        virtual ~Staging() = default;
+        virtual int flush(tsdb_entry& entry) = 0;
+    };
+
+    // 多字段流的值按行存放，每个时间戳对应字段数个值
+    template <typename T>
+    struct TypedStaging : Staging {
+        std::vector<long long> timestamps;
+        std::vector<T> values;
+        std::vector<long long> overflowTimestamps;
+        std::vector<T> overflowValues;
+        // 有效性掩码，与values同样按行存放；为空表示还没有出现空值
+        std::vector<uint8_t> valid;
+        std::vector<uint8_t> overflowValid;
+        long long maxTimestamp = LLONG_MIN;
+        long long sealedTimestamp = LLONG_MIN;
+        // 已移出暂存区、正在逐块落盘的行，[frozenBegin, size)还没有登记为块
+        std::shared_ptr<const Memtable<T>> frozen;
+        size_t frozenBegin = 0;
+
+        int flush(tsdb_entry& entry) override
+        {
+            return entry.sealStaging(*this, true);
+        }
+    };
+
+    Stream* stream = nullptr;
+    std::unique_ptr<Staging> staging;
+    // 写入方修改stream、暂存区和冻结区时持有，snapshot()在其他线程中据此取得一致的视图
+    mutable std::mutex liveMutex;
+    std::shared_ptr<Manifest> manifest;
+    std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx { ZSTD_createCCtx(), ZSTD_freeCCtx };
+    std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx { ZSTD_createDCtx(), ZSTD_freeDCtx };
+    std::vector<char> compressBuffer;
+
+public:
+    tsdb_entry()
+    {
+        arguments.compress_outBufferSize = ArgParser::get<size_t>("outBufferSize", "hf_compress");
+        arguments.compress_compressionLevel = ArgParser::get<int>("compressionLevel", "hf_compress");
+        arguments.blockPoints = ArgParser::get<size_t>("blockPoints", "hf_compress");
+        arguments.sketchAccuracy = ArgParser::get<double>("accuracy", "hf_sketch");
+        arguments.sketchMaxBuckets = ArgParser::get<size_t>("maxBuckets", "hf_sketch");
+        arguments.reorderWindow = ArgParser::get<long long>("reorderWindow", "hf");
+        arguments.dataDir = ArgParser::get<std::string>("dataDir", "hf");
+        arguments.jsonDir = ArgParser::get<std::string>("jsonDir", "hf");
+        arguments.manifestFile = ArgParser::get<std::string>("manifestFile", "hf");
+        arguments.fileNameFormat = ArgParser::get<std::string>("fileNameFormat", "hf");
+        arguments.timestampsFileNamePrefix = ArgParser::get<std::string>("timestampsFileNamePrefix", "hf");
+        arguments.valuesFileNamePrefix = ArgParser::get<std::string>("valuesFileNamePrefix", "hf");
+        arguments.fsync = ArgParser::get<bool>("fsync", "hf");
+        arguments.metricsDumpFile = ArgParser::get<std::string>("dumpFile", "metrics");
+        arguments.metricsListenPort = ArgParser::get<int>("listenPort", "metrics");
+        arguments.indexWidth = 10;
+        std::filesystem::create_directory(arguments.dataDir);
+        std::filesystem::create_directory(arguments.jsonDir);
+        if (!arguments.manifestFile.empty()) {
+            manifest = Manifest::open(arguments.jsonDir + '/' + arguments.manifestFile, arguments.fsync, arguments.jsonDir);
+        }
+        if (arguments.metricsListenPort > 0)
+            Metrics::startServer(arguments.metricsListenPort);
+    }
+
+    void initialize(long long timestampOffset = 0, std::string timeUnit = "ns")
+    {
+        Stream* next = new Stream();
+        next->setTimestampOffset(timestampOffset);
+        next->setTimeUnit(timeUnit);
+        std::lock_guard<std::mutex> lock(liveMutex);
+        stream = next;
+        staging.reset();
+    }
+
+    /**
+     * @brief 为当前流开启有损压缩，只对float/double值生效，须在该流第一次insert_points之前调用
+     *
+     * @return 流未初始化或已有数据写入时返回false
+     */
+    bool setErrorBound(const ErrorBound& bound)
+    {
+        if (!stream || staging || !stream->getBlocks().empty())
+            return false;
+        stream->setErrorBound(bound);
+        return true;
+    }
+
+    /**
+     * @brief 把当前流设为多字段流，每个时间戳对应每个字段各一个值，块内共用一个时间戳列，每个字段一个值列。
+     * 须在该流第一次写入之前调用，之后只能用insert_records写入
+     *
+     * @return 流未初始化、已有数据写入、字段名为空或重复时返回false
+     */
+    bool setFields(const std::vector<std::string>& names)
+    {
+        if (!stream || staging || !stream->getBlocks().empty() || names.empty())
+            return false;
+        std::set<std::string> unique(names.begin(), names.end());
+        if (unique.size() != names.size() || unique.count(""))
+            return false;
+        stream->setFields(names);
+        return true;
+    }
+
+    /**
+     * @brief 设置乱序窗口，比已写入的最大时间戳早不超过window的点仍能按序写入普通块
+     */
+    void setReorderWindow(long long window)
+    {
+        arguments.reorderWindow = window;
+    }
+
+    /**
+     * @brief 结束当前流，写出流的json元数据
+     *
+     * @return json文件路径，写出失败时为空
+     */
+    std::string close()
+    {
+        if (staging) {
+            auto start = std::chrono::steady_clock::now();
+            staging->flush(*this);
+            auto end = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(liveMutex);
+            staging.reset();
+            stream->compressTimeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        }
+        stream->showPerformance();
+        std::string path = stream->emit(arguments.jsonDir);
+        if (!path.empty() && manifest && !manifest->add(*stream, path))
+            std::cerr << "Cannot register stream " << stream->getName() << " in manifest" << std::endl;
+        if (!arguments.metricsDumpFile.empty())
+            Metrics::dumpPrometheus(arguments.metricsDumpFile);
+        std::lock_guard<std::mutex> lock(liveMutex);
+        delete stream;
+        stream = nullptr;
+        return path;
+    }
+
+    /**
+     * @brief 当前流的一致快照：已封存的块和尚未封存的行（暂存区、溢出区和正在落盘的冻结行）。
+     * 这是tsdb_entry唯一可以在其他线程中与写入并发调用的方法，读取快照时使用另一个tsdb_entry的read_snapshot
+     *
+     * @return 流未初始化、还没有写入或值类型不是T时为空
+     */
+    template <typename T>
+    std::shared_ptr<const LiveSnapshot<T>> snapshot() const
+    {
+        auto snap = std::make_shared<LiveSnapshot<T>>();
+        std::lock_guard<std::mutex> lock(liveMutex);
+        auto* st = dynamic_cast<TypedStaging<T>*>(staging.get());
+        if (!stream || !st)
+            return nullptr;
+        snap->stream = *stream;
+        snap->frozen = st->frozen;
+        snap->frozenBegin = st->frozenBegin;
+        Memtable<T>& staged = snap->staged;
+        staged.timestamps.reserve(st->timestamps.size() + st->overflowTimestamps.size());
+        staged.timestamps = st->timestamps;
+        staged.timestamps.insert(staged.timestamps.end(), st->overflowTimestamps.begin(), st->overflowTimestamps.end());
+        staged.values = st->values;
+        staged.values.insert(staged.values.end(), st->overflowValues.begin(), st->overflowValues.end());
+        if (!st->valid.empty() || !st->overflowValid.empty()) {
+            staged.valid = st->valid;
+            staged.valid.resize(st->values.size(), 1);
+            staged.valid.insert(staged.valid.end(), st->overflowValid.begin(), st->overflowValid.end());
+            staged.valid.resize(staged.values.size(), 1);
+        }
+        return snap;
+    }
+
+    /**
+     * @brief 读取快照中字段在[from, to]内的数据，按时间排序后写入timestamps和values（原有内容被清空），
+     * 空值读作NaN（浮点）、0或false。时间范围不相交的块不读取
+     *
+     * @return 字段不存在、值类型不符或读取失败时返回false
+     */
+    template <typename T>
+    bool read_snapshot(const LiveSnapshot<T>& snapshot, const std::string& field, std::vector<long long>& timestamps, std::vector<T>& values,
+        long long from = LLONG_MIN, long long to = LLONG_MAX)
+    {
+        const Stream& source = snapshot.stream;
+        size_t index;
+        timestamps.clear();
+        values.clear();
+        if (!resolveField<T>(source, field, index))
+            return false;
+        std::vector<long long> blockTimestamps;
+        std::vector<T> blockValues;
+        for (const auto& block : source.getBlocks()) {
+            if (block.maxTimestamp < from || block.minTimestamp > to)
+                continue;
+            blockTimestamps.clear();
+            blockValues.clear();
+            if (!readTimestamps(source, block, blockTimestamps) || !readField(source, block, index, blockValues))
+                return false;
+            for (size_t i = 0; i < blockTimestamps.size(); i++) {
+                if (blockTimestamps[i] >= from && blockTimestamps[i] <= to) {
+                    timestamps.push_back(blockTimestamps[i]);
+                    values.push_back(blockValues[i]);
+                }
+            }
+        }
+        size_t width = source.fieldCount();
+        auto appendRows = [&](const Memtable<T>& rows, size_t begin) {
+            for (size_t i = begin; i < rows.timestamps.size(); i++) {
+                if (rows.timestamps[i] < from || rows.timestamps[i] > to)
+                    continue;
+                timestamps.push_back(rows.timestamps[i]);
+                bool isValid = rows.valid.empty() || rows.valid[i * width + index];
+                values.push_back(isValid ? rows.values[i * width + index] : Kernels::nullValue<T>());
+            }
+        };
+        if (snapshot.frozen)
+            appendRows(*snapshot.frozen, snapshot.frozenBegin);
+        appendRows(snapshot.staged, 0);
+        Utils::sortColumnsByKey(timestamps, values);
+        return true;
+    }
+
+    /**
+     * @brief 已封存流段的清单，hf.manifestFile为空时为空
+     */
+    std::shared_ptr<Manifest> getManifest() const
+    {
+        return manifest;
+    }
+
+    /**
+     * @brief 写入一批点。点先进入按时间有序的暂存区，早于水位线（最大时间戳 - 乱序窗口）的点每攒满blockPoints个
+     * 封存为一个块，按值类型选择编码后压缩落盘；早于已封存数据的点写入溢出块。有序写入时只做追加
+     *
+     * @tparam T 值类型，同一个流内必须一致
+     * @return 0 成功，-1 值类型与流不一致，-2 写文件失败，-3 当前流是多字段流
+     */
+    template <typename T>
+    int insert_points(const std::vector<basic_point<T>>& points)
+    {
+        const std::string& name = points.empty() ? std::string() : points[0].name_;
+        return ingest<T>(name, points.size(), 1, nullptr, [&points](size_t i) { return std::make_pair(points[i].nanoseconds_, &points[i].value_); });
+    }
+
+    /**
+     * @brief 以列的形式写入一批点，语义与insert_points相同，省去逐点构造point
+     *
+     * @param valid 可为空；非空时valid[i]为0表示第i个点缺失（空值），缺失的点保留时间戳，值只记一位
+     */
+    template <typename T>
+    int insert_columns(const std::string& name, const long long* timestamps, const T* values, size_t n, const uint8_t* valid = nullptr)
+    {
+        return ingest<T>(name, n, 1, valid, [timestamps, values](size_t i) { return std::make_pair(timestamps[i], values + i); });
+    }
 
-private:
-    static size_t streamNumber;
-    long long timestampOffset;
-    std::string streamName;
-    std::string timeUnit;
-    std::string datetimeStr;
-    std::map<std::string, std::vector<std::pair<size_t, size_t>>> idxRangesMap;
+    /**
+     * @brief 向setFields()设置的多字段流写入n条记录，语义与insert_points相同
+     *
+     * @param values 按行存放，第i条记录的第k个字段为values[i * 字段数 + k]
+     * @param valid 可为空；非空时与values同样按行存放，0表示该字段缺失
+     * @return 0 成功，-1 值类型与流不一致，-2 写文件失败，-3 当前流不是多字段流
+     */
+    template <typename T>
+    int insert_records(const std::string& name, const long long* timestamps, const T* values, size_t n, const uint8_t* valid = nullptr)
+    {
+        size_t width = stream ? stream->getFields().size() : 0;
+        if (width == 0)
+            return -3;
+        return ingest<T>(name, n, width, valid, [timestamps, values, width](size_t i) { return std::make_pair(timestamps[i], values + i * width); });
+    }
 
-public:
-    Stream()
+    /**
+     * @brief 读取流的全部数据点。空值读作NaN（浮点）、0或false，需要区分时使用read_fields
+     *
+     * @param streamJsonPath close()返回的json文件路径
+     */
+    template <typename T = double>
+    std::vector<basic_point<T>> extract_points(const std::string& streamJsonPath)
     {
-        streamNumber++;
-        timestampOffset = 0;
-        timeUnit = "ns";
-        streamInputSize = 0;
-        streamOutputSize = 0;
-        compressTimeMs = 0;
-        streamName = "";
+        Metrics::ScopedTimer queryTimer(Metrics::STAGE_QUERY);
+        std::vector<basic_point<T>> points;
+        Stream source;
+        std::vector<long long> timestamps;
+        std::vector<T> values;
+        if (!Stream::load(streamJsonPath, source) || !read_columns(source, timestamps, values))
+            return points;
+
+        points.reserve(timestamps.size());
+        for (size_t i = 0; i < timestamps.size(); i++)
+            points.emplace_back(source.getName(), values[i], timestamps[i]);
+        queryTimer.setBytes(timestamps.size() * sizeof(long long) + values.size() * sizeof(T));
+        return points;
     }
 
-    void addFile(const std::string& file)
+    /**
+     * @brief 解码流的全部块，按时间排序后写入timestamps和values（原有内容被清空）
+     */
+    template <typename T>
+    bool read_columns(const Stream& source, std::vector<long long>& timestamps, std::vector<T>& values)
     {
-        idxRangesMap[file] = std::vector<std::pair<size_t, size_t>>({ { 0, 0 } });
+        std::vector<long long> overflowTimestamps;
+        std::vector<T> overflowValues;
+        timestamps.clear();
+        values.clear();
+        for (const auto& block : source.getBlocks()) {
+            auto& ts = block.overflow ? overflowTimestamps : timestamps;
+            auto& vs = block.overflow ? overflowValues : values;
+            if (!read_block(source, block, ts, vs))
+                return false;
+        }
+        // 普通块首尾相接且有序，溢出块中的迟到点排序后与之归并
+        if (!overflowTimestamps.empty()) {
+            size_t mid = timestamps.size();
+            timestamps.insert(timestamps.end(), overflowTimestamps.begin(), overflowTimestamps.end());
+            values.insert(values.end(), overflowValues.begin(), overflowValues.end());
+            Utils::sortColumnsByKey(timestamps, values, mid);
+            Utils::mergeSortedColumns(timestamps, values, mid);
+        }
+        return true;
     }
 
-    void addIdxRangeOfFile(const std::string& file, std::pair<size_t, size_t>& range)
+    /**
+     * @brief 只解码fields中的字段，按时间排序后写入timestamps和columns（原有内容被清空），columns[j]对应fields[j]。
+     * 未投影的字段不读取文件
+     *
+     * @param valid 非空时写入每列的有效性掩码，0表示空值；空值在columns中读作NaN（浮点）、0或false
+     * @return 字段不存在、值类型不符或读取失败时返回false
+     */
+    template <typename T>
+    bool read_fields(const Stream& source, const std::vector<std::string>& fields, std::vector<long long>& timestamps, std::vector<std::vector<T>>& columns,
+        std::vector<std::vector<uint8_t>>* valid = nullptr)
     {
-        if (range.first == range.second)
-            return;
-        if (idxRangesMap.count(file) == 0)
-            addFile(file);
-        std::vector<std::pair<size_t, size_t>>& idxRangesOfFile = idxRangesMap.at(file);
-        auto res = Utils::mergeRange(idxRangesOfFile[idxRangesOfFile.size() - 1], range);
-        if (!res)
-            idxRangesOfFile.push_back(range);
+        std::vector<size_t> indexes;
+        for (const auto& field : fields) {
+            int index = source.fieldIndex(field);
+            if (index < 0) {
+                std::cerr << "Stream " << source.getName() << " has no field " << field << std::endl;
+                return false;
+            }
+            indexes.push_back(index);
+        }
+        timestamps.clear();
+        columns.assign(indexes.size(), std::vector<T>());
+        if (valid)
+            valid->assign(indexes.size(), std::vector<uint8_t>());
+        if (!checkValueType<T>(source))
+            return false;
+        // 普通块在前，溢出块在后
+        size_t mid = SIZE_MAX;
+        for (bool overflow : { false, true }) {
+            for (const auto& block : source.getBlocks()) {
+                if (block.overflow != overflow)
+                    continue;
+                if (overflow && mid == SIZE_MAX)
+                    mid = timestamps.size();
+                if (!readTimestamps(source, block, timestamps))
+                    return false;
+                for (size_t j = 0; j < indexes.size(); j++) {
+                    if (!readField(source, block, indexes[j], columns[j], valid ? &(*valid)[j] : nullptr))
+                        return false;
+                }
+            }
+        }
+        if (mid < timestamps.size() && !std::is_sorted(timestamps.begin(), timestamps.end())) {
+            std::vector<size_t> order(timestamps.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&timestamps](size_t a, size_t b) { return timestamps[a] < timestamps[b]; });
+            Utils::permute(timestamps, order);
+            for (auto& column : columns)
+                Utils::permute(column, order);
+            if (valid) {
+                for (auto& mask : *valid)
+                    Utils::permute(mask, order);
+            }
+        }
+        return true;
     }
 
-    void setTimestampOffset(long long offset)
+    /**
+     * @brief 聚合字段在[from, to]内的非空值。时间范围不相交的块不读取；完全落在范围内的块只解码非空值，不展开空值
+     *
+     * @return 字段不存在、值类型不符或读取失败时返回false
+     */
+    template <typename T>
+    bool aggregate_field(const Stream& source, const std::string& field, Aggregate& result, long long from = LLONG_MIN, long long to = LLONG_MAX)
     {
-        timestampOffset = offset;
+        size_t index;
+        if (!resolveField<T>(source, field, index))
+            return false;
+        std::vector<long long> timestamps;
+        std::vector<T> values;
+        std::vector<uint8_t> mask;
+        std::vector<char> bitmap;
+        for (const auto& block : source.getBlocks()) {
+            if (block.maxTimestamp < from || block.minTimestamp > to)
+                continue;
+            values.clear();
+            if (block.minTimestamp >= from && block.maxTimestamp <= to) {
+                if (!readPackedField(source, block, index, values, bitmap))
+                    return false;
+                Kernels::aggregate(values, result);
+                result.nulls += block.fieldNullCount(index);
+                continue;
+            }
+            timestamps.clear();
+            mask.clear();
+            if (!readTimestamps(source, block, timestamps) || !readField(source, block, index, values, &mask))
+                return false;
+            // 范围外的行按空值屏蔽，但不计入nulls
+            size_t nulls = 0;
+            for (size_t i = 0; i < timestamps.size(); i++) {
+                bool inRange = timestamps[i] >= from && timestamps[i] <= to;
+                nulls += inRange && !mask[i];
+                mask[i] = inRange && mask[i];
+            }
+            Aggregate local;
+            Kernels::aggregate(values, mask, local);
+            local.nulls = nulls;
+            result.merge(local);
+        }
+        return true;
     }
 
-    void setTimeUnit(std::string unit)
+    /**
+     * @brief 找出字段在[from, to]内满足谓词的非空值，按时间顺序写入timestamps和values（原有内容被清空）。
+     * 值域与谓词不相交的块不读取；其余块先只解码值列做比较，有命中时才解码时间戳
+     *
+     * @return 字段不存在、值类型不符或读取失败时返回false
+     */
+    template <typename T>
+    bool filter_field(const Stream& source, const std::string& field, const Predicate& predicate, std::vector<long long>& timestamps, std::vector<T>& values,
+        long long from = LLONG_MIN, long long to = LLONG_MAX)
     {
-        timeUnit = unit;
+        size_t index;
+        timestamps.clear();
+        values.clear();
+        if (!resolveField<T>(source, field, index))
+            return false;
+        bool sorted = true;
+        std::vector<long long> blockTimestamps;
+        std::vector<T> blockValues;
+        std::vector<uint8_t> mask;
+        std::vector<uint32_t> rows;
+        for (const auto& block : source.getBlocks()) {
+            if (!scanBlock(block, index, from, to) || !predicate.overlaps(block.fieldMinValue(index), block.fieldMaxValue(index)))
+                continue;
+            blockValues.clear();
+            mask.clear();
+            rows.clear();
+            if (!readField(source, block, index, blockValues, block.fieldNullCount(index) ? &mask : nullptr))
+                return false;
+            Kernels::select(blockValues, predicate, mask, rows);
+            if (rows.empty())
+                continue;
+            blockTimestamps.clear();
+            if (!readTimestamps(source, block, blockTimestamps))
+                return false;
+            for (uint32_t r : rows) {
+                if (blockTimestamps[r] < from || blockTimestamps[r] > to)
+                    continue;
+                // 溢出块与普通块的时间范围可能重叠
+                sorted = sorted && (timestamps.empty() || blockTimestamps[r] >= timestamps.back());
+                timestamps.push_back(blockTimestamps[r]);
+                values.push_back(blockValues[r]);
+            }
+        }
+        if (!sorted)
+            Utils::sortColumnsByKey(timestamps, values);
+        return true;
     }
 
-    nlohmann::json to_json() const
+    /**
+     * @brief 字段在[from, to]内最大（largest为false时最小）的k个非空值，按名次写入timestamps和values（原有内容被清空），
+     * 值相同时时间早的在前。块按值域的上界（下界）依次扫描，k个候选凑满后值域够不上第k名的块不再读取，
+     * 其余块的比较谓词随第k名收紧
+     *
+     * @return 字段不存在、值类型不符或读取失败时返回false
+     */
+    template <typename T>
+    bool top_field(const Stream& source, const std::string& field, size_t k, std::vector<long long>& timestamps, std::vector<T>& values,
+        bool largest = true, long long from = LLONG_MIN, long long to = LLONG_MAX)
     {
-        nlohmann::json j;
-        j["streamNumber"] = streamNumber;
-        j["timestampOffset"] = timestampOffset;
-        j["timeUnit"] = timeUnit;
-        for (const auto& pair : idxRangesMap) {
-            nlohmann::json ranges;
-            for (const auto& range : pair.second) {
-                ranges.push_back({ { "start", range.first }, { "end", range.second } });
+        size_t index;
+        timestamps.clear();
+        values.clear();
+        if (!resolveField<T>(source, field, index))
+            return false;
+        // 求最小值时取相反数，统一按key从大到小排名；堆顶是当前第k名
+        using Candidate = std::tuple<double, long long, T>;
+        auto better = [](const Candidate& a, const Candidate& b) {
+            return std::get<0>(a) > std::get<0>(b) || (std::get<0>(a) == std::get<0>(b) && std::get<1>(a) < std::get<1>(b));
+        };
+        std::priority_queue<Candidate, std::vector<Candidate>, decltype(better)> heap(better);
+        std::vector<std::pair<double, const Block*>> order;
+        for (const auto& block : source.getBlocks()) {
+            if (scanBlock(block, index, from, to))
+                order.emplace_back(largest ? block.fieldMaxValue(index) : -block.fieldMinValue(index), &block);
+        }
+        std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        std::vector<long long> blockTimestamps;
+        std::vector<T> blockValues;
+        std::vector<uint8_t> mask;
+        std::vector<uint32_t> rows;
+        for (const auto& [bound, block] : order) {
+            if (k == 0 || (heap.size() == k && bound < std::get<0>(heap.top())))
+                break;
+            Predicate predicate;
+            if (heap.size() == k) {
+                double kth = std::get<0>(heap.top());
+                predicate = largest ? Predicate::greaterEqual(kth) : Predicate::lessEqual(-kth);
+            }
+            blockValues.clear();
+            mask.clear();
+            rows.clear();
+            if (!readField(source, *block, index, blockValues, block->fieldNullCount(index) ? &mask : nullptr))
+                return false;
+            Kernels::select(blockValues, predicate, mask, rows);
+            if (rows.empty())
+                continue;
+            blockTimestamps.clear();
+            if (!readTimestamps(source, *block, blockTimestamps))
+                return false;
+            for (uint32_t r : rows) {
+                if (blockTimestamps[r] < from || blockTimestamps[r] > to)
+                    continue;
+                double v = static_cast<double>(blockValues[r]);
+                Candidate candidate { largest ? v : -v, blockTimestamps[r], blockValues[r] };
+                if (heap.size() < k) {
+                    heap.push(candidate);
+                } else if (better(candidate, heap.top())) {
+                    heap.pop();
+                    heap.push(candidate);
+                }
             }
-            j["idxRangesMap"][pair.first] = ranges;
         }
-        return j;
+        for (; !heap.empty(); heap.pop()) {
+            timestamps.push_back(std::get<1>(heap.top()));
+            values.push_back(std::get<2>(heap.top()));
+        }
+        std::reverse(timestamps.begin(), timestamps.end());
+        std::reverse(values.begin(), values.end());
+        return true;
     }
 
-    void emit(const std::string& targetDir)
+    /**
+     * @brief 字段在[from, to]内非空值的分位数草图，结果写入sketch（原有内容被清空）。完全落在范围内且带草图的块只读取草图，
+     * 与范围部分相交或没有草图的块解码后逐块加入结果草图，不保留解码的值。分位数的相对误差不超过写入时的sketch.accuracy
+     *
+     * @return 字段不存在、值类型不符、bool流或读取失败时返回false
+     */
+    template <typename T>
+    bool sketch_field(const Stream& source, const std::string& field, QuantileSketch& sketch, long long from = LLONG_MIN, long long to = LLONG_MAX)
     {
-        std::filesystem::create_directory(targetDir);
-        std::string path = targetDir + '/' + streamName + datetimeStr + ".json";
-        std::fstream file(path, std::ios::out);
-        if (!file) {
-            std::cerr << "Cannot open file " << path << std::endl;
-            return;
+        size_t index;
+        if (!resolveField<T>(source, field, index))
+            return false;
+        if constexpr (std::is_same_v<T, bool>) {
+            std::cerr << "Stream " << source.getName() << " stores bool values, which have no quantiles" << std::endl;
+            return false;
+        } else {
+            double accuracy = arguments.sketchAccuracy > 0 && arguments.sketchAccuracy < 1 ? arguments.sketchAccuracy : 0.01;
+            QuantileSketch result(accuracy, arguments.sketchMaxBuckets);
+            std::vector<long long> timestamps;
+            std::vector<T> values;
+            std::vector<uint8_t> mask;
+            for (const auto& block : source.getBlocks()) {
+                if (block.maxTimestamp < from || block.minTimestamp > to)
+                    continue;
+                if (block.minTimestamp >= from && block.maxTimestamp <= to && block.fieldSketchSize(index)) {
+                    QuantileSketch blockSketch;
+                    if (!readSketch(source, block, index, blockSketch))
+                        return false;
+                    // 结果还是空的时沿用块草图的精度；精度不同的草图不能合并，退回解码
+                    if (result.empty()) {
+                        result = std::move(blockSketch);
+                        continue;
+                    }
+                    if (result.merge(blockSketch))
+                        continue;
+                }
+                timestamps.clear();
+                values.clear();
+                mask.clear();
+                if (!readTimestamps(source, block, timestamps) || !readField(source, block, index, values, &mask))
+                    return false;
+                for (size_t i = 0; i < timestamps.size(); i++)
+                    mask[i] = mask[i] && timestamps[i] >= from && timestamps[i] <= to;
+                result.add(values, mask);
+            }
+            sketch = std::move(result);
+            return true;
         }
-        auto jsonStr = this->to_json().dump(4);
-        file << jsonStr;
     }
 
-    void resetNumber()
+    /**
+     * @brief 字段在[from, to]内非空值的分位数，results[i]对应qs[i]（0 <= q <= 1），范围内没有值时为NaN
+     */
+    template <typename T>
+    bool quantile_field(const Stream& source, const std::string& field, const std::vector<double>& qs, std::vector<double>& results,
+        long long from = LLONG_MIN, long long to = LLONG_MAX)
     {
-        streamNumber = 0;
+        QuantileSketch sketch;
+        if (!sketch_field<T>(source, field, sketch, from, to))
+            return false;
+        results.clear();
+        for (double q : qs)
+            results.push_back(sketch.quantile(q));
+        return true;
     }
 
-    void setName(std::string name)
+    /**
+     * @brief 解压并解码一个块，结果追加到timestamps和values末尾。多字段流读取第一个字段，空值读作NaN（浮点）、0或false
+     */
+    template <typename T>
+    bool read_block(const Stream& source, const Block& block, std::vector<long long>& timestamps, std::vector<T>& values)
     {
-        streamName = name;
+        return checkValueType<T>(source) && readTimestamps(source, block, timestamps) && readField(source, block, 0, values);
     }
 
-    size_t getNumber() const
+    /**
+     * @brief 解压并解码一个块的全部字段，时间戳追加到timestamps，第k个字段按行追加到columns[k]，columns不足字段数时补齐。
+     * 空值读作NaN（浮点）、0或false
+     *
+     * @param valid 非空时同样追加每个字段的有效性掩码，0表示空值
+     */
+    template <typename T>
+    bool read_block_fields(const Stream& source, const Block& block, std::vector<long long>& timestamps, std::vector<std::vector<T>>& columns,
+        std::vector<std::vector<uint8_t>>* valid = nullptr)
     {
-        return streamNumber;
+        size_t width = source.fieldCount();
+        columns.resize(std::max(columns.size(), width));
+        if (valid)
+            valid->resize(std::max(valid->size(), width));
+        if (!checkValueType<T>(source) || !readTimestamps(source, block, timestamps))
+            return false;
+        for (size_t k = 0; k < width; k++) {
+            if (!readField(source, block, k, columns[k], valid ? &(*valid)[k] : nullptr))
+                return false;
+        }
+        return true;
     }
 
-    std::string getName() const
+    std::string blockFileName(const std::string& dir, const std::string& prefix, size_t index) const
     {
-        return streamName;
+        std::stringstream indexStr;
+        indexStr << std::setw(arguments.indexWidth) << std::setfill('0') << index;
+        std::map<std::string, std::string> argsMap = { { "prefix", prefix }, { "index", indexStr.str() } };
+        return dir + '/' + Utils::parseFormatStr(arguments.fileNameFormat, argsMap) + ".zst";
     }
 
-    void setDatetimeStr(std::string datetime)
+    template <typename T>
+    bool checkValueType(const Stream& source) const
     {
-        datetimeStr = datetime;
+        if (source.getValueType() == ValueTraits<T>::type)
+            return true;
+        std::cerr << "Stream " << source.getName() << " stores " << valueTypeName(source.getValueType())
+                  << " values, cannot read as " << valueTypeName(ValueTraits<T>::type) << std::endl;
+        return false;
     }
 
-    std::string getDatetimeStr() const
+    bool readTimestamps(const Stream& source, const Block& block, std::vector<long long>& timestamps)
     {
-        return datetimeStr;
+        std::vector<char> bytes;
+        if (!readBlockFile(blockFileName(source.getDataPath(), arguments.timestampsFileNamePrefix, block.index), bytes))
+            return false;
+        Metrics::ScopedTimer timer(Metrics::STAGE_DECODE, bytes.size());
+        if (!Codec::decodeTimestamps(block.timestampEncoding, bytes.data(), bytes.size(), block.count, timestamps)) {
+            std::cerr << "Corrupted block " << block.index << " of stream " << source.getName() << std::endl;
+            return false;
+        }
+        return true;
     }
 
-    void showPerformance()
+    /**
+     * @brief 只解码非空值，追加到values；bitmap为有效性位图，没有空值时为空
+     */
+    template <typename T>
+    bool readPackedField(const Stream& source, const Block& block, size_t field, std::vector<T>& values, std::vector<char>& bitmap)
     {
-        std::cout << "stream " << streamName << "\'s performance: " << std::endl;
-        std::cout << "stream input size:  \t" << streamInputSize / 1024.0 << " KB" << std::endl;
-        std::cout << "stream output size: \t" << streamOutputSize / 1024.0 << " KB" << std::endl;
-        std::cout << "compress time cost: \t" << compressTimeMs << " ms." << std::endl;
-        std::cout << "compress ratio:     \t" << 100.0 * streamInputSize / streamOutputSize << " %." << std::endl;
-        std::cout << "throughput:         \t" << (streamInputSize / compressTimeMs) * 1000 / 1024 / 1024 << " MB/s.\n"
-                  << std::endl;
+        std::vector<char> bytes;
+        if (!readBlockFile(blockFileName(source.getDataPath(), valuesFilePrefix(field), block.index), bytes))
+            return false;
+        Metrics::ScopedTimer timer(Metrics::STAGE_DECODE, bytes.size());
+        size_t nulls = block.fieldNullCount(field);
+        size_t bitmapBytes = nulls ? (block.count + 7) / 8 : 0;
+        bitmap.assign(bytes.begin(), bytes.begin() + std::min(bitmapBytes, bytes.size()));
+        if (bytes.size() < bitmapBytes || nulls > block.count
+            || (nulls < block.count && !Codec::decodeValues(block.fieldValueEncoding(field), bytes.data() + bitmapBytes, bytes.size() - bitmapBytes, block.count - nulls, values))) {
+            std::cerr << "Corrupted block " << block.index << " of stream " << source.getName() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 解码一个字段的值列，按行追加到values，空值处填Kernels::nullValue；mask非空时追加有效性掩码
+     */
+    template <typename T>
+    bool readField(const Stream& source, const Block& block, size_t field, std::vector<T>& values, std::vector<uint8_t>* mask = nullptr)
+    {
+        if (block.fieldNullCount(field) == 0) {
+            std::vector<char> bitmap;
+            if (!readPackedField(source, block, field, values, bitmap))
+                return false;
+            if (mask)
+                mask->resize(mask->size() + block.count, 1);
+            return true;
+        }
+        std::vector<T> packed;
+        std::vector<char> bitmap;
+        if (!readPackedField(source, block, field, packed, bitmap))
+            return false;
+        const uint8_t* bits = reinterpret_cast<const uint8_t*>(bitmap.data());
+        if (!Kernels::expand(bits, packed, block.count, values, Kernels::nullValue<T>())) {
+            std::cerr << "Corrupted validity bitmap in block " << block.index << " of stream " << source.getName() << std::endl;
+            return false;
+        }
+        if (mask)
+            Kernels::unpackBitmap(bits, block.count, *mask);
+        return true;
     }
-};
 
-size_t Stream::streamNumber = 0;
+    // 字段名转为序号并检查值类型
+    template <typename T>
+    bool resolveField(const Stream& source, const std::string& field, size_t& index) const
+    {
+        int i = source.fieldIndex(field);
+        if (i < 0) {
+            std::cerr << "Stream " << source.getName() << " has no field " << field << std::endl;
+            return false;
+        }
+        index = i;
+        return checkValueType<T>(source);
+    }
 
-struct tsdb_entry {
-    enum CompressOp {
-        COMPRESS_ERROR,
-        COMPRESS_CONTINUE,
-        COMPRESS_END
-    };
+    // 块与时间范围相交，且该字段不全为空
+    static bool scanBlock(const Block& block, size_t field, long long from, long long to)
+    {
+        return block.maxTimestamp >= from && block.minTimestamp <= to && block.fieldNullCount(field) < block.count;
+    }
 
-private:
-    struct Arguments {
-        int compress_compressionLevel;
-        size_t compress_outBufferSize;
-        size_t zstFileMaxSize;
-        size_t indexWidth;
-        std::string dataDir;
-        std::string jsonDir;
-        std::string fileNameFormat;
-        std::string timestampsFileNamePrefix;
-        std::string valuesFileNamePrefix;
-    } arguments;
+    bool readSketch(const Stream& source, const Block& block, size_t field, QuantileSketch& sketch)
+    {
+        std::vector<char> bytes;
+        if (!readBlockFile(blockFileName(source.getDataPath(), sketchFilePrefix(field), block.index), bytes))
+            return false;
+        Metrics::ScopedTimer timer(Metrics::STAGE_DECODE, bytes.size());
+        if (!QuantileSketch::deserialize(bytes.data(), bytes.size(), sketch, arguments.sketchMaxBuckets)) {
+            std::cerr << "Corrupted sketch of block " << block.index << " of stream " << source.getName() << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-    Stream* stream;
+    // 第1个字段沿用valuesFileNamePrefix，其后的字段加上序号
+    std::string valuesFilePrefix(size_t field) const
+    {
+        return field == 0 ? arguments.valuesFileNamePrefix : arguments.valuesFileNamePrefix + std::to_string(field);
+    }
 
-public:
-    tsdb_entry()
+    std::string sketchFilePrefix(size_t field) const
     {
-        arguments.compress_outBufferSize = ArgParser::get<size_t>("outBufferSize", "hf_compress");
-        arguments.compress_compressionLevel = ArgParser::get<int>("compressionLevel", "hf_compress");
-        arguments.dataDir = ArgParser::get<std::string>("dataDir", "hf");
-        arguments.jsonDir = ArgParser::get<std::string>("jsonDir", "hf");
-        arguments.fileNameFormat = ArgParser::get<std::string>("fileNameFormat", "hf");
-        arguments.timestampsFileNamePrefix = ArgParser::get<std::string>("timestampsFileNamePrefix", "hf");
-        arguments.valuesFileNamePrefix = ArgParser::get<std::string>("valuesFileNamePrefix", "hf");
-        arguments.indexWidth = 10;
-        std::filesystem::create_directory(arguments.dataDir);
-        std::filesystem::create_directory(arguments.jsonDir);
+        return field == 0 ? "sketch" : "sketch" + std::to_string(field);
     }
 
-    void initialize(long long timestampOffset = 0, std::string timeUnit = "ns")
+    // 暂存区开始出现空值时补齐之前各行的掩码
+    template <typename T>
+    static void appendRow(std::vector<T>& values, std::vector<uint8_t>& mask, const T* row, const uint8_t* valid, size_t width)
     {
-        stream = new Stream();
-        stream->setTimestampOffset(timestampOffset);
-        stream->setTimeUnit(timeUnit);
+        if (width == 1)
+            values.push_back(*row);
+        else
+            values.insert(values.end(), row, row + width);
+        if (valid && mask.size() < values.size() - width)
+            mask.resize(values.size() - width, 1);
+        if (valid)
+            mask.insert(mask.end(), valid, valid + width);
+        else if (!mask.empty())
+            mask.resize(values.size(), 1);
     }
 
-    void close()
+    // 按时间戳稳定排序暂存的行，有掩码时与值同步重排
+    template <typename T>
+    static void sortRows(std::vector<long long>& timestamps, std::vector<T>& values, std::vector<uint8_t>& mask, size_t from, size_t width)
     {
-        stream->showPerformance();
-        stream->emit(arguments.jsonDir);
-        delete stream;
-        stream = nullptr;
+        if (mask.empty()) {
+            Utils::sortColumnsByKey(timestamps, values, from, width);
+            Utils::mergeSortedColumns(timestamps, values, from, width);
+            return;
+        }
+        if (std::is_sorted(timestamps.begin(), timestamps.end()))
+            return;
+        std::vector<size_t> order(timestamps.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&timestamps](size_t a, size_t b) { return timestamps[a] < timestamps[b]; });
+        Utils::permute(timestamps, order);
+        Utils::permuteRows(values, order, width);
+        Utils::permuteRows(mask, order, width);
     }
 
-    int insert_points(const std::vector<point>& points)
+    /**
+     * @param width 每个时间戳的值个数，get(i)返回第i行的时间戳和指向width个值的指针
+     * @param valid 可为空，按行存放的有效性掩码
+     */
+    template <typename T, typename Get>
+    int ingest(const std::string& name, size_t n, size_t width, const uint8_t* valid, Get get)
     {
         if (!stream) {
             std::cerr << "You should call initialize() first." << std::endl;
             exit(0);
         }
+        if (width != stream->fieldCount() || (width == 1 && !stream->getFields().empty())) {
+            std::cerr << "Stream " << stream->getName() << " has " << stream->fieldCount() << " fields, cannot insert " << width << std::endl;
+            return -3;
+        }
+        if (n == 0)
+            return 0;
+        std::unique_lock<std::mutex> lock(liveMutex);
+        if (!stream->bindValueType(ValueTraits<T>::type)) {
+            std::cerr << "Stream " << stream->getName() << " stores " << valueTypeName(stream->getValueType())
+                      << " values, cannot insert " << valueTypeName(ValueTraits<T>::type) << std::endl;
+            return -1;
+        }
 
-        stream->setName(points[0].name_);
-        stream->setDatetimeStr(Utils::getCurDatetimeStr());
-        std::vector<long long> timestamps;
-        std::vector<double> values;
-        for (auto& p : points) {
-            timestamps.push_back(p.nanoseconds_);
-            values.push_back(p.value_);
+        if (stream->getDataPath().empty()) {
+            stream->setName(name);
+            // 同名的流在同一秒内创建时加序号区分，避免覆盖
+            std::string now = Utils::getCurDatetimeStr(), datetime = now;
+            for (int i = 1; std::filesystem::exists(arguments.dataDir + '/' + stream->getName() + datetime); i++)
+                datetime = now + '-' + std::to_string(i);
+            stream->setDatetimeStr(datetime);
+            stream->setDataPath(arguments.dataDir + '/' + stream->getName() + stream->getDatetimeStr());
+            std::filesystem::create_directory(stream->getDataPath());
+        }
+
+        if (!staging)
+            staging = std::make_unique<TypedStaging<T>>();
+        auto& st = static_cast<TypedStaging<T>&>(*staging);
+
+        auto start = std::chrono::steady_clock::now();
+        size_t stagedSize = st.timestamps.size();
+        long long last = stagedSize ? st.timestamps.back() : LLONG_MIN;
+        bool sorted = true;
+        st.timestamps.reserve(stagedSize + n);
+        st.values.reserve((stagedSize + n) * width);
+        for (size_t i = 0; i < n; i++) {
+            auto [timestamp, row] = get(i);
+            const uint8_t* rowValid = valid ? valid + i * width : nullptr;
+            if (timestamp < st.sealedTimestamp) {
+                st.overflowTimestamps.push_back(timestamp);
+                appendRow(st.overflowValues, st.overflowValid, row, rowValid, width);
+                continue;
+            }
+            sorted = sorted && timestamp >= last;
+            last = timestamp;
+            st.maxTimestamp = std::max(st.maxTimestamp, timestamp);
+            st.timestamps.push_back(timestamp);
+            if (width == 1 && st.valid.empty() && !valid)
+                st.values.push_back(*row);
+            else
+                appendRow(st.values, st.valid, row, rowValid, width);
+        }
+        if (!sorted)
+            sortRows(st.timestamps, st.values, st.valid, stagedSize, width);
+        lock.unlock();
+        int ret = sealStaging(st, false);
+        auto end = std::chrono::steady_clock::now();
+        lock.lock();
+        stream->compressTimeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        return ret;
+    }
+
+    /**
+     * @brief 封存暂存区中已不会再被迟到点插队的数据
+     *
+     * @param final 为true时不考虑乱序窗口，封存全部暂存数据和溢出数据
+     */
+    template <typename T>
+    int sealStaging(TypedStaging<T>& st, bool final)
+    {
+        size_t ready = st.timestamps.size();
+        if (!final && ready > 0) {
+            long long watermark = st.maxTimestamp - arguments.reorderWindow;
+            ready = std::upper_bound(st.timestamps.begin(), st.timestamps.end(), watermark) - st.timestamps.begin();
+            ready -= ready % arguments.blockPoints;
+        }
+
+        int ret = 0;
+        if (ready > 0) {
+            freeze(st, st.timestamps, st.values, st.valid, ready);
+            ret = sealFrozen(st, false);
         }
+        if (ret == 0 && !st.overflowTimestamps.empty() && (final || st.overflowTimestamps.size() >= arguments.blockPoints)) {
+            {
+                std::lock_guard<std::mutex> lock(liveMutex);
+                sortRows(st.overflowTimestamps, st.overflowValues, st.overflowValid, 0, stream->fieldCount());
+            }
+            freeze(st, st.overflowTimestamps, st.overflowValues, st.overflowValid, st.overflowTimestamps.size());
+            ret = sealFrozen(st, true);
+        }
+        return ret;
+    }
+
+    // 把暂存区或溢出区的前count行移入冻结区，封存为块之前快照仍能读到它们
+    template <typename T>
+    void freeze(TypedStaging<T>& st, std::vector<long long>& timestamps, std::vector<T>& values, std::vector<uint8_t>& valid, size_t count)
+    {
+        size_t width = stream->fieldCount();
+        auto rows = std::make_shared<Memtable<T>>();
+        rows->timestamps.assign(timestamps.begin(), timestamps.begin() + count);
+        rows->values.assign(values.begin(), values.begin() + count * width);
+        if (!valid.empty())
+            rows->valid.assign(valid.begin(), valid.begin() + count * width);
+        std::lock_guard<std::mutex> lock(liveMutex);
+        timestamps.erase(timestamps.begin(), timestamps.begin() + count);
+        values.erase(values.begin(), values.begin() + count * width);
+        if (!valid.empty())
+            valid.erase(valid.begin(), valid.begin() + count * width);
+        st.frozen = std::move(rows);
+        st.frozenBegin = 0;
+    }
 
-        std::string targetDir = arguments.dataDir + '/' + stream->getName() + stream->getDatetimeStr();
+    /**
+     * @brief 逐块封存冻结区。每个块落盘后在锁内登记到流并移出冻结区，快照中的每个点恰好在块或内存行之一；
+     * 失败时未封存的行放回暂存区（overflow为true时放回溢出区）
+     */
+    template <typename T>
+    int sealFrozen(TypedStaging<T>& st, bool overflow)
+    {
+        const Memtable<T>& rows = *st.frozen;
+        size_t width = stream->fieldCount(), total = rows.timestamps.size();
+        std::vector<long long> blockTimestamps;
+        std::vector<T> blockValues;
+        std::vector<uint8_t> blockValid;
+        int ret = 0;
+        while (st.frozenBegin < total && ret == 0) {
+            size_t beg = st.frozenBegin, end = std::min(beg + arguments.blockPoints, total);
+            blockTimestamps.assign(rows.timestamps.begin() + beg, rows.timestamps.begin() + end);
+            blockValues.assign(rows.values.begin() + beg * width, rows.values.begin() + end * width);
+            if (!rows.valid.empty())
+                blockValid.assign(rows.valid.begin() + beg * width, rows.valid.begin() + end * width);
+            ret = sealBlock(blockTimestamps, blockValues, blockValid, overflow, [&st, end] { st.frozenBegin = end; });
+            if (ret == 0 && !overflow)
+                st.sealedTimestamp = blockTimestamps.back();
+        }
 
-        auto bytes1 = Utils::vec2Bytes(timestamps);
-        auto bytes2 = Utils::vec2Bytes(values);
+        std::lock_guard<std::mutex> lock(liveMutex);
+        if (ret != 0) {
+            auto& timestamps = overflow ? st.overflowTimestamps : st.timestamps;
+            auto& values = overflow ? st.overflowValues : st.values;
+            auto& valid = overflow ? st.overflowValid : st.valid;
+            size_t staged = values.size();
+            timestamps.insert(timestamps.begin(), rows.timestamps.begin() + st.frozenBegin, rows.timestamps.end());
+            values.insert(values.begin(), rows.values.begin() + st.frozenBegin * width, rows.values.end());
+            if (!rows.valid.empty() || !valid.empty()) {
+                if (valid.empty())
+                    valid.assign(staged, 1);
+                if (rows.valid.empty())
+                    valid.insert(valid.begin(), values.size() - staged, 1);
+                else
+                    valid.insert(valid.begin(), rows.valid.begin() + st.frozenBegin * width, rows.valid.end());
+            }
+        }
+        st.frozen.reset();
+        st.frozenBegin = 0;
+        return ret;
+    }
 
-        auto start = std::chrono::high_resolution_clock::now();
-        auto [range1, outputSize1] = compressBytesToFiles(bytes1, targetDir, arguments.timestampsFileNamePrefix);
-        auto [range2, outputSize2] = compressBytesToFiles(bytes2, targetDir, arguments.valuesFileNamePrefix);
-        auto end = std::chrono::high_resolution_clock::now();
-        auto timeCostMS = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    /**
+     * @brief 编码并写出一个块，块元数据登记到当前流
+     *
+     * @param valid 按行存放的有效性掩码，为空表示没有空值
+     * @param publish 与登记块在同一个临界区内调用，把这些行移出冻结区
+     */
+    template <typename T, typename Publish>
+    int sealBlock(const std::vector<long long>& timestamps, const std::vector<T>& values, const std::vector<uint8_t>& valid, bool overflow, Publish publish)
+    {
+        Block block;
+        block.index = stream->nextBlockIndex();
+        block.overflow = overflow;
+        block.count = timestamps.size();
+        block.minTimestamp = *std::min_element(timestamps.begin(), timestamps.end());
+        block.maxTimestamp = *std::max_element(timestamps.begin(), timestamps.end());
+
+        size_t width = stream->fieldCount();
+        std::vector<char> timestampsBytes;
+        std::vector<std::vector<char>> valuesBytes(width);
+        std::vector<Encoding> valueEncodings(width);
+        std::vector<size_t> nullCounts(width);
+        std::vector<std::vector<char>> sketchBytes(width);
+        std::vector<std::pair<double, double>> ranges(width);
+        {
+            Metrics::ScopedTimer timer(Metrics::STAGE_ENCODE, timestamps.size() * sizeof(long long) + values.size() * sizeof(T));
+            block.timestampEncoding = Codec::encodeTimestamps(timestamps, timestampsBytes);
+            if (width == 1 && valid.empty()) {
+                valueEncodings[0] = encodeValues(values, valuesBytes[0], ranges[0]);
+                sketchValues(values, sketchBytes[0]);
+            } else {
+                // 按行存放的值拆成每个字段一列，有空值的列以位图开头，只保留非空值
+                std::vector<T> column;
+                std::vector<uint8_t> mask(timestamps.size());
+                for (size_t k = 0; k < width; k++) {
+                    column.clear();
+                    for (size_t i = 0; i < timestamps.size(); i++) {
+                        mask[i] = valid.empty() || valid[i * width + k];
+                        if (mask[i])
+                            column.push_back(values[i * width + k]);
+                    }
+                    if (column.size() < timestamps.size())
+                        nullCounts[k] = Kernels::packBitmap(mask.data(), mask.size(), valuesBytes[k]);
+                    valueEncodings[k] = column.empty() ? ValueTraits<T>::encoding : encodeValues(column, valuesBytes[k], ranges[k]);
+                    if (column.empty())
+                        ranges[k] = valueRange(column);
+                    sketchValues(column, sketchBytes[k]);
+                }
+            }
+        }
 
-        stream->streamInputSize += bytes1.size() + bytes2.size();
-        stream->compressTimeMs += timeCostMS;
-        stream->streamOutputSize += outputSize1 + outputSize2;
-        stream->addIdxRangeOfFile(arguments.timestampsFileNamePrefix, range1);
-        stream->addIdxRangeOfFile(arguments.valuesFileNamePrefix, range2);
+        long long timestampsSize = writeBlockFile(blockFileName(stream->getDataPath(), arguments.timestampsFileNamePrefix, block.index), timestampsBytes);
+        if (timestampsSize < 0)
+            return -2;
+        block.timestampsSize = timestampsSize;
+        long long outputSize = timestampsSize;
+        for (size_t k = 0; k < width; k++) {
+            long long valuesSize = writeBlockFile(blockFileName(stream->getDataPath(), valuesFilePrefix(k), block.index), valuesBytes[k]);
+            long long sketchSize = sketchBytes[k].empty() ? 0 : writeBlockFile(blockFileName(stream->getDataPath(), sketchFilePrefix(k), block.index), sketchBytes[k]);
+            if (valuesSize < 0 || sketchSize < 0)
+                return -2;
+            if (k == 0) {
+                block.valuesSize = valuesSize;
+                block.valueEncoding = valueEncodings[0];
+                block.nullCount = nullCounts[0];
+                block.sketchSize = sketchSize;
+                std::tie(block.minValue, block.maxValue) = ranges[0];
+            } else {
+                block.extraFields.push_back({ static_cast<size_t>(valuesSize), valueEncodings[k], nullCounts[k], static_cast<size_t>(sketchSize), ranges[k].first, ranges[k].second });
+            }
+            outputSize += valuesSize + sketchSize;
+        }
 
+        std::pair<size_t, size_t> range = { block.index, block.index + 1 };
+        std::lock_guard<std::mutex> lock(liveMutex);
+        stream->addBlock(block);
+        stream->addIdxRangeOfFile(arguments.timestampsFileNamePrefix, range);
+        for (size_t k = 0; k < width; k++) {
+            stream->addIdxRangeOfFile(valuesFilePrefix(k), range);
+            if (block.fieldSketchSize(k))
+                stream->addIdxRangeOfFile(sketchFilePrefix(k), range);
+        }
+        stream->streamInputSize += timestamps.size() * sizeof(long long) + values.size() * sizeof(T);
+        stream->streamOutputSize += outputSize;
+        publish();
         return 0;
     }
 
-    std::vector<point> extract_points(const std::string& timestampsFilePath, const std::string& valuesFilePath)
+    // 非空值的下界和上界，忽略NaN；int64转为double时向外取整，保证仍是界
+    template <typename T>
+    static std::pair<double, double> valueRange(const std::vector<T>& values)
     {
-        std::vector<point> points;
-        auto timestampsStream = decompressBytesFromFile(arguments.dataDir, "timestamps.zst");
-        auto valuesStream = decompressBytesFromFile(arguments.dataDir, "values.zst");
-        auto timestamps = Utils::bytes2Vec<long long>(timestampsStream);
-        auto values = Utils::bytes2Vec<double>(valuesStream);
+        double min = std::numeric_limits<double>::infinity(), max = -std::numeric_limits<double>::infinity();
+        for (size_t i = 0; i < values.size(); i++) {
+            double v = static_cast<double>(values[i]);
+            min = v < min ? v : min;
+            max = v > max ? v : max;
+        }
+        if (min > max)
+            return { -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+        if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+            const double exact = 9007199254740992.0;
+            if (std::fabs(min) > exact)
+                min = std::nextafter(min, -std::numeric_limits<double>::infinity());
+            if (std::fabs(max) > exact)
+                max = std::nextafter(max, std::numeric_limits<double>::infinity());
+        }
+        return { min, max };
+    }
 
-        if (timestamps.size() != values.size()) {
-            std::cerr << "Mismatched sizes of decompressed timestamps and values" << std::endl;
-            return points;
+    // 非空值的分位数草图追加到bytes，bool列和sketch.accuracy为0时不生成；有损压缩的列按原值统计
+    template <typename T>
+    void sketchValues(const std::vector<T>& values, std::vector<char>& bytes)
+    {
+        if constexpr (!std::is_same_v<T, bool>) {
+            if (arguments.sketchAccuracy > 0 && arguments.sketchAccuracy < 1 && !values.empty()) {
+                QuantileSketch sketch(arguments.sketchAccuracy, arguments.sketchMaxBuckets);
+                sketch.add(values);
+                sketch.serialize(bytes);
+            }
         }
+    }
 
-        const auto name = new std::string("point");
-        for (size_t i = 0; i < timestamps.size(); i++) {
-            point p(*name, values[i], timestamps[i]);
-            points.push_back(p);
+    // 按值类型编码一列，追加到bytes，range为读出时的值域；开启有损压缩的浮点列优先量化，
+    // 量化块的值域取重建值的，过滤和top-k比较的是解码后的值，原值的值域可能把命中的块跳过
+    template <typename T>
+    Encoding encodeValues(const std::vector<T>& values, std::vector<char>& bytes, std::pair<double, double>& range)
+    {
+        if constexpr (std::is_floating_point_v<T>) {
+            size_t pos = bytes.size();
+            if (stream->getErrorBound().mode != ERROR_NONE && Codec::encodeQuantized(values, stream->getErrorBound(), bytes)) {
+                std::vector<T> restored;
+                Codec::decodeQuantized(bytes.data() + pos, bytes.size() - pos, values.size(), restored);
+                range = valueRange(restored);
+                return ENCODING_QUANTIZED;
+            }
         }
-        return points;
+        Codec::encode(values, bytes);
+        range = valueRange(values);
+        return ValueTraits<T>::encoding;
+    }
+
+    /**
+     * @brief 将bytes压缩为一个完整的zstd frame写入文件
+     *
+     * @return 压缩后的大小，失败时为-1
+     */
+    long long writeBlockFile(const std::string& fileName, const std::vector<char>& bytes)
+    {
+        size_t bound = ZSTD_compressBound(bytes.size());
+        if (compressBuffer.size() < bound)
+            compressBuffer.resize(bound);
+        size_t cSize;
+        {
+            Metrics::ScopedTimer timer(Metrics::STAGE_COMPRESS, bytes.size());
+            cSize = ZSTD_compressCCtx(cctx.get(), compressBuffer.data(), bound, bytes.data(), bytes.size(), arguments.compress_compressionLevel);
+        }
+        if (ZSTD_isError(cSize)) {
+            std::cerr << "ZSTD_compress error: " << ZSTD_getErrorName(cSize) << std::endl;
+            return -1;
+        }
+        {
+            Metrics::ScopedTimer timer(Metrics::STAGE_FILE_WRITE, cSize);
+            std::ofstream outFile(fileName, std::ios::trunc | std::ios::binary);
+            if (!outFile.write(compressBuffer.data(), cSize)) {
+                std::cerr << "Failed to write file " << fileName << std::endl;
+                return -1;
+            }
+        }
+        if (arguments.fsync)
+            syncFile(fileName);
+        return cSize;
+    }
+
+    bool readBlockFile(const std::string& fileName, std::vector<char>& bytes)
+    {
+        std::ifstream inFile(fileName, std::ios::binary | std::ios::ate);
+        if (!inFile) {
+            std::cerr << "Failed to open file " << fileName << std::endl;
+            return false;
+        }
+        std::vector<char> compressed(inFile.tellg());
+        inFile.seekg(0, std::ios::beg);
+        if (!inFile.read(compressed.data(), compressed.size())) {
+            std::cerr << "Failed to read file " << fileName << std::endl;
+            return false;
+        }
+
+        Metrics::ScopedTimer timer(Metrics::STAGE_DECOMPRESS, compressed.size());
+        unsigned long long contentSize = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+        if (contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize == ZSTD_CONTENTSIZE_UNKNOWN) {
+            std::cerr << "Not a zstd block file " << fileName << std::endl;
+            return false;
+        }
+        bytes.resize(contentSize);
+        size_t dSize = ZSTD_decompressDCtx(dctx.get(), bytes.data(), bytes.size(), compressed.data(), compressed.size());
+        if (ZSTD_isError(dSize)) {
+            std::cerr << "ZSTD_decompress error: " << ZSTD_getErrorName(dSize) << std::endl;
+            return false;
+        }
+        bytes.resize(dSize);
+        return true;
     }
 
     std::pair<std::pair<size_t, size_t>, size_t> compressBytesToFiles(const std::vector<char>& bytes, const std::string targetDir, const std::string& fileNamePrefix, size_t beg = 0)
@@ -324,6 +2440,8 @@ public:
         // 否则，需要多次调用该函数，直到CompressOP返回COMPRESS_END
         size_t inBufferCapacity = inBuffer.size;
         inBuffer.size = std::min(inBuffer.pos + std::min(outBuffer.size, inBufferCapacity), inBufferCapacity);
+        auto compressStart = std::chrono::steady_clock::now();
+        size_t compressInput = inBuffer.size - inBuffer.pos;
         size_t remaining = 1;
         while (remaining > 0)
             remaining = ZSTD_compressStream2(cctx, &outBuffer, &inBuffer, ZSTD_e_continue);
@@ -338,9 +2456,16 @@ public:
         if (ZSTD_isError(endResult)) {
             std::cerr << "Cannot end stream" << std::endl;
         }
+        auto compressEnd = std::chrono::steady_clock::now();
+        Metrics::record(Metrics::STAGE_COMPRESS, compressInput, std::chrono::duration_cast<std::chrono::nanoseconds>(compressEnd - compressStart).count());
 
-        outFile.write((char*)outBuffer.dst, outBuffer.size);
-        outFile.close();
+        {
+            Metrics::ScopedTimer timer(Metrics::STAGE_FILE_WRITE, outBuffer.size);
+            outFile.write((char*)outBuffer.dst, outBuffer.size);
+            outFile.close();
+        }
+        if (arguments.fsync)
+            syncFile(fileName);
 
         auto res = COMPRESS_CONTINUE;
         if (inBufferCapacity == inBuffer.pos)
@@ -434,6 +2559,7 @@ public:
             return output;
         }
         ZSTD_initDStream(dctx);
+        Metrics::ScopedTimer timer(Metrics::STAGE_DECOMPRESS);
 
         size_t const buffInSize = ZSTD_DStreamInSize();
         std::vector<char> input(buffInSize);
@@ -465,9 +2591,24 @@ public:
         output.resize(outBuff.pos);
         res.insert(res.end(), output.begin(), output.end());
         ZSTD_freeDCtx(dctx);
+        timer.setBytes(res.size());
         return res;
     }
 
+    // 将文件内容刷到磁盘，耗时计入fsync阶段
+    void syncFile(const std::string& fileName)
+    {
+        Metrics::ScopedTimer timer(Metrics::STAGE_FSYNC);
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Cannot open file " << fileName << " for fsync" << std::endl;
+            return;
+        }
+        if (::fsync(fd) < 0)
+            std::cerr << "Cannot fsync file " << fileName << std::endl;
+        ::close(fd);
+    }
+
     // 将数据压缩并写入文件的辅助函数
     bool compressToFile(const std::string& filename, const void* data, size_t dataSize)
     {
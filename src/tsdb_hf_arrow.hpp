@@ -0,0 +1,371 @@
+// Arrow C data interface export of high frenqence streams
+#ifndef TSDB_HF_ARROW_HPP
+#define TSDB_HF_ARROW_HPP
+
+#include "tsdb_hf.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Arrow C数据接口和C流接口的结构体定义，与https://arrow.apache.org/docs/format/CDataInterface.html一致，
+// 已由arrow或nanoarrow的头文件定义时跳过
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+    int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema* out);
+    int (*get_next)(struct ArrowArrayStream*, struct ArrowArray* out);
+    const char* (*get_last_error)(struct ArrowArrayStream*);
+    void (*release)(struct ArrowArrayStream*);
+    void* private_data;
+};
+
+#endif // ARROW_C_STREAM_INTERFACE
+
+namespace tsdb_hf_cpp {
+
+/**
+ * @brief 以Arrow C数据接口导出解码后的列。数组是结构体，第一列为time，之后每个字段一列：
+ * 单字段流的值列以流名命名，多字段流的各列以字段名命名（struct<time, 流名>或struct<time, 字段1, 字段2, ...>）。
+ * 时间列按流的timeUnit取timestamp类型，值列为float64、float32、int64或bool，可为空，空值记在validity位图中。
+ * 列缓冲就是解码得到的vector，由导出的ArrowArray持有，消费者调用release后释放，中间不再复制
+ */
+class ArrowExport {
+public:
+    /**
+     * @brief 导出流的全部数据点，溢出块已归并，按时间有序
+     *
+     * @return 流或块读取失败时返回false，array和schema不被修改
+     */
+    static bool export_arrow(tsdb_entry& entry, const std::string& streamJsonPath, ArrowArray* array, ArrowSchema* schema)
+    {
+        Stream source;
+        if (!Stream::load(streamJsonPath, source))
+            return false;
+        std::vector<std::string> fields;
+        for (size_t k = 0; k < source.fieldCount(); k++)
+            fields.push_back(source.fieldName(k));
+        auto columns = std::make_shared<Columns>();
+        if (!decode(source, [&](auto& timestamps, auto& values, auto& valid) { return entry.read_fields(source, fields, timestamps, values, &valid); }, *columns))
+            return false;
+        exportSchema(source, schema);
+        exportArray(std::move(columns), array);
+        return true;
+    }
+
+    /**
+     * @brief 按块导出为ArrowArrayStream，每个块一个批次，溢出块排在最后，批次之间不保证时间有序
+     */
+    static bool export_arrow_stream(const std::string& streamJsonPath, ArrowArrayStream* stream)
+    {
+        auto state = std::make_unique<StreamState>();
+        if (!Stream::load(streamJsonPath, state->source))
+            return false;
+        for (size_t i = 0; i < state->source.getBlocks().size(); i++) {
+            if (!state->source.getBlocks()[i].overflow)
+                state->order.push_back(i);
+        }
+        for (size_t i = 0; i < state->source.getBlocks().size(); i++) {
+            if (state->source.getBlocks()[i].overflow)
+                state->order.push_back(i);
+        }
+        stream->get_schema = getSchema;
+        stream->get_next = getNext;
+        stream->get_last_error = getLastError;
+        stream->release = releaseStream;
+        stream->private_data = state.release();
+        return true;
+    }
+
+private:
+    // 一个字段解码得到的值列
+    struct FieldColumn {
+        std::vector<double> doubles;
+        std::vector<float> floats;
+        std::vector<int64_t> ints;
+        std::vector<uint8_t> bits; // bool按Arrow的位图排列，低位在前
+        const void* values = nullptr;
+        std::vector<char> validity; // 有效性位图，没有空值时为空
+        size_t nullCount = 0;
+    };
+
+    // 解码得到的列，由数组及其子数组共享
+    struct Columns {
+        std::vector<long long> timestamps;
+        std::vector<FieldColumn> fields;
+    };
+
+    struct ArrayPrivate {
+        std::shared_ptr<Columns> columns;
+        const void* buffers[2] = { nullptr, nullptr };
+        std::vector<ArrowArray*> children;
+        std::vector<ArrowArray> childArrays;
+    };
+
+    struct SchemaPrivate {
+        std::string format;
+        std::string name;
+        std::vector<ArrowSchema*> children;
+        std::vector<ArrowSchema> childSchemas;
+    };
+
+    struct StreamState {
+        Stream source;
+        std::unique_ptr<tsdb_entry> reader;
+        std::vector<size_t> order;
+        size_t next = 0;
+        std::string lastError;
+    };
+
+    // 按流的值类型解码，read(timestamps, columns, valid)填充时间列、每个字段的值列和有效性掩码
+    template <typename Read>
+    static bool decode(const Stream& source, Read&& read, Columns& columns)
+    {
+        bool ok = false;
+        switch (source.getValueType()) {
+        case VALUE_DOUBLE:
+            ok = decodeAs<double>(read, columns);
+            break;
+        case VALUE_FLOAT:
+            ok = decodeAs<float>(read, columns);
+            break;
+        case VALUE_INT64:
+            ok = decodeAs<int64_t>(read, columns);
+            break;
+        case VALUE_BOOL:
+            ok = decodeAs<bool>(read, columns);
+            break;
+        }
+        if (ok && source.getTimestampOffset()) {
+            for (auto& t : columns.timestamps)
+                t += source.getTimestampOffset();
+        }
+        return ok;
+    }
+
+    template <typename T, typename Read>
+    static bool decodeAs(Read& read, Columns& columns)
+    {
+        std::vector<std::vector<T>> values;
+        std::vector<std::vector<uint8_t>> valid;
+        if (!read(columns.timestamps, values, valid))
+            return false;
+        columns.fields.resize(values.size());
+        for (size_t k = 0; k < values.size(); k++) {
+            FieldColumn& field = columns.fields[k];
+            field.nullCount = Kernels::packBitmap(valid[k].data(), valid[k].size(), field.validity);
+            if (field.nullCount == 0)
+                field.validity.clear();
+            if constexpr (std::is_same_v<T, bool>) {
+                field.bits.assign((values[k].size() + 7) / 8, 0);
+                for (size_t i = 0; i < values[k].size(); i++)
+                    field.bits[i >> 3] |= static_cast<uint8_t>(values[k][i]) << (i & 7);
+                field.values = field.bits.data();
+            } else if constexpr (std::is_same_v<T, double>) {
+                field.doubles = std::move(values[k]);
+                field.values = field.doubles.data();
+            } else if constexpr (std::is_same_v<T, float>) {
+                field.floats = std::move(values[k]);
+                field.values = field.floats.data();
+            } else {
+                field.ints = std::move(values[k]);
+                field.values = field.ints.data();
+            }
+        }
+        return true;
+    }
+
+    static std::string timeFormat(const std::string& timeUnit)
+    {
+        if (timeUnit == "ns")
+            return "tsn:";
+        if (timeUnit == "us")
+            return "tsu:";
+        if (timeUnit == "ms")
+            return "tsm:";
+        if (timeUnit == "s")
+            return "tss:";
+        return "l";
+    }
+
+    static const char* valueFormat(ValueType type)
+    {
+        switch (type) {
+        case VALUE_FLOAT:
+            return "f";
+        case VALUE_INT64:
+            return "l";
+        case VALUE_BOOL:
+            return "b";
+        default:
+            return "g";
+        }
+    }
+
+    static void exportSchema(const Stream& source, ArrowSchema* schema)
+    {
+        size_t width = source.fieldCount();
+        auto* p = new SchemaPrivate();
+        p->format = "+s";
+        p->childSchemas.resize(width + 1);
+        for (size_t i = 0; i <= width; i++) {
+            auto* c = new SchemaPrivate();
+            c->format = i == 0 ? timeFormat(source.getTimeUnit()) : valueFormat(source.getValueType());
+            c->name = i == 0 ? "time" : source.getFields().empty() ? source.getName() : source.fieldName(i - 1);
+            initSchema(&p->childSchemas[i], c, 0);
+            if (i > 0)
+                p->childSchemas[i].flags = ARROW_FLAG_NULLABLE;
+            p->children.push_back(&p->childSchemas[i]);
+        }
+        initSchema(schema, p, static_cast<int64_t>(width + 1));
+    }
+
+    static void initSchema(ArrowSchema* schema, SchemaPrivate* p, int64_t children)
+    {
+        schema->format = p->format.c_str();
+        schema->name = p->name.c_str();
+        schema->metadata = nullptr;
+        schema->flags = 0;
+        schema->n_children = children;
+        schema->children = children ? p->children.data() : nullptr;
+        schema->dictionary = nullptr;
+        schema->release = releaseSchema;
+        schema->private_data = p;
+    }
+
+    static void releaseSchema(ArrowSchema* schema)
+    {
+        for (int64_t i = 0; i < schema->n_children; i++) {
+            if (schema->children[i]->release)
+                schema->children[i]->release(schema->children[i]);
+        }
+        delete static_cast<SchemaPrivate*>(schema->private_data);
+        schema->release = nullptr;
+    }
+
+    static void exportArray(std::shared_ptr<Columns> columns, ArrowArray* array)
+    {
+        int64_t length = static_cast<int64_t>(columns->timestamps.size());
+        size_t width = columns->fields.size();
+        auto* p = new ArrayPrivate();
+        p->childArrays.resize(width + 1);
+        for (size_t i = 0; i <= width; i++) {
+            auto* c = new ArrayPrivate();
+            c->columns = columns;
+            c->buffers[1] = i == 0 ? static_cast<const void*>(columns->timestamps.data()) : columns->fields[i - 1].values;
+            if (i > 0 && columns->fields[i - 1].nullCount)
+                c->buffers[0] = columns->fields[i - 1].validity.data();
+            initArray(&p->childArrays[i], c, length, 2, 0);
+            if (i > 0)
+                p->childArrays[i].null_count = static_cast<int64_t>(columns->fields[i - 1].nullCount);
+            p->children.push_back(&p->childArrays[i]);
+        }
+        p->columns = std::move(columns);
+        initArray(array, p, length, 1, static_cast<int64_t>(width + 1));
+    }
+
+    static void initArray(ArrowArray* array, ArrayPrivate* p, int64_t length, int64_t buffers, int64_t children)
+    {
+        array->length = length;
+        array->null_count = 0;
+        array->offset = 0;
+        array->n_buffers = buffers;
+        array->n_children = children;
+        array->buffers = p->buffers;
+        array->children = children ? p->children.data() : nullptr;
+        array->dictionary = nullptr;
+        array->release = releaseArray;
+        array->private_data = p;
+    }
+
+    // 子数组可能已被消费者移走并单独释放，列缓冲在最后一个引用释放时回收
+    static void releaseArray(ArrowArray* array)
+    {
+        for (int64_t i = 0; i < array->n_children; i++) {
+            if (array->children[i]->release)
+                array->children[i]->release(array->children[i]);
+        }
+        delete static_cast<ArrayPrivate*>(array->private_data);
+        array->release = nullptr;
+    }
+
+    static int getSchema(ArrowArrayStream* stream, ArrowSchema* out)
+    {
+        exportSchema(static_cast<StreamState*>(stream->private_data)->source, out);
+        return 0;
+    }
+
+    // 流结束时返回一个release为空的数组
+    static int getNext(ArrowArrayStream* stream, ArrowArray* out)
+    {
+        auto* state = static_cast<StreamState*>(stream->private_data);
+        if (state->next == state->order.size()) {
+            out->release = nullptr;
+            return 0;
+        }
+        if (!state->reader)
+            state->reader = std::make_unique<tsdb_entry>();
+        const Block& block = state->source.getBlocks()[state->order[state->next]];
+        auto columns = std::make_shared<Columns>();
+        if (!decode(state->source, [&](auto& timestamps, auto& values, auto& valid) { return state->reader->read_block_fields(state->source, block, timestamps, values, &valid); }, *columns)) {
+            state->lastError = "cannot read block " + std::to_string(block.index) + " of stream " + state->source.getName();
+            return EIO;
+        }
+        state->next++;
+        exportArray(std::move(columns), out);
+        return 0;
+    }
+
+    static const char* getLastError(ArrowArrayStream* stream)
+    {
+        auto* state = static_cast<StreamState*>(stream->private_data);
+        return state->lastError.empty() ? nullptr : state->lastError.c_str();
+    }
+
+    static void releaseStream(ArrowArrayStream* stream)
+    {
+        delete static_cast<StreamState*>(stream->private_data);
+        stream->release = nullptr;
+    }
+};
+
+}
+
+#endif // TSDB_HF_ARROW_HPP
@@ -0,0 +1,496 @@
+// parallel bulk loader of high frenqence data api
+#ifndef TSDB_HF_BULK_HPP
+#define TSDB_HF_BULK_HPP
+
+#include "tsdb_hf.hpp"
+#include "tsdb_hf_kernels.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace tsdb_hf_cpp {
+
+enum BulkFormat {
+    BULK_CSV, // 序列名,时间戳,值；只有两列时为时间戳,值，序列名由调用方给出
+    // InfluxDB行协议：measurement[,tag=v...] field=v[,field=v...] [时间戳]。measurement和标签中的转义（\ 、\,、\=）按原样保留在序列名中，
+    // 字段值为浮点、整数（i或u后缀）或布尔；字符串字段可含空格和转义，跳过并计入stringFields；没有时间戳的行不导入，计入untimed
+    BULK_LINE_PROTOCOL
+};
+
+inline bool parseBulkFormat(const std::string& name, BulkFormat& format)
+{
+    static const std::map<std::string, BulkFormat> formats = {
+        { "csv", BULK_CSV }, { "lp", BULK_LINE_PROTOCOL }, { "line-protocol", BULK_LINE_PROTOCOL }
+    };
+    auto it = formats.find(name);
+    if (it == formats.end())
+        return false;
+    format = it->second;
+    return true;
+}
+
+struct BulkStats {
+    size_t bytes = 0;
+    size_t lines = 0; // 不含空行和#开头的注释行
+    size_t points = 0;
+    size_t errors = 0; // 无法解析而跳过的行
+    size_t untimed = 0; // 没有时间戳、无法回填而跳过的行协议行
+    size_t stringFields = 0; // 跳过的行协议字符串字段
+    size_t series = 0;
+    double parseSeconds = 0;
+    double compressSeconds = 0;
+
+    double seconds() const
+    {
+        return parseSeconds + compressSeconds;
+    }
+
+    // 按输入字节计的吞吐
+    double gbps() const
+    {
+        return seconds() > 0 ? bytes / seconds() / 1e9 : 0;
+    }
+};
+
+/**
+ * @brief 批量导入。输入按行边界切成不超过windowBytes的窗口，逐个窗口处理：窗口再切成若干段，每个线程用向量化扫描
+ * 找出换行符和分隔符、用from_chars解析一段，得到每个序列的时间戳列和值列；之后各线程按序列领取，
+ * 把各段的列按文件顺序直接写入该序列的tsdb_entry完成压缩，释放这些列后再解析下一个窗口。
+ * 各序列的tsdb_entry跨窗口保持打开，全部窗口处理完后才close()，解析结果占用的内存以窗口大小为上限
+ *
+ * @tparam T 值类型
+ */
+template <typename T = double>
+class bulk_loader {
+public:
+    bulk_loader()
+        : bulk_loader(ArgParser::get<size_t>("threads", "hf_bulk"), ArgParser::get<size_t>("windowBytes", "hf_bulk"))
+    {
+    }
+
+    /**
+     * @param threads 解析和压缩的线程数，0表示使用全部硬件线程
+     * @param windowBytes 每次解析的输入字节数上限，0表示整个输入作为一个窗口
+     */
+    explicit bulk_loader(size_t threads, size_t windowBytes = DEFAULT_WINDOW_BYTES)
+        : threadCount(threads ? threads : std::max(1u, std::thread::hardware_concurrency()))
+        , windowBytes(windowBytes ? windowBytes : SIZE_MAX)
+    {
+    }
+
+    /**
+     * @brief 以mmap读入并导入文件
+     *
+     * @param series CSV只有时间戳和值两列时使用的序列名
+     * @return 各序列流的json文件路径，按序列名排序
+     */
+    std::vector<std::string> load(const std::string& path, BulkFormat format, BulkStats& stats, const std::string& series = "")
+    {
+        stats = BulkStats();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            std::cerr << "Cannot open " << path << std::endl;
+            if (fd >= 0)
+                ::close(fd);
+            return {};
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void* addr = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << "Cannot map " << path << std::endl;
+            return {};
+        }
+        if (!addr)
+            return {};
+        madvise(addr, size, MADV_SEQUENTIAL);
+        // 处理完的窗口所在的整页立即释放，映射的文件不会整个驻留
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto paths = loadWindows(static_cast<const char*>(addr), size, format, stats, series, [addr, page](size_t end) {
+            madvise(addr, end / page * page, MADV_DONTNEED);
+        });
+        munmap(addr, size);
+        return paths;
+    }
+
+    /**
+     * @brief 导入内存中的文本，语义与按文件导入相同
+     */
+    std::vector<std::string> load(const char* data, size_t size, BulkFormat format, BulkStats& stats, const std::string& series = "")
+    {
+        return loadWindows(data, size, format, stats, series, [](size_t) {});
+    }
+
+private:
+    static constexpr size_t MIN_CHUNK_BYTES = 1 << 16;
+    static constexpr size_t DEFAULT_WINDOW_BYTES = 1 << 26;
+    // 一行中记录位置的分隔符个数，更多的分隔符只计数
+    static constexpr size_t MAX_DELIMITERS = 4;
+
+    struct Column {
+        std::vector<long long> timestamps;
+        std::vector<T> values;
+    };
+
+    // 一段输入的解析结果，每个序列一列
+    struct Chunk {
+        std::unordered_map<std::string, size_t> index;
+        std::vector<Column> columns;
+        size_t lines = 0;
+        size_t errors = 0;
+        size_t untimed = 0;
+        size_t stringFields = 0;
+    };
+
+    // consumed(end)在前end字节处理完、不再访问时调用
+    template <typename Consumed>
+    std::vector<std::string> loadWindows(const char* data, size_t size, BulkFormat format, BulkStats& stats, const std::string& series, Consumed&& consumed)
+    {
+        stats = BulkStats();
+        stats.bytes = size;
+        // 按序列名排序；tsdb_entry构造时读取配置，在当前线程创建
+        std::map<std::string, std::unique_ptr<tsdb_entry>> writers;
+        std::vector<std::thread> workers;
+        for (size_t begin = 0; begin < size;) {
+            auto start = std::chrono::steady_clock::now();
+            size_t end = size;
+            if (size - begin > windowBytes) {
+                const void* newline = memchr(data + begin + windowBytes - 1, '\n', size - begin - windowBytes + 1);
+                end = newline ? static_cast<const char*>(newline) - data + 1 : size;
+            }
+            std::vector<Chunk> chunks = parseWindow(data + begin, end - begin, format, series, begin == 0);
+
+            // 同一序列在各段中的列，按文件顺序
+            std::map<std::string, std::vector<const Column*>> bySeries;
+            for (const auto& chunk : chunks) {
+                stats.lines += chunk.lines;
+                stats.errors += chunk.errors;
+                stats.untimed += chunk.untimed;
+                stats.stringFields += chunk.stringFields;
+                for (const auto& [name, index] : chunk.index) {
+                    bySeries[name].push_back(&chunk.columns[index]);
+                    stats.points += chunk.columns[index].timestamps.size();
+                }
+            }
+            std::vector<std::tuple<const std::string*, tsdb_entry*, const std::vector<const Column*>*>> work;
+            for (const auto& [name, columns] : bySeries) {
+                auto& writer = writers[name];
+                if (!writer) {
+                    writer = std::make_unique<tsdb_entry>();
+                    writer->initialize();
+                }
+                work.emplace_back(&name, writer.get(), &columns);
+            }
+            auto parsed = std::chrono::steady_clock::now();
+            stats.parseSeconds += std::chrono::duration<double>(parsed - start).count();
+
+            // 每个序列同一时刻只由一个线程写入
+            std::atomic<size_t> next { 0 };
+            for (size_t t = 0; t < std::min(threadCount, work.size()); t++) {
+                workers.emplace_back([&]() {
+                    for (size_t k; (k = next.fetch_add(1)) < work.size();) {
+                        auto [name, entry, columns] = work[k];
+                        for (const Column* column : *columns) {
+                            if (entry->insert_columns(*name, column->timestamps.data(), column->values.data(), column->timestamps.size()) != 0)
+                                std::cerr << "Cannot load series " << *name << std::endl;
+                        }
+                    }
+                });
+            }
+            for (auto& worker : workers)
+                worker.join();
+            workers.clear();
+            stats.compressSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - parsed).count();
+            consumed(end);
+            begin = end;
+        }
+        stats.series = writers.size();
+        if (stats.errors)
+            std::cerr << "Skip " << stats.errors << " unparsable lines" << std::endl;
+
+        // 封存各序列剩余的点并写出json
+        auto start = std::chrono::steady_clock::now();
+        std::vector<tsdb_entry*> entries;
+        for (auto& item : writers)
+            entries.push_back(item.second.get());
+        std::vector<std::string> paths(entries.size());
+        std::atomic<size_t> next { 0 };
+        for (size_t t = 0; t < std::min(threadCount, entries.size()); t++) {
+            workers.emplace_back([&]() {
+                for (size_t k; (k = next.fetch_add(1)) < entries.size();)
+                    paths[k] = entries[k]->close();
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        stats.compressSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return paths;
+    }
+
+    // 窗口按行边界切成若干段并行解析，每段从行首开始，太小的窗口不值得多开线程
+    std::vector<Chunk> parseWindow(const char* data, size_t size, BulkFormat format, const std::string& series, bool first) const
+    {
+        size_t parts = std::clamp<size_t>(size / MIN_CHUNK_BYTES, 1, threadCount);
+        std::vector<size_t> bounds(parts + 1, size);
+        bounds[0] = 0;
+        for (size_t i = 1; i < parts; i++) {
+            size_t pos = std::max(bounds[i - 1], size / parts * i);
+            const void* newline = pos < size ? memchr(data + pos, '\n', size - pos) : nullptr;
+            bounds[i] = newline ? static_cast<const char*>(newline) - data + 1 : size;
+        }
+        std::vector<Chunk> chunks(parts);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < parts; i++)
+            workers.emplace_back([&, i]() { parse(data + bounds[i], bounds[i + 1] - bounds[i], format, series, first && i == 0, chunks[i]); });
+        for (auto& worker : workers)
+            worker.join();
+        return chunks;
+    }
+
+    template <typename N>
+    static bool parseNumber(const char* begin, const char* end, N& value)
+    {
+        auto [ptr, ec] = std::from_chars(begin, end, value);
+        return ec == std::errc() && ptr == end && begin != end;
+    }
+
+    /**
+     * @brief 有效数字不超过15位、没有指数的十进制小数：整数部分和小数部分拼成的整数与10的幂都能用double精确表示，
+     * 一次除法即得到正确舍入的结果（Clinger快速路径）。其余写法返回false，交给from_chars
+     */
+    static bool parseDecimal(const char* begin, const char* end, double& value)
+    {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+        const char* p = begin;
+        bool negative = p < end && *p == '-';
+        p += negative;
+        uint64_t mantissa = 0;
+        int digits = 0, fraction = -1;
+        for (; p < end; p++) {
+            if (*p == '.' && fraction < 0) {
+                fraction = 0;
+                continue;
+            }
+            unsigned d = static_cast<unsigned>(*p - '0');
+            if (d > 9 || ++digits > 15)
+                return false;
+            mantissa = mantissa * 10 + d;
+            fraction += fraction >= 0;
+        }
+        if (digits == 0)
+            return false;
+        value = static_cast<double>(mantissa) / powers[std::max(fraction, 0)];
+        value = negative ? -value : value;
+        return true;
+    }
+
+    static bool parseValue(const char* begin, const char* end, T& value)
+    {
+        std::string_view token(begin, end - begin);
+        if constexpr (std::is_same_v<T, bool>) {
+            if (token == "true" || token == "t" || token == "1")
+                value = true;
+            else if (token == "false" || token == "f" || token == "0")
+                value = false;
+            else
+                return false;
+            return true;
+        } else {
+            // 行协议的整数以i或u结尾
+            if (!token.empty() && (token.back() == 'i' || token.back() == 'u'))
+                end--;
+            if constexpr (std::is_same_v<T, double>) {
+                if (parseDecimal(begin, end, value))
+                    return true;
+            }
+            return parseNumber(begin, end, value);
+        }
+    }
+
+    /**
+     * @brief 按行协议的规则找出measurement和标签、字段集的结束位置：反斜杠转义下一个字符，字段集中引号内的空格不是分隔符。
+     * 没有时间戳时fieldsEnd为行尾
+     */
+    static bool splitLineProtocol(const char* data, size_t begin, size_t end, size_t& keyEnd, size_t& fieldsEnd)
+    {
+        size_t i = begin;
+        while (i < end && data[i] != ' ')
+            i += data[i] == '\\' ? 2 : 1;
+        if (i >= end)
+            return false;
+        keyEnd = i;
+        bool quoted = false;
+        for (i++; i < end && (quoted || data[i] != ' '); i++) {
+            if (data[i] == '\\')
+                i++;
+            else if (data[i] == '"')
+                quoted = !quoted;
+        }
+        fieldsEnd = std::min(i, end);
+        return !quoted;
+    }
+
+    void parse(const char* data, size_t n, BulkFormat format, const std::string& series, bool first, Chunk& chunk) const
+    {
+        char delimiter = format == BULK_CSV ? ',' : ' ';
+        size_t lineStart = 0, found = 0;
+        size_t delimiters[MAX_DELIMITERS];
+        // 相邻的行多属于同一序列，缓存上一次查到的列
+        std::string cachedName, composite;
+        size_t cached = SIZE_MAX;
+        std::vector<std::pair<std::string_view, T>> fields;
+
+        auto column = [&](std::string_view name) -> Column& {
+            if (cached == SIZE_MAX || name != cachedName) {
+                cachedName.assign(name.data(), name.size());
+                auto it = chunk.index.find(cachedName);
+                if (it == chunk.index.end()) {
+                    it = chunk.index.emplace(cachedName, chunk.columns.size()).first;
+                    chunk.columns.emplace_back();
+                }
+                cached = it->second;
+            }
+            return chunk.columns[cached];
+        };
+        auto parseCsv = [&](size_t end) {
+            size_t nameEnd = lineStart, timestampBegin = lineStart;
+            if (found == 2) {
+                nameEnd = delimiters[0];
+                timestampBegin = delimiters[0] + 1;
+            } else if (found != 1 || series.empty()) {
+                return false;
+            }
+            long long timestamp;
+            T value;
+            if (!parseNumber(data + timestampBegin, data + delimiters[found - 1], timestamp) || !parseValue(data + delimiters[found - 1] + 1, data + end, value))
+                return false;
+            std::string_view name = found == 2 ? std::string_view(data + lineStart, nameEnd - lineStart) : std::string_view(series);
+            if (name.empty())
+                return false;
+            Column& c = column(name);
+            c.timestamps.push_back(timestamp);
+            c.values.push_back(value);
+            return true;
+        };
+        auto parseLineProtocol = [&](size_t end) {
+            // 多数行没有转义和引号，直接用扫描得到的两个空格；否则逐字节跳过转义的字符和引号内的空格
+            size_t keyEnd, fieldsEnd;
+            if (found == 2 && !memchr(data + lineStart, '\\', delimiters[1] - lineStart) && !memchr(data + delimiters[0], '"', delimiters[1] - delimiters[0])) {
+                keyEnd = delimiters[0];
+                fieldsEnd = delimiters[1];
+            } else if (!splitLineProtocol(data, lineStart, end, keyEnd, fieldsEnd)) {
+                return false;
+            }
+            if (keyEnd == lineStart)
+                return false;
+            // 逐个解析field=value，整行都能解析时才写入
+            fields.clear();
+            size_t strings = 0;
+            const char* p = data + keyEnd + 1;
+            const char* fieldsStop = data + fieldsEnd;
+            while (p < fieldsStop) {
+                const char* eq = p;
+                while (eq < fieldsStop && *eq != '=' && *eq != ',')
+                    eq += *eq == '\\' ? 2 : 1;
+                if (eq >= fieldsStop || *eq != '=' || eq == p)
+                    return false;
+                const char* next;
+                if (eq + 1 < fieldsStop && eq[1] == '"') {
+                    for (next = eq + 2; next < fieldsStop && *next != '"'; next++)
+                        next += *next == '\\';
+                    if (next >= fieldsStop)
+                        return false;
+                    next++;
+                    strings++;
+                } else {
+                    next = static_cast<const char*>(memchr(eq + 1, ',', fieldsStop - eq - 1));
+                    next = next ? next : fieldsStop;
+                    T value;
+                    if (!parseValue(eq + 1, next, value))
+                        return false;
+                    fields.emplace_back(std::string_view(p, eq - p), value);
+                }
+                if (next < fieldsStop && *next != ',')
+                    return false;
+                p = next + 1;
+            }
+            if (fields.empty() && strings == 0)
+                return false;
+            size_t timestampBegin = std::min(fieldsEnd + 1, end);
+            while (timestampBegin < end && data[timestampBegin] == ' ')
+                timestampBegin++;
+            long long timestamp;
+            if (timestampBegin == end) {
+                chunk.untimed++;
+                return true;
+            }
+            if (!parseNumber(data + timestampBegin, data + end, timestamp))
+                return false;
+            chunk.stringFields += strings;
+            // 字段名为value时序列名即measurement和标签，否则再加上.字段名
+            std::string_view key(data + lineStart, keyEnd - lineStart);
+            for (const auto& [field, value] : fields) {
+                std::string_view name = key;
+                if (field != "value") {
+                    composite.assign(key.data(), key.size());
+                    composite.append(1, '.').append(field.data(), field.size());
+                    name = composite;
+                }
+                Column& c = column(name);
+                c.timestamps.push_back(timestamp);
+                c.values.push_back(value);
+            }
+            return true;
+        };
+        auto line = [&](size_t end) {
+            if (end > lineStart && data[end - 1] == '\r')
+                end--;
+            if (end == lineStart || data[lineStart] == '#')
+                return;
+            chunk.lines++;
+            if (format == BULK_CSV ? found > MAX_DELIMITERS || !parseCsv(end) : !parseLineProtocol(end)) {
+                // CSV的首行无法解析时视为表头
+                if (first && format == BULK_CSV && chunk.lines == 1 && chunk.errors == 0)
+                    chunk.lines--;
+                else
+                    chunk.errors++;
+            }
+            first = false;
+        };
+
+        Kernels::scanBytes(data, n, '\n', delimiter, [&](size_t i) {
+            if (data[i] != '\n') {
+                if (found < MAX_DELIMITERS)
+                    delimiters[found] = i;
+                found++;
+                return;
+            }
+            line(i);
+            lineStart = i + 1;
+            found = 0;
+        });
+        if (lineStart < n)
+            line(n);
+    }
+
+    size_t threadCount;
+    size_t windowBytes;
+};
+}
+#endif // TSDB_HF_BULK_HPP
@@ -0,0 +1,431 @@
+// column codecs of high frenqence data api
+#ifndef TSDB_HF_CODEC_HPP
+#define TSDB_HF_CODEC_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace tsdb_hf_cpp {
+
+enum ValueType {
+    VALUE_DOUBLE,
+    VALUE_FLOAT,
+    VALUE_INT64,
+    VALUE_BOOL
+};
+
+enum Encoding {
+    ENCODING_PLAIN,
+    ENCODING_BYTE_SHUFFLE,
+    ENCODING_ZIGZAG_VARINT,
+    ENCODING_BITMAP,
+    ENCODING_CADENCE,
+    ENCODING_QUANTIZED
+};
+
+enum ErrorMode {
+    ERROR_NONE,
+    ERROR_ABSOLUTE,
+    ERROR_RELATIVE
+};
+
+/**
+ * @brief 有损压缩的误差上界。ERROR_ABSOLUTE: |v - v'| <= value；ERROR_RELATIVE: |v - v'| <= value * |v|
+ */
+struct ErrorBound {
+    ErrorMode mode = ERROR_NONE;
+    double value = 0;
+
+    static ErrorBound absolute(double error)
+    {
+        return { ERROR_ABSOLUTE, error };
+    }
+
+    static ErrorBound relative(double ratio)
+    {
+        return { ERROR_RELATIVE, ratio };
+    }
+
+    double maxError(double v) const
+    {
+        return mode == ERROR_ABSOLUTE ? value : value * std::fabs(v);
+    }
+};
+
+/**
+ * @brief 值列类型的编译期信息，决定该类型在流元数据中的名称以及使用的编码
+ *
+ * @tparam T double、float、bool或64位有符号整数
+ */
+template <typename T>
+struct ValueTraits {
+    static_assert(std::is_same_v<T, double> || std::is_same_v<T, float> || std::is_same_v<T, bool>
+            || (std::is_integral_v<T> && std::is_signed_v<T> && sizeof(T) == 8),
+        "value type must be double, float, bool or a 64-bit signed integer");
+
+    static constexpr ValueType type = std::is_same_v<T, double> ? VALUE_DOUBLE
+        : std::is_same_v<T, float>                              ? VALUE_FLOAT
+        : std::is_same_v<T, bool>                               ? VALUE_BOOL
+                                                                : VALUE_INT64;
+
+    // 浮点数按字节平面重排，使相同位置的指数/高位字节相邻，便于zstd压缩；整数做差分+zig-zag+varint；布尔值为位图
+    static constexpr Encoding encoding = type == VALUE_INT64 ? ENCODING_ZIGZAG_VARINT
+        : type == VALUE_BOOL                                 ? ENCODING_BITMAP
+                                                             : ENCODING_BYTE_SHUFFLE;
+};
+
+inline const char* valueTypeName(ValueType type)
+{
+    static const char* names[] = { "double", "float", "int64", "bool" };
+    return names[type];
+}
+
+inline const char* encodingName(Encoding encoding)
+{
+    static const char* names[] = { "plain", "byte-shuffle", "zigzag-varint", "bitmap", "cadence", "quantized" };
+    return names[encoding];
+}
+
+inline bool parseValueType(const std::string& name, ValueType& type)
+{
+    for (int t = VALUE_DOUBLE; t <= VALUE_BOOL; t++) {
+        if (name == valueTypeName(static_cast<ValueType>(t))) {
+            type = static_cast<ValueType>(t);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool parseEncoding(const std::string& name, Encoding& encoding)
+{
+    for (int e = ENCODING_PLAIN; e <= ENCODING_QUANTIZED; e++) {
+        if (name == encodingName(static_cast<Encoding>(e))) {
+            encoding = static_cast<Encoding>(e);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Codec {
+    /**
+     * @brief 按编码将一列数据追加到out中
+     */
+    template <typename T, Encoding E = ValueTraits<T>::encoding>
+    static void encode(const std::vector<T>& values, std::vector<char>& out)
+    {
+        size_t n = values.size();
+        if constexpr (E == ENCODING_PLAIN) {
+            size_t pos = out.size();
+            out.resize(pos + n * sizeof(T));
+            memcpy(out.data() + pos, values.data(), n * sizeof(T));
+        } else if constexpr (E == ENCODING_BYTE_SHUFFLE) {
+            size_t pos = out.size();
+            out.resize(pos + n * sizeof(T));
+            const unsigned char* src = reinterpret_cast<const unsigned char*>(values.data());
+            for (size_t b = 0; b < sizeof(T); b++) {
+                char* plane = out.data() + pos + b * n;
+                for (size_t i = 0; i < n; i++)
+                    plane[i] = src[i * sizeof(T) + b];
+            }
+        } else if constexpr (E == ENCODING_ZIGZAG_VARINT) {
+            out.reserve(out.size() + n * 2);
+            uint64_t prev = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t cur = static_cast<uint64_t>(values[i]);
+                putVarint(out, zigzag(cur - prev));
+                prev = cur;
+            }
+        } else if constexpr (E == ENCODING_BITMAP) {
+            size_t pos = out.size();
+            out.resize(pos + (n + 7) / 8, 0);
+            for (size_t i = 0; i < n; i++) {
+                if (values[i])
+                    out[pos + i / 8] |= static_cast<char>(1 << (i % 8));
+            }
+        }
+    }
+
+    /**
+     * @brief 从data解码n个值并追加到out中
+     *
+     * @return 消耗的字节数，数据不完整时返回0
+     */
+    template <typename T, Encoding E = ValueTraits<T>::encoding>
+    static size_t decode(const char* data, size_t size, size_t n, std::vector<T>& out)
+    {
+        size_t pos = out.size();
+        if constexpr (E == ENCODING_PLAIN) {
+            if (size < n * sizeof(T))
+                return 0;
+            out.resize(pos + n);
+            memcpy(out.data() + pos, data, n * sizeof(T));
+            return n * sizeof(T);
+        } else if constexpr (E == ENCODING_BYTE_SHUFFLE) {
+            if (size < n * sizeof(T))
+                return 0;
+            out.resize(pos + n);
+            unsigned char* dst = reinterpret_cast<unsigned char*>(out.data() + pos);
+            for (size_t b = 0; b < sizeof(T); b++) {
+                const char* plane = data + b * n;
+                for (size_t i = 0; i < n; i++)
+                    dst[i * sizeof(T) + b] = plane[i];
+            }
+            return n * sizeof(T);
+        } else if constexpr (E == ENCODING_ZIGZAG_VARINT) {
+            out.resize(pos + n);
+            size_t offset = 0;
+            uint64_t prev = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t delta;
+                if (!getVarint(data, size, offset, delta)) {
+                    out.resize(pos);
+                    return 0;
+                }
+                prev += unzigzag(delta);
+                out[pos + i] = static_cast<T>(prev);
+            }
+            return offset;
+        } else if constexpr (E == ENCODING_BITMAP) {
+            size_t bytes = (n + 7) / 8;
+            if (size < bytes)
+                return 0;
+            out.resize(pos + n);
+            for (size_t i = 0; i < n; i++)
+                out[pos + i] = (data[i / 8] >> (i % 8)) & 1;
+            return bytes;
+        }
+    }
+
+    /**
+     * @brief 在误差上界内将浮点值量化为整数 q = round(v / step)，再做差分+zig-zag+varint。
+     * 绝对误差的步长为2 * error；相对误差的步长由块内最小非零绝对值决定，块内所有值都满足相对误差
+     *
+     * @return 块内存在NaN、Inf、超出整数精度的值或无法满足误差上界时返回false，调用方应改用无损编码
+     */
+    template <typename T>
+    static bool encodeQuantized(const std::vector<T>& values, const ErrorBound& bound, std::vector<char>& out)
+    {
+        static_assert(std::is_floating_point_v<T>, "only floating point values can be quantized");
+        double half = bound.value;
+        if (bound.mode == ERROR_RELATIVE) {
+            double minAbs = HUGE_VAL;
+            for (T v : values) {
+                if (v != 0)
+                    minAbs = std::min(minAbs, std::fabs(static_cast<double>(v)));
+            }
+            half = bound.value * (minAbs == HUGE_VAL ? 1 : minAbs);
+        }
+        // 步长略小于两倍误差，避免浮点舍入使重建误差恰好越界
+        double step = 2 * half * (1 - 1.0 / (1 << 20));
+        if (!(step > 0) || !std::isfinite(step))
+            return false;
+
+        size_t pos = out.size();
+        out.resize(pos + sizeof(double));
+        memcpy(out.data() + pos, &step, sizeof(double));
+        int64_t prev = 0;
+        for (T v : values) {
+            double q = std::nearbyint(static_cast<double>(v) / step);
+            if (!std::isfinite(q) || std::fabs(q) > 9007199254740992.0) {
+                out.resize(pos);
+                return false;
+            }
+            T restored = static_cast<T>(q * step);
+            if (std::fabs(static_cast<double>(restored) - static_cast<double>(v)) > bound.maxError(v)) {
+                out.resize(pos);
+                return false;
+            }
+            int64_t cur = static_cast<int64_t>(q);
+            putVarint(out, zigzag(static_cast<uint64_t>(cur - prev)));
+            prev = cur;
+        }
+        return true;
+    }
+
+    template <typename T>
+    static size_t decodeQuantized(const char* data, size_t size, size_t n, std::vector<T>& out)
+    {
+        double step;
+        if (size < sizeof(double))
+            return 0;
+        memcpy(&step, data, sizeof(double));
+        size_t pos = out.size();
+        out.resize(pos + n);
+        size_t offset = sizeof(double);
+        uint64_t prev = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t delta;
+            if (!getVarint(data, size, offset, delta)) {
+                out.resize(pos);
+                return 0;
+            }
+            prev += unzigzag(delta);
+            out[pos + i] = static_cast<T>(static_cast<double>(static_cast<int64_t>(prev)) * step);
+        }
+        return offset;
+    }
+
+    /**
+     * @brief 按块元数据中记录的编码解码值列
+     */
+    template <typename T>
+    static size_t decodeValues(Encoding encoding, const char* data, size_t size, size_t n, std::vector<T>& out)
+    {
+        if (encoding == ValueTraits<T>::encoding)
+            return decode(data, size, n, out);
+        if constexpr (std::is_floating_point_v<T>) {
+            if (encoding == ENCODING_QUANTIZED)
+                return decodeQuantized(data, size, n, out);
+        }
+        return 0;
+    }
+
+    /**
+     * @brief 编码时间戳列。固定采样间隔的块只保存起始时间、步长和间隔异常的位置，否则退化为差分varint
+     *
+     * @return 实际使用的编码，需要记录到块元数据中供解码使用
+     */
+    static Encoding encodeTimestamps(const std::vector<long long>& timestamps, std::vector<char>& out)
+    {
+        long long step;
+        if (detectCadence(timestamps, step)) {
+            encodeCadence(timestamps, step, out);
+            return ENCODING_CADENCE;
+        }
+        encode<long long, ENCODING_ZIGZAG_VARINT>(timestamps, out);
+        return ENCODING_ZIGZAG_VARINT;
+    }
+
+    static size_t decodeTimestamps(Encoding encoding, const char* data, size_t size, size_t n, std::vector<long long>& out)
+    {
+        switch (encoding) {
+        case ENCODING_PLAIN:
+            return decode<long long, ENCODING_PLAIN>(data, size, n, out);
+        case ENCODING_ZIGZAG_VARINT:
+            return decode<long long, ENCODING_ZIGZAG_VARINT>(data, size, n, out);
+        case ENCODING_CADENCE:
+            return decodeCadence(data, size, n, out);
+        default:
+            return 0;
+        }
+    }
+
+    /**
+     * @brief 取相邻时间戳差值的中位数作为步长，与步长不同的差值（抖动、断档）不超过1/8时认为是固定采样间隔
+     */
+    static bool detectCadence(const std::vector<long long>& timestamps, long long& step)
+    {
+        size_t n = timestamps.size();
+        if (n < 2)
+            return false;
+        std::vector<long long> deltas(n - 1);
+        for (size_t i = 1; i < n; i++)
+            deltas[i - 1] = timestamps[i] - timestamps[i - 1];
+        std::nth_element(deltas.begin(), deltas.begin() + deltas.size() / 2, deltas.end());
+        step = deltas[deltas.size() / 2];
+
+        size_t exceptions = 0;
+        for (size_t i = 1; i < n; i++)
+            exceptions += timestamps[i] - timestamps[i - 1] != step;
+        return exceptions * 8 <= n;
+    }
+
+    /**
+     * @brief 格式：起始时间、步长、异常个数，之后每个异常为（与上一个异常的下标差, 实际差值 - 步长），均为zig-zag varint
+     */
+    static void encodeCadence(const std::vector<long long>& timestamps, long long step, std::vector<char>& out)
+    {
+        std::vector<char> exceptions;
+        size_t count = 0, last = 0;
+        for (size_t i = 1; i < timestamps.size(); i++) {
+            long long delta = timestamps[i] - timestamps[i - 1];
+            if (delta == step)
+                continue;
+            putVarint(exceptions, i - last);
+            putVarint(exceptions, zigzag(static_cast<uint64_t>(delta - step)));
+            last = i;
+            count++;
+        }
+        putVarint(out, zigzag(static_cast<uint64_t>(timestamps.empty() ? 0 : timestamps[0])));
+        putVarint(out, zigzag(static_cast<uint64_t>(step)));
+        putVarint(out, count);
+        out.insert(out.end(), exceptions.begin(), exceptions.end());
+    }
+
+    static size_t decodeCadence(const char* data, size_t size, size_t n, std::vector<long long>& out)
+    {
+        size_t offset = 0;
+        uint64_t start, step, count;
+        if (!getVarint(data, size, offset, start) || !getVarint(data, size, offset, step) || !getVarint(data, size, offset, count))
+            return 0;
+        start = unzigzag(start);
+        step = unzigzag(step);
+
+        size_t pos = out.size();
+        out.resize(pos + n);
+        long long* dst = out.data() + pos;
+        // 两个异常之间是等差数列，逐段填充
+        size_t segBeg = 0;
+        uint64_t segStart = start;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t gap, diff;
+            if (!getVarint(data, size, offset, gap) || !getVarint(data, size, offset, diff) || gap == 0 || segBeg + gap >= n) {
+                out.resize(pos);
+                return 0;
+            }
+            size_t segEnd = segBeg + gap;
+            fillArithmetic(dst + segBeg, segEnd - segBeg, segStart, step);
+            segStart = static_cast<uint64_t>(dst[segEnd - 1]) + step + unzigzag(diff);
+            segBeg = segEnd;
+        }
+        fillArithmetic(dst + segBeg, n - segBeg, segStart, step);
+        return offset;
+    }
+
+    static void fillArithmetic(long long* dst, size_t n, uint64_t start, uint64_t step)
+    {
+        for (size_t k = 0; k < n; k++)
+            dst[k] = static_cast<long long>(start + k * step);
+    }
+
+    static uint64_t zigzag(uint64_t v)
+    {
+        return (v << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(v) >> 63);
+    }
+
+    static uint64_t unzigzag(uint64_t v)
+    {
+        return (v >> 1) ^ (~(v & 1) + 1);
+    }
+
+    static void putVarint(std::vector<char>& out, uint64_t v)
+    {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    static bool getVarint(const char* data, size_t size, size_t& offset, uint64_t& v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(data[offset++]);
+            v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+};
+}
+#endif // TSDB_HF_CODEC_HPP
@@ -0,0 +1,284 @@
+// export stored high frenqence streams to a line protocol endpoint
+#ifndef TSDB_HF_EXPORT_HPP
+#define TSDB_HF_EXPORT_HPP
+
+#include "tsdb.hpp"
+#include "tsdb_hf.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace tsdb_hf_cpp {
+
+struct ExportOptions {
+    std::string measurement = "datas"; // 与tsdb_cpp::tsdb_entry写入的行格式一致
+    std::string tagKey = "pointName"; // 标签值为流名
+    std::string fieldKey = "value"; // 单字段流的字段键，多字段流使用各自的字段名
+    size_t threads = 4; // 解压、解码、格式化和发送的线程数
+    size_t batchBytes = 1 << 20; // HTTP每个请求体的目标大小；UDP每攒够该大小交给sendmmsg
+    double maxPointsPerSec = 0; // 速率上限，0表示不限
+    double maxBytesPerSec = 0;
+    unsigned timeoutSec = 0;
+};
+
+struct ExportStats {
+    size_t blocks = 0;
+    size_t points = 0;
+    size_t skipped = 0; // 空值以及行协议无法表示的NaN和Inf，跳过；多字段流只计全部字段都不能写出的行
+    size_t requests = 0; // HTTP请求数或UDP数据报数
+    size_t bytes = 0; // 发送的行协议字节
+    double seconds = 0;
+    bool readError = false; // 流的json或块文件读取失败
+    int error = 0; // 第一个失败的发送返回值，含义同tsdb_cpp的post_http和insert_points
+};
+
+/**
+ * @brief 把本地存储的流转发到行协议接口。各线程按块取任务，独立解压解码，
+ * 直接从列缓冲格式化成大批量的行协议，再通过连接池的HTTP或sendmmsg批量的UDP发送
+ */
+class export_entry {
+public:
+    /**
+     * @param si 写入HTTP接口，连接池由各线程共享；precision_按流的timeUnit覆盖
+     */
+    export_entry(const tsdb_cpp::server_info& si, ExportOptions options = ExportOptions())
+        : si(si)
+        , options(options)
+        , limiter(options.maxPointsPerSec, options.maxBytesPerSec)
+    {
+    }
+
+    /**
+     * @brief 写入UDP接口，时间戳精度由服务端的UDP监听配置决定
+     */
+    export_entry(const std::string& host, int port, ExportOptions options = ExportOptions(), size_t packetBytes = tsdb_cpp::UDP_PAYLOAD_BYTES)
+        : si(host, port)
+        , options(options)
+        , udp(true)
+        , packetBytes(packetBytes)
+        , limiter(options.maxPointsPerSec, options.maxBytesPerSec)
+    {
+    }
+
+    /**
+     * @brief 导出一个流的全部数据点，时间戳为存储值加流的timestampOffset。多字段流每个时间戳一行，包含全部字段。
+     * 溢出块中的迟到点一并导出，不保证发送顺序
+     *
+     * @param streamJsonPath close()返回的json文件路径
+     */
+    ExportStats export_stream(const std::string& streamJsonPath)
+    {
+        auto start = std::chrono::steady_clock::now();
+        ExportStats stats;
+        Stream source;
+        if (!Stream::load(streamJsonPath, source)) {
+            stats.readError = true;
+            return stats;
+        }
+        switch (source.getValueType()) {
+        case VALUE_DOUBLE:
+            run<double>(source, stats);
+            break;
+        case VALUE_FLOAT:
+            run<float>(source, stats);
+            break;
+        case VALUE_INT64:
+            run<int64_t>(source, stats);
+            break;
+        case VALUE_BOOL:
+            run<bool>(source, stats);
+            break;
+        }
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+private:
+    static constexpr size_t CHUNK_ROWS = 1024;
+
+    // 按点数和字节数的上限给各批次排出发送时刻，各线程共享
+    class RateLimiter {
+    public:
+        RateLimiter(double pointsPerSec, double bytesPerSec)
+            : pointsPerSec(pointsPerSec)
+            , bytesPerSec(bytesPerSec)
+        {
+        }
+
+        void acquire(size_t points, size_t bytes)
+        {
+            if (pointsPerSec <= 0 && bytesPerSec <= 0)
+                return;
+            double cost = std::max(pointsPerSec > 0 ? points / pointsPerSec : 0, bytesPerSec > 0 ? bytes / bytesPerSec : 0);
+            std::chrono::steady_clock::time_point at;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                at = std::max(next, std::chrono::steady_clock::now());
+                next = at + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(cost));
+            }
+            std::this_thread::sleep_until(at);
+        }
+
+    private:
+        double pointsPerSec;
+        double bytesPerSec;
+        std::mutex mutex;
+        std::chrono::steady_clock::time_point next;
+    };
+
+    // 各线程的计数，结束时汇总
+    struct Counters {
+        std::atomic<size_t> blocks { 0 }, points { 0 }, skipped { 0 }, requests { 0 }, bytes { 0 };
+        std::atomic<bool> readError { false };
+        std::atomic<int> error { 0 };
+        std::atomic<bool> failed { false };
+    };
+
+    // InfluxDB的precision参数，不认识的单位返回空串
+    static std::string precisionOf(const std::string& timeUnit)
+    {
+        if (timeUnit == "ns" || timeUnit == "ms" || timeUnit == "s")
+            return timeUnit;
+        return timeUnit == "us" ? "u" : "";
+    }
+
+    template <typename T>
+    void run(const Stream& source, ExportStats& stats)
+    {
+        tsdb_cpp::server_info target(si);
+        std::string precision = precisionOf(source.getTimeUnit());
+        if (!precision.empty())
+            target.precision_ = precision;
+
+        std::string name = source.getName();
+        tsdb_cpp::tag_list tags { { options.tagKey, name } };
+        long long offset = source.getTimestampOffset();
+        size_t width = source.fieldCount();
+        std::vector<std::string> keys;
+        for (size_t k = 0; k < width; k++)
+            keys.push_back(source.getFields().empty() ? options.fieldKey : source.fieldName(k));
+        std::vector<std::string_view> keyViews(keys.begin(), keys.end());
+        const std::vector<Block>& blocks = source.getBlocks();
+        std::atomic<size_t> nextBlock { 0 };
+        Counters counters;
+        auto work = [&](tsdb_entry& reader) {
+            std::unique_ptr<tsdb_cpp::tsdb_entry> sender;
+            if (udp)
+                sender = std::make_unique<tsdb_cpp::tsdb_entry>(si.host_, si.port_, packetBytes);
+            std::vector<long long> timestamps;
+            std::vector<std::vector<T>> values;
+            std::vector<std::vector<uint8_t>> valid;
+            // std::vector<bool>没有连续存储，逐块展开
+            std::vector<std::unique_ptr<bool[]>> bools(width);
+            std::vector<const T*> columns(width), rowColumns(width);
+            std::vector<const uint8_t*> rowValid(width);
+            tsdb_cpp::tsdb_data_builder body(options.batchBytes + 0x1000);
+            size_t batchPoints = 0;
+            auto flush = [&]() {
+                if (body.view().empty() || counters.failed)
+                    return;
+                limiter.acquire(batchPoints, body.view().length());
+                int ret;
+                if (udp) {
+                    ret = sender->insert_lines(body.view());
+                    counters.requests += sender->last_batch().packets_;
+                } else {
+                    ret = body.post_http(target, nullptr, options.timeoutSec);
+                    counters.requests++;
+                }
+                if (ret != 0) {
+                    int expected = 0;
+                    counters.error.compare_exchange_strong(expected, ret);
+                    counters.failed = true;
+                    return;
+                }
+                counters.points += batchPoints;
+                counters.bytes += body.view().length();
+                body.clear();
+                batchPoints = 0;
+            };
+
+            for (size_t i; !counters.failed && (i = nextBlock++) < blocks.size();) {
+                timestamps.clear();
+                for (auto& column : values)
+                    column.clear();
+                for (auto& mask : valid)
+                    mask.clear();
+                if (!reader.read_block_fields(source, blocks[i], timestamps, values, &valid)) {
+                    counters.readError = true;
+                    counters.failed = true;
+                    break;
+                }
+                for (size_t k = 0; k < width; k++) {
+                    if constexpr (std::is_same_v<T, bool>) {
+                        bools[k].reset(new bool[values[k].size()]);
+                        std::copy(values[k].begin(), values[k].end(), bools[k].get());
+                        columns[k] = bools[k].get();
+                    } else {
+                        columns[k] = values[k].data();
+                    }
+                }
+                if (offset)
+                    for (auto& t : timestamps)
+                        t += offset;
+                // 按行块格式化，使每批接近batchBytes
+                size_t n = timestamps.size();
+                for (size_t beg = 0; beg < n; beg += CHUNK_ROWS) {
+                    size_t rows = std::min(CHUNK_ROWS, n - beg);
+                    size_t written;
+                    if (width == 1) {
+                        written = body.columns(options.measurement, tags, options.fieldKey, timestamps.data() + beg, columns[0] + beg, rows, -1, valid[0].data() + beg);
+                    } else {
+                        for (size_t k = 0; k < width; k++) {
+                            rowColumns[k] = columns[k] + beg;
+                            rowValid[k] = valid[k].data() + beg;
+                        }
+                        written = body.columns(options.measurement, tags, keyViews, timestamps.data() + beg, rowColumns.data(), rows, -1, rowValid.data());
+                    }
+                    counters.skipped += rows - written;
+                    batchPoints += written;
+                    if (body.view().length() >= options.batchBytes)
+                        flush();
+                }
+                counters.blocks++;
+            }
+            flush();
+        };
+
+        size_t threads = std::min(std::max<size_t>(options.threads, 1), std::max<size_t>(blocks.size(), 1));
+        // tsdb_entry构造时读取配置、打开清单，都在当前线程完成，再分给各线程
+        std::vector<std::unique_ptr<tsdb_entry>> readers(threads);
+        for (auto& reader : readers)
+            reader = std::make_unique<tsdb_entry>();
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; t++)
+            workers.emplace_back(work, std::ref(*readers[t]));
+        work(*readers[0]);
+        for (auto& w : workers)
+            w.join();
+
+        stats.blocks = counters.blocks;
+        stats.points = counters.points;
+        stats.skipped = counters.skipped;
+        stats.requests = counters.requests;
+        stats.bytes = counters.bytes;
+        stats.readError = counters.readError;
+        stats.error = counters.error;
+    }
+
+    tsdb_cpp::server_info si;
+    ExportOptions options;
+    bool udp = false;
+    size_t packetBytes = tsdb_cpp::UDP_PAYLOAD_BYTES;
+    RateLimiter limiter;
+};
+
+}
+
+#endif // TSDB_HF_EXPORT_HPP
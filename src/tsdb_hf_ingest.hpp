@@ -0,0 +1,252 @@
+// multi-producer ingest queue of high frenqence data api
+#ifndef TSDB_HF_INGEST_HPP
+#define TSDB_HF_INGEST_HPP
+
+#include "../utils/RingBuffer.hpp"
+#include "tsdb_hf.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tsdb_hf_cpp {
+
+enum OverflowPolicy {
+    OVERFLOW_BLOCK, // 队列满时生产者等待
+    OVERFLOW_DROP_OLDEST, // 丢弃队列中最早的记录
+    OVERFLOW_DROP_NEWEST // 丢弃本次写入的记录
+};
+
+inline bool parseOverflowPolicy(const std::string& name, OverflowPolicy& policy)
+{
+    static const std::map<std::string, OverflowPolicy> policies = {
+        { "block", OVERFLOW_BLOCK }, { "drop-oldest", OVERFLOW_DROP_OLDEST }, { "drop-newest", OVERFLOW_DROP_NEWEST }
+    };
+    auto it = policies.find(name);
+    if (it == policies.end())
+        return false;
+    policy = it->second;
+    return true;
+}
+
+/**
+ * @brief 多线程写入入口。生产者线程把点按定长记录写入无锁环形队列，每条记录只需几次原子操作；
+ * 后台线程独占消费队列，为每个序列维护一个tsdb_entry并完成暂存、封块和落盘。
+ * 计数：pushed()为进入队列且未被挤出的点数，dropped()为按溢出策略丢弃或挤出的点数，
+ * failed()为消费时写入失败的点数；stop()之后pushed() - failed()即写入流的点数
+ *
+ * @tparam T 值类型
+ */
+template <typename T = double>
+class ingest_entry {
+public:
+    static constexpr size_t RECORD_POINTS = 256;
+
+    struct record {
+        uint32_t series;
+        uint32_t count;
+        long long timestamps[RECORD_POINTS];
+        T values[RECORD_POINTS];
+    };
+
+    ingest_entry()
+        : ingest_entry(ArgParser::get<size_t>("queueCapacity", "hf_ingest"), policyFromConfig())
+    {
+    }
+
+    /**
+     * @param capacity 队列可容纳的记录数，每条记录最多RECORD_POINTS个点
+     * @param policy 队列满时的处理方式
+     */
+    ingest_entry(size_t capacity, OverflowPolicy policy)
+        : ring(capacity)
+        , policy(policy)
+    {
+    }
+
+    ~ingest_entry()
+    {
+        stop();
+    }
+
+    /**
+     * @brief 注册序列并返回其编号，生产者之后用编号写入，避免每批都按名字查找
+     */
+    uint32_t register_series(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(seriesMutex);
+        auto it = seriesIds.find(name);
+        if (it != seriesIds.end())
+            return it->second;
+        uint32_t id = static_cast<uint32_t>(seriesNames.size());
+        seriesNames.push_back(name);
+        seriesIds[name] = id;
+        return id;
+    }
+
+    /**
+     * @brief 启动后台消费线程。OVERFLOW_BLOCK策略下，未启动时写满队列的生产者会一直等待
+     */
+    void start()
+    {
+        if (running.exchange(true))
+            return;
+        consumer = std::thread([this]() { consume(); });
+    }
+
+    /**
+     * @brief 写入一批点，可被多个线程并发调用
+     *
+     * @return 进入队列的点数，其余的点按溢出策略被丢弃；OVERFLOW_DROP_OLDEST下其中的点之后仍可能被挤出
+     */
+    size_t push(uint32_t series, const long long* timestamps, const T* values, size_t n)
+    {
+        size_t accepted = 0;
+        for (size_t beg = 0; beg < n; beg += RECORD_POINTS) {
+            uint32_t count = static_cast<uint32_t>(std::min(RECORD_POINTS, n - beg));
+            // 在记录发布之前计数，挤出该记录的线程一定看得到这次计数
+            auto fill = [&](record& r) {
+                r.series = series;
+                r.count = count;
+                std::copy(timestamps + beg, timestamps + beg + count, r.timestamps);
+                std::copy(values + beg, values + beg + count, r.values);
+                pushedPoints.fetch_add(count, std::memory_order_relaxed);
+            };
+            bool pushed = ring.tryPush(fill);
+            while (!pushed) {
+                if (policy == OVERFLOW_DROP_NEWEST)
+                    break;
+                if (policy == OVERFLOW_DROP_OLDEST) {
+                    ring.tryPop([this](record& r) {
+                        pushedPoints.fetch_sub(r.count, std::memory_order_relaxed);
+                        droppedPoints.fetch_add(r.count, std::memory_order_relaxed);
+                    });
+                } else
+                    std::this_thread::yield();
+                pushed = ring.tryPush(fill);
+            }
+            if (pushed)
+                accepted += count;
+            else
+                droppedPoints.fetch_add(count, std::memory_order_relaxed);
+        }
+        return accepted;
+    }
+
+    size_t push(const std::vector<basic_point<T>>& points)
+    {
+        if (points.empty())
+            return 0;
+        std::vector<long long> timestamps(points.size());
+        std::unique_ptr<T[]> values(new T[points.size()]);
+        for (size_t i = 0; i < points.size(); i++) {
+            timestamps[i] = points[i].nanoseconds_;
+            values[i] = points[i].value_;
+        }
+        return push(register_series(points[0].name_), timestamps.data(), values.get(), points.size());
+    }
+
+    /**
+     * @brief 等待队列排空后停止后台线程，结束所有序列的流。未调用start()时在当前线程排空队列
+     *
+     * @return 各序列流的json文件路径
+     */
+    std::vector<std::string> stop()
+    {
+        std::vector<std::string> paths;
+        if (running.exchange(false))
+            consumer.join();
+        else
+            consume();
+        for (auto& writer : writers) {
+            if (writer.second)
+                paths.push_back(writer.second->close());
+        }
+        writers.clear();
+        return paths;
+    }
+
+    uint64_t pushed() const
+    {
+        return pushedPoints.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() const
+    {
+        return droppedPoints.load(std::memory_order_relaxed);
+    }
+
+    // 写入流时返回错误（值类型不符、写文件失败）的记录中的点数
+    uint64_t failed() const
+    {
+        return failedPoints.load(std::memory_order_relaxed);
+    }
+
+    size_t queued() const
+    {
+        return ring.size();
+    }
+
+private:
+    static OverflowPolicy policyFromConfig()
+    {
+        OverflowPolicy policy = OVERFLOW_BLOCK;
+        std::string name = ArgParser::get<std::string>("overflowPolicy", "hf_ingest");
+        if (!parseOverflowPolicy(name, policy))
+            std::cerr << "Unknown overflow policy " << name << ", use block" << std::endl;
+        return policy;
+    }
+
+    void consume()
+    {
+        auto insert = [this](record& r) {
+            if (r.series >= writers.size())
+                writers.resize(r.series + 1);
+            auto& [name, entry] = writers[r.series];
+            if (!entry) {
+                {
+                    std::lock_guard<std::mutex> lock(seriesMutex);
+                    name = seriesNames[r.series];
+                }
+                entry = std::make_unique<tsdb_entry>();
+                entry->initialize();
+            }
+            int ret = entry->insert_columns(name, r.timestamps, r.values, r.count);
+            if (ret != 0) {
+                failedPoints.fetch_add(r.count, std::memory_order_relaxed);
+                std::cerr << "Cannot write " << r.count << " points of series " << name << ", error " << ret << std::endl;
+            }
+        };
+        // 停止时先把队列中剩余的记录消费完
+        for (;;) {
+            bool active = running.load(std::memory_order_acquire);
+            if (ring.tryPop(insert))
+                continue;
+            if (!active)
+                break;
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    RingBuffer<record> ring;
+    OverflowPolicy policy;
+    std::atomic<uint64_t> pushedPoints { 0 };
+    std::atomic<uint64_t> droppedPoints { 0 };
+    std::atomic<uint64_t> failedPoints { 0 };
+    std::atomic<bool> running { false };
+    std::thread consumer;
+
+    std::mutex seriesMutex;
+    std::vector<std::string> seriesNames;
+    std::map<std::string, uint32_t> seriesIds;
+
+    // 每个序列的名字和写入器，只由消费线程访问
+    std::vector<std::pair<std::string, std::unique_ptr<tsdb_entry>>> writers;
+};
+}
+#endif // TSDB_HF_INGEST_HPP
@@ -0,0 +1,369 @@
+// scan kernels of high frenqence data api
+#ifndef TSDB_HF_KERNELS_HPP
+#define TSDB_HF_KERNELS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define TSDB_HF_KERNELS_AVX2 1
+#endif
+
+namespace tsdb_hf_cpp {
+
+/**
+ * @brief 非空值的聚合结果，bool按0/1计
+ */
+struct Aggregate {
+    size_t count = 0;
+    size_t nulls = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    double mean() const
+    {
+        return count ? sum / count : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    void merge(const Aggregate& other)
+    {
+        count += other.count;
+        nulls += other.nulls;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+/**
+ * @brief 值的区间谓词 lower < v < upper，两端可各自包含端点。NaN不满足任何谓词
+ */
+struct Predicate {
+    double lower = -std::numeric_limits<double>::infinity();
+    double upper = std::numeric_limits<double>::infinity();
+    bool lowerInclusive = true;
+    bool upperInclusive = true;
+
+    static Predicate greater(double x)
+    {
+        return { x, std::numeric_limits<double>::infinity(), false, true };
+    }
+
+    static Predicate greaterEqual(double x)
+    {
+        return { x, std::numeric_limits<double>::infinity(), true, true };
+    }
+
+    static Predicate less(double x)
+    {
+        return { -std::numeric_limits<double>::infinity(), x, true, false };
+    }
+
+    static Predicate lessEqual(double x)
+    {
+        return { -std::numeric_limits<double>::infinity(), x, true, true };
+    }
+
+    static Predicate between(double lo, double hi)
+    {
+        return { lo, hi, true, true };
+    }
+
+    static Predicate equal(double x)
+    {
+        return { x, x, true, true };
+    }
+
+    bool matches(double v) const
+    {
+        return (lowerInclusive ? v >= lower : v > lower) && (upperInclusive ? v <= upper : v < upper);
+    }
+
+    // 值域为[min, max]的块中是否可能有值满足
+    bool overlaps(double min, double max) const
+    {
+        return (lowerInclusive ? max >= lower : max > lower) && (upperInclusive ? min <= upper : min < upper);
+    }
+};
+
+/**
+ * @brief 列上的批量运算。掩码每个值一个字节，非0表示有效；位图每个值一位，低位在前，与Arrow的validity缓冲一致。
+ * double列和字节扫描在支持AVX2的CPU上使用向量化实现，运行时检测，不要求以-mavx2编译
+ */
+struct Kernels {
+    // 空值在按行展开的列中的填充值
+    template <typename T>
+    static T nullValue()
+    {
+        if constexpr (std::is_floating_point_v<T>)
+            return std::numeric_limits<T>::quiet_NaN();
+        else
+            return T();
+    }
+
+    /**
+     * @brief 掩码打包为位图，追加到out
+     *
+     * @return 空值个数
+     */
+    static size_t packBitmap(const uint8_t* mask, size_t n, std::vector<char>& out)
+    {
+        size_t pos = out.size(), valid = 0;
+        out.resize(pos + (n + 7) / 8, 0);
+        for (size_t i = 0; i < n; i++) {
+            uint8_t bit = mask[i] != 0;
+            out[pos + i / 8] |= static_cast<char>(bit << (i % 8));
+            valid += bit;
+        }
+        return n - valid;
+    }
+
+    /**
+     * @brief 位图展开为掩码，追加到mask
+     */
+    static void unpackBitmap(const uint8_t* bitmap, size_t n, std::vector<uint8_t>& mask)
+    {
+        size_t pos = mask.size();
+        mask.resize(pos + n);
+        for (size_t i = 0; i < n; i++)
+            mask[pos + i] = (bitmap[i / 8] >> (i % 8)) & 1;
+    }
+
+    /**
+     * @brief 按位图把只含有效值的紧凑列展开为n行追加到out，空值处填fill。整字节全有效或全空时成段复制或填充
+     *
+     * @return packed不足时返回false
+     */
+    template <typename T>
+    static bool expand(const uint8_t* bitmap, const std::vector<T>& packed, size_t n, std::vector<T>& out, T fill)
+    {
+        size_t pos = out.size(), j = 0;
+        out.resize(pos + n, fill);
+        for (size_t i = 0; i < n; i += 8) {
+            uint8_t byte = bitmap[i / 8];
+            size_t m = std::min<size_t>(8, n - i);
+            if (byte == 0)
+                continue;
+            if (byte == 0xFF && m == 8 && j + 8 <= packed.size()) {
+                std::copy(packed.begin() + j, packed.begin() + j + 8, out.begin() + pos + i);
+                j += 8;
+                continue;
+            }
+            for (size_t b = 0; b < m; b++) {
+                if ((byte >> b) & 1) {
+                    if (j == packed.size())
+                        return false;
+                    out[pos + i + b] = packed[j++];
+                }
+            }
+        }
+        return j == packed.size();
+    }
+
+    /**
+     * @brief 聚合全部值
+     */
+    template <typename T>
+    static void aggregate(const std::vector<T>& values, Aggregate& result)
+    {
+        if constexpr (std::is_same_v<T, double>) {
+#ifdef TSDB_HF_KERNELS_AVX2
+            if (hasAvx2()) {
+                aggregateAvx2(values.data(), nullptr, values.size(), result);
+                return;
+            }
+#endif
+        }
+        Aggregate local;
+        for (size_t i = 0; i < values.size(); i++) {
+            double v = static_cast<double>(values[i]);
+            local.sum += v;
+            local.min = std::min(local.min, v);
+            local.max = std::max(local.max, v);
+        }
+        local.count = values.size();
+        result.merge(local);
+    }
+
+    /**
+     * @brief 只聚合mask非0的值，其余计入nulls
+     */
+    template <typename T>
+    static void aggregate(const std::vector<T>& values, const std::vector<uint8_t>& mask, Aggregate& result)
+    {
+        size_t n = std::min(values.size(), mask.size());
+        if constexpr (std::is_same_v<T, double>) {
+#ifdef TSDB_HF_KERNELS_AVX2
+            if (hasAvx2()) {
+                aggregateAvx2(values.data(), mask.data(), n, result);
+                return;
+            }
+#endif
+        }
+        // 无分支：无效值以0和±inf参与运算
+        constexpr double inf = std::numeric_limits<double>::infinity();
+        Aggregate local;
+        for (size_t i = 0; i < n; i++) {
+            bool keep = mask[i] != 0;
+            double v = static_cast<double>(values[i]);
+            local.sum += keep ? v : 0;
+            local.min = std::min(local.min, keep ? v : inf);
+            local.max = std::max(local.max, keep ? v : -inf);
+            local.count += keep;
+        }
+        local.nulls = n - local.count;
+        result.merge(local);
+    }
+
+    /**
+     * @brief 满足谓词的行号追加到rows，mask非空时跳过mask为0的行
+     */
+    template <typename T>
+    static void select(const std::vector<T>& values, const Predicate& predicate, const std::vector<uint8_t>& mask, std::vector<uint32_t>& rows)
+    {
+        size_t n = mask.empty() ? values.size() : std::min(values.size(), mask.size());
+        const uint8_t* m = mask.empty() ? nullptr : mask.data();
+        if constexpr (std::is_same_v<T, double>) {
+#ifdef TSDB_HF_KERNELS_AVX2
+            if (hasAvx2()) {
+                // 比较方式须为立即数，按端点是否包含分派
+                if (predicate.lowerInclusive && predicate.upperInclusive)
+                    selectAvx2<_CMP_GE_OQ, _CMP_LE_OQ>(values.data(), m, n, predicate, rows);
+                else if (predicate.lowerInclusive)
+                    selectAvx2<_CMP_GE_OQ, _CMP_LT_OQ>(values.data(), m, n, predicate, rows);
+                else if (predicate.upperInclusive)
+                    selectAvx2<_CMP_GT_OQ, _CMP_LE_OQ>(values.data(), m, n, predicate, rows);
+                else
+                    selectAvx2<_CMP_GT_OQ, _CMP_LT_OQ>(values.data(), m, n, predicate, rows);
+                return;
+            }
+#endif
+        }
+        for (size_t i = 0; i < n; i++) {
+            if ((!m || m[i]) && predicate.matches(static_cast<double>(values[i])))
+                rows.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    /**
+     * @brief 按顺序对data[0, n)中每个等于a或b的字节调用visit(下标)，用于查找换行符和分隔符
+     */
+    template <typename Visit>
+    static void scanBytes(const char* data, size_t n, char a, char b, Visit visit)
+    {
+        size_t i = 0;
+#ifdef TSDB_HF_KERNELS_AVX2
+        if (hasAvx2())
+            i = scanBytesAvx2(data, n, a, b, visit);
+#endif
+        for (; i < n; i++) {
+            if (data[i] == a || data[i] == b)
+                visit(i);
+        }
+    }
+
+private:
+#ifdef TSDB_HF_KERNELS_AVX2
+    static bool hasAvx2()
+    {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+
+    // mask为空时聚合全部值；每次处理4个double，掩码的4个字节扩展为4个64位通道。
+    // min_pd/max_pd在任一操作数为NaN时返回第二个操作数，新值放在前面，NaN不进入累加器，与逐个的std::min/max一致
+    __attribute__((target("avx2"))) static void aggregateAvx2(const double* values, const uint8_t* mask, size_t n, Aggregate& result)
+    {
+        const __m256d inf = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+        const __m256d negInf = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+        const __m256i zero = _mm256_setzero_si256();
+        __m256d sum = _mm256_setzero_pd(), lo = inf, hi = negInf;
+        size_t count = 0, i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d v = _mm256_loadu_pd(values + i);
+            if (mask) {
+                uint32_t m4;
+                memcpy(&m4, mask + i, sizeof(m4));
+                __m256d keep = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(m4))), zero));
+                count += __builtin_popcount(_mm256_movemask_pd(keep));
+                sum = _mm256_add_pd(sum, _mm256_and_pd(v, keep));
+                lo = _mm256_min_pd(_mm256_blendv_pd(inf, v, keep), lo);
+                hi = _mm256_max_pd(_mm256_blendv_pd(negInf, v, keep), hi);
+            } else {
+                sum = _mm256_add_pd(sum, v);
+                lo = _mm256_min_pd(v, lo);
+                hi = _mm256_max_pd(v, hi);
+            }
+        }
+        alignas(32) double s[4], l[4], h[4];
+        _mm256_store_pd(s, sum);
+        _mm256_store_pd(l, lo);
+        _mm256_store_pd(h, hi);
+        Aggregate local;
+        local.sum = (s[0] + s[1]) + (s[2] + s[3]);
+        local.min = std::min(std::min(l[0], l[1]), std::min(l[2], l[3]));
+        local.max = std::max(std::max(h[0], h[1]), std::max(h[2], h[3]));
+        local.count = mask ? count : i;
+        for (; i < n; i++) {
+            if (mask && !mask[i])
+                continue;
+            local.sum += values[i];
+            local.min = std::min(local.min, values[i]);
+            local.max = std::max(local.max, values[i]);
+            local.count++;
+        }
+        local.nulls = mask ? n - local.count : 0;
+        result.merge(local);
+    }
+
+    // 每次比较4个double，比较结果与掩码合成4位，逐位取出行号
+    template <int LowerCmp, int UpperCmp>
+    __attribute__((target("avx2"))) static void selectAvx2(const double* values, const uint8_t* mask, size_t n, const Predicate& predicate, std::vector<uint32_t>& rows)
+    {
+        const __m256d lower = _mm256_set1_pd(predicate.lower), upper = _mm256_set1_pd(predicate.upper);
+        const __m256i zero = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d v = _mm256_loadu_pd(values + i);
+            __m256d hit = _mm256_and_pd(_mm256_cmp_pd(v, lower, LowerCmp), _mm256_cmp_pd(v, upper, UpperCmp));
+            if (mask) {
+                uint32_t m4;
+                memcpy(&m4, mask + i, sizeof(m4));
+                hit = _mm256_and_pd(hit, _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(m4))), zero)));
+            }
+            for (unsigned bits = _mm256_movemask_pd(hit); bits; bits &= bits - 1)
+                rows.push_back(static_cast<uint32_t>(i + __builtin_ctz(bits)));
+        }
+        for (; i < n; i++) {
+            if ((!mask || mask[i]) && predicate.matches(values[i]))
+                rows.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    // 每次比较32个字节，命中的位逐个取出；返回已扫描的长度，余下不足32个字节
+    template <typename Visit>
+    __attribute__((target("avx2"))) static size_t scanBytesAvx2(const char* data, size_t n, char a, char b, Visit& visit)
+    {
+        const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            uint32_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))));
+            for (; bits; bits &= bits - 1)
+                visit(i + __builtin_ctz(bits));
+        }
+        return i;
+    }
+#endif
+};
+
+}
+
+#endif // TSDB_HF_KERNELS_HPP
@@ -0,0 +1,308 @@
+// quantile sketches of high frenqence data api
+#ifndef TSDB_HF_SKETCH_HPP
+#define TSDB_HF_SKETCH_HPP
+
+#include "tsdb_hf_codec.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace tsdb_hf_cpp {
+
+/**
+ * @brief DDSketch分位数草图。值按绝对值的对数落入宽度为gamma = (1 + accuracy) / (1 - accuracy)的桶，
+ * 以桶的代表值回答分位数，相对误差不超过accuracy。精度相同的草图按桶相加即可合并，与插入顺序无关。
+ * 正负两侧和0所在的桶合计超过maxBuckets时，从桶较多的一侧合并绝对值最小的桶，超出预算的误差只落在这些桶所在的分位。
+ * maxBuckets小于3时正负两侧和0各至少保留一个桶
+ */
+class QuantileSketch {
+public:
+    explicit QuantileSketch(double accuracy = 0.01, size_t maxBuckets = 1024)
+        : relativeAccuracy(accuracy)
+        , bucketLimit(std::max<size_t>(maxBuckets, 1))
+    {
+        gamma = (1 + accuracy) / (1 - accuracy);
+        logGamma = std::log(gamma);
+    }
+
+    double accuracy() const
+    {
+        return relativeAccuracy;
+    }
+
+    uint64_t count() const
+    {
+        return total;
+    }
+
+    bool empty() const
+    {
+        return total == 0;
+    }
+
+    double min() const
+    {
+        return minValue;
+    }
+
+    double max() const
+    {
+        return maxValue;
+    }
+
+    size_t bucketCount() const
+    {
+        return positive.counts.size() + negative.counts.size() + (zeroCount ? 1 : 0);
+    }
+
+    /**
+     * @brief 加入一个值，NaN被忽略
+     */
+    void add(double v, uint64_t n = 1)
+    {
+        if (std::isnan(v) || n == 0)
+            return;
+        if (v > MIN_INDEXABLE)
+            positive.add(key(v), n, bucketLimit);
+        else if (v < -MIN_INDEXABLE)
+            negative.add(key(-v), n, bucketLimit);
+        else
+            zeroCount += n;
+        total += n;
+        minValue = std::min(minValue, v);
+        maxValue = std::max(maxValue, v);
+        fitBuckets();
+    }
+
+    /**
+     * @brief 加入mask非0的值，mask为空时加入全部值
+     */
+    template <typename T>
+    void add(const std::vector<T>& values, const std::vector<uint8_t>& mask = {})
+    {
+        for (size_t i = 0; i < values.size(); i++) {
+            if (mask.empty() || mask[i])
+                add(static_cast<double>(values[i]));
+        }
+    }
+
+    /**
+     * @brief 合并另一个草图，结果的桶数仍受本草图的maxBuckets约束
+     *
+     * @return 两者精度不同时返回false，本草图不变
+     */
+    bool merge(const QuantileSketch& other)
+    {
+        if (other.relativeAccuracy != relativeAccuracy)
+            return false;
+        if (other.empty())
+            return true;
+        positive.merge(other.positive, bucketLimit);
+        negative.merge(other.negative, bucketLimit);
+        zeroCount += other.zeroCount;
+        total += other.total;
+        minValue = std::min(minValue, other.minValue);
+        maxValue = std::max(maxValue, other.maxValue);
+        fitBuckets();
+        return true;
+    }
+
+    /**
+     * @brief 第q分位数（0 <= q <= 1），q为0和1时返回精确的最小、最大值；草图为空时返回NaN
+     */
+    double quantile(double q) const
+    {
+        if (total == 0 || std::isnan(q))
+            return std::numeric_limits<double>::quiet_NaN();
+        if (q <= 0)
+            return minValue;
+        if (q >= 1)
+            return maxValue;
+        double rank = q * static_cast<double>(total - 1);
+        uint64_t seen = 0;
+        double v = maxValue;
+        bool found = false;
+        // 负值按绝对值从大到小，然后是0，最后是正值从小到大
+        for (size_t i = negative.counts.size(); i-- > 0 && !found;) {
+            seen += negative.counts[i];
+            if (static_cast<double>(seen) > rank) {
+                v = -value(negative.offset + static_cast<int>(i));
+                found = true;
+            }
+        }
+        if (!found) {
+            seen += zeroCount;
+            if (static_cast<double>(seen) > rank) {
+                v = 0;
+                found = true;
+            }
+        }
+        for (size_t i = 0; i < positive.counts.size() && !found; i++) {
+            seen += positive.counts[i];
+            if (static_cast<double>(seen) > rank) {
+                v = value(positive.offset + static_cast<int>(i));
+                found = true;
+            }
+        }
+        return std::clamp(v, minValue, maxValue);
+    }
+
+    /**
+     * @brief 序列化追加到out：精度、最值、0的个数，以及正负两侧的起始桶号和各桶计数（varint）
+     */
+    void serialize(std::vector<char>& out) const
+    {
+        size_t pos = out.size();
+        out.resize(pos + 3 * sizeof(double));
+        memcpy(out.data() + pos, &relativeAccuracy, sizeof(double));
+        memcpy(out.data() + pos + sizeof(double), &minValue, sizeof(double));
+        memcpy(out.data() + pos + 2 * sizeof(double), &maxValue, sizeof(double));
+        Codec::putVarint(out, zeroCount);
+        for (const Store* store : { &positive, &negative }) {
+            Codec::putVarint(out, Codec::zigzag(static_cast<uint64_t>(static_cast<int64_t>(store->offset))));
+            Codec::putVarint(out, store->counts.size());
+            for (uint64_t c : store->counts)
+                Codec::putVarint(out, c);
+        }
+    }
+
+    /**
+     * @brief 从serialize()的输出恢复，maxBuckets为之后合并时的桶数上限
+     *
+     * @return 数据不完整时返回false
+     */
+    static bool deserialize(const char* data, size_t size, QuantileSketch& sketch, size_t maxBuckets = 1024)
+    {
+        if (size < 3 * sizeof(double))
+            return false;
+        double accuracy;
+        memcpy(&accuracy, data, sizeof(double));
+        if (!(accuracy > 0 && accuracy < 1))
+            return false;
+        QuantileSketch result(accuracy, maxBuckets);
+        memcpy(&result.minValue, data + sizeof(double), sizeof(double));
+        memcpy(&result.maxValue, data + 2 * sizeof(double), sizeof(double));
+        size_t offset = 3 * sizeof(double);
+        if (!Codec::getVarint(data, size, offset, result.zeroCount))
+            return false;
+        result.total = result.zeroCount;
+        for (Store* store : { &result.positive, &result.negative }) {
+            uint64_t start, n;
+            if (!Codec::getVarint(data, size, offset, start) || !Codec::getVarint(data, size, offset, n) || n > size - offset)
+                return false;
+            store->offset = static_cast<int>(static_cast<int64_t>(Codec::unzigzag(start)));
+            store->counts.resize(n);
+            for (auto& c : store->counts) {
+                if (!Codec::getVarint(data, size, offset, c))
+                    return false;
+                result.total += c;
+            }
+        }
+        sketch = std::move(result);
+        return true;
+    }
+
+private:
+    // 比它更接近0的值计入zeroCount
+    static constexpr double MIN_INDEXABLE = DBL_MIN * 4;
+
+    // 连续的桶，counts[i]是桶号offset + i的计数
+    struct Store {
+        int offset = 0;
+        std::vector<uint64_t> counts;
+
+        void add(int index, uint64_t n, size_t limit)
+        {
+            if (counts.empty()) {
+                offset = index;
+                counts.assign(1, n);
+                return;
+            }
+            int top = offset + static_cast<int>(counts.size()) - 1;
+            if (index > top) {
+                counts.resize(index - offset + 1, 0);
+            } else if (index < offset) {
+                // 向下扩展不超过上限，更小的值直接计入最低的桶
+                index = std::max<long long>(index, static_cast<long long>(top) - static_cast<long long>(limit) + 1);
+                if (index < offset) {
+                    counts.insert(counts.begin(), offset - index, 0);
+                    offset = index;
+                }
+                index = std::max(index, offset);
+            }
+            counts[index - offset] += n;
+            collapse(limit);
+        }
+
+        void merge(const Store& other, size_t limit)
+        {
+            if (other.counts.empty())
+                return;
+            // 先扩展到能容纳other的最高桶，再逐桶相加
+            add(other.offset + static_cast<int>(other.counts.size()) - 1, 0, limit);
+            for (size_t i = 0; i < other.counts.size(); i++) {
+                if (other.counts[i])
+                    add(other.offset + static_cast<int>(i), other.counts[i], limit);
+            }
+        }
+
+        // 桶数超过上限时把最低的桶并入保留下来的最低桶
+        void collapse(size_t limit)
+        {
+            if (counts.size() <= limit)
+                return;
+            size_t excess = counts.size() - limit;
+            uint64_t merged = 0;
+            for (size_t i = 0; i <= excess; i++)
+                merged += counts[i];
+            counts.erase(counts.begin(), counts.begin() + excess);
+            counts[0] = merged;
+            offset += static_cast<int>(excess);
+        }
+    };
+
+    // 两侧分别受bucketLimit约束，合计仍可能超出，从桶较多的一侧继续合并
+    void fitBuckets()
+    {
+        size_t reserved = zeroCount ? 1 : 0;
+        size_t budget = bucketLimit > reserved ? bucketLimit - reserved : 0;
+        while (positive.counts.size() + negative.counts.size() > budget) {
+            Store& larger = positive.counts.size() >= negative.counts.size() ? positive : negative;
+            if (larger.counts.size() <= 1)
+                break;
+            size_t excess = positive.counts.size() + negative.counts.size() - budget;
+            larger.collapse(larger.counts.size() - std::min(excess, larger.counts.size() - 1));
+        }
+    }
+
+    int key(double v) const
+    {
+        return static_cast<int>(std::ceil(std::log(v) / logGamma));
+    }
+
+    // 桶(gamma^(k-1), gamma^k]中相对误差最小的代表值
+    double value(int k) const
+    {
+        return 2 * std::pow(gamma, k) / (gamma + 1);
+    }
+
+    double relativeAccuracy;
+    size_t bucketLimit;
+    double gamma;
+    double logGamma;
+    Store positive;
+    Store negative;
+    uint64_t zeroCount = 0;
+    uint64_t total = 0;
+    double minValue = std::numeric_limits<double>::infinity();
+    double maxValue = -std::numeric_limits<double>::infinity();
+};
+
+}
+
+#endif // TSDB_HF_SKETCH_HPP
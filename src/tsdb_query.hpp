@@ -0,0 +1,441 @@
+// streaming columnar query api of tsdb_cpp
+#ifndef TSDB_QUERY_HPP
+#define TSDB_QUERY_HPP
+
+#include "tsdb.hpp"
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace tsdb_cpp {
+    // 一个序列的一批行，按列存放；time列进入timestamps_，其余各列转为double（null、字符串记为NaN，布尔记为1/0）
+    struct series_batch {
+        std::string name_;
+        std::vector<std::pair<std::string, std::string>> tags_;
+        std::vector<std::string> columns_;              // 除time外的列名
+        std::vector<long long> timestamps_;
+        std::vector<std::vector<double>> values_;       // 与columns_一一对应
+        size_t rows() const { return timestamps_.size(); }
+    };
+    // 返回false时中止查询
+    typedef std::function<bool(const series_batch&)> batch_callback;
+
+    enum query_format { QUERY_JSON, QUERY_CSV };
+
+    namespace detail {
+        // 两种格式共用的列批次状态：列映射、按批回调
+        struct column_sink {
+            column_sink(const batch_callback& cb, size_t batch_rows) : cb_(cb), batch_rows_(std::max<size_t>(batch_rows, 1)) {}
+
+            int error() const { return error_; }
+        protected:
+            void begin_series() {
+                batch_.name_.clear();
+                batch_.tags_.clear();
+                batch_.columns_.clear();
+                batch_.timestamps_.clear();
+                batch_.values_.clear();
+                slots_.clear();
+            }
+            void add_column(std::string name) {
+                if(name == "time") {
+                    slots_.push_back(-1);
+                    return;
+                }
+                slots_.push_back(static_cast<int>(batch_.columns_.size()));
+                batch_.columns_.push_back(std::move(name));
+                batch_.values_.emplace_back();
+                batch_.values_.back().reserve(batch_rows_);
+            }
+            void begin_row() {
+                batch_.timestamps_.push_back(0);
+                for(auto& column : batch_.values_) column.push_back(std::numeric_limits<double>::quiet_NaN());
+                cell_ = 0;
+            }
+            void set_cell(const char* p, size_t n, bool quoted) {
+                size_t cell = cell_++;
+                if(cell >= slots_.size() || quoted) return;
+                if(slots_[cell] < 0) {
+                    long long ts = 0;
+                    if(std::from_chars(p, p + n, ts).ec != std::errc()) {
+                        double d = 0;
+                        std::from_chars(p, p + n, d);
+                        ts = static_cast<long long>(d);
+                    }
+                    batch_.timestamps_.back() = ts;
+                    return;
+                }
+                double v = std::numeric_limits<double>::quiet_NaN();
+                if(n == 4 && !memcmp(p, "true", 4)) v = 1;
+                else if(n == 5 && !memcmp(p, "false", 5)) v = 0;
+                else std::from_chars(p, p + n, v);
+                batch_.values_[slots_[cell]].back() = v;
+            }
+            // 攒满一批或force时交给回调，之后只清空行，保留序列名、标签和列
+            bool emit(bool force) {
+                if(batch_.timestamps_.empty() || (!force && batch_.timestamps_.size() < batch_rows_)) return true;
+                bool ok = cb_(batch_);
+                batch_.timestamps_.clear();
+                for(auto& column : batch_.values_) column.clear();
+                if(!ok) error_ = -13;
+                return ok;
+            }
+
+            const batch_callback& cb_;
+            size_t batch_rows_;
+            series_batch batch_;
+            std::vector<int> slots_;        // 各列在values_中的下标，time列为-1
+            size_t cell_ = 0;
+            int error_ = 0;
+        };
+
+        /**
+         * @brief 增量解析InfluxDB的JSON查询结果（含chunked=true时以换行分隔的多个对象），
+         * 只跟踪results[].series[]下的name、tags、columns和values，其余内容跳过
+         */
+        struct json_column_parser : public column_sink {
+            json_column_parser(const batch_callback& cb, size_t batch_rows) : column_sink(cb, batch_rows) {}
+
+            // 返回false时停止输入，原因见error()
+            bool feed(const char* p, size_t n) {
+                const char* end = p + n;
+                while(p < end && !error_) {
+                    if(tok_ == T_STRING) {
+                        p = scan_string(p, end);
+                        continue;
+                    }
+                    if(tok_ == T_SCALAR) {
+                        const char* q = p;
+                        while(q < end && !is_delim(*q)) q++;
+                        text_.append(p, q - p);
+                        p = q;
+                        if(p == end) break;
+                        tok_ = T_NONE;
+                        on_scalar(false);
+                        continue;
+                    }
+                    char c = *p++;
+                    switch(c) {
+                        case ' ': case '\t': case '\r': case '\n': case ',': case ':':
+                            break;
+                        case '"':
+                            tok_ = T_STRING;
+                            text_.clear();
+                            break;
+                        case '{': case '[':
+                            open(c == '[');
+                            break;
+                        case '}': case ']':
+                            close();
+                            break;
+                        default:
+                            tok_ = T_SCALAR;
+                            text_.assign(1, c);
+                            break;
+                    }
+                }
+                return !error_;
+            }
+
+            // 响应结束时调用，返回0或错误码
+            int finish() {
+                if(tok_ == T_SCALAR) {
+                    tok_ = T_NONE;
+                    on_scalar(false);
+                }
+                if(!error_ && (tok_ != T_NONE || !stack_.empty())) error_ = -14;
+                if(!error_ && !server_error_.empty()) error_ = -15;
+                return error_;
+            }
+
+            // 服务端在结果中报告的错误
+            const std::string& server_error() const { return server_error_; }
+        private:
+            enum token { T_NONE, T_STRING, T_SCALAR };
+            enum role { R_OTHER, R_SERIES_LIST, R_SERIES, R_TAGS, R_COLUMNS, R_VALUES, R_ROW };
+            struct frame {
+                bool array;
+                role role_;
+                bool has_key;
+                std::string key;
+            };
+
+            static bool is_delim(char c) { return c == ',' || c == ']' || c == '}' || c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+            const char* scan_string(const char* p, const char* end) {
+                while(p < end) {
+                    if(escape_) {
+                        if(!unescape(*p++)) return end;
+                        continue;
+                    }
+                    const char* q = p;
+                    while(q < end && *q != '"' && *q != '\\') q++;
+                    text_.append(p, q - p);
+                    p = q;
+                    if(p == end) break;
+                    if(*p++ == '\\') {
+                        escape_ = 1;
+                        continue;
+                    }
+                    tok_ = T_NONE;
+                    on_scalar(true);
+                    break;
+                }
+                return p;
+            }
+            // escape_: 1为反斜杠之后，2~5为\u之后读到的十六进制位数加1
+            bool unescape(char c) {
+                if(escape_ == 1) {
+                    static const char from[] = "\"\\/bfnrt", to[] = "\"\\/\b\f\n\r\t";
+                    const char* hit = strchr(from, c);
+                    if(c == 'u') {
+                        escape_ = 2;
+                        code_ = 0;
+                        return true;
+                    }
+                    if(!c || !hit) {
+                        error_ = -14;
+                        return false;
+                    }
+                    text_ += to[hit - from];
+                    escape_ = 0;
+                    return true;
+                }
+                int digit = isdigit(static_cast<unsigned char>(c)) ? c - '0' : (isxdigit(static_cast<unsigned char>(c)) ? (tolower(c) - 'a' + 10) : -1);
+                if(digit < 0) {
+                    error_ = -14;
+                    return false;
+                }
+                code_ = code_ * 16 + digit;
+                if(++escape_ < 6) return true;
+                // 代理对各自按一个码点输出，序列名和标签中极少出现
+                if(code_ < 0x80) {
+                    text_ += static_cast<char>(code_);
+                } else if(code_ < 0x800) {
+                    text_ += static_cast<char>(0xC0 | (code_ >> 6));
+                    text_ += static_cast<char>(0x80 | (code_ & 0x3F));
+                } else {
+                    text_ += static_cast<char>(0xE0 | (code_ >> 12));
+                    text_ += static_cast<char>(0x80 | ((code_ >> 6) & 0x3F));
+                    text_ += static_cast<char>(0x80 | (code_ & 0x3F));
+                }
+                escape_ = 0;
+                return true;
+            }
+
+            void open(bool array) {
+                role parent = stack_.empty() ? R_OTHER : stack_.back().role_;
+                const std::string* key = !stack_.empty() && !stack_.back().array ? &stack_.back().key : NULL;
+                role r = R_OTHER;
+                if(array && key && *key == "series") r = R_SERIES_LIST;
+                else if(!array && parent == R_SERIES_LIST) r = R_SERIES;
+                else if(!array && parent == R_SERIES && *key == "tags") r = R_TAGS;
+                else if(array && parent == R_SERIES && *key == "columns") r = R_COLUMNS;
+                else if(array && parent == R_SERIES && *key == "values") r = R_VALUES;
+                else if(array && parent == R_VALUES) r = R_ROW;
+
+                if(r == R_SERIES) begin_series();
+                else if(r == R_ROW) begin_row();
+                stack_.push_back(frame { array, r, false, std::string() });
+            }
+
+            void close() {
+                if(stack_.empty()) {
+                    error_ = -14;
+                    return;
+                }
+                role r = stack_.back().role_;
+                stack_.pop_back();
+                if(!stack_.empty()) stack_.back().has_key = false;
+                if(r == R_ROW) emit(false);
+                else if(r == R_SERIES) emit(true);
+            }
+
+            void on_scalar(bool quoted) {
+                if(stack_.empty()) return;
+                frame& f = stack_.back();
+                if(!f.array && !f.has_key) {
+                    if(!quoted) {
+                        error_ = -14;
+                        return;
+                    }
+                    f.key.swap(text_);
+                    f.has_key = true;
+                    return;
+                }
+                f.has_key = false;
+                switch(f.role_) {
+                    case R_ROW:
+                        set_cell(text_.data(), text_.length(), quoted);
+                        break;
+                    case R_COLUMNS:
+                        if(quoted) add_column(text_);
+                        break;
+                    case R_TAGS:
+                        batch_.tags_.emplace_back(f.key, text_);
+                        break;
+                    case R_SERIES:
+                        if(f.key == "name") batch_.name_ = text_;
+                        break;
+                    default:
+                        if(!f.array && f.key == "error" && quoted) server_error_ = text_;
+                        break;
+                }
+            }
+
+            std::vector<frame> stack_;
+            token tok_ = T_NONE;
+            std::string text_;
+            int escape_ = 0;
+            unsigned code_ = 0;
+            std::string server_error_;
+        };
+
+        /**
+         * @brief 增量解析InfluxDB的CSV查询结果（Accept: application/csv），
+         * 表头为name,tags,time,列...，name或tags变化时视为新序列
+         */
+        struct csv_column_parser : public column_sink {
+            csv_column_parser(const batch_callback& cb, size_t batch_rows) : column_sink(cb, batch_rows) {}
+
+            bool feed(const char* p, size_t n) {
+                const char* end = p + n;
+                while(p < end && !error_) {
+                    const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+                    if(!nl) {
+                        line_.append(p, end - p);
+                        break;
+                    }
+                    // 整行都在本次输入中时直接解析，不经过line_
+                    if(line_.empty()) {
+                        on_line(p, nl - p);
+                    } else {
+                        line_.append(p, nl - p);
+                        on_line(line_.data(), line_.length());
+                        line_.clear();
+                    }
+                    p = nl + 1;
+                }
+                return !error_;
+            }
+
+            int finish() {
+                if(!error_ && !line_.empty()) {
+                    on_line(line_.data(), line_.length());
+                    line_.clear();
+                }
+                if(!error_) emit(true);
+                return error_;
+            }
+        private:
+            // 按逗号切分，支持双引号包围及""转义
+            void split(const char* p, size_t n) {
+                fields_.clear();
+                const char* end = p + n;
+                if(n && end[-1] == '\r') end--;
+                size_t used = 0;
+                for(;;) {
+                    if(used == storage_.size()) storage_.emplace_back();
+                    std::string& field = storage_[used++];
+                    field.clear();
+                    bool quoted = p < end && *p == '"';
+                    if(quoted) {
+                        for(p++; p < end; p++) {
+                            if(*p == '"') {
+                                if(p + 1 < end && p[1] == '"') {
+                                    field += '"';
+                                    p++;
+                                } else {
+                                    p++;
+                                    break;
+                                }
+                            } else {
+                                field += *p;
+                            }
+                        }
+                    }
+                    const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+                    const char* stop = comma ? comma : end;
+                    field.append(p, stop - p);
+                    fields_.emplace_back(field, quoted);
+                    if(!comma) break;
+                    p = comma + 1;
+                }
+            }
+
+            void on_line(const char* p, size_t n) {
+                if(!n || (n == 1 && *p == '\r')) return;
+                split(p, n);
+                if(fields_.size() < 3) {
+                    error_ = -14;
+                    return;
+                }
+                if(fields_[0].first == "name" && fields_[1].first == "tags") {
+                    if(!emit(true)) return;
+                    header_.clear();
+                    for(size_t i = 2; i < fields_.size(); i++) header_.push_back(fields_[i].first);
+                    series_key_.clear();
+                    return;
+                }
+                std::string key = fields_[0].first + '\n' + fields_[1].first;
+                if(key != series_key_) {
+                    if(!emit(true)) return;
+                    begin_series();
+                    batch_.name_ = fields_[0].first;
+                    parse_tags(fields_[1].first);
+                    for(const auto& column : header_) add_column(column);
+                    series_key_.swap(key);
+                }
+                begin_row();
+                for(size_t i = 2; i < fields_.size(); i++) {
+                    const std::string& text = fields_[i].first;
+                    set_cell(text.data(), text.length(), fields_[i].second);
+                }
+                emit(false);
+            }
+
+            void parse_tags(const std::string& tags) {
+                size_t beg = 0;
+                while(beg < tags.length()) {
+                    size_t comma = tags.find(',', beg), eq = tags.find('=', beg);
+                    if(comma == std::string::npos) comma = tags.length();
+                    if(eq < comma) batch_.tags_.emplace_back(tags.substr(beg, eq - beg), tags.substr(eq + 1, comma - eq - 1));
+                    beg = comma + 1;
+                }
+            }
+
+            std::string line_;
+            std::vector<std::string> storage_;
+            std::vector<std::pair<std::string, bool>> fields_;
+            std::vector<std::string> header_;
+            std::string series_key_;
+        };
+    }
+
+    /**
+     * @brief 流式执行查询：响应边到达边解析，每个序列按batch_rows行一批以列的形式交给回调，内存占用与结果大小无关
+     *
+     * @return 0成功；网络错误同query；非2xx返回状态码；-13回调中止；-14响应体格式错误；-15服务端报告查询错误
+     */
+    inline int query_columns(const std::string& query, const server_info& si, const batch_callback& cb,
+                             query_format format = QUERY_JSON, size_t batch_rows = 4096, unsigned timeout_sec = 0) {
+        std::string qs("&chunked=true&chunk_size=");
+        qs += std::to_string(batch_rows);
+        qs += "&q=";
+        url_encode(qs, query);
+
+        if(format == QUERY_CSV) {
+            detail::csv_column_parser parser(cb, batch_rows);
+            int ret = detail::inner::http_request("GET", "query", qs, "", si,
+                [&parser](const char* p, size_t n) { return parser.feed(p, n); }, timeout_sec, "\r\nAccept: application/csv");
+            return parser.error() ? parser.error() : ret ? ret : parser.finish();
+        }
+        detail::json_column_parser parser(cb, batch_rows);
+        int ret = detail::inner::http_request("GET", "query", qs, "", si,
+            [&parser](const char* p, size_t n) { return parser.feed(p, n); }, timeout_sec, "\r\nAccept: application/json");
+        return parser.error() ? parser.error() : ret ? ret : parser.finish();
+    }
+}
+
+#endif // TSDB_QUERY_HPP
@@ -0,0 +1,364 @@
+// disk-backed write spool of tsdb_cpp (posix only)
+#ifndef TSDB_SPOOL_HPP
+#define TSDB_SPOOL_HPP
+
+#include "tsdb.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace tsdb_cpp {
+    struct spool_stats {
+        size_t depth_bytes_ = 0;        // 待发送的记录字节（含记录头）
+        size_t depth_records_ = 0;      // 待发送的记录数
+        size_t segments_ = 0;           // 磁盘上的段文件数
+        size_t appended_ = 0;           // 本进程写入的记录数
+        size_t drained_ = 0;            // 服务端已接受的记录数
+        size_t drained_bytes_ = 0;
+        size_t dropped_ = 0;            // 队列已满或记录超过段大小而未写入的记录数
+        size_t rejected_ = 0;           // 服务端以4xx拒绝、不再重试的记录数
+        size_t send_failures_ = 0;      // 网络错误或5xx，稍后重试
+        double drain_records_per_sec_ = 0;  // 自上次stats()以来的排空速率
+        double drain_bytes_per_sec_ = 0;
+    };
+
+    // 有界的磁盘写入缓冲：append把请求体追加到mmap的段文件，内存速度吸收突发；
+    // 后台线程按服务端能接受的速度逐条发送。读位置持久化在cursor文件中，重启后从未确认的记录继续发送。
+    // 段文件由记录[u32 长度][u32 crc32][请求体]顺序组成，长度0或crc不符处为段的有效末尾
+    struct spool {
+        // 返回值与post_http相同：0成功，4xx丢弃该记录，负数、429和5xx退避后重试
+        typedef std::function<int(std::string_view)> sender;
+
+        /**
+         * @param dir 段文件和cursor所在目录，不存在时创建
+         * @param segment_bytes 单个段文件大小，也是单条记录的上限
+         * @param max_segments 段文件数上限，写满后append丢弃新记录
+         */
+        spool(const std::string& dir, sender send, size_t segment_bytes = 64 << 20, size_t max_segments = 16)
+            : dir_(dir), send_(std::move(send)), segment_bytes_(std::max<size_t>(segment_bytes, 0x1000)), max_segments_(std::max<size_t>(max_segments, 2)) {
+            std::error_code ec;
+            std::filesystem::create_directories(dir_, ec);
+            recover();
+            last_stats_time_ = std::chrono::steady_clock::now();
+        }
+        ~spool() {
+            stop();
+            for(auto& s : segments_) unmap(s.second);
+            if(cursor_) munmap(cursor_, sizeof(cursor_state));
+        }
+        spool(const spool&) = delete;
+        spool& operator=(const spool&) = delete;
+
+        // 发送到si的write接口
+        static sender http_sender(const server_info& si, unsigned timeout_sec = 0) {
+            return [si, timeout_sec](std::string_view body) {
+                return detail::inner::http_request("POST", "write", "", body, si, detail::body_sink(), timeout_sec);
+            };
+        }
+
+        // 打开失败（目录不可写等）时append总是返回false
+        bool good() const { return cursor_ != nullptr; }
+
+        // 返回false表示记录未写入：队列已满、记录超过段大小或spool不可用
+        bool append(std::string_view body) {
+            if(body.empty()) return true;
+            size_t need = RECORD_HEADER + body.length();
+            std::lock_guard<std::mutex> lock(mtx_);
+            segment* seg = segments_.empty() ? nullptr : &segments_.rbegin()->second;
+            bool roll = !seg || seg->sealed_ || seg->end_ + need > seg->size_;
+            if(!cursor_ || need > segment_bytes_ || (roll && segments_.size() >= max_segments_)) {
+                dropped_++;
+                return false;
+            }
+            if(roll) {
+                uint64_t seq = segments_.empty() ? cursor_->seq_ : segments_.rbegin()->first + 1;
+                if(seg) seg->sealed_ = true;
+                if(!(seg = create_segment(seq))) {
+                    dropped_++;
+                    return false;
+                }
+            }
+            char* p = seg->base_ + seg->end_;
+            uint32_t head[2] = { static_cast<uint32_t>(body.length()), checksum(body) };
+            memcpy(p + RECORD_HEADER, body.data(), body.length());
+            memcpy(p, head, RECORD_HEADER);
+            seg->end_ += need;
+            depth_bytes_ += need;
+            depth_records_++;
+            appended_++;
+            cv_.notify_all();
+            return true;
+        }
+        bool append(const tsdb_data_builder& builder) { return append(builder.view()); }
+
+        // 启动后台发送线程
+        void start() {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if(running_ || !cursor_) return;
+            running_ = true;
+            stopping_ = false;
+            drain_ = std::thread([this]() { run(); });
+        }
+
+        // 等待正在发送的记录完成后停止，未发送的记录留在磁盘上
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if(!running_) return;
+                stopping_ = true;
+            }
+            cv_.notify_all();
+            drain_.join();
+            std::lock_guard<std::mutex> lock(mtx_);
+            running_ = false;
+        }
+
+        // 等待队列排空，超时返回false
+        bool wait_empty(unsigned timeout_ms) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            return cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return depth_records_ == 0; });
+        }
+
+        spool_stats stats() {
+            std::lock_guard<std::mutex> lock(mtx_);
+            spool_stats s;
+            s.depth_bytes_ = depth_bytes_;
+            s.depth_records_ = depth_records_;
+            s.segments_ = segments_.size();
+            s.appended_ = appended_;
+            s.drained_ = drained_;
+            s.drained_bytes_ = drained_bytes_;
+            s.dropped_ = dropped_;
+            s.rejected_ = rejected_;
+            s.send_failures_ = send_failures_;
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - last_stats_time_).count();
+            if(elapsed > 0) {
+                s.drain_records_per_sec_ = (drained_ - last_drained_) / elapsed;
+                s.drain_bytes_per_sec_ = (drained_bytes_ - last_drained_bytes_) / elapsed;
+            }
+            last_stats_time_ = now;
+            last_drained_ = drained_;
+            last_drained_bytes_ = drained_bytes_;
+            return s;
+        }
+
+        // Prometheus文本格式
+        std::string to_prometheus() {
+            spool_stats s = stats();
+            std::ostringstream out;
+            auto metric = [&out](const char* name, const char* type, const char* help, double value) {
+                out << "# HELP tsdb_spool_" << name << ' ' << help << "\n# TYPE tsdb_spool_" << name << ' ' << type << "\ntsdb_spool_" << name << ' ' << value << '\n';
+            };
+            metric("depth_bytes", "gauge", "Bytes waiting in the spool.", s.depth_bytes_);
+            metric("depth_records", "gauge", "Records waiting in the spool.", s.depth_records_);
+            metric("segments", "gauge", "Segment files on disk.", s.segments_);
+            metric("drain_records_per_second", "gauge", "Records accepted by the server per second since the last scrape.", s.drain_records_per_sec_);
+            metric("drain_bytes_per_second", "gauge", "Bytes accepted by the server per second since the last scrape.", s.drain_bytes_per_sec_);
+            metric("appended_total", "counter", "Records appended.", s.appended_);
+            metric("drained_total", "counter", "Records accepted by the server.", s.drained_);
+            metric("dropped_total", "counter", "Records dropped because the spool was full.", s.dropped_);
+            metric("rejected_total", "counter", "Records rejected by the server with 4xx.", s.rejected_);
+            metric("send_failures_total", "counter", "Failed send attempts that will be retried.", s.send_failures_);
+            return out.str();
+        }
+    private:
+        static constexpr size_t RECORD_HEADER = 8;
+        static constexpr unsigned MAX_BACKOFF_MS = 5000;
+
+        struct segment {
+            int fd_ = -1;
+            char* base_ = nullptr;
+            size_t size_ = 0;
+            size_t end_ = 0;            // 有效记录的末尾
+            bool sealed_ = false;       // 不再追加
+        };
+        struct cursor_state {
+            uint64_t seq_;
+            uint64_t offset_;
+        };
+
+        static uint32_t checksum(std::string_view body) {
+            return static_cast<uint32_t>(crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(body.data()), static_cast<uInt>(body.length())));
+        }
+
+        std::string segment_path(uint64_t seq) const {
+            char name[40];
+            snprintf(name, sizeof(name), "spool-%016llu.seg", static_cast<unsigned long long>(seq));
+            return dir_ + '/' + name;
+        }
+
+        static void unmap(segment& s) {
+            if(s.base_) munmap(s.base_, s.size_);
+            if(s.fd_ >= 0) ::close(s.fd_);
+            s.base_ = nullptr;
+            s.fd_ = -1;
+        }
+
+        static bool map(const std::string& path, int flags, size_t size, segment& s) {
+            if((s.fd_ = ::open(path.c_str(), flags | O_RDWR | O_CLOEXEC, 0644)) < 0) return false;
+            struct stat st;
+            if(fstat(s.fd_, &st) < 0 || (static_cast<size_t>(st.st_size) < size && ftruncate(s.fd_, size) < 0)) {
+                unmap(s);
+                return false;
+            }
+            s.size_ = std::max<size_t>(st.st_size, size);
+            void* p = mmap(nullptr, s.size_, PROT_READ | PROT_WRITE, MAP_SHARED, s.fd_, 0);
+            if(p == MAP_FAILED) {
+                unmap(s);
+                return false;
+            }
+            s.base_ = static_cast<char*>(p);
+            return true;
+        }
+
+        segment* create_segment(uint64_t seq) {
+            segment s;
+            if(!map(segment_path(seq), O_CREAT | O_TRUNC, segment_bytes_, s)) return nullptr;
+            return &(segments_[seq] = s);
+        }
+
+        // 扫描到第一条长度为0、越界或crc不符的记录，返回有效末尾和记录数
+        static size_t scan(const segment& s, size_t from, size_t& records) {
+            size_t off = 0;
+            records = 0;
+            while(off + RECORD_HEADER <= s.size_) {
+                uint32_t head[2];
+                memcpy(head, s.base_ + off, RECORD_HEADER);
+                if(!head[0] || head[0] > s.size_ - off - RECORD_HEADER || checksum(std::string_view(s.base_ + off + RECORD_HEADER, head[0])) != head[1]) break;
+                off += RECORD_HEADER + head[0];
+                if(off > from) records++;
+            }
+            return off;
+        }
+
+        void recover() {
+            segment c;
+            if(!map(dir_ + "/cursor", O_CREAT, sizeof(cursor_state), c)) return;
+            ::close(c.fd_);
+            cursor_ = reinterpret_cast<cursor_state*>(c.base_);
+            std::vector<uint64_t> seqs;
+            std::error_code ec;
+            for(const auto& entry : std::filesystem::directory_iterator(dir_, ec)) {
+                std::string name = entry.path().filename().string();
+                unsigned long long seq;
+                if(name.length() == 26 && sscanf(name.c_str(), "spool-%16llu.seg", &seq) == 1) seqs.push_back(seq);
+            }
+            std::sort(seqs.begin(), seqs.end());
+            for(uint64_t seq : seqs) {
+                if(seq < cursor_->seq_) {
+                    std::filesystem::remove(segment_path(seq), ec);
+                    continue;
+                }
+                segment s;
+                if(!map(segment_path(seq), 0, 0, s)) continue;
+                size_t from = seq == cursor_->seq_ ? cursor_->offset_ : 0, records;
+                s.end_ = scan(s, from, records);
+                s.sealed_ = true;
+                depth_bytes_ += s.end_ - std::min(from, s.end_);
+                depth_records_ += records;
+                segments_[seq] = s;
+            }
+            if(segments_.empty()) {
+                cursor_->offset_ = 0;
+            } else {
+                if(segments_.begin()->first != cursor_->seq_) {
+                    cursor_->seq_ = segments_.begin()->first;
+                    cursor_->offset_ = 0;
+                }
+                cursor_->offset_ = std::min<uint64_t>(cursor_->offset_, segments_.begin()->second.end_);
+                // 继续追加到最后一个段，尾部残缺的记录被覆盖
+                segment& last = segments_.rbegin()->second;
+                last.sealed_ = last.size_ != segment_bytes_;
+            }
+        }
+
+        // 取读位置的记录；当前段读完且已封存时删除并前进到下一段
+        bool next_record(std::string_view& rec) {
+            while(!segments_.empty()) {
+                auto it = segments_.begin();
+                segment& s = it->second;
+                if(cursor_->offset_ < s.end_) {
+                    uint32_t len;
+                    memcpy(&len, s.base_ + cursor_->offset_, sizeof(len));
+                    rec = std::string_view(s.base_ + cursor_->offset_ + RECORD_HEADER, len);
+                    return true;
+                }
+                if(!s.sealed_) return false;
+                unmap(s);
+                std::error_code ec;
+                std::filesystem::remove(segment_path(it->first), ec);
+                segments_.erase(it);
+                cursor_->offset_ = 0;
+                cursor_->seq_ = segments_.empty() ? cursor_->seq_ + 1 : segments_.begin()->first;
+            }
+            return false;
+        }
+
+        void run() {
+            unsigned backoff_ms = 0;
+            std::unique_lock<std::mutex> lock(mtx_);
+            while(!stopping_) {
+                std::string_view rec;
+                if(!next_record(rec)) {
+                    cv_.wait(lock, [&]() { return stopping_ || next_record(rec); });
+                    if(stopping_) break;
+                }
+                // 记录所在的段只由本线程删除，发送期间不持锁
+                lock.unlock();
+                int ret = send_(rec);
+                lock.lock();
+                if(ret == 0 || (ret >= 400 && ret < 500 && ret != 429)) {
+                    cursor_->offset_ += RECORD_HEADER + rec.length();
+                    depth_bytes_ -= RECORD_HEADER + rec.length();
+                    depth_records_--;
+                    if(ret) rejected_++;
+                    else {
+                        drained_++;
+                        drained_bytes_ += RECORD_HEADER + rec.length();
+                    }
+                    backoff_ms = 0;
+                    cv_.notify_all();
+                } else {
+                    send_failures_++;
+                    backoff_ms = std::min(MAX_BACKOFF_MS, backoff_ms ? backoff_ms * 2 : 10);
+                    cv_.wait_for(lock, std::chrono::milliseconds(backoff_ms), [this]() { return stopping_; });
+                }
+            }
+        }
+
+        std::string dir_;
+        sender send_;
+        size_t segment_bytes_;
+        size_t max_segments_;
+        cursor_state* cursor_ = nullptr;
+        std::map<uint64_t, segment> segments_;
+
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        std::thread drain_;
+        bool running_ = false;
+        bool stopping_ = false;
+
+        size_t depth_bytes_ = 0;
+        size_t depth_records_ = 0;
+        size_t appended_ = 0;
+        size_t drained_ = 0;
+        size_t drained_bytes_ = 0;
+        size_t dropped_ = 0;
+        size_t rejected_ = 0;
+        size_t send_failures_ = 0;
+        std::chrono::steady_clock::time_point last_stats_time_;
+        size_t last_drained_ = 0;
+        size_t last_drained_bytes_ = 0;
+    };
+}
+
+#endif // TSDB_SPOOL_HPP
@@ -0,0 +1,547 @@
+#include "../src/tsdb.hpp"
+#include "../src/tsdb_async.hpp"
+#include "../src/tsdb_hf_export.hpp"
+#include "../src/tsdb_query.hpp"
+#include "../src/tsdb_spool.hpp"
+#include "MockServer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ClientUnitTest {
+public:
+    void keepAliveUnitTest()
+    {
+        MockServer server;
+        int port = server.start();
+        assert(port > 0);
+        tsdb_cpp::server_info si("127.0.0.1", port, "test");
+        const int requests = 2000;
+
+        auto run = [&]() {
+            auto beg = std::chrono::steady_clock::now();
+            for (int i = 0; i < requests; i++) {
+                tsdb_cpp::tsdb_data_builder builder;
+                int ret = builder.meas("cpu").tag("host", "a").field("value", i).timestamp(i).post_http(si);
+                assert(ret == 0);
+            }
+            return requests / std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+        };
+
+        double pooled = run();
+        assert(server.connections() == 1);
+        assert(si.pool_->reuses() == requests - 1);
+        assert(tsdb_cpp::ping(si) == 0);
+
+        si.pool_.reset();
+        double unpooled = run();
+        assert(server.connections() == requests + 1);
+        assert(server.requests() == 2 * requests + 1);
+        assert(server.lastRequest().headers["connection"] == "close");
+
+        std::cout << "keep-alive: " << static_cast<long long>(pooled) << " req/s, connection per request: "
+                  << static_cast<long long>(unpooled) << " req/s" << std::endl;
+    }
+
+    void builderUnitTest()
+    {
+        tsdb_cpp::tsdb_data_builder builder(256);
+        builder.meas("cpu load").tag("host,name", "a=b c").field("value", 1.5).field("count", 42).field("ok", true).field("msg", "say \"hi\"").timestamp(1700000000000LL);
+        builder.meas("m").field("v", -0.125, 3).field("big", 1e300, 0).timestamp(0);
+        std::string_view lines = builder.view();
+        std::string first = "\ncpu\\ load,host\\,name=a\\=b\\ c value=1.50,count=42i,ok=t,msg=\"say \\\"hi\\\"\" 1700000000000";
+        assert(lines.substr(0, first.size()) == first);
+        assert(lines.substr(first.size(), 17) == "\nm v=-0.125,big=1");
+        assert(lines.size() == first.size() + 17 + 300 + 2);
+        assert(lines.substr(lines.size() - 2) == " 0");
+
+        // clear()后复用同一块缓冲区
+        const char* data = builder.view().data();
+        builder.clear();
+        builder.meas("m").field("v", 1LL).timestamp(1);
+        assert(builder.view() == "\nm v=1i 1");
+        assert(builder.view().data() == data);
+
+        // 列批量格式化：前缀只转义一次，NaN跳过，浮点数默认取最短表示
+        builder.clear();
+        long long ts[] = { 1, 2, 3 };
+        double vs[] = { 0.1, NAN, -2.5e-300 };
+        assert(builder.columns("cpu load", { { "host", "a b" }, { "dc", "x" } }, "v", ts, vs, 3) == 2);
+        assert(builder.view() == "\ncpu\\ load,host=a\\ b,dc=x v=0.1 1\ncpu\\ load,host=a\\ b,dc=x v=-2.5e-300 3");
+        builder.clear();
+        long long counts[] = { -7, 9 };
+        bool flags[] = { true, false };
+        builder.columns("m", {}, "c", ts, counts, 2);
+        builder.columns("m", {}, "f", ts, flags, 2);
+        builder.columns("m", {}, "d", ts, vs, 1, 2);
+        assert(builder.view() == "\nm c=-7i 1\nm c=9i 2\nm f=t 1\nm f=f 2\nm d=0.10 1");
+
+        // point持有名字的副本，临时字符串销毁后仍然有效
+        tsdb_cpp::point p(std::string(40, 'n'), 1, 1);
+        std::vector<tsdb_cpp::point> copies(3, p);
+        assert(copies[2].name_ == std::string(40, 'n'));
+    }
+
+    void udpBatchingUnitTest()
+    {
+        MockUdpSink sink;
+        int port = sink.start();
+        assert(port > 0);
+        std::string name = "sensor";
+        std::vector<tsdb_cpp::point> points;
+        for (int i = 0; i < 2000; i++)
+            points.emplace_back(name, i * 0.5, 1700000000000000000LL + i);
+
+        tsdb_cpp::tsdb_entry entry("127.0.0.1", port);
+        assert(entry.insert_points(points) == 0);
+        tsdb_cpp::udp_stats batch = entry.last_batch();
+        assert(sink.waitForLines(points.size()));
+        assert(batch.send_errors_ == 0 && batch.zero_sends_ == 0);
+        assert(sink.packets() == batch.packets_ && sink.bytes() == batch.bytes_);
+        assert(sink.maxPacket() <= tsdb_cpp::UDP_PAYLOAD_BYTES);
+        // 除最后一个外，每个数据报都接近预算
+        assert(batch.packets_ == (batch.bytes_ + tsdb_cpp::UDP_PAYLOAD_BYTES - 100) / tsdb_cpp::UDP_PAYLOAD_BYTES);
+
+        // 巨帧预算下数据报更少；超出预算的单行独占一个数据报
+        entry.set_packet_bytes(8900);
+        assert(entry.insert_points(points) == 0);
+        assert(entry.last_batch().packets_ < batch.packets_ / 5);
+        std::string longName(3000, 'x');
+        assert(entry.insert_point(tsdb_cpp::point(longName, 1, 1)) == 0);
+        assert(sink.waitForLines(2 * points.size() + 1));
+        assert(sink.maxPacket() > 3000 && sink.maxPacket() <= 8900);
+        assert(entry.totals().packets_ == sink.packets());
+
+        // 列批量写入不构造point，按同样的字节预算打包
+        std::vector<long long> timestamps(points.size());
+        std::vector<double> values(points.size());
+        for (size_t i = 0; i < points.size(); i++) {
+            timestamps[i] = points[i].nanoseconds_;
+            values[i] = points[i].value_;
+        }
+        size_t packets = sink.packets();
+        assert(entry.insert_columns("datas", { { "pointName", name } }, "value", timestamps.data(), values.data(), values.size()) == 0);
+        assert(sink.waitForLines(3 * points.size() + 1));
+        assert(sink.packets() - packets == entry.last_batch().packets_);
+
+        tsdb_cpp::tsdb_entry invalid("not an address", port);
+        assert(invalid.insert_points(points) == -1);
+    }
+
+    void asyncUnitTest()
+    {
+        MockServer server;
+        int port = server.start();
+        assert(port > 0);
+        tsdb_cpp::server_info si("127.0.0.1", port, "test");
+        const int threads = 4, requests = 2000;
+
+        // 少量线程提交大量在途请求，future在收到应答后完成
+        tsdb_cpp::async_client client(si, 2, 16);
+        auto beg = std::chrono::steady_clock::now();
+        std::vector<std::thread> producers;
+        std::atomic<int> failed { 0 };
+        for (int t = 0; t < threads; t++) {
+            producers.emplace_back([&, t]() {
+                std::vector<std::future<int>> results;
+                tsdb_cpp::tsdb_data_builder builder;
+                for (int i = 0; i < requests / threads; i++) {
+                    builder.clear();
+                    builder.meas("cpu").tag("thread", std::to_string(t)).field("value", i).timestamp(i);
+                    results.push_back(client.post(builder));
+                }
+                for (auto& r : results)
+                    failed += r.get() != 0;
+            });
+        }
+        for (auto& p : producers)
+            p.join();
+        double rps = requests / std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+        assert(failed == 0);
+        assert(client.pending() == 0);
+        assert(server.requests() == static_cast<size_t>(requests));
+        assert(server.connections() <= 2);
+
+        std::atomic<int> done { 0 };
+        for (int i = 0; i < 100; i++)
+            client.post("\ncpu value=1i " + std::to_string(i), [&](int ret) { done += ret == 0; });
+        client.stop();
+        assert(done == 100);
+        assert(client.post("\ncpu value=1i 0").get() == -12);
+        std::cout << "async pipelined: " << static_cast<long long>(rps) << " req/s" << std::endl;
+
+        // 服务端不可用时请求以负数完成而不是永远等待
+        server.stop();
+        tsdb_cpp::async_client offline(si, 2, 4);
+        std::vector<std::future<int>> results;
+        for (int i = 0; i < 20; i++)
+            results.push_back(offline.post("\ncpu value=1i 0"));
+        for (auto& r : results)
+            assert(r.get() < 0);
+    }
+
+    void compressionUnitTest()
+    {
+        MockServer server;
+        int port = server.start();
+        assert(port > 0);
+        tsdb_cpp::server_info si("127.0.0.1", port, "test");
+        tsdb_cpp::tsdb_data_builder builder;
+        tsdb_cpp::detail::ts_caller* lines = nullptr;
+        for (int i = 0; i < 5000; i++)
+            lines = &builder.meas("adc").tag("channel", "ch" + std::to_string(i % 8)).field("value", 0.001 * i, 3).timestamp(1700000000000000000LL + 20000LL * i);
+        std::string body(builder.view());
+
+        struct Case {
+            tsdb_cpp::content_encoding encoding;
+            int level;
+            const char* name;
+        };
+        const Case cases[] = { { tsdb_cpp::ENCODING_IDENTITY, 0, "identity" }, { tsdb_cpp::ENCODING_GZIP, 1, "gzip" }, { tsdb_cpp::ENCODING_GZIP, 6, "gzip" },
+            { tsdb_cpp::ENCODING_ZSTD, 1, "zstd" }, { tsdb_cpp::ENCODING_ZSTD, 3, "zstd" } };
+        std::cout << "write body " << body.size() << " bytes:" << std::endl;
+        for (const Case& c : cases) {
+            si.encoding_ = c.encoding;
+            si.compression_level_ = c.level;
+            size_t before = server.bodyBytes();
+            assert(lines->post_http(si) == 0);
+            MockServer::Request req = server.lastRequest();
+            assert(req.body == body);
+            assert(c.encoding == tsdb_cpp::ENCODING_IDENTITY ? req.headers.count("content-encoding") == 0 : req.headers["content-encoding"] == c.name);
+
+            std::string out;
+            const int rounds = 20;
+            auto beg = std::chrono::steady_clock::now();
+            for (int i = 0; i < rounds; i++)
+                assert(tsdb_cpp::detail::inner::compress_body(body, c.encoding, c.level, out) == 0);
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - beg).count() / rounds;
+            std::cout << "  " << c.name << " level " << c.level << ": " << server.bodyBytes() - before << " bytes on the wire, "
+                      << ns / body.size() << " ns/byte" << std::endl;
+        }
+
+        tsdb_cpp::async_client client(si, 1, 4);
+        assert(client.post(body).get() == 0);
+        assert(server.lastRequest().body == body && server.lastRequest().wireBytes < body.size() / 4);
+    }
+
+    void streamingQueryUnitTest()
+    {
+        MockServer server;
+        int port = server.start();
+        assert(port > 0);
+        server.setChunked(true, 777);
+        tsdb_cpp::server_info si("127.0.0.1", port, "test");
+        const int rows = 10000;
+        const char* hosts[] = { "a", "b\\\"c\\u00e9" };
+
+        // 与InfluxDB的chunked=true一致：每个序列切成若干以换行分隔的部分结果
+        server.setHandler([&](const MockServer::Request& req, std::string& body) {
+            if (req.path != "/query")
+                return MockServer::defaultHandler(req, body);
+            if (req.query.find("bad") != std::string::npos) {
+                body = "{\"results\":[{\"statement_id\":0,\"error\":\"boom\"}]}\n";
+                return 200;
+            }
+            bool csv = req.headers.count("accept") && req.headers.at("accept") == "application/csv";
+            if (csv)
+                body = "name,tags,time,value,state\n";
+            for (int h = 0; h < 2; h++) {
+                for (int beg = 0; beg < rows; beg += 3000) {
+                    if (!csv)
+                        body += std::string("{\"results\":[{\"statement_id\":0,\"series\":[{\"name\":\"cpu\",\"tags\":{\"host\":\"") + hosts[h]
+                            + "\"},\"columns\":[\"time\",\"value\",\"state\"],\"values\":[";
+                    for (int i = beg; i < std::min(rows, beg + 3000); i++) {
+                        std::string value = i % 100 == 7 ? "null" : std::to_string(i * 0.5 + h);
+                        if (csv)
+                            body += std::string("cpu,host=") + (h ? "b" : "a") + "," + std::to_string(1000LL * i) + "," + (i % 100 == 7 ? "" : value) + ",ok\n";
+                        else
+                            body += std::string(i > beg ? "," : "") + "[" + std::to_string(1000LL * i) + "," + value + ",\"ok\"]";
+                    }
+                    if (!csv)
+                        body += "]}],\"partial\":true}]}\n";
+                }
+            }
+            return 200;
+        });
+
+        for (tsdb_cpp::query_format format : { tsdb_cpp::QUERY_JSON, tsdb_cpp::QUERY_CSV }) {
+            std::map<std::string, std::pair<std::vector<long long>, std::vector<double>>> received;
+            size_t batches = 0;
+            int ret = tsdb_cpp::query_columns("select value, state from cpu", si, [&](const tsdb_cpp::series_batch& b) {
+                assert(b.name_ == "cpu" && b.tags_.size() == 1 && b.tags_[0].first == "host");
+                assert(b.columns_.size() == 2 && b.columns_[0] == "value" && b.rows() <= 1024);
+                assert(std::isnan(b.values_[1][0]));
+                auto& [ts, vals] = received[b.tags_[0].second];
+                ts.insert(ts.end(), b.timestamps_.begin(), b.timestamps_.end());
+                vals.insert(vals.end(), b.values_[0].begin(), b.values_[0].end());
+                batches++;
+                return true;
+            }, format, 1024);
+            assert(ret == 0);
+            assert(received.size() == 2 && batches >= 2 * rows / 1024);
+            for (int h = 0; h < 2; h++) {
+                auto& [ts, vals] = received[format == tsdb_cpp::QUERY_CSV ? (h ? "b" : "a") : (h ? "b\"c\xc3\xa9" : "a")];
+                assert(ts.size() == static_cast<size_t>(rows));
+                for (int i = 0; i < rows; i++) {
+                    assert(ts[i] == 1000LL * i);
+                    assert(i % 100 == 7 ? std::isnan(vals[i]) : vals[i] == i * 0.5 + h);
+                }
+            }
+        }
+
+        // 回调中止后连接不再复用，之后的查询照常进行
+        int calls = 0;
+        assert(tsdb_cpp::query_columns("select * from cpu", si, [&](const tsdb_cpp::series_batch&) { return ++calls < 2; }) == -13);
+        assert(calls == 2);
+        assert(tsdb_cpp::query_columns("bad", si, [](const tsdb_cpp::series_batch&) { return true; }) == -15);
+    }
+
+    void exportUnitTest()
+    {
+        // 写入一个跨越多个块的本地流，含一个无法用行协议表示的NaN
+        const int count = 20000;
+        const long long base = 1700000000000000000LL;
+        tsdb_hf_cpp::tsdb_entry local;
+        local.initialize();
+        std::vector<long long> timestamps(count);
+        std::vector<double> values(count);
+        for (int i = 0; i < count; i++) {
+            timestamps[i] = base + i * 1000LL;
+            values[i] = i == 7 ? NAN : std::sin(i * 0.01) * 1e3;
+        }
+        assert(local.insert_columns("exportUnitTest", timestamps.data(), values.data(), count) == 0);
+        std::string path = local.close();
+
+        MockServer server;
+        int port = server.start();
+        assert(port > 0);
+        std::mutex mtx;
+        std::map<long long, double> received;
+        std::string precision;
+        server.setHandler([&](const MockServer::Request& req, std::string& body) {
+            if (req.path != "/write")
+                return MockServer::defaultHandler(req, body);
+            std::lock_guard<std::mutex> lock(mtx);
+            precision = req.query.substr(req.query.find("precision=") + 10, 2);
+            const char* p = req.body.c_str();
+            while ((p = strstr(p, "datas,pointName=exportUnitTest value=")) != nullptr) {
+                char* end;
+                double v = strtod(p + 37, &end);
+                received[strtoll(end, &end, 10)] = v;
+                p = end;
+            }
+            return 204;
+        });
+
+        // 多线程解压格式化，经连接池批量发送，浮点数按最短表示精确还原
+        tsdb_cpp::server_info si("127.0.0.1", port, "test");
+        tsdb_hf_cpp::ExportOptions options;
+        options.batchBytes = 64 << 10;
+        tsdb_hf_cpp::export_entry http(si, options);
+        tsdb_hf_cpp::ExportStats stats = http.export_stream(path);
+        assert(stats.error == 0 && !stats.readError);
+        assert(stats.points == count - 1 && stats.skipped == 1 && stats.blocks > 1);
+        assert(stats.requests == server.requests() && stats.requests > 1);
+        assert(received.size() == count - 1u && precision == "ns");
+        for (int i = 0; i < count; i++)
+            assert(i == 7 ? !received.count(timestamps[i]) : received[timestamps[i]] == values[i]);
+        std::cout << "export http: " << static_cast<long long>(stats.points / stats.seconds) << " points/s, "
+                  << stats.bytes / stats.seconds / 1e6 << " MB/s" << std::endl;
+
+        // UDP按字节速率限速
+        MockUdpSink sink;
+        int udpPort = sink.start();
+        assert(udpPort > 0);
+        options.threads = 1;
+        options.maxBytesPerSec = 10e6;
+        tsdb_hf_cpp::export_entry udp("127.0.0.1", udpPort, options);
+        stats = udp.export_stream(path);
+        assert(stats.error == 0 && stats.points == count - 1);
+        assert(sink.waitForLines(count - 1) && sink.packets() == stats.requests);
+        assert(stats.seconds >= (stats.bytes - options.batchBytes) / options.maxBytesPerSec);
+
+        // 多字段流每个时间戳一行，包含全部字段，NaN和空值的字段不写出，全部字段为空的行跳过
+        std::vector<double> records;
+        std::vector<uint8_t> recordsValid(200, 1);
+        for (int i = 0; i < 100; i++)
+            records.insert(records.end(), { i * 1.5, i == 3 ? NAN : -i * 1.0 });
+        recordsValid[5 * 2 + 1] = 0;
+        recordsValid[6 * 2] = recordsValid[6 * 2 + 1] = 0;
+        local.initialize();
+        assert(local.setFields({ "a", "b" }) && local.insert_records("exportFieldsUnitTest", timestamps.data(), records.data(), 100, recordsValid.data()) == 0);
+        std::string fieldsPath = local.close();
+        std::vector<std::string> lines;
+        server.setHandler([&](const MockServer::Request& req, std::string& body) {
+            if (req.path != "/write")
+                return MockServer::defaultHandler(req, body);
+            std::lock_guard<std::mutex> lock(mtx);
+            std::istringstream in(req.body);
+            for (std::string line; std::getline(in, line);) {
+                if (!line.empty())
+                    lines.push_back(line);
+            }
+            return 204;
+        });
+        stats = http.export_stream(fieldsPath);
+        assert(stats.error == 0 && stats.points == 99 && stats.skipped == 1 && lines.size() == 99);
+        std::sort(lines.begin(), lines.end());
+        assert(std::count(lines.begin(), lines.end(), "datas,pointName=exportFieldsUnitTest a=3,b=-2 " + std::to_string(timestamps[2])));
+        assert(std::count(lines.begin(), lines.end(), "datas,pointName=exportFieldsUnitTest a=4.5 " + std::to_string(timestamps[3])));
+        assert(std::count(lines.begin(), lines.end(), "datas,pointName=exportFieldsUnitTest a=7.5 " + std::to_string(timestamps[5])));
+        for (const auto& line : lines)
+            assert(line.compare(line.size() - std::to_string(timestamps[6]).size(), std::string::npos, std::to_string(timestamps[6])) != 0);
+
+        // 单字段流的空值与NaN一样跳过，计入skipped，不导出为0
+        std::vector<uint8_t> valid(100, 1);
+        for (int i = 0; i < 100; i += 10)
+            valid[i] = 0;
+        local.initialize();
+        assert(local.insert_columns("exportNullsUnitTest", timestamps.data(), values.data(), 100, valid.data()) == 0);
+        std::string nullsPath = local.close();
+        lines.clear();
+        stats = http.export_stream(nullsPath);
+        assert(stats.error == 0 && stats.points == 89 && stats.skipped == 11 && lines.size() == 89);
+        for (const auto& line : lines)
+            assert(line.find(" " + std::to_string(timestamps[0])) == std::string::npos && line.find(" " + std::to_string(timestamps[10])) == std::string::npos);
+
+        server.stop();
+        stats = http.export_stream(path);
+        assert(stats.error < 0 && stats.points < count - 1u);
+        assert(http.export_stream("missing.json").readError);
+    }
+
+    void spoolUnitTest()
+    {
+        MockServer server;
+        int port = server.start();
+        assert(port > 0);
+        tsdb_cpp::server_info si("127.0.0.1", port, "test");
+        const std::string dir = "../test/data/spool";
+        std::filesystem::remove_all(dir);
+
+        std::mutex mtx;
+        std::vector<std::string> received;
+        std::atomic<int> status { 204 };
+        server.setHandler([&](const MockServer::Request& req, std::string& body) {
+            if (req.path != "/write")
+                return MockServer::defaultHandler(req, body);
+            if (status != 204)
+                return status.load();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            std::lock_guard<std::mutex> lock(mtx);
+            received.push_back(req.body);
+            return 204;
+        });
+
+        // 突发写入先落到段文件，发送一部分后停止，重新打开时从cursor继续，每条记录恰好送达一次
+        const int records = 2000;
+        std::vector<std::string> bodies;
+        for (int i = 0; i < records; i++)
+            bodies.push_back("cpu,host=a value=" + std::to_string(i) + "i " + std::to_string(i));
+        {
+            tsdb_cpp::spool sp(dir, tsdb_cpp::spool::http_sender(si), 0x4000, 64);
+            auto beg = std::chrono::steady_clock::now();
+            for (const auto& b : bodies)
+                assert(sp.append(b));
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - beg).count() / records;
+            tsdb_cpp::spool_stats st = sp.stats();
+            assert(st.depth_records_ == static_cast<size_t>(records) && st.segments_ > 1);
+            sp.start();
+            while (sp.stats().drained_ < static_cast<size_t>(records) / 4)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            sp.stop();
+            st = sp.stats();
+            assert(st.depth_records_ > 0 && st.depth_records_ + st.drained_ == static_cast<size_t>(records));
+            std::cout << "spool append: " << ns << " ns/record" << std::endl;
+        }
+        {
+            tsdb_cpp::spool sp(dir, tsdb_cpp::spool::http_sender(si), 0x4000, 64);
+            assert(sp.stats().depth_records_ == records - received.size());
+            sp.start();
+            assert(sp.wait_empty(10000));
+            tsdb_cpp::spool_stats st = sp.stats();
+            assert(st.segments_ == 1 && st.depth_bytes_ == 0);
+            assert(sp.to_prometheus().find("tsdb_spool_depth_records 0") != std::string::npos);
+        }
+        assert(received == bodies);
+
+        // 服务端5xx时退避重试，4xx时丢弃该记录
+        received.clear();
+        status = 503;
+        {
+            tsdb_cpp::spool sp(dir, tsdb_cpp::spool::http_sender(si), 0x4000, 64);
+            assert(sp.append(bodies[0]));
+            sp.start();
+            while (sp.stats().send_failures_ < 2)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            status = 204;
+            assert(sp.wait_empty(10000));
+            status = 400;
+            assert(sp.append(bodies[1]));
+            assert(sp.wait_empty(10000));
+            tsdb_cpp::spool_stats st = sp.stats();
+            assert(st.drained_ == 1 && st.rejected_ == 1);
+        }
+        assert(received.size() == 1 && received[0] == bodies[0]);
+
+        // 段文件数达到上限后丢弃新记录
+        {
+            tsdb_cpp::spool sp(dir, tsdb_cpp::spool::http_sender(si), 0x1000, 2);
+            int accepted = 0;
+            while (sp.append(bodies[0]))
+                accepted++;
+            assert(accepted > 0 && sp.stats().dropped_ == 1);
+            assert(!sp.append(std::string(0x1000, 'x')));
+        }
+        std::filesystem::remove_all(dir);
+    }
+
+    void responseFramingUnitTest()
+    {
+        MockServer server;
+        int port = server.start();
+        assert(port > 0);
+        tsdb_cpp::server_info si("127.0.0.1", port, "test");
+
+        // 跨越多个读缓冲的响应体，分别用Content-Length和chunked编码返回
+        std::string payload;
+        for (int i = 0; payload.size() < 100000; i++)
+            payload += "{\"series\":" + std::to_string(i) + "}\n";
+        server.setHandler([&](const MockServer::Request& req, std::string& body) {
+            if (req.path != "/query")
+                return MockServer::defaultHandler(req, body);
+            body = payload;
+            return req.query.find("fail") == std::string::npos ? 200 : 500;
+        });
+
+        std::string resp;
+        assert(tsdb_cpp::query(resp, "select * from cpu", si) == 0);
+        assert(resp == payload);
+        server.setChunked(true, 777);
+        assert(tsdb_cpp::query(resp, "select * from cpu", si) == 0);
+        assert(resp == payload);
+        assert(tsdb_cpp::query(resp, "fail", si) == 500);
+        assert(resp == payload);
+        assert(server.connections() == 1);
+
+        // 服务端关闭空闲连接后，健康检查丢弃旧连接并重新建立
+        server.dropConnections();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        assert(tsdb_cpp::create_db(resp, "test", si) == 0);
+        assert(server.connections() == 2);
+        assert(si.pool_->idle() == 1);
+
+        server.stop();
+        assert(tsdb_cpp::ping(si) < 0);
+        assert(si.pool_->idle() == 0);
+    }
+};
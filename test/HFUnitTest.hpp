@@ -1,9 +1,26 @@
 #include "../src/tsdb_hf.hpp"
+#include "../src/tsdb_hf_arrow.hpp"
+#include "../src/tsdb_hf_bulk.hpp"
+#include "../src/tsdb_hf_ingest.hpp"
+#include "../utils/Metrics.hpp"
+#include "../utils/FastClock.hpp"
 #include "../utils/Utils.hpp"
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cmath>
 #include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
 #include <map>
+#include <numeric>
+#include <random>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -57,6 +74,1085 @@ public:
         assert(Utils::parseFormatStr(format, args2) == std::string("12timestamps32{}{{}1}}"));
     }
 
+    void codecUnitTest()
+    {
+        std::vector<long long> ints = { 0, 1, -1, 1000000, -1000000, LLONG_MAX, LLONG_MIN, 42 };
+        std::vector<float> floats = { 0.0f, -1.5f, 3.25f, 1e30f };
+        std::vector<bool> flags = { true, false, false, true, true, true, false, true, true };
+        std::vector<char> intBytes, floatBytes, flagBytes, valueBytes;
+        Codec::encode(ints, intBytes);
+        Codec::encode(floats, floatBytes);
+        Codec::encode(flags, flagBytes);
+        Codec::encode(values, valueBytes);
+        assert(floatBytes.size() == floats.size() * sizeof(float));
+        assert(flagBytes.size() == 2);
+
+        std::vector<long long> intsDecoded;
+        std::vector<float> floatsDecoded;
+        std::vector<bool> flagsDecoded;
+        std::vector<double> valuesDecoded;
+        assert(Codec::decode(intBytes.data(), intBytes.size(), ints.size(), intsDecoded) == intBytes.size());
+        assert(Codec::decode(floatBytes.data(), floatBytes.size(), floats.size(), floatsDecoded) == floatBytes.size());
+        assert(Codec::decode(flagBytes.data(), flagBytes.size(), flags.size(), flagsDecoded) == flagBytes.size());
+        assert(Codec::decode(valueBytes.data(), valueBytes.size(), values.size(), valuesDecoded) == valueBytes.size());
+        assert(Utils::vec1dEqual(ints, intsDecoded));
+        assert(Utils::vec1dEqual(floats, floatsDecoded));
+        assert(Utils::vec1dEqual(flags, flagsDecoded));
+        assert(Utils::vec1dEqual(values, valuesDecoded));
+        assert(Codec::decode(intBytes.data(), intBytes.size() - 1, ints.size(), intsDecoded) == 0);
+    }
+
+    void cadenceUnitTest()
+    {
+        std::vector<long long> regular;
+        for (long long i = 0; i < 4096; i++)
+            regular.push_back(timestamps[0] + i * 1000 + (i >= 2000 ? 50000 : 0) + (i == 100 ? 3 : 0));
+        std::vector<char> bytes;
+        assert(Codec::encodeTimestamps(regular, bytes) == ENCODING_CADENCE);
+        assert(bytes.size() < 32);
+        std::vector<long long> decoded;
+        assert(Codec::decodeTimestamps(ENCODING_CADENCE, bytes.data(), bytes.size(), regular.size(), decoded) == bytes.size());
+        assert(Utils::vec1dEqual(regular, decoded));
+
+        std::vector<long long> irregular;
+        for (long long i = 0; i < 4096; i++)
+            irregular.push_back(timestamps[0] + i * 1000 + (i * 7919) % 13);
+        bytes.clear();
+        decoded.clear();
+        assert(Codec::encodeTimestamps(irregular, bytes) == ENCODING_ZIGZAG_VARINT);
+        assert(Codec::decodeTimestamps(ENCODING_ZIGZAG_VARINT, bytes.data(), bytes.size(), irregular.size(), decoded) == bytes.size());
+        assert(Utils::vec1dEqual(irregular, decoded));
+    }
+
+    void typedStreamUnitTest()
+    {
+        std::vector<basic_point<int64_t>> counters;
+        std::vector<basic_point<bool>> flags;
+        for (size_t i = 0; i < timestamps.size(); i++) {
+            counters.emplace_back("counterUnitTest", 1000 + 3 * i, timestamps[i]);
+            flags.emplace_back("flagUnitTest", i % 3 == 0, timestamps[i]);
+        }
+
+        entry.initialize();
+        assert(entry.insert_points(counters) == 0);
+        assert(entry.insert_points(flags) == -1);
+        auto countersPath = entry.close();
+        entry.initialize();
+        assert(entry.insert_points(flags) == 0);
+        auto flagsPath = entry.close();
+
+        auto countersRead = entry.extract_points<int64_t>(countersPath);
+        auto flagsRead = entry.extract_points<bool>(flagsPath);
+        assert(countersRead.size() == counters.size() && flagsRead.size() == flags.size());
+        for (size_t i = 0; i < counters.size(); i++) {
+            assert(countersRead[i].value_ == counters[i].value_ && countersRead[i].nanoseconds_ == counters[i].nanoseconds_);
+            assert(flagsRead[i].value_ == flags[i].value_ && flagsRead[i].nanoseconds_ == flags[i].nanoseconds_);
+        }
+        assert(entry.extract_points<double>(countersPath).empty());
+    }
+
+    void lossyUnitTest()
+    {
+        std::default_random_engine engine(7);
+        std::normal_distribution<double> noise(0, 0.01);
+        std::vector<point> signal;
+        std::vector<basic_point<float>> positive;
+        for (long long i = 0; i < 12000; i++) {
+            signal.emplace_back("lossyUnitTest", std::sin(i / 100.0) + noise(engine), timestamps[0] + i * 1000);
+            positive.emplace_back("lossyRelativeUnitTest", static_cast<float>(1 + i * 0.37 + noise(engine)), timestamps[0] + i * 1000);
+        }
+
+        auto valuesSize = [](const std::string& path) {
+            Stream stream;
+            assert(Stream::load(path, stream));
+            size_t size = 0;
+            for (const auto& block : stream.getBlocks())
+                size += block.valuesSize;
+            return size;
+        };
+
+        entry.initialize();
+        entry.insert_points(signal);
+        auto losslessPath = entry.close();
+
+        const double error = 1e-3;
+        entry.initialize();
+        assert(entry.setErrorBound(ErrorBound::absolute(error)));
+        entry.insert_points(signal);
+        assert(!entry.setErrorBound(ErrorBound::absolute(error)));
+        auto lossyPath = entry.close();
+        assert(valuesSize(lossyPath) * 2 < valuesSize(losslessPath));
+
+        auto restored = entry.extract_points(lossyPath);
+        assert(restored.size() == signal.size());
+        for (size_t i = 0; i < signal.size(); i++)
+            assert(std::fabs(restored[i].value_ - signal[i].value_) <= error);
+
+        const double ratio = 1e-4;
+        entry.initialize();
+        assert(entry.setErrorBound(ErrorBound::relative(ratio)));
+        entry.insert_points(positive);
+        auto relativePath = entry.close();
+        auto restoredFloats = entry.extract_points<float>(relativePath);
+        assert(restoredFloats.size() == positive.size());
+        for (size_t i = 0; i < positive.size(); i++)
+            assert(std::fabs(restoredFloats[i].value_ - positive[i].value_) <= ratio * std::fabs(positive[i].value_));
+
+        // 无法量化的块（含NaN）退化为无损编码
+        std::vector<char> bytes;
+        std::vector<double> withNaN = { 1.0, std::nan(""), 2.0 };
+        assert(!Codec::encodeQuantized(withNaN, ErrorBound::absolute(error), bytes));
+        assert(bytes.empty());
+    }
+
+    void outOfOrderUnitTest()
+    {
+        long long base = timestamps[0];
+        std::vector<long long> expected;
+        std::vector<point> inOrder, late;
+        // 相邻两点交换顺序，乱序距离在窗口内
+        for (long long i = 0; i < 20000; i++)
+            inOrder.emplace_back("outOfOrderUnitTest", i ^ 1, base + (i ^ 1));
+        // 早于已封存数据的迟到点进入溢出块
+        for (long long i = 7; i < 20000; i += 1000)
+            late.emplace_back("outOfOrderUnitTest", i, base + i);
+        for (const auto& p : inOrder)
+            expected.push_back(p.nanoseconds_);
+        for (const auto& p : late)
+            expected.push_back(p.nanoseconds_);
+        std::sort(expected.begin(), expected.end());
+
+        entry.setReorderWindow(100);
+        entry.initialize();
+        assert(entry.insert_points(inOrder) == 0);
+        assert(entry.insert_points(late) == 0);
+        auto path = entry.close();
+        entry.setReorderWindow(ArgParser::get<long long>("reorderWindow", "hf"));
+
+        Stream stream;
+        assert(Stream::load(path, stream));
+        assert(std::any_of(stream.getBlocks().begin(), stream.getBlocks().end(), [](const Block& b) { return b.overflow; }));
+
+        auto points = entry.extract_points(path);
+        assert(points.size() == expected.size());
+        for (size_t i = 0; i < points.size(); i++) {
+            assert(points[i].nanoseconds_ == expected[i]);
+            assert(points[i].value_ == points[i].nanoseconds_ - base);
+        }
+    }
+
+    void ingestUnitTest()
+    {
+        const int producers = 4;
+        const long long perProducer = 20000;
+        long long base = timestamps[0];
+        ingest_entry<double> ingest(64, OVERFLOW_BLOCK);
+        uint32_t series[2] = { ingest.register_series("ingestUnitTestA"), ingest.register_series("ingestUnitTestB") };
+        ingest.start();
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; p++) {
+            threads.emplace_back([&ingest, &series, p, base, perProducer]() {
+                std::vector<long long> ts;
+                std::vector<double> vs;
+                for (long long i = 0; i < perProducer; i++) {
+                    ts.push_back(base + i * producers + p);
+                    vs.push_back(p);
+                    if (ts.size() == 1000) {
+                        ingest.push(series[p % 2], ts.data(), vs.data(), ts.size());
+                        ts.clear();
+                        vs.clear();
+                    }
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        auto paths = ingest.stop();
+        assert(paths.size() == 2);
+        assert(ingest.pushed() == producers * perProducer && ingest.dropped() == 0);
+        for (const auto& path : paths) {
+            auto points = entry.extract_points(path);
+            assert(points.size() == producers / 2 * perProducer);
+            for (size_t i = 1; i < points.size(); i++)
+                assert(points[i - 1].nanoseconds_ < points[i].nanoseconds_);
+        }
+
+        // 未启动消费线程时写满队列，新写入的记录被丢弃并计数
+        ingest_entry<bool> lossy(2, OVERFLOW_DROP_NEWEST);
+        std::vector<basic_point<bool>> flags;
+        for (long long i = 0; i < 1000; i++)
+            flags.emplace_back("ingestUnitTestFlags", i % 2, base + i);
+        assert(lossy.push(flags) == 2 * ingest_entry<bool>::RECORD_POINTS);
+        assert(lossy.dropped() == 1000 - 2 * ingest_entry<bool>::RECORD_POINTS);
+        assert(lossy.stop().size() == 1);
+
+        // 挤出的记录从pushed()移到dropped()，stop()后写入流的点数等于pushed()
+        ingest_entry<double> oldest(2, OVERFLOW_DROP_OLDEST);
+        uint32_t oldestId = oldest.register_series("ingestUnitTestOldest");
+        std::vector<long long> ts(1000);
+        std::vector<double> vs(1000, 1.5);
+        for (long long i = 0; i < 1000; i++)
+            ts[i] = base + i;
+        assert(oldest.push(oldestId, ts.data(), vs.data(), ts.size()) == 1000);
+        assert(oldest.pushed() == 1000 - 2 * ingest_entry<double>::RECORD_POINTS && oldest.pushed() + oldest.dropped() == 1000);
+        auto oldestPaths = oldest.stop();
+        assert(oldestPaths.size() == 1 && entry.extract_points(oldestPaths[0]).size() == oldest.pushed() && oldest.failed() == 0);
+    }
+
+    void metricsUnitTest()
+    {
+        for (uint64_t v : { 0ull, 31ull, 32ull, 1000ull, 123456789ull, ~0ull }) {
+            size_t idx = Metrics::bucketIndex(v);
+            assert(idx < Metrics::BUCKET_COUNT);
+            assert(Metrics::bucketLowerBound(idx) <= v);
+            assert(Metrics::bucketIndex(Metrics::bucketLowerBound(idx)) == idx);
+        }
+
+        Metrics::reset();
+        for (uint64_t ns = 1; ns <= 1000; ns++)
+            Metrics::record(Metrics::STAGE_QUERY, 8, ns * 1000);
+        auto snap = Metrics::snapshot(Metrics::STAGE_QUERY);
+        assert(snap.ops == 1000 && snap.bytes == 8000 && snap.maxNs == 1000000);
+        uint64_t p99 = snap.percentileNs(0.99);
+        assert(p99 > 990000 * 0.95 && p99 < 990000 * 1.05);
+
+        auto text = Metrics::toPrometheus();
+        assert(text.find("tsdb_stage_operations_total{stage=\"query\"} 1000") != std::string::npos);
+        assert(text.find("tsdb_stage_latency_seconds_count{stage=\"query\"} 1000") != std::string::npos);
+        Metrics::reset();
+    }
+
+    void fastClockUnitTest()
+    {
+        auto nsPerCall = [](auto clock) {
+            const int calls = 1000000;
+            long long sink = 0;
+            auto beg = std::chrono::steady_clock::now();
+            for (int i = 0; i < calls; i++)
+                sink += clock();
+            assert(sink != 0);
+            return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - beg).count() / calls;
+        };
+        double chronoNs = nsPerCall([]() { return Utils::getCurNanoseconds(); });
+        double gettimeNs = nsPerCall([]() { return FastClock::realtimeNs(); });
+        double fastNs = nsPerCall([]() { return Utils::getFastNanoseconds(); });
+        std::cout << "clock ns/call: high_resolution_clock " << chronoNs << ", clock_gettime " << gettimeNs
+                  << ", " << (FastClock::usingTsc() ? "tsc " : "fallback ") << fastNs << std::endl;
+
+        // 与CLOCK_REALTIME的偏差在1ms以内，单线程读数不回退；跨过重新校准周期后依然成立
+        auto checkAccuracy = []() {
+            long long before = FastClock::realtimeNs();
+            long long fast = Utils::getFastNanoseconds();
+            long long after = FastClock::realtimeNs();
+            assert(fast > before - 1000000 && fast < after + 1000000);
+        };
+        checkAccuracy();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&]() {
+                long long last = Utils::getFastNanoseconds();
+                for (int i = 0; i < 200000; i++) {
+                    long long now = Utils::getFastNanoseconds();
+                    assert(now >= last);
+                    last = now;
+                }
+                checkAccuracy();
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        std::this_thread::sleep_for(std::chrono::nanoseconds(FastClock::resyncIntervalNs + 100000000));
+        checkAccuracy();
+
+        std::vector<long long> stamps(5);
+        Utils::fillCadence(stamps.data(), stamps.size(), 100, 10);
+        assert((stamps == std::vector<long long> { 100, 110, 120, 130, 140 }));
+        long long before = Utils::getFastNanoseconds();
+        Utils::stampCadence(stamps.data(), stamps.size(), 1000);
+        assert(stamps.back() >= before && stamps[0] == stamps.back() - 4000);
+    }
+
+    void arrowUnitTest()
+    {
+        long long base = timestamps[0];
+        std::vector<point> points;
+        std::vector<basic_point<bool>> flags;
+        for (long long i = 0; i < 20000; i++) {
+            points.emplace_back("arrowUnitTest", i * 0.5, base + i);
+            flags.emplace_back("arrowFlagUnitTest", i % 3 == 0, base + i);
+        }
+        entry.initialize();
+        assert(entry.insert_points(points) == 0);
+        auto path = entry.close();
+        entry.initialize();
+        assert(entry.insert_points(flags) == 0);
+        auto flagsPath = entry.close();
+
+        ArrowArray array;
+        ArrowSchema schema;
+        assert(ArrowExport::export_arrow(entry, path, &array, &schema));
+        assert(std::string(schema.format) == "+s" && schema.n_children == 2);
+        assert(std::string(schema.children[0]->format) == "tsn:" && std::string(schema.children[0]->name) == "time");
+        assert(std::string(schema.children[1]->format) == "g" && std::string(schema.children[1]->name) == "arrowUnitTest");
+        assert(array.length == 20000 && array.n_children == 2 && array.children[0]->n_buffers == 2);
+        auto expected = entry.extract_points(path);
+        const long long* ts = static_cast<const long long*>(array.children[0]->buffers[1]);
+        const double* vs = static_cast<const double*>(array.children[1]->buffers[1]);
+        for (size_t i = 0; i < expected.size(); i++)
+            assert(ts[i] == expected[i].nanoseconds_ && vs[i] == expected[i].value_);
+        // 移走子数组后父数组先释放，缓冲仍归子数组所有
+        ArrowArray values = *array.children[1];
+        array.children[1]->release = nullptr;
+        array.release(&array);
+        assert(array.release == nullptr && static_cast<const double*>(values.buffers[1])[19999] == 19999 * 0.5);
+        values.release(&values);
+        schema.release(&schema);
+
+        assert(ArrowExport::export_arrow(entry, flagsPath, &array, &schema));
+        assert(std::string(schema.children[1]->format) == "b");
+        const uint8_t* bits = static_cast<const uint8_t*>(array.children[1]->buffers[1]);
+        for (size_t i = 0; i < flags.size(); i++)
+            assert(((bits[i >> 3] >> (i & 7)) & 1) == flags[i].value_);
+        array.release(&array);
+        schema.release(&schema);
+
+        ArrowArrayStream stream;
+        assert(ArrowExport::export_arrow_stream(path, &stream));
+        assert(stream.get_schema(&stream, &schema) == 0 && std::string(schema.children[1]->format) == "g");
+        schema.release(&schema);
+        int64_t total = 0;
+        size_t batches = 0;
+        for (;;) {
+            assert(stream.get_next(&stream, &array) == 0);
+            if (!array.release)
+                break;
+            total += array.length;
+            batches++;
+            array.release(&array);
+        }
+        assert(total == 20000 && batches > 1 && stream.get_last_error(&stream) == nullptr);
+        stream.release(&stream);
+        assert(!ArrowExport::export_arrow_stream(path + ".missing", &stream));
+
+        // 多字段流每个字段一列，以字段名命名
+        std::vector<long long> recordTimestamps;
+        std::vector<double> records;
+        for (long long i = 0; i < 12000; i++) {
+            recordTimestamps.push_back(base + i);
+            records.insert(records.end(), { i * 1.0, i * -2.0, i * 0.25 });
+        }
+        entry.initialize();
+        assert(entry.setFields({ "x", "y", "z" }) && entry.insert_records("arrowFieldsUnitTest", recordTimestamps.data(), records.data(), recordTimestamps.size()) == 0);
+        auto fieldsPath = entry.close();
+        assert(ArrowExport::export_arrow(entry, fieldsPath, &array, &schema));
+        assert(schema.n_children == 4 && array.n_children == 4 && array.length == 12000);
+        for (int k = 0; k < 3; k++) {
+            assert(std::string(schema.children[k + 1]->name) == std::string(1, "xyz"[k]));
+            const double* column = static_cast<const double*>(array.children[k + 1]->buffers[1]);
+            for (size_t i = 0; i < recordTimestamps.size(); i++)
+                assert(column[i] == records[i * 3 + k]);
+        }
+        array.release(&array);
+        schema.release(&schema);
+        assert(ArrowExport::export_arrow_stream(fieldsPath, &stream) && stream.get_next(&stream, &array) == 0);
+        assert(array.n_children == 4 && static_cast<const double*>(array.children[2]->buffers[1])[3] == -6);
+        array.release(&array);
+        stream.release(&stream);
+
+        // 空值进入子数组的validity位图和null_count，不导出为0或NaN
+        std::vector<uint8_t> valid(records.size(), 1);
+        for (size_t i = 0; i < recordTimestamps.size(); i += 7)
+            valid[i * 3 + 1] = 0;
+        entry.initialize();
+        assert(entry.setFields({ "x", "y", "z" }) && entry.insert_records("arrowNullsUnitTest", recordTimestamps.data(), records.data(), recordTimestamps.size(), valid.data()) == 0);
+        auto nullsPath = entry.close();
+        assert(ArrowExport::export_arrow(entry, nullsPath, &array, &schema));
+        assert(schema.children[2]->flags & ARROW_FLAG_NULLABLE);
+        assert(array.children[1]->null_count == 0 && array.children[1]->buffers[0] == nullptr);
+        assert(array.children[2]->null_count == static_cast<int64_t>((recordTimestamps.size() + 6) / 7));
+        const uint8_t* validity = static_cast<const uint8_t*>(array.children[2]->buffers[0]);
+        const double* ys = static_cast<const double*>(array.children[2]->buffers[1]);
+        for (size_t i = 0; i < recordTimestamps.size(); i++) {
+            bool isValid = (validity[i >> 3] >> (i & 7)) & 1;
+            assert(isValid == (i % 7 != 0) && (!isValid || ys[i] == records[i * 3 + 1]));
+        }
+        array.release(&array);
+        schema.release(&schema);
+        assert(ArrowExport::export_arrow_stream(nullsPath, &stream) && stream.get_next(&stream, &array) == 0);
+        assert(array.children[2]->null_count > 0 && !(static_cast<const uint8_t*>(array.children[2]->buffers[0])[0] & 1));
+        array.release(&array);
+        stream.release(&stream);
+    }
+
+    void manifestUnitTest()
+    {
+        long long base = timestamps[0];
+        std::vector<point> points;
+        for (long long i = 0; i < 12000; i++)
+            points.emplace_back("manifestUnitTest", i, base + i);
+        entry.initialize(1000);
+        assert(entry.insert_points(points) == 0);
+        auto path = entry.close();
+
+        auto segments = entry.getManifest()->segments("manifestUnitTest");
+        assert(segments.size() == 1 && segments[0].jsonPath == path && segments[0].points == points.size());
+        assert(segments[0].minTimestamp == base + 1000 && segments[0].maxTimestamp == base + 11999 + 1000);
+        assert(entry.getManifest()->segments("manifestUnitTest", LLONG_MIN, base).empty());
+        Stream fromJson, fromManifest;
+        assert(Stream::load(path, fromJson) && entry.getManifest()->load(segments[0].id, fromManifest));
+        assert(fromManifest.getBlocks().size() == fromJson.getBlocks().size() && fromManifest.getTimestampOffset() == 1000);
+        for (size_t i = 0; i < fromJson.getBlocks().size(); i++) {
+            const Block &a = fromJson.getBlocks()[i], &b = fromManifest.getBlocks()[i];
+            assert(a.index == b.index && a.count == b.count && a.minTimestamp == b.minTimestamp && a.valuesSize == b.valuesSize);
+            assert(a.timestampEncoding == b.timestampEncoding && a.valueEncoding == b.valueEncoding && a.overflow == b.overflow);
+        }
+        std::vector<long long> ts;
+        std::vector<double> vs;
+        assert(entry.read_columns(fromManifest, ts, vs) && ts.size() == points.size() && vs.back() == 11999);
+
+        // 独立的清单：事务替换、重新打开、残缺尾部和重写
+        std::string dir = "data/manifestUnitTest";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        std::string manifestPath = dir + "/MANIFEST";
+        auto manifest = Manifest::open(manifestPath);
+        assert(manifest && manifest->created() && Manifest::open(manifestPath) == manifest);
+        uint64_t a = manifest->add(fromJson, path), b = manifest->add(fromJson, path);
+        uint64_t c = manifest->replace({ a }, &fromJson, path);
+        assert(a && b && c && c > b && manifest->size() == 2);
+        size_t bytes = manifest->fileBytes();
+        manifest.reset();
+
+        {
+            std::ofstream torn(manifestPath, std::ios::binary | std::ios::app);
+            torn.write("\x40\0\0\0garbage", 11);
+        }
+        manifest = Manifest::open(manifestPath);
+        assert(!manifest->created() && manifest->size() == 2 && manifest->fileBytes() == bytes);
+        assert(std::filesystem::file_size(manifestPath) == bytes);
+
+        assert(manifest->replace({ b }, nullptr) == UINT64_MAX && manifest->size() == 1);
+        assert(manifest->checkpoint() && manifest->fileBytes() < bytes);
+        manifest.reset();
+        manifest = Manifest::open(manifestPath);
+        Stream reloaded;
+        assert(manifest->size() == 1 && manifest->load(c, reloaded) && !manifest->load(b, reloaded));
+        assert(reloaded.getBlocks().size() == fromJson.getBlocks().size());
+        assert(manifest->add(fromJson, path) > c);
+
+        // 打开耗时只与流段数有关
+        for (int i = 0; i < 2000; i++)
+            manifest->add(fromJson, path);
+        manifest.reset();
+        auto start = std::chrono::steady_clock::now();
+        manifest = Manifest::open(manifestPath);
+        auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        assert(manifest->size() == 2002);
+        std::cout << "manifest open: " << manifest->size() << " segments, " << manifest->fileBytes() / 1024 << " KB, " << elapsed << " us" << std::endl;
+
+        // 从已有的json目录迁移
+        auto imported = Manifest::open(dir + "/imported.MANIFEST");
+        assert(imported->importDirectory("data") > 0 && imported->importDirectory("data") == 0);
+        segments = imported->segments("manifestUnitTest");
+        assert(std::any_of(segments.begin(), segments.end(), [&](const Manifest::Segment& s) { return s.jsonPath == path; }));
+
+        // 没有格式版本的旧清单：记录的crc有效但布局不同，不解析，视为新建后从json重建
+        std::string legacyPath = dir + "/legacy.MANIFEST";
+        {
+            std::string legacy("TSDBMAN1", 8);
+            uint64_t header[2] = { 24 + 8 + 4, 1 };
+            legacy.append(reinterpret_cast<const char*>(header), sizeof(header));
+            uint32_t record[2] = { 4, static_cast<uint32_t>(crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>("\x01\x07\0\0"), 4)) };
+            legacy.append(reinterpret_cast<const char*>(record), sizeof(record)).append("\x01\x07\0\0", 4);
+            std::ofstream(legacyPath, std::ios::binary) << legacy;
+        }
+        // 新建时由open()登记importDir中的json，共享实例再次open()不重复登记
+        std::string importDir = dir + "/json";
+        std::filesystem::create_directories(importDir);
+        std::filesystem::copy_file(path, importDir + "/a.json");
+        auto legacy = Manifest::open(legacyPath, false, importDir);
+        assert(legacy && legacy->created() && legacy->size() == 1);
+        std::filesystem::copy_file(path, importDir + "/b.json");
+        assert(Manifest::open(legacyPath, false, importDir) == legacy && legacy->size() == 1);
+        legacy.reset();
+        legacy = Manifest::open(legacyPath, false, importDir);
+        assert(!legacy->created() && legacy->size() == 1);
+    }
+
+    void multiFieldUnitTest()
+    {
+        const size_t fieldCount = 8;
+        long long base = timestamps[0];
+        std::vector<std::string> fields;
+        for (size_t k = 0; k < fieldCount; k++)
+            fields.push_back("ch" + std::to_string(k));
+        // 采样间隔带抖动，相邻两行交换顺序，另有早于已封存数据的迟到行进入溢出块
+        std::vector<long long> ts;
+        std::vector<double> rows;
+        for (long long i = 0; i < 12000; i++)
+            ts.push_back(base + (i ^ 1) * 1000 + ((i ^ 1) * 7919) % 97);
+        for (long long i = 7; i < 12000; i += 1000)
+            ts.push_back(base + i * 1000 + 500);
+        for (long long t : ts) {
+            for (size_t k = 0; k < fieldCount; k++)
+                rows.push_back((t - base) * 10.0 + k);
+        }
+
+        entry.setReorderWindow(100000);
+        entry.initialize();
+        assert(entry.insert_records("multiFieldUnitTest", ts.data(), rows.data(), ts.size()) == -3);
+        assert(entry.setFields(fields) && !entry.setFields({ "a", "a" }));
+        assert(entry.insert_columns("multiFieldUnitTest", ts.data(), rows.data(), ts.size()) == -3);
+        assert(entry.insert_records("multiFieldUnitTest", ts.data(), rows.data(), 12000) == 0);
+        assert(entry.insert_records("multiFieldUnitTest", ts.data() + 12000, rows.data() + 12000 * fieldCount, ts.size() - 12000) == 0);
+        auto path = entry.close();
+        entry.setReorderWindow(ArgParser::get<long long>("reorderWindow", "hf"));
+
+        Stream stream;
+        assert(Stream::load(path, stream) && stream.getFields() == fields);
+        assert(std::any_of(stream.getBlocks().begin(), stream.getBlocks().end(), [](const Block& b) { return b.overflow; }));
+        for (const auto& block : stream.getBlocks())
+            assert(block.extraFields.size() == fieldCount - 1);
+
+        std::vector<long long> expected(ts);
+        std::sort(expected.begin(), expected.end());
+        std::vector<long long> readTimestamps;
+        std::vector<std::vector<double>> columns;
+        assert(entry.read_fields(stream, { "ch5", "ch0" }, readTimestamps, columns));
+        assert(readTimestamps == expected && columns.size() == 2);
+        for (size_t i = 0; i < expected.size(); i++) {
+            assert(columns[0][i] == (expected[i] - base) * 10.0 + 5);
+            assert(columns[1][i] == (expected[i] - base) * 10.0);
+        }
+        assert(!entry.read_fields(stream, { "ch8" }, readTimestamps, columns));
+        std::vector<std::vector<int64_t>> wrongType;
+        assert(!entry.read_fields(stream, { "ch0" }, readTimestamps, wrongType));
+        // 单字段的读取接口读第一个字段
+        auto points = entry.extract_points(path);
+        assert(points.size() == expected.size() && points.back().value_ == (expected.back() - base) * 10.0);
+
+        Stream fromManifest;
+        auto segments = entry.getManifest()->segments("multiFieldUnitTest");
+        assert(!segments.empty() && entry.getManifest()->load(segments.back().id, fromManifest));
+        assert(fromManifest.getFields() == fields && fromManifest.getBlocks()[0].extraFields.size() == fieldCount - 1);
+        assert(entry.read_fields(fromManifest, { "ch7" }, readTimestamps, columns) && columns[0].back() == (expected.back() - base) * 10.0 + 7);
+
+        // 与每个通道各一个流相比，时间戳列只存一份
+        size_t sharedBytes = 0, separateBytes = 0;
+        for (const auto& block : stream.getBlocks()) {
+            sharedBytes += block.timestampsSize;
+            for (size_t k = 0; k < fieldCount; k++)
+                sharedBytes += block.fieldValuesSize(k);
+        }
+        std::vector<double> column(ts.size());
+        for (size_t k = 0; k < fieldCount; k++) {
+            for (size_t i = 0; i < ts.size(); i++)
+                column[i] = rows[i * fieldCount + k];
+            entry.initialize();
+            assert(entry.insert_columns("multiFieldSeparate" + fields[k], ts.data(), column.data(), ts.size()) == 0);
+            Stream separate;
+            assert(Stream::load(entry.close(), separate));
+            for (const auto& block : separate.getBlocks())
+                separateBytes += block.timestampsSize + block.valuesSize;
+        }
+        std::cout << "multi-field stream: " << sharedBytes << " bytes, " << fieldCount << " separate streams: " << separateBytes << " bytes" << std::endl;
+        assert(sharedBytes < separateBytes);
+    }
+
+    void nullUnitTest()
+    {
+        const long long rowCount = 20000;
+        long long base = timestamps[0];
+        // 相邻两行交换顺序，另有迟到行进入溢出块；dense全部有效，sparse每100行一个值，gappy每1000行缺失300行
+        std::vector<long long> ts, ids;
+        for (long long i = 0; i < rowCount; i++)
+            ids.push_back(i ^ 1);
+        for (long long i = 7; i < rowCount; i += 2000)
+            ids.push_back(i);
+        std::vector<double> rows;
+        std::vector<uint8_t> valid;
+        for (size_t r = 0; r < ids.size(); r++) {
+            long long i = ids[r];
+            ts.push_back(base + i * 1000 + (r >= rowCount ? 500 : 0));
+            rows.insert(rows.end(), { i * 1.0, i * 2.0, i * 3.0 });
+            valid.insert(valid.end(), { 1, i % 100 == 0, i % 1000 >= 300 });
+        }
+
+        entry.initialize();
+        assert(entry.setFields({ "dense", "sparse", "gappy" }));
+        assert(entry.insert_records("nullUnitTest", ts.data(), rows.data(), rowCount, valid.data()) == 0);
+        assert(entry.insert_records("nullUnitTest", ts.data() + rowCount, rows.data() + rowCount * 3, ts.size() - rowCount, valid.data() + rowCount * 3) == 0);
+        auto path = entry.close();
+
+        Stream stream;
+        assert(Stream::load(path, stream));
+        assert(std::any_of(stream.getBlocks().begin(), stream.getBlocks().end(), [](const Block& b) { return b.overflow; }));
+        size_t nulls[3] = { 0, 0, 0 };
+        for (const auto& block : stream.getBlocks()) {
+            for (size_t k = 0; k < 3; k++)
+                nulls[k] += block.fieldNullCount(k);
+        }
+        size_t expectedNulls[3] = { 0, 0, 0 };
+        for (size_t r = 0; r < ids.size(); r++) {
+            for (size_t k = 0; k < 3; k++)
+                expectedNulls[k] += !valid[r * 3 + k];
+        }
+        assert(nulls[0] == 0 && nulls[1] == expectedNulls[1] && nulls[2] == expectedNulls[2]);
+
+        std::vector<size_t> order(ts.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&ts](size_t a, size_t b) { return ts[a] < ts[b]; });
+        std::vector<long long> readTimestamps;
+        std::vector<std::vector<double>> columns;
+        std::vector<std::vector<uint8_t>> masks;
+        assert(entry.read_fields(stream, { "gappy", "sparse", "dense" }, readTimestamps, columns, &masks));
+        assert(readTimestamps.size() == ts.size() && masks.size() == 3);
+        for (size_t i = 0; i < order.size(); i++) {
+            size_t r = order[i];
+            assert(readTimestamps[i] == ts[r]);
+            for (size_t j = 0; j < 3; j++) {
+                size_t k = 2 - j;
+                assert(masks[j][i] == valid[r * 3 + k]);
+                assert(valid[r * 3 + k] ? columns[j][i] == rows[r * 3 + k] : std::isnan(columns[j][i]));
+            }
+        }
+
+        // 与逐行计算的结果对比，一次覆盖全部块，一次只覆盖部分块
+        for (auto range : { std::make_pair(LLONG_MIN, LLONG_MAX), std::make_pair(base + 3333 * 1000, base + 15555 * 1000) }) {
+            for (size_t k = 0; k < 3; k++) {
+                Aggregate expected;
+                for (size_t r = 0; r < ids.size(); r++) {
+                    if (ts[r] < range.first || ts[r] > range.second)
+                        continue;
+                    if (!valid[r * 3 + k]) {
+                        expected.nulls++;
+                        continue;
+                    }
+                    double v = rows[r * 3 + k];
+                    expected.count++;
+                    expected.sum += v;
+                    expected.min = std::min(expected.min, v);
+                    expected.max = std::max(expected.max, v);
+                }
+                Aggregate actual;
+                const char* names[3] = { "dense", "sparse", "gappy" };
+                assert(entry.aggregate_field<double>(stream, names[k], actual, range.first, range.second));
+                assert(actual.count == expected.count && actual.nulls == expected.nulls);
+                assert(actual.sum == expected.sum && actual.min == expected.min && actual.max == expected.max);
+            }
+        }
+        // 存储的NaN不影响最小值和最大值，向量化聚合与逐个聚合（float走标量路径）一致，NaN在任一通道、有无掩码都一样
+        for (size_t at = 0; at < 11; at++) {
+            std::vector<double> withNan;
+            for (int i = 1; i <= 11; i++)
+                withNan.push_back(i == static_cast<int>(at) + 1 ? std::nan("") : i);
+            std::vector<float> scalarValues(withNan.begin(), withNan.end());
+            std::vector<uint8_t> all(withNan.size(), 1);
+            Aggregate vectorized, masked, scalar;
+            Kernels::aggregate(withNan, vectorized);
+            Kernels::aggregate(withNan, all, masked);
+            Kernels::aggregate(scalarValues, scalar);
+            for (const Aggregate* a : { &vectorized, &masked }) {
+                assert(a->min == scalar.min && a->max == scalar.max && a->count == scalar.count && std::isnan(a->sum));
+                assert(a->min == (at == 0 ? 2 : 1) && a->max == (at == 10 ? 10 : 11));
+            }
+        }
+
+        Aggregate none;
+        assert(entry.aggregate_field<double>(stream, "sparse", none, LLONG_MIN, base - 1) && none.count == 0 && std::isnan(none.mean()));
+        assert(!entry.aggregate_field<int64_t>(stream, "sparse", none));
+
+        Stream fromManifest;
+        auto segments = entry.getManifest()->segments("nullUnitTest");
+        assert(!segments.empty() && entry.getManifest()->load(segments.back().id, fromManifest));
+        for (size_t i = 0; i < stream.getBlocks().size(); i++) {
+            for (size_t k = 0; k < 3; k++)
+                assert(fromManifest.getBlocks()[i].fieldNullCount(k) == stream.getBlocks()[i].fieldNullCount(k));
+        }
+
+        // 单字段流：单字段的读取接口中空值读作NaN
+        std::vector<double> sparse;
+        std::vector<uint8_t> sparseValid;
+        for (size_t r = 0; r < ids.size(); r++) {
+            sparse.push_back(rows[r * 3 + 1]);
+            sparseValid.push_back(valid[r * 3 + 1]);
+        }
+        entry.initialize();
+        assert(entry.insert_columns("nullUnitTestSingle", ts.data(), sparse.data(), ts.size(), sparseValid.data()) == 0);
+        auto points = entry.extract_points(entry.close());
+        assert(points.size() == ts.size());
+        assert(static_cast<size_t>(std::count_if(points.begin(), points.end(), [](const point& p) { return std::isnan(p.value_); })) == expectedNulls[1]);
+
+        size_t denseBytes = 0, sparseBytes = 0;
+        for (const auto& block : stream.getBlocks()) {
+            denseBytes += block.fieldValuesSize(0);
+            sparseBytes += block.fieldValuesSize(1);
+        }
+        std::cout << "null bitmap: dense field " << denseBytes << " bytes, sparse field " << sparseBytes << " bytes" << std::endl;
+        assert(sparseBytes * 4 < denseBytes);
+    }
+
+    void sketchUnitTest()
+    {
+        std::default_random_engine engine(11);
+        std::lognormal_distribution<double> latency(0, 1.5);
+        std::vector<double> samples;
+        for (int i = 0; i < 200000; i++)
+            samples.push_back(i % 10 == 0 ? -latency(engine) : latency(engine));
+        auto exact = [](std::vector<double> sorted, double q) {
+            std::sort(sorted.begin(), sorted.end());
+            return sorted[static_cast<size_t>(q * (sorted.size() - 1))];
+        };
+        auto close = [](double actual, double expected) { return std::fabs(actual - expected) <= 0.01 * std::fabs(expected) * (1 + 1e-9); };
+
+        // 合并与插入顺序无关，序列化往返，桶数受上限约束
+        QuantileSketch whole(0.01), left(0.01), right(0.01), small(0.01, 512);
+        whole.add(samples);
+        small.add(samples);
+        for (size_t i = 0; i < samples.size(); i++)
+            (i % 3 ? left : right).add(samples[i]);
+        assert(left.merge(right) && !left.merge(QuantileSketch(0.02)));
+        std::vector<char> bytes;
+        whole.serialize(bytes);
+        QuantileSketch restored;
+        assert(QuantileSketch::deserialize(bytes.data(), bytes.size(), restored) && restored.count() == whole.count());
+        assert(!QuantileSketch::deserialize(bytes.data(), bytes.size() - 1, restored));
+        for (double q : { 0.0, 0.05, 0.5, 0.95, 0.99, 1.0 }) {
+            assert(close(whole.quantile(q), exact(samples, q)));
+            assert(left.quantile(q) == whole.quantile(q) && restored.quantile(q) == whole.quantile(q));
+        }
+        assert(small.bucketCount() <= 512 && small.bucketCount() < whole.bucketCount() && close(small.quantile(0.99), exact(samples, 0.99)));
+        assert(std::isnan(QuantileSketch().quantile(0.5)));
+        // 正负两侧和0合计不超过上限，合并后也一样
+        QuantileSketch tiny(0.01, 64), other(0.01, 64);
+        tiny.add(0.0);
+        for (int i = -600; i <= 600; i++) {
+            tiny.add(std::copysign(std::exp(std::abs(i) / 50.0), i));
+            other.add(-std::exp(i / 40.0));
+        }
+        assert(tiny.bucketCount() <= 64 && tiny.merge(other) && tiny.bucketCount() <= 64 && tiny.max() == std::exp(12.0));
+
+        // 每个块写入时带草图，查询只合并草图
+        long long base = timestamps[0];
+        std::vector<point> points;
+        for (size_t i = 0; i < samples.size(); i++)
+            points.emplace_back("sketchUnitTest", samples[i], base + static_cast<long long>(i) * 1000);
+        entry.initialize();
+        assert(entry.insert_points(points) == 0);
+        auto path = entry.close();
+        Stream stream;
+        assert(Stream::load(path, stream));
+        size_t sketchBytes = 0, valuesBytes = 0;
+        for (const auto& block : stream.getBlocks()) {
+            assert(block.sketchSize > 0);
+            sketchBytes += block.sketchSize;
+            valuesBytes += block.valuesSize;
+        }
+
+        const std::vector<double> qs = { 0.5, 0.95, 0.99 };
+        std::vector<double> results;
+        auto start = std::chrono::steady_clock::now();
+        assert(entry.quantile_field<double>(stream, "value", qs, results));
+        auto sketchUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        auto extracted = entry.extract_points(path);
+        std::vector<double> all;
+        for (const auto& p : extracted)
+            all.push_back(p.value_);
+        std::sort(all.begin(), all.end());
+        auto sortUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        for (size_t j = 0; j < qs.size(); j++)
+            assert(close(results[j], exact(all, qs[j])));
+        std::cout << "quantile sketch: " << sketchBytes << " sketch bytes for " << valuesBytes << " value bytes, p99 in " << sketchUs
+                  << " us, decode and sort " << sortUs << " us" << std::endl;
+
+        // 与范围部分相交的块解码后加入
+        long long from = base + 12345 * 1000, to = base + 150000 * 1000;
+        std::vector<double> inRange(samples.begin() + 12345, samples.begin() + 150001);
+        assert(entry.quantile_field<double>(stream, "value", qs, results, from, to));
+        for (size_t j = 0; j < qs.size(); j++)
+            assert(close(results[j], exact(inRange, qs[j])));
+        assert(entry.quantile_field<double>(stream, "value", qs, results, LLONG_MIN, base - 1) && std::isnan(results[0]));
+        assert(!entry.quantile_field<int64_t>(stream, "value", qs, results) && !entry.quantile_field<double>(stream, "other", qs, results));
+
+        Stream fromManifest;
+        auto segments = entry.getManifest()->segments("sketchUnitTest");
+        assert(!segments.empty() && entry.getManifest()->load(segments.back().id, fromManifest));
+        assert(fromManifest.getBlocks()[0].sketchSize == stream.getBlocks()[0].sketchSize);
+        QuantileSketch merged;
+        assert(entry.sketch_field<double>(fromManifest, "value", merged) && merged.count() == samples.size());
+    }
+
+    void filterUnitTest()
+    {
+        std::default_random_engine engine(5);
+        std::normal_distribution<double> noise(0, 0.1);
+        // 向量化比较与逐个比较一致，包括NaN、端点和不足4个的尾部
+        std::vector<double> column;
+        std::vector<uint8_t> mask;
+        for (int i = 0; i < 1003; i++) {
+            column.push_back(i % 50 == 0 ? std::nan("") : std::round(noise(engine) * 40) / 4);
+            mask.push_back(i % 7 != 0);
+        }
+        for (Predicate predicate : { Predicate::greater(0), Predicate::lessEqual(-0.25), Predicate::between(-0.5, 0.5), Predicate::equal(0.25), Predicate { -1, 1, false, false } }) {
+            std::vector<uint32_t> rows, masked;
+            Kernels::select(column, predicate, {}, rows);
+            Kernels::select(column, predicate, mask, masked);
+            std::vector<uint32_t> expected, expectedMasked;
+            for (uint32_t i = 0; i < column.size(); i++) {
+                if (predicate.matches(column[i])) {
+                    expected.push_back(i);
+                    if (mask[i])
+                        expectedMasked.push_back(i);
+                }
+            }
+            assert(rows == expected && masked == expectedMasked && !expected.empty());
+        }
+
+        // 缓慢变化的信号上偶有尖峰，另有迟到点进入溢出块
+        long long base = timestamps[0];
+        std::vector<point> points, late;
+        for (long long i = 0; i < 200000; i++) {
+            double v = std::sin(i / 20000.0) * 10 + noise(engine);
+            if (i % 40000 == 12345)
+                v = 100 + i / 40000;
+            points.emplace_back("filterUnitTest", v, base + i * 1000);
+        }
+        for (long long i = 3; i < 200000; i += 50000)
+            late.emplace_back("filterUnitTest", 100 + i % 7 - 0.5, base + i * 1000 + 500);
+        entry.initialize();
+        assert(entry.insert_points(points) == 0 && entry.insert_points(late) == 0);
+        auto path = entry.close();
+        Stream stream;
+        assert(Stream::load(path, stream));
+        size_t candidates = std::count_if(stream.getBlocks().begin(), stream.getBlocks().end(), [](const Block& b) { return b.maxValue > 50; });
+        assert(candidates > 0 && candidates < stream.getBlocks().size() / 4);
+
+        // (时间戳, 值)，按时间排序
+        std::vector<std::pair<long long, double>> all;
+        for (const auto& p : points)
+            all.emplace_back(p.nanoseconds_, p.value_);
+        for (const auto& p : late)
+            all.emplace_back(p.nanoseconds_, p.value_);
+        std::sort(all.begin(), all.end());
+        long long from = base + 30000 * 1000, to = base + 170000 * 1000;
+        for (auto [predicate, lo, hi] : { std::make_tuple(Predicate::greater(50), LLONG_MIN, LLONG_MAX), std::make_tuple(Predicate::greater(50), from, to),
+                 std::make_tuple(Predicate::between(-0.05, 0.05), from, to) }) {
+            std::vector<long long> ts;
+            std::vector<double> vs;
+            assert(entry.filter_field<double>(stream, "value", predicate, ts, vs, lo, hi));
+            size_t j = 0;
+            for (const auto& [t, v] : all) {
+                if (t < lo || t > hi || !predicate.matches(v))
+                    continue;
+                assert(j < ts.size() && ts[j] == t && vs[j] == v);
+                j++;
+            }
+            assert(j == ts.size() && j > 0);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<long long> ts;
+        std::vector<double> vs;
+        assert(entry.filter_field<double>(stream, "value", Predicate::greater(50), ts, vs));
+        auto filterUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        size_t matched = 0;
+        for (const auto& p : entry.extract_points(path))
+            matched += p.value_ > 50;
+        auto extractUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        assert(matched == ts.size());
+        std::cout << "filter scan: " << candidates << " of " << stream.getBlocks().size() << " blocks read, " << filterUs << " us, extract_points " << extractUs << " us" << std::endl;
+
+        // top-k与全排序的结果一致，值相同时时间早的在前
+        for (bool largest : { true, false }) {
+            auto ranked(all);
+            std::stable_sort(ranked.begin(), ranked.end(), [largest](const auto& a, const auto& b) { return largest ? a.second > b.second : a.second < b.second; });
+            assert(entry.top_field<double>(stream, "value", 100, ts, vs, largest));
+            assert(ts.size() == 100);
+            for (size_t i = 0; i < ts.size(); i++)
+                assert(ts[i] == ranked[i].first && vs[i] == ranked[i].second);
+        }
+        assert(entry.top_field<double>(stream, "value", 3, ts, vs, true, from, to) && ts.size() == 3 && vs[0] == 103 && vs[2] == 101.5);
+        assert(entry.top_field<double>(stream, "value", 0, ts, vs) && ts.empty());
+        std::vector<int64_t> ints;
+        assert(!entry.filter_field<int64_t>(stream, "value", Predicate::greater(0), ts, ints));
+
+        // 整数流，以及清单中的值域
+        std::vector<basic_point<int64_t>> counters;
+        for (long long i = 0; i < 20000; i++)
+            counters.emplace_back("filterCounterUnitTest", i * 3, base + i);
+        entry.initialize();
+        assert(entry.insert_points(counters) == 0);
+        Stream counterStream;
+        assert(Stream::load(entry.close(), counterStream));
+        assert(entry.filter_field<int64_t>(counterStream, "value", Predicate::equal(30000), ts, ints) && ints.size() == 1 && ts[0] == base + 10000);
+        assert(entry.top_field<int64_t>(counterStream, "value", 2, ts, ints, false) && ints == std::vector<int64_t>({ 0, 3 }));
+        Stream fromManifest;
+        auto segments = entry.getManifest()->segments("filterCounterUnitTest");
+        assert(!segments.empty() && entry.getManifest()->load(segments.back().id, fromManifest));
+        assert(fromManifest.getBlocks().back().maxValue == counterStream.getBlocks().back().maxValue && fromManifest.getBlocks().back().maxValue == 59997);
+
+        // 有损压缩的块按重建值记录值域：0.6量化后读出约为1，第一个块不能因原值的值域被跳过
+        std::vector<point> lossy;
+        for (long long i = 0; i < 2 * 5120; i++)
+            lossy.emplace_back("filterLossyUnitTest", i >= 5120 && i % 100 == 0 ? 5.0 : 0.6, base + i);
+        entry.initialize();
+        assert(entry.setErrorBound(ErrorBound::absolute(0.5)) && entry.insert_points(lossy) == 0);
+        auto lossyPath = entry.close();
+        Stream lossyStream;
+        assert(Stream::load(lossyPath, lossyStream) && lossyStream.getBlocks().size() == 2);
+        assert(lossyStream.getBlocks()[0].valueEncoding == ENCODING_QUANTIZED && lossyStream.getBlocks()[0].maxValue > 0.8);
+        auto decoded = entry.extract_points(lossyPath);
+        std::vector<long long> expectedTs;
+        for (const auto& p : decoded) {
+            if (p.value_ > 0.8)
+                expectedTs.push_back(p.nanoseconds_);
+        }
+        assert(entry.filter_field<double>(lossyStream, "value", Predicate::greater(0.8), ts, vs) && ts == expectedTs);
+        assert(ts.size() == lossy.size() && ts.front() == base && ts.back() == base + 2 * 5120 - 1);
+        assert(entry.top_field<double>(lossyStream, "value", 5200, ts, vs) && ts.size() == 5200 && vs.back() > 0.8);
+    }
+
+    void liveUnitTest()
+    {
+        // 写入线程逐批写入，本线程不断取快照：每个快照恰好包含已写入的若干整批，不重复也不缺失
+        const long long batches = 300, batchPoints = 700;
+        long long base = timestamps[0];
+        tsdb_entry writer;
+        writer.initialize();
+        assert(writer.snapshot<double>() == nullptr);
+        std::thread producer([&] {
+            std::vector<point> batch;
+            for (long long b = 0; b < batches; b++) {
+                batch.clear();
+                // 每批的最后两行逆序，乱序在重排窗口内
+                for (long long k = 0; k < batchPoints; k++) {
+                    long long i = b * batchPoints + (k < batchPoints - 2 ? k : 2 * batchPoints - 3 - k);
+                    batch.emplace_back("liveUnitTest", i * 0.5, base + i * 1000);
+                }
+                assert(writer.insert_points(batch) == 0);
+            }
+        });
+
+        size_t last = 0, snapshots = 0, withFrozen = 0;
+        std::vector<long long> ts;
+        std::vector<double> vs;
+        while (last < batches * batchPoints) {
+            auto snap = writer.snapshot<double>();
+            if (!snap)
+                continue;
+            assert(entry.read_snapshot(*snap, "value", ts, vs));
+            assert(ts.size() >= last && ts.size() % batchPoints == 0);
+            for (size_t i = 0; i < ts.size(); i++)
+                assert(ts[i] == base + static_cast<long long>(i) * 1000 && vs[i] == i * 0.5);
+            withFrozen += snap->memtableRows() > 0 && !snap->getStream().getBlocks().empty();
+            last = ts.size();
+            snapshots++;
+        }
+        producer.join();
+        assert(!entry.read_snapshot(*writer.snapshot<double>(), "missing", ts, vs));
+        assert(writer.snapshot<int64_t>() == nullptr);
+
+        // 时间范围只读相交的块和内存行
+        auto snap = writer.snapshot<double>();
+        long long from = base + 1000 * 1000, to = base + 150000 * 1000;
+        assert(entry.read_snapshot(*snap, "value", ts, vs, from, to) && ts.size() == 149001 && ts.front() == from && ts.back() == to);
+        Stream stream;
+        assert(Stream::load(writer.close(), stream));
+        assert(stream.getBlocks().size() >= snap->getStream().getBlocks().size());
+        std::cout << "live snapshots: " << snapshots << ", " << withFrozen << " with both blocks and memtable rows" << std::endl;
+    }
+
+    void bulkUnitTest()
+    {
+        // 向量化扫描与逐字节比较一致，包括不足32字节的尾部
+        std::default_random_engine engine(7);
+        std::uniform_int_distribution<int> byte(0, 15);
+        std::string bytes;
+        for (int i = 0; i < 1017; i++)
+            bytes += "ab,\n cdefghijkl"[byte(engine)];
+        std::vector<size_t> hits, expected;
+        Kernels::scanBytes(bytes.data(), bytes.size(), '\n', ',', [&](size_t i) { hits.push_back(i); });
+        for (size_t i = 0; i < bytes.size(); i++) {
+            if (bytes[i] == '\n' || bytes[i] == ',')
+                expected.push_back(i);
+        }
+        assert(hits == expected && !hits.empty());
+
+        // 三个序列交错的CSV：表头、注释、空行、CRLF和无法解析的行；值有定点小数、最短表示的任意double和指数写法
+        long long base = timestamps[0];
+        std::normal_distribution<double> noise(0, 100);
+        std::map<std::string, std::vector<std::pair<long long, double>>> series;
+        std::string csv = "series,timestamp,value\n# comment\n";
+        char number[64];
+        for (long long i = 0; i < 60000; i++) {
+            std::string name = std::string("bulkUnitTest") + static_cast<char>('A' + i % 3);
+            long long ts = base + i * 1000;
+            if (i % 3 == 0)
+                snprintf(number, sizeof(number), "%.3f", (i % 2000 - 1000) * 0.125);
+            else if (i % 3 == 1)
+                *std::to_chars(number, number + sizeof(number) - 1, noise(engine)).ptr = 0;
+            else
+                snprintf(number, sizeof(number), "%.6e", noise(engine));
+            csv += name + ',' + std::to_string(ts) + ',' + number + (i % 1000 == 7 ? "\r\n" : "\n");
+            series[name].emplace_back(ts, std::strtod(number, nullptr));
+            if (i % 20000 == 11)
+                csv += "bulkUnitTestA,12x,1\n\nbulkUnitTestB,1,2,3\n";
+        }
+        std::string file = (std::filesystem::temp_directory_path() / "bulkUnitTest.csv").string();
+        std::ofstream(file, std::ios::binary) << csv;
+        bulk_loader<double> loader(4);
+        BulkStats stats;
+        auto paths = loader.load(file, BULK_CSV, stats);
+        std::filesystem::remove(file);
+        assert(stats.bytes == csv.size() && stats.lines == 60006 && stats.errors == 6 && stats.points == 60000 && stats.series == 3);
+        assert(paths.size() == 3);
+        auto check = [this](const std::string& path, const std::string& name, const std::vector<std::pair<long long, double>>& expected) {
+            auto points = entry.extract_points(path);
+            assert(points.size() == expected.size());
+            for (size_t i = 0; i < points.size(); i++)
+                assert(points[i].name_ == name && points[i].nanoseconds_ == expected[i].first && points[i].value_ == expected[i].second);
+        };
+        size_t k = 0;
+        for (const auto& [name, expectedPoints] : series)
+            check(paths[k++], name, expectedPoints);
+
+        // 小窗口逐个解析压缩，跨窗口的序列写入同一个流，结果与整体导入相同
+        bulk_loader<double> windowed(2, 4096);
+        BulkStats windowedStats;
+        paths = windowed.load(csv.data(), csv.size(), BULK_CSV, windowedStats);
+        assert(windowedStats.lines == stats.lines && windowedStats.errors == stats.errors && windowedStats.points == stats.points && windowedStats.series == 3);
+        k = 0;
+        for (const auto& [name, expectedPoints] : series)
+            check(paths[k++], name, expectedPoints);
+        std::cout << "bulk load: " << stats.bytes << " bytes, parse " << stats.parseSeconds * 1000 << " ms, compress " << stats.compressSeconds * 1000 << " ms, " << stats.gbps() << " GB/s" << std::endl;
+
+        // 两列的CSV使用给定的序列名；行协议中字段名不是value时序列名加上.字段名，整数以i结尾
+        std::string twoColumns = std::to_string(base) + ",1.5\n" + std::to_string(base + 1) + ",-2\n";
+        paths = loader.load(twoColumns.data(), twoColumns.size(), BULK_CSV, stats, "bulkUnitTestPair");
+        assert(paths.size() == 1 && stats.points == 2 && stats.errors == 0);
+        check(paths[0], "bulkUnitTestPair", { { base, 1.5 }, { base + 1, -2 } });
+        assert(loader.load(twoColumns.data(), twoColumns.size(), BULK_CSV, stats).empty() && stats.errors == 1);
+
+        std::string lp = "bulkUnitTestLp,host=a value=1.25 " + std::to_string(base) + "\n"
+            + "bulkUnitTestLp,host=a value=2.5,count=3i " + std::to_string(base + 10) + "\n"
+            + "bulkUnitTestLp,host=a value=4 \n"
+            + "bulkUnitTestLp,host=a name=\"x\" " + std::to_string(base + 20) + "\n"
+            + "bulkUnitTestLp,host=a value=5 " + std::to_string(base + 30) + "\n"
+            // 引号内的空格和逗号、转义的空格不是分隔符；字符串字段跳过，没有时间戳的行计入untimed
+            + "bulkUnitTestLp,host=a msg=\"a b, \\\"c\\\" d\",value=6 " + std::to_string(base + 40) + "\n"
+            + "bulkUnitTestLp\\ x,host=a value=7 " + std::to_string(base + 50) + "\n"
+            + "bulkUnitTestLp,host=a value=8\n"
+            + "bulkUnitTestLp,host=a msg=\"open " + std::to_string(base + 60) + "\n"
+            + "bad line here";
+        paths = loader.load(lp.data(), lp.size(), BULK_LINE_PROTOCOL, stats);
+        assert(paths.size() == 3 && stats.lines == 10 && stats.errors == 2 && stats.untimed == 2 && stats.stringFields == 2 && stats.points == 6);
+        check(paths[0], "bulkUnitTestLp,host=a", { { base, 1.25 }, { base + 10, 2.5 }, { base + 30, 5 }, { base + 40, 6 } });
+        check(paths[1], "bulkUnitTestLp,host=a.count", { { base + 10, 3 } });
+        check(paths[2], "bulkUnitTestLp\\ x,host=a", { { base + 50, 7 } });
+    }
+
     void mergeRangeUnitTest()
     {
         std::pair<size_t, size_t> p1 = { 1, 2 }, p2 = { 2, 4 };
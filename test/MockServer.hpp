@@ -0,0 +1,463 @@
+/**
+ * @file MockServer.hpp
+ * @brief 回环地址上的InfluxDB替身服务，供客户端单元测试和bench/client_bench.cpp使用
+ *
+ * 每条连接一个线程，支持HTTP/1.1 keep-alive，请求体按Content-Length或chunked分帧读取，按Content-Encoding（gzip/zstd）解压；
+ * 响应体可选Content-Length或chunked编码。默认对/write和/ping返回204，对/query返回一段JSON。
+ * MockUdpSink接收UDP行协议数据报并计数。
+ */
+#ifndef MOCK_SERVER_HPP
+#define MOCK_SERVER_HPP
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+
+class MockServer {
+public:
+    struct Request {
+        std::string method;
+        std::string path;
+        std::string query;
+        std::map<std::string, std::string> headers; // 名字为小写
+        std::string body; // 解压后的请求体
+        size_t wireBytes = 0; // 线路上的请求体字节数
+        bool badEncoding = false;
+    };
+
+    // 返回状态码，响应体写入body
+    using Handler = std::function<int(const Request&, std::string& body)>;
+
+    MockServer()
+        : handler(defaultHandler)
+    {
+    }
+
+    ~MockServer()
+    {
+        stop();
+    }
+
+    /**
+     * @param port 为0时由系统分配
+     * @return 实际监听的端口，失败返回-1
+     */
+    int start(int port = 0)
+    {
+        sockaddr_in addr {};
+        socklen_t len = sizeof(addr);
+        int one = 1;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if ((listenFd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+            return -1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, 128) < 0
+            || getsockname(listenFd, reinterpret_cast<sockaddr*>(&addr), &len) < 0) {
+            ::close(listenFd);
+            listenFd = -1;
+            return -1;
+        }
+        running = true;
+        acceptor = std::thread([this]() { acceptLoop(); });
+        return ntohs(addr.sin_port);
+    }
+
+    void stop()
+    {
+        if (!running.exchange(false))
+            return;
+        shutdown(listenFd, SHUT_RDWR);
+        acceptor.join();
+        ::close(listenFd);
+        listenFd = -1;
+        dropConnections();
+        while (active.load() > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    void setHandler(Handler h)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        handler = std::move(h);
+    }
+
+    // 响应体改用chunked编码，每块chunkSize字节
+    void setChunked(bool chunked, size_t chunkSize = 1000)
+    {
+        chunkedResponse = chunked;
+        responseChunkSize = chunkSize;
+    }
+
+    // 关闭所有已建立的连接，模拟服务端的空闲超时
+    void dropConnections()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int fd : clients)
+            shutdown(fd, SHUT_RDWR);
+    }
+
+    size_t connections() const { return connectionCount.load(); }
+    size_t requests() const { return requestCount.load(); }
+    size_t bodyBytes() const { return bodyByteCount.load(); } // 线路上的字节数
+
+    Request lastRequest()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return last;
+    }
+
+    static int defaultHandler(const Request& req, std::string& body)
+    {
+        if (req.path == "/write" || req.path == "/ping")
+            return 204;
+        if (req.path == "/query") {
+            body = "{\"results\":[{\"statement_id\":0}]}\n";
+            return 200;
+        }
+        return 404;
+    }
+
+private:
+    struct Connection {
+        int fd;
+        std::string buf;
+        size_t pos = 0;
+
+        bool fill()
+        {
+            char tmp[16384];
+            ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+            if (n <= 0)
+                return false;
+            buf.erase(0, pos);
+            pos = 0;
+            buf.append(tmp, n);
+            return true;
+        }
+
+        bool readLine(std::string& line)
+        {
+            size_t nl;
+            while ((nl = buf.find('\n', pos)) == std::string::npos) {
+                if (!fill())
+                    return false;
+            }
+            line.assign(buf, pos, nl - pos);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            pos = nl + 1;
+            return true;
+        }
+
+        bool readBytes(size_t n, std::string& out)
+        {
+            while (buf.size() - pos < n) {
+                if (!fill())
+                    return false;
+            }
+            out.append(buf, pos, n);
+            pos += n;
+            return true;
+        }
+    };
+
+    void acceptLoop()
+    {
+        while (running) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+                break;
+            connectionCount++;
+            active++;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                clients.insert(fd);
+            }
+            std::thread([this, fd]() {
+                serve(fd);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    clients.erase(fd);
+                }
+                ::close(fd);
+                active--;
+            }).detach();
+        }
+    }
+
+    bool readRequest(Connection& conn, Request& req)
+    {
+        std::string line;
+        if (!conn.readLine(line))
+            return false;
+        size_t sp1 = line.find(' '), sp2 = line.rfind(' ');
+        if (sp1 == std::string::npos || sp2 == sp1)
+            return false;
+        std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+        size_t q = target.find('?');
+        req.method = line.substr(0, sp1);
+        req.path = target.substr(0, q);
+        req.query = q == std::string::npos ? "" : target.substr(q + 1);
+        for (;;) {
+            if (!conn.readLine(line))
+                return false;
+            if (line.empty())
+                break;
+            size_t colon = line.find(':');
+            if (colon == std::string::npos)
+                return false;
+            size_t value = line.find_first_not_of(' ', colon + 1);
+            std::string name = line.substr(0, colon);
+            for (auto& c : name)
+                c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            req.headers[name] = value == std::string::npos ? "" : line.substr(value);
+        }
+        auto te = req.headers.find("transfer-encoding");
+        if (te != req.headers.end() && te->second.find("chunked") != std::string::npos) {
+            for (;;) {
+                if (!conn.readLine(line))
+                    return false;
+                size_t n = strtoull(line.c_str(), nullptr, 16);
+                if (n == 0)
+                    break;
+                if (!conn.readBytes(n, req.body) || !conn.readLine(line))
+                    return false;
+            }
+            do {
+                if (!conn.readLine(line))
+                    return false;
+            } while (!line.empty());
+        } else {
+            auto cl = req.headers.find("content-length");
+            if (cl != req.headers.end() && !conn.readBytes(strtoull(cl->second.c_str(), nullptr, 10), req.body))
+                return false;
+        }
+        req.wireBytes = req.body.size();
+        auto ce = req.headers.find("content-encoding");
+        if (ce != req.headers.end())
+            req.badEncoding = !decode(ce->second, req.body);
+        return true;
+    }
+
+    static bool decode(const std::string& encoding, std::string& body)
+    {
+        std::string out;
+        char buf[65536];
+        if (encoding == "gzip") {
+            z_stream zs {};
+            int ret = Z_OK;
+            if (inflateInit2(&zs, 15 + 32) != Z_OK)
+                return false;
+            zs.next_in = reinterpret_cast<Bytef*>(&body[0]);
+            zs.avail_in = static_cast<uInt>(body.size());
+            while (ret == Z_OK) {
+                zs.next_out = reinterpret_cast<Bytef*>(buf);
+                zs.avail_out = sizeof(buf);
+                ret = inflate(&zs, Z_NO_FLUSH);
+                out.append(buf, sizeof(buf) - zs.avail_out);
+            }
+            inflateEnd(&zs);
+            if (ret != Z_STREAM_END)
+                return false;
+        } else if (encoding == "zstd") {
+            std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream*)> ds(ZSTD_createDStream(), ZSTD_freeDStream);
+            ZSTD_inBuffer in { body.data(), body.size(), 0 };
+            size_t ret = 1;
+            while (ret != 0) {
+                ZSTD_outBuffer o { buf, sizeof(buf), 0 };
+                ret = ZSTD_decompressStream(ds.get(), &o, &in);
+                if (ZSTD_isError(ret) || (o.pos == 0 && in.pos == in.size && ret != 0))
+                    return false;
+                out.append(buf, o.pos);
+            }
+        } else if (encoding != "identity") {
+            return false;
+        }
+        body.swap(out);
+        return true;
+    }
+
+    static bool sendAll(int fd, const std::string& data)
+    {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    void serve(int fd)
+    {
+        Connection conn { fd, std::string(), 0 };
+        for (;;) {
+            Request req;
+            if (!readRequest(conn, req))
+                return;
+            std::string body;
+            Handler h;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                h = handler;
+            }
+            int status = req.badEncoding ? 415 : h(req, body);
+            auto connection = req.headers.find("connection");
+            bool close = connection != req.headers.end() && connection->second == "close";
+
+            std::string resp = "HTTP/1.1 " + std::to_string(status) + (status / 100 == 2 ? " OK" : " Error") + "\r\n";
+            if (close)
+                resp += "Connection: close\r\n";
+            if (status == 204) {
+                resp += "\r\n";
+            } else if (chunkedResponse) {
+                resp += "Transfer-Encoding: chunked\r\n\r\n";
+                char size[32];
+                size_t chunkSize = responseChunkSize;
+                for (size_t beg = 0; beg < body.size(); beg += chunkSize) {
+                    size_t n = std::min(chunkSize, body.size() - beg);
+                    snprintf(size, sizeof(size), "%zx\r\n", n);
+                    resp += size;
+                    resp.append(body, beg, n);
+                    resp += "\r\n";
+                }
+                resp += "0\r\n\r\n";
+            } else {
+                resp += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+            }
+
+            requestCount++;
+            bodyByteCount += req.wireBytes;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                last = std::move(req);
+            }
+            if (!sendAll(fd, resp) || close)
+                return;
+        }
+    }
+
+    int listenFd = -1;
+    std::atomic<bool> running { false };
+    std::thread acceptor;
+    std::atomic<int> active { 0 };
+    std::atomic<size_t> connectionCount { 0 };
+    std::atomic<size_t> requestCount { 0 };
+    std::atomic<size_t> bodyByteCount { 0 };
+    std::atomic<bool> chunkedResponse { false };
+    std::atomic<size_t> responseChunkSize { 1000 };
+
+    std::mutex mutex;
+    std::set<int> clients;
+    Handler handler;
+    Request last;
+};
+
+class MockUdpSink {
+public:
+    ~MockUdpSink()
+    {
+        stop();
+    }
+
+    /**
+     * @return 实际监听的端口，失败返回-1
+     */
+    int start(int port = 0)
+    {
+        sockaddr_in addr {};
+        socklen_t len = sizeof(addr);
+        int rcvbuf = 8 << 20;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+            return -1;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+            || getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0) {
+            ::close(fd);
+            fd = -1;
+            return -1;
+        }
+        running = true;
+        receiver = std::thread([this]() { receive(); });
+        return ntohs(addr.sin_port);
+    }
+
+    void stop()
+    {
+        if (!running.exchange(false))
+            return;
+        receiver.join();
+        ::close(fd);
+        fd = -1;
+    }
+
+    // 等待收到至少n行，超时返回false
+    bool waitForLines(size_t n, int timeoutMs = 2000)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (lineCount.load() < n) {
+            if (std::chrono::steady_clock::now() > deadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    size_t packets() const { return packetCount.load(); }
+    size_t bytes() const { return byteCount.load(); }
+    size_t lines() const { return lineCount.load(); }
+    size_t maxPacket() const { return maxPacketBytes.load(); }
+
+private:
+    void receive()
+    {
+        std::string buf(65536, '\0');
+        pollfd pfd { fd, POLLIN, 0 };
+        while (running) {
+            if (poll(&pfd, 1, 20) <= 0)
+                continue;
+            ssize_t n = recv(fd, &buf[0], buf.size(), 0);
+            if (n <= 0)
+                continue;
+            packetCount++;
+            byteCount += n;
+            if (static_cast<size_t>(n) > maxPacketBytes)
+                maxPacketBytes = n;
+            lineCount += std::count(buf.begin(), buf.begin() + n, '\n');
+        }
+    }
+
+    int fd = -1;
+    std::atomic<bool> running { false };
+    std::thread receiver;
+    std::atomic<size_t> packetCount { 0 };
+    std::atomic<size_t> byteCount { 0 };
+    std::atomic<size_t> lineCount { 0 };
+    std::atomic<size_t> maxPacketBytes { 0 };
+};
+
+#endif // MOCK_SERVER_HPP
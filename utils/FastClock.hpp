@@ -0,0 +1,204 @@
+/**
+ * @file FastClock.hpp
+ * @brief 基于不变TSC的挂钟时间源，每次读取只需一条rdtsc和一次定点乘法
+ *
+ * 首次使用时对照CLOCK_MONOTONIC测出TSC频率，以CLOCK_REALTIME为起点；之后每隔resyncIntervalNs，
+ * 发现到期的线程重新采样：频率按自首次校准以来的长基线修正，与CLOCK_REALTIME的偏差在下一个周期内平滑追回，
+ * 偏差超过stepThresholdNs（如系统时间被调整）时直接跳到新时间。
+ * 换算参数由顺序锁保护，读取不加锁。非x86_64、CPU不报告不变TSC或测得的频率不合理时退回clock_gettime。
+ */
+#ifndef FAST_CLOCK_HPP
+#define FAST_CLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+class FastClock {
+public:
+    static constexpr long long resyncIntervalNs = 1000000000;
+    static constexpr long long stepThresholdNs = 1000000;
+
+    /**
+     * @brief 当前的CLOCK_REALTIME纳秒数
+     */
+    static long long now()
+    {
+        FastClock& clock = instance();
+        if (!clock.useTsc)
+            return realtimeNs();
+        uint64_t tsc = readTsc();
+        for (;;) {
+            uint32_t seq = clock.sequence.load(std::memory_order_acquire);
+            uint64_t baseTsc = clock.baseTsc.load(std::memory_order_relaxed);
+            long long baseNs = clock.baseNs.load(std::memory_order_relaxed);
+            long long mult = clock.mult.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((seq & 1) || clock.sequence.load(std::memory_order_relaxed) != seq)
+                continue;
+            // 其他线程刚以更晚的TSC重新校准时差值为负
+            long long delta = static_cast<long long>(tsc - baseTsc);
+            if (delta > clock.resyncTicks && clock.resync())
+                continue;
+            return baseNs + static_cast<long long>((static_cast<__int128>(delta) * mult) >> SHIFT);
+        }
+    }
+
+    /**
+     * @brief 是否在使用TSC，false表示每次调用clock_gettime
+     */
+    static bool usingTsc()
+    {
+        return instance().useTsc;
+    }
+
+    /**
+     * @brief 校准得到的TSC频率，未使用TSC时为0
+     */
+    static double tscHz()
+    {
+        FastClock& clock = instance();
+        return clock.useTsc ? static_cast<double>(1ull << SHIFT) * 1e9 / clock.mult.load() : 0;
+    }
+
+    static long long realtimeNs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+private:
+    // mult为每个TSC周期的纳秒数，32位小数的定点数
+    static constexpr int SHIFT = 32;
+
+    struct Sample {
+        uint64_t tsc;
+        long long realNs;
+        long long monoNs;
+    };
+
+    static FastClock& instance()
+    {
+        static FastClock clock;
+        return clock;
+    }
+
+#if defined(__x86_64__)
+    static uint64_t readTsc()
+    {
+        return __rdtsc();
+    }
+
+    static bool invariantTsc()
+    {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+            return false;
+        __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        return edx & (1u << 8);
+    }
+#else
+    static uint64_t readTsc()
+    {
+        return 0;
+    }
+
+    static bool invariantTsc()
+    {
+        return false;
+    }
+#endif
+
+    static long long monotonicNs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    // 前后两次rdtsc夹住clock_gettime，取夹得最紧的一次，TSC取中点
+    static Sample sample()
+    {
+        Sample best {};
+        uint64_t bestSpan = UINT64_MAX;
+        for (int i = 0; i < 8; i++) {
+            uint64_t before = readTsc();
+            long long realNs = realtimeNs();
+            long long monoNs = monotonicNs();
+            uint64_t after = readTsc();
+            if (after - before < bestSpan) {
+                bestSpan = after - before;
+                best = { before + (after - before) / 2, realNs, monoNs };
+            }
+        }
+        return best;
+    }
+
+    FastClock()
+    {
+        if (!invariantTsc())
+            return;
+        first = sample();
+        long long deadline = first.monoNs + 10000000;
+        while (monotonicNs() < deadline)
+            ;
+        Sample s = sample();
+        double nsPerTick = static_cast<double>(s.monoNs - first.monoNs) / static_cast<double>(s.tsc - first.tsc);
+        // 合理的TSC频率在100MHz到10GHz之间
+        if (!(nsPerTick > 0.1 && nsPerTick < 10))
+            return;
+        mult.store(static_cast<long long>(nsPerTick * (1ull << SHIFT)));
+        baseTsc.store(s.tsc);
+        baseNs.store(s.realNs);
+        resyncTicks = static_cast<long long>(resyncIntervalNs / nsPerTick);
+        useTsc = true;
+    }
+
+    // 由发现到期的线程执行，其他线程继续使用旧参数；返回true表示参数已更新
+    bool resync()
+    {
+        std::unique_lock<std::mutex> lock(resyncMutex, std::try_to_lock);
+        if (!lock.owns_lock())
+            return false;
+        uint64_t oldTsc = baseTsc.load(std::memory_order_relaxed);
+        if (static_cast<long long>(readTsc() - oldTsc) <= resyncTicks)
+            return true;
+        Sample s = sample();
+        long long oldMult = mult.load(std::memory_order_relaxed);
+        long long extrapolated = baseNs.load(std::memory_order_relaxed)
+            + static_cast<long long>((static_cast<__int128>(s.tsc - oldTsc) * oldMult) >> SHIFT);
+        long long newMult = static_cast<long long>(static_cast<double>(s.monoNs - first.monoNs) / static_cast<double>(s.tsc - first.tsc) * (1ull << SHIFT));
+        long long error = s.realNs - extrapolated;
+        long long nextNs = extrapolated;
+        if (error > stepThresholdNs || error < -stepThresholdNs)
+            nextNs = s.realNs;
+        else
+            newMult += static_cast<long long>((static_cast<__int128>(error) << SHIFT) / resyncTicks);
+
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        baseTsc.store(s.tsc, std::memory_order_relaxed);
+        baseNs.store(nextNs, std::memory_order_relaxed);
+        mult.store(newMult, std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+        return true;
+    }
+
+    bool useTsc = false;
+    long long resyncTicks = 0;
+    Sample first {};
+    std::atomic<uint32_t> sequence { 0 };
+    std::atomic<uint64_t> baseTsc { 0 };
+    std::atomic<long long> baseNs { 0 };
+    std::atomic<long long> mult { 0 };
+    std::mutex resyncMutex;
+};
+
+#endif
@@ -0,0 +1,401 @@
+/**
+ * @file Metrics.hpp
+ * @brief 热路径指标：按线程分片的计数器、字节数和纳秒精度的HDR风格延迟直方图，可导出为Prometheus文本格式
+ *
+ * 每个线程写入自己的分片（单写者，只需relaxed的load/store），读取时再汇总所有分片，
+ * 因此记录一次指标只有几次内存写入，不会产生跨线程的缓存行争用。
+ */
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class Metrics {
+public:
+    enum Stage {
+        STAGE_ENCODE,
+        STAGE_COMPRESS,
+        STAGE_FILE_WRITE,
+        STAGE_FSYNC,
+        STAGE_DECOMPRESS,
+        STAGE_DECODE,
+        STAGE_QUERY,
+        STAGE_COUNT
+    };
+
+    // 直方图精度：每个2的幂区间划分为SUB_BUCKET_COUNT / 2个线性子桶，相对误差不超过 1 / SUB_BUCKET_COUNT
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr size_t SUB_BUCKET_COUNT = size_t(1) << SUB_BUCKET_BITS;
+    static constexpr size_t HALF_SUB_BUCKET_COUNT = SUB_BUCKET_COUNT / 2;
+    static constexpr size_t BUCKET_COUNT = SUB_BUCKET_COUNT + (64 - SUB_BUCKET_BITS) * HALF_SUB_BUCKET_COUNT;
+
+    struct StageSnapshot {
+        uint64_t ops = 0;
+        uint64_t bytes = 0;
+        uint64_t sumNs = 0;
+        uint64_t maxNs = 0;
+        std::vector<uint64_t> buckets = std::vector<uint64_t>(BUCKET_COUNT, 0);
+
+        uint64_t percentileNs(double q) const
+        {
+            if (ops == 0)
+                return 0;
+            uint64_t target = static_cast<uint64_t>(q * ops + 0.5);
+            target = std::max<uint64_t>(1, std::min(target, ops));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKET_COUNT; i++) {
+                seen += buckets[i];
+                if (seen >= target)
+                    return std::min(bucketMidpoint(i), maxNs);
+            }
+            return maxNs;
+        }
+
+        double meanNs() const
+        {
+            return ops ? static_cast<double>(sumNs) / ops : 0;
+        }
+    };
+
+    /**
+     * @brief 计时作用域，析构时将耗时记录到对应阶段
+     */
+    class ScopedTimer {
+    public:
+        ScopedTimer(Stage stage, uint64_t bytes = 0)
+            : stage_(stage)
+            , bytes_(bytes)
+            , start_(std::chrono::steady_clock::now())
+        {
+        }
+        ~ScopedTimer()
+        {
+            auto end = std::chrono::steady_clock::now();
+            Metrics::record(stage_, bytes_, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count());
+        }
+        void setBytes(uint64_t bytes) { bytes_ = bytes; }
+
+    private:
+        Stage stage_;
+        uint64_t bytes_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    static const char* stageName(Stage stage)
+    {
+        static const char* names[STAGE_COUNT] = { "encode", "compress", "file_write", "fsync", "decompress", "decode", "query" };
+        return names[stage];
+    }
+
+    static size_t bucketIndex(uint64_t ns)
+    {
+        if (ns < SUB_BUCKET_COUNT)
+            return ns;
+        int msb = 63 - __builtin_clzll(ns);
+        int shift = msb - (SUB_BUCKET_BITS - 1);
+        uint64_t top = ns >> shift;
+        return SUB_BUCKET_COUNT + (msb - SUB_BUCKET_BITS) * HALF_SUB_BUCKET_COUNT + (top - HALF_SUB_BUCKET_COUNT);
+    }
+
+    static uint64_t bucketLowerBound(size_t idx)
+    {
+        if (idx < SUB_BUCKET_COUNT)
+            return idx;
+        size_t k = idx - SUB_BUCKET_COUNT;
+        int msb = static_cast<int>(k / HALF_SUB_BUCKET_COUNT) + SUB_BUCKET_BITS;
+        uint64_t top = k % HALF_SUB_BUCKET_COUNT + HALF_SUB_BUCKET_COUNT;
+        return top << (msb - (SUB_BUCKET_BITS - 1));
+    }
+
+    static uint64_t bucketMidpoint(size_t idx)
+    {
+        if (idx < SUB_BUCKET_COUNT)
+            return idx;
+        size_t k = idx - SUB_BUCKET_COUNT;
+        int msb = static_cast<int>(k / HALF_SUB_BUCKET_COUNT) + SUB_BUCKET_BITS;
+        return bucketLowerBound(idx) + ((uint64_t(1) << (msb - (SUB_BUCKET_BITS - 1))) >> 1);
+    }
+
+    /**
+     * @brief 记录一次阶段操作，只写当前线程的分片
+     *
+     * @param stage 流水线阶段
+     * @param bytes 本次操作处理的字节数
+     * @param ns 本次操作耗时（纳秒）
+     */
+    static void record(Stage stage, uint64_t bytes, uint64_t ns)
+    {
+        StageCells& cells = localShard().stages[stage];
+        bump(cells.ops, 1);
+        bump(cells.bytes, bytes);
+        bump(cells.sumNs, ns);
+        if (ns > cells.maxNs.load(std::memory_order_relaxed))
+            cells.maxNs.store(ns, std::memory_order_relaxed);
+        bump(cells.buckets[bucketIndex(ns)], 1);
+    }
+
+    static StageSnapshot snapshot(Stage stage)
+    {
+        StageSnapshot snap;
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mtx);
+        for (const auto& shard : reg.shards) {
+            const StageCells& cells = shard->stages[stage];
+            snap.ops += cells.ops.load(std::memory_order_relaxed);
+            snap.bytes += cells.bytes.load(std::memory_order_relaxed);
+            snap.sumNs += cells.sumNs.load(std::memory_order_relaxed);
+            snap.maxNs = std::max(snap.maxNs, cells.maxNs.load(std::memory_order_relaxed));
+            for (size_t i = 0; i < BUCKET_COUNT; i++)
+                snap.buckets[i] += cells.buckets[i].load(std::memory_order_relaxed);
+        }
+        return snap;
+    }
+
+    // 清零所有分片，仅在没有并发写入时调用（如单元测试）
+    static void reset()
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mtx);
+        for (auto& shard : reg.shards) {
+            for (auto& cells : shard->stages) {
+                cells.ops.store(0, std::memory_order_relaxed);
+                cells.bytes.store(0, std::memory_order_relaxed);
+                cells.sumNs.store(0, std::memory_order_relaxed);
+                cells.maxNs.store(0, std::memory_order_relaxed);
+                for (auto& bucket : cells.buckets)
+                    bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    static std::string toPrometheus()
+    {
+        static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        std::vector<StageSnapshot> snaps;
+        for (int s = 0; s < STAGE_COUNT; s++)
+            snaps.push_back(snapshot(static_cast<Stage>(s)));
+
+        std::ostringstream out;
+        out.imbue(std::locale("C"));
+        out << "# HELP tsdb_stage_operations_total Number of operations per pipeline stage.\n"
+            << "# TYPE tsdb_stage_operations_total counter\n";
+        for (int s = 0; s < STAGE_COUNT; s++)
+            out << "tsdb_stage_operations_total{stage=\"" << stageName(static_cast<Stage>(s)) << "\"} " << snaps[s].ops << '\n';
+
+        out << "# HELP tsdb_stage_bytes_total Bytes processed per pipeline stage.\n"
+            << "# TYPE tsdb_stage_bytes_total counter\n";
+        for (int s = 0; s < STAGE_COUNT; s++)
+            out << "tsdb_stage_bytes_total{stage=\"" << stageName(static_cast<Stage>(s)) << "\"} " << snaps[s].bytes << '\n';
+
+        out << "# HELP tsdb_stage_latency_seconds Latency per pipeline stage.\n"
+            << "# TYPE tsdb_stage_latency_seconds summary\n";
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            const char* name = stageName(static_cast<Stage>(s));
+            for (double q : quantiles)
+                out << "tsdb_stage_latency_seconds{stage=\"" << name << "\",quantile=\"" << q << "\"} "
+                    << snaps[s].percentileNs(q) * 1e-9 << '\n';
+            out << "tsdb_stage_latency_seconds_sum{stage=\"" << name << "\"} " << snaps[s].sumNs * 1e-9 << '\n';
+            out << "tsdb_stage_latency_seconds_count{stage=\"" << name << "\"} " << snaps[s].ops << '\n';
+        }
+
+        out << "# HELP tsdb_stage_latency_max_seconds Maximum observed latency per pipeline stage.\n"
+            << "# TYPE tsdb_stage_latency_max_seconds gauge\n";
+        for (int s = 0; s < STAGE_COUNT; s++)
+            out << "tsdb_stage_latency_max_seconds{stage=\"" << stageName(static_cast<Stage>(s)) << "\"} " << snaps[s].maxNs * 1e-9 << '\n';
+        return out.str();
+    }
+
+    /**
+     * @brief 将Prometheus文本写入文件。先写临时文件再rename，抓取方不会读到写了一半的内容
+     */
+    static bool dumpPrometheus(const std::string& path)
+    {
+        std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::out | std::ios::trunc);
+            if (!file) {
+                std::cerr << "Cannot open file " << tmpPath << std::endl;
+                return false;
+            }
+            file << toPrometheus();
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec) {
+            std::cerr << "Cannot rename " << tmpPath << " to " << path << ": " << ec.message() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 在127.0.0.1:port上启动后台线程，以HTTP响应Prometheus的拉取请求。重复调用无效果
+     *
+     * @return 0 成功，-1 已在运行，-2 创建socket失败，-3 绑定或监听失败
+     */
+    static int startServer(int port)
+    {
+        Server& server = exportServer();
+        std::lock_guard<std::mutex> lock(server.mtx);
+        if (server.running)
+            return -1;
+
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0)
+            return -2;
+        int reuse = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+            ::close(sock);
+            return -3;
+        }
+
+        server.sock = sock;
+        server.running = true;
+        server.thread = std::thread([&server]() { serveLoop(server); });
+        return 0;
+    }
+
+    static void stopServer()
+    {
+        Server& server = exportServer();
+        std::lock_guard<std::mutex> lock(server.mtx);
+        server.stop();
+    }
+
+private:
+    struct StageCells {
+        std::atomic<uint64_t> ops;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> sumNs;
+        std::atomic<uint64_t> maxNs;
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets;
+    };
+
+    struct Shard {
+        std::array<StageCells, STAGE_COUNT> stages;
+        bool inUse;
+    };
+
+    struct Registry {
+        std::mutex mtx;
+        std::vector<std::unique_ptr<Shard>> shards;
+    };
+
+    // 线程退出时归还分片，新线程复用。计数是累计值，复用不影响正确性
+    struct ShardHolder {
+        Shard* shard;
+        ShardHolder()
+        {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mtx);
+            for (auto& s : reg.shards) {
+                if (!s->inUse) {
+                    s->inUse = true;
+                    shard = s.get();
+                    return;
+                }
+            }
+            reg.shards.push_back(std::make_unique<Shard>());
+            shard = reg.shards.back().get();
+            shard->inUse = true;
+        }
+        ~ShardHolder()
+        {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mtx);
+            shard->inUse = false;
+        }
+    };
+
+    struct Server {
+        std::mutex mtx;
+        std::thread thread;
+        std::atomic<bool> running { false };
+        int sock = -1;
+
+        void stop()
+        {
+            if (!running)
+                return;
+            running = false;
+            if (thread.joinable())
+                thread.join();
+            ::close(sock);
+            sock = -1;
+        }
+        ~Server() { stop(); }
+    };
+
+    static void bump(std::atomic<uint64_t>& cell, uint64_t v)
+    {
+        cell.store(cell.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    static Registry& registry()
+    {
+        static Registry reg;
+        return reg;
+    }
+
+    static Shard& localShard()
+    {
+        thread_local ShardHolder holder;
+        return *holder.shard;
+    }
+
+    static Server& exportServer()
+    {
+        static Server server;
+        return server;
+    }
+
+    static void serveLoop(Server& server)
+    {
+        struct pollfd pfd = { server.sock, POLLIN, 0 };
+        while (server.running) {
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+            int conn = accept(server.sock, nullptr, nullptr);
+            if (conn < 0)
+                continue;
+            // 请求内容无关紧要，读掉请求头后直接返回全部指标
+            char request[1024];
+            recv(conn, request, sizeof(request), 0);
+            std::string body = toPrometheus();
+            std::string header = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+            send(conn, header.data(), header.size(), MSG_NOSIGNAL);
+            send(conn, body.data(), body.size(), MSG_NOSIGNAL);
+            ::close(conn);
+        }
+    }
+};
+
+#endif // METRICS_HPP
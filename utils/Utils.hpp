@@ -1,12 +1,15 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
 
+#include "FastClock.hpp"
+#include <algorithm>
 #include <chrono>
 #include <cstddef>
 #include <cstring>
 #include <ctime>
 #include <iomanip>
 #include <map>
+#include <numeric>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -104,6 +107,32 @@ public:
         return nanoseconds;
     }
 
+    /**
+     * @brief 与getCurNanoseconds相同的挂钟纳秒数，读TSC而不经过系统时钟，见FastClock.hpp
+     */
+    static long long getFastNanoseconds()
+    {
+        return FastClock::now();
+    }
+
+    /**
+     * @brief 按固定采样周期填充时间戳：timestamps[i] = start + i * periodNs
+     */
+    static void fillCadence(long long* timestamps, size_t n, long long start, long long periodNs)
+    {
+        for (size_t i = 0; i < n; i++)
+            timestamps[i] = start + static_cast<long long>(i) * periodNs;
+    }
+
+    /**
+     * @brief 为刚采集完的一批定周期样本打时间戳，最后一个样本为当前时刻，整批只读一次时钟
+     */
+    static void stampCadence(long long* timestamps, size_t n, long long periodNs)
+    {
+        if (n > 0)
+            fillCadence(timestamps, n, FastClock::now() - static_cast<long long>(n - 1) * periodNs, periodNs);
+    }
+
     static long long stringToNanoseconds(const std::string& timestampStr)
     {
         std::istringstream iss(timestampStr);
@@ -162,6 +191,86 @@ public:
         return true;
     }
 
+    /**
+     * @brief 以keys为键对keys、values两列的[from, size)部分做稳定排序。values按行存放，每个键对应width个值
+     */
+    template <typename K, typename V>
+    static void sortColumnsByKey(std::vector<K>& keys, std::vector<V>& values, size_t from = 0, size_t width = 1)
+    {
+        if (std::is_sorted(keys.begin() + from, keys.end()))
+            return;
+        std::vector<size_t> order(keys.size() - from);
+        std::iota(order.begin(), order.end(), from);
+        std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+        std::vector<K> sortedKeys;
+        std::vector<V> sortedValues;
+        sortedKeys.reserve(order.size());
+        sortedValues.reserve(order.size() * width);
+        for (size_t i : order) {
+            sortedKeys.push_back(keys[i]);
+            for (size_t k = 0; k < width; k++)
+                sortedValues.push_back(values[i * width + k]);
+        }
+        std::copy(sortedKeys.begin(), sortedKeys.end(), keys.begin() + from);
+        std::copy(sortedValues.begin(), sortedValues.end(), values.begin() + from * width);
+    }
+
+    /**
+     * @brief 归并两列中各自有序的[0, mid)和[mid, size)两段，键相同时前一段在前。values按行存放，每个键对应width个值
+     */
+    template <typename K, typename V>
+    static void mergeSortedColumns(std::vector<K>& keys, std::vector<V>& values, size_t mid, size_t width = 1)
+    {
+        size_t n = keys.size();
+        if (mid == 0 || mid >= n || !(keys[mid] < keys[mid - 1]))
+            return;
+        // 前一段中不大于后一段最小键的部分已在最终位置，无需参与归并
+        size_t lo = std::upper_bound(keys.begin(), keys.begin() + mid, keys[mid]) - keys.begin();
+        std::vector<K> mergedKeys;
+        std::vector<V> mergedValues;
+        mergedKeys.reserve(n - lo);
+        mergedValues.reserve((n - lo) * width);
+        size_t i = lo, j = mid;
+        while (i < mid || j < n) {
+            size_t& next = (j == n || (i < mid && !(keys[j] < keys[i]))) ? i : j;
+            mergedKeys.push_back(keys[next]);
+            for (size_t k = 0; k < width; k++)
+                mergedValues.push_back(values[next * width + k]);
+            next++;
+        }
+        std::copy(mergedKeys.begin(), mergedKeys.end(), keys.begin() + lo);
+        std::copy(mergedValues.begin(), mergedValues.end(), values.begin() + lo * width);
+    }
+
+    /**
+     * @brief 按order重排values，重排后第i个元素为原来的values[order[i]]
+     */
+    template <typename V>
+    static void permute(std::vector<V>& values, const std::vector<size_t>& order)
+    {
+        std::vector<V> permuted;
+        permuted.reserve(order.size());
+        for (size_t i : order)
+            permuted.push_back(values[i]);
+        values.swap(permuted);
+    }
+
+    /**
+     * @brief 按order重排按行存放的values，每行width个值
+     */
+    template <typename V>
+    static void permuteRows(std::vector<V>& values, const std::vector<size_t>& order, size_t width)
+    {
+        std::vector<V> permuted;
+        permuted.reserve(order.size() * width);
+        for (size_t i : order) {
+            for (size_t k = 0; k < width; k++)
+                permuted.push_back(values[i * width + k]);
+        }
+        values.swap(permuted);
+    }
+
     template <typename Func, typename... Args>
     static auto funcExecTimeMs(double& cost, Func func, Args&&... args)
     {